@@ -10,6 +10,7 @@
 #include "bucket/BucketApplicator.h"
 #include "bucket/BucketList.h"
 #include "bucket/BucketManager.h"
+#include "bucket/BucketMergePipeline.h"
 #include "bucket/BucketOutputIterator.h"
 #include "bucket/LedgerCmp.h"
 #include "crypto/Hex.h"
@@ -20,19 +21,43 @@
 #include "main/Application.h"
 #include "medida/timer.h"
 #include "util/Fs.h"
-#include "util/LogSlowExecution.h"
 #include "util/Logging.h"
+#include "util/MappedFile.h"
 #include "util/TmpDir.h"
 #include "util/XDRStream.h"
 #include "xdrpp/message.h"
+#include <algorithm>
 #include <cassert>
+#include <fstream>
 #include <future>
+#include <thread>
 
 namespace spn
 {
 
-Bucket::Bucket(std::string const& filename, Hash const& hash)
-    : mFilename(filename), mHash(hash)
+static size_t
+residentBytes(std::shared_ptr<std::vector<BucketEntry> const> const& entries)
+{
+    if (!entries)
+    {
+        return 0;
+    }
+    size_t bytes = entries->capacity() * sizeof(BucketEntry);
+    for (auto const& e : *entries)
+    {
+        bytes += xdr::xdr_size(e);
+    }
+    return bytes;
+}
+
+Bucket::Bucket(std::string const& filename, Hash const& hash,
+               std::shared_ptr<std::vector<BucketEntry> const> entries,
+               size_t nEntries)
+    : mFilename(filename)
+    , mHash(hash)
+    , mEntries(std::move(entries))
+    , mResidentBytes(residentBytes(mEntries))
+    , mEntryCount(mEntries ? mEntries->size() : nEntries)
 {
     assert(filename.empty() || fs::exists(filename));
     if (!filename.empty())
@@ -46,6 +71,10 @@ Bucket::Bucket()
 {
 }
 
+Bucket::~Bucket()
+{
+}
+
 Hash const&
 Bucket::getHash() const
 {
@@ -58,6 +87,140 @@ Bucket::getFilename() const
     return mFilename;
 }
 
+std::shared_ptr<std::vector<BucketEntry> const>
+Bucket::getResidentEntries() const
+{
+    if (mFilename.empty())
+    {
+        static auto const empty =
+            std::make_shared<std::vector<BucketEntry> const>();
+        return empty;
+    }
+    return std::atomic_load(&mEntries);
+}
+
+void
+Bucket::makeResident(std::shared_ptr<std::vector<BucketEntry> const> entries)
+{
+    assert(entries);
+    if (mFilename.empty() || std::atomic_load(&mEntries))
+    {
+        return;
+    }
+    assert(mEntryCount == 0 || mEntryCount == entries->size());
+    mResidentBytes = residentBytes(entries);
+    std::atomic_store(&mEntries, std::move(entries));
+}
+
+size_t
+Bucket::getResidentBytes() const
+{
+    return mResidentBytes;
+}
+
+static size_t
+fileSize(std::string const& filename)
+{
+    if (filename.empty())
+    {
+        return 0;
+    }
+    std::ifstream in(filename, std::ifstream::binary | std::ifstream::ate);
+    return in ? static_cast<size_t>(in.tellg()) : 0;
+}
+
+size_t
+Bucket::getMaxEntryCount() const
+{
+    if (mEntryCount != 0 || mFilename.empty())
+    {
+        return mEntryCount;
+    }
+    return BucketIndex::maxEntryCount(fileSize(mFilename));
+}
+
+// Whether the key of `entry` sorts before `key`.
+static bool
+entryBefore(BucketEntry const& entry, LedgerKey const& key)
+{
+    LedgerEntryIdCmp cmp;
+    return entry.type() == LIVEENTRY ? cmp(entry.liveEntry().data, key)
+                                     : cmp(entry.deadEntry(), key);
+}
+
+// Whether the key of `entry` sorts after `key`.
+static bool
+entryAfter(BucketEntry const& entry, LedgerKey const& key)
+{
+    LedgerEntryIdCmp cmp;
+    return entry.type() == LIVEENTRY ? cmp(key, entry.liveEntry().data)
+                                     : cmp(key, entry.deadEntry());
+}
+
+void
+Bucket::prepareLookup() const
+{
+    mLookupFile = std::make_unique<MappedFile>(mFilename,
+                                               MappedFile::Access::RANDOM);
+    mIndex = BucketIndex::load(mFilename, mLookupFile->size());
+    if (!mIndex)
+    {
+        // kept in memory only: saving index files is up to the BucketManager
+        mIndex = BucketIndex::build(mFilename);
+    }
+}
+
+std::shared_ptr<BucketEntry const>
+Bucket::lookup(LedgerKey const& key, uint64_t keyHash) const
+{
+    if (mFilename.empty())
+    {
+        return nullptr;
+    }
+
+    if (auto entries = std::atomic_load(&mEntries))
+    {
+        auto it = std::lower_bound(entries->begin(), entries->end(), key,
+                                   entryBefore);
+        if (it == entries->end() || entryAfter(*it, key))
+        {
+            return nullptr;
+        }
+        return std::make_shared<BucketEntry const>(*it);
+    }
+
+    std::call_once(mLookupReady, [this]() { prepareLookup(); });
+    uint64_t pos, end;
+    if (!mIndex->mayContain(keyHash) || !mIndex->findPage(key, pos, end))
+    {
+        return nullptr;
+    }
+
+    ByteSlice page(mLookupFile->data() + pos, end - pos);
+    for (size_t offset = 0;;)
+    {
+        auto record = XDRInputMappedFileStream::recordAt(page, offset);
+        if (record.empty())
+        {
+            break;
+        }
+        auto entry = std::make_shared<BucketEntry>();
+        xdr::xdr_get g(record.data() + 4, record.end());
+        xdr::xdr_argpack_archive(g, *entry);
+        offset += record.size();
+
+        if (entryAfter(*entry, key))
+        {
+            break;
+        }
+        if (!entryBefore(*entry, key))
+        {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
 bool
 Bucket::containsBucketIdentity(BucketEntry const& id) const
 {
@@ -100,147 +263,262 @@ Bucket::apply(Application& app) const
     BucketApplicator applicator(app, shared_from_this());
     while (applicator)
     {
-        applicator.advance();
+        if (applicator.advance() == 0)
+        {
+            // the next batch is still being read
+            std::this_thread::yield();
+        }
     }
 }
 
 std::shared_ptr<Bucket>
 Bucket::fresh(BucketManager& bucketManager,
-              std::vector<LedgerEntry> const& liveEntries,
-              std::vector<LedgerKey> const& deadEntries)
+              std::vector<LedgerEntry> liveEntries,
+              std::vector<LedgerKey> deadEntries, bool resident)
 {
-    std::vector<BucketEntry> live, dead, combined;
-    live.reserve(liveEntries.size());
-    dead.reserve(deadEntries.size());
+    auto timer = bucketManager.getFreshTimer().TimeScope();
 
-    for (auto const& e : liveEntries)
+    std::vector<BucketEntry> entries(liveEntries.size() + deadEntries.size());
+    auto ce = entries.begin();
+    for (auto& e : liveEntries)
+    {
+        ce->type(LIVEENTRY);
+        ce->liveEntry() = std::move(e);
+        ++ce;
+    }
+    for (auto& e : deadEntries)
     {
-        BucketEntry ce;
-        ce.type(LIVEENTRY);
-        ce.liveEntry() = e;
-        live.push_back(ce);
+        ce->type(DEADENTRY);
+        ce->deadEntry() = std::move(e);
+        ++ce;
     }
 
-    for (auto const& e : deadEntries)
+    // The sort is stable, so of a live and a dead entry for the same key the
+    // dead one stays last, and replaces the live one in the output iterator:
+    // the result is what merging a bucket of the live entries with a (newer)
+    // bucket of the dead ones would give, in one pass over the entries.
+    std::stable_sort(entries.begin(), entries.end(), BucketEntryIdCmp());
+
+    BucketOutputIterator out(bucketManager.getTmpDir(), true, resident,
+                             entries.size());
+    for (auto const& e : entries)
     {
-        BucketEntry ce;
-        ce.type(DEADENTRY);
-        ce.deadEntry() = e;
-        dead.push_back(ce);
+        out.put(e);
     }
+    return out.getBucket(bucketManager);
+}
 
-    std::sort(live.begin(), live.end(), BucketEntryIdCmp());
+inline void
+maybePut(BucketOutputIterator& out, BucketInputIterator& in,
+         std::vector<BucketInputIterator>& shadowIterators)
+{
+    BucketEntry const& entry = *in;
+    if (isShadowed(entry, shadowIterators))
+    {
+        return;
+    }
+    // Nothing shadowed: copy the entry's bytes out of the input file as-is
+    // rather than re-serializing it.
+    out.put(entry, in.currentRecord());
+}
 
-    std::sort(dead.begin(), dead.end(), BucketEntryIdCmp());
+namespace
+{
+// Reads the resident entries of a bucket the way a BucketInputIterator reads
+// its file.
+class ResidentIterator
+{
+    std::shared_ptr<std::vector<BucketEntry> const> mEntries;
+    size_t mPos{0};
 
-    BucketOutputIterator liveOut(bucketManager.getTmpDir(), true);
-    BucketOutputIterator deadOut(bucketManager.getTmpDir(), true);
-    for (auto const& e : live)
+  public:
+    explicit ResidentIterator(std::shared_ptr<Bucket> const& bucket)
+        : mEntries(bucket->getResidentEntries())
     {
-        liveOut.put(e);
+        assert(mEntries);
     }
-    for (auto const& e : dead)
+
+    operator bool() const
     {
-        deadOut.put(e);
+        return mPos < mEntries->size();
     }
 
-    auto liveBucket = liveOut.getBucket(bucketManager);
-    auto deadBucket = deadOut.getBucket(bucketManager);
+    BucketEntry const& operator*() const
+    {
+        return (*mEntries)[mPos];
+    }
 
-    std::shared_ptr<Bucket> bucket;
+    ResidentIterator& operator++()
     {
-        auto timer = LogSlowExecution("Bucket merge");
-        bucket = Bucket::merge(bucketManager, liveBucket, deadBucket);
+        ++mPos;
+        return *this;
     }
-    return bucket;
+};
 }
 
-inline void
-maybePut(BucketOutputIterator& out, BucketEntry const& entry,
-         std::vector<BucketInputIterator>& shadowIterators)
+// As isShadowed, on resident buckets.
+static bool
+isShadowed(BucketEntry const& entry, std::vector<ResidentIterator>& shadows)
 {
     BucketEntryIdCmp cmp;
-    for (auto& si : shadowIterators)
+    for (auto& si : shadows)
     {
-        // Advance the shadowIterator while it's less than the candidate
         while (si && cmp(*si, entry))
         {
             ++si;
         }
-        // We have stepped si forward to the point that either si is exhausted,
-        // or else *si >= entry; we now check the opposite direction to see if
-        // we have equality.
         if (si && !cmp(entry, *si))
         {
-            // If so, then entry is shadowed in at least one level and we will
-            // not be doing a 'put'; we return early. There is no need to
-            // advance the other iterators, they will advance as and if
-            // necessary in future calls to maybePut.
-            return;
+            return true;
         }
     }
-    // Nothing shadowed.
-    out.put(entry);
+    return false;
 }
 
-std::shared_ptr<Bucket>
-Bucket::merge(BucketManager& bucketManager,
-              std::shared_ptr<Bucket> const& oldBucket,
-              std::shared_ptr<Bucket> const& newBucket,
-              std::vector<std::shared_ptr<Bucket>> const& shadows,
-              bool keepDeadEntries)
+inline void
+maybePut(BucketOutputIterator& out, ResidentIterator& in,
+         std::vector<ResidentIterator>& shadowIterators)
 {
-    // This is the key operation in the scheme: merging two (read-only)
-    // buckets together into a new 3rd bucket, while calculating its hash,
-    // in a single pass.
-
-    assert(oldBucket);
-    assert(newBucket);
-
-    BucketInputIterator oi(oldBucket);
-    BucketInputIterator ni(newBucket);
-
-    std::vector<BucketInputIterator> shadowIterators(shadows.begin(),
-                                                     shadows.end());
-
-    auto timer = bucketManager.getMergeTimer().TimeScope();
-    BucketOutputIterator out(bucketManager.getTmpDir(), keepDeadEntries);
+    BucketEntry const& entry = *in;
+    if (isShadowed(entry, shadowIterators))
+    {
+        return;
+    }
+    out.put(entry);
+}
 
+template <typename Iterator>
+static void
+mergeEntries(BucketOutputIterator& out, Iterator& oi, Iterator& ni,
+             std::vector<Iterator>& shadowIterators)
+{
     BucketEntryIdCmp cmp;
     while (oi || ni)
     {
         if (!ni)
         {
             // Out of new entries, take old entries.
-            maybePut(out, *oi, shadowIterators);
+            maybePut(out, oi, shadowIterators);
             ++oi;
         }
         else if (!oi)
         {
             // Out of old entries, take new entries.
-            maybePut(out, *ni, shadowIterators);
+            maybePut(out, ni, shadowIterators);
             ++ni;
         }
         else if (cmp(*oi, *ni))
         {
             // Next old-entry has smaller key, take it.
-            maybePut(out, *oi, shadowIterators);
+            maybePut(out, oi, shadowIterators);
             ++oi;
         }
         else if (cmp(*ni, *oi))
         {
             // Next new-entry has smaller key, take it.
-            maybePut(out, *ni, shadowIterators);
+            maybePut(out, ni, shadowIterators);
             ++ni;
         }
         else
         {
             // Old and new are for the same key, take new.
-            maybePut(out, *ni, shadowIterators);
+            maybePut(out, ni, shadowIterators);
             ++oi;
             ++ni;
         }
     }
+}
+
+// Merges buckets whose entries are all resident, without reading their
+// files; the output is resident too.
+static std::shared_ptr<Bucket>
+mergeResident(BucketManager& bucketManager,
+              std::shared_ptr<Bucket> const& oldBucket,
+              std::shared_ptr<Bucket> const& newBucket,
+              std::vector<std::shared_ptr<Bucket>> const& shadows,
+              bool keepDeadEntries)
+{
+    ResidentIterator oi(oldBucket);
+    ResidentIterator ni(newBucket);
+    std::vector<ResidentIterator> shadowIterators;
+    shadowIterators.reserve(shadows.size());
+    for (auto const& b : shadows)
+    {
+        shadowIterators.emplace_back(b);
+    }
+
+    auto timer = bucketManager.getMergeTimer().TimeScope();
+    BucketOutputIterator out(bucketManager.getTmpDir(), keepDeadEntries, true,
+                             oldBucket->getMaxEntryCount() +
+                                 newBucket->getMaxEntryCount());
+    mergeEntries(out, oi, ni, shadowIterators);
+    return out.getBucket(bucketManager);
+}
+
+std::shared_ptr<Bucket>
+Bucket::merge(BucketManager& bucketManager,
+              std::shared_ptr<Bucket> const& oldBucket,
+              std::shared_ptr<Bucket> const& newBucket,
+              std::vector<std::shared_ptr<Bucket>> const& shadows,
+              bool keepDeadEntries, bool resident)
+{
+    assert(oldBucket);
+    assert(newBucket);
+
+    if (resident)
+    {
+        // Inputs are not resident when they were loaded from disk, as after a
+        // restart; they are then read from their files this once.
+        auto isResident = [](std::shared_ptr<Bucket> const& b) {
+            return b->getResidentEntries() != nullptr;
+        };
+        if (isResident(oldBucket) && isResident(newBucket) &&
+            std::all_of(shadows.begin(), shadows.end(), isResident))
+        {
+            return mergeResident(bucketManager, oldBucket, newBucket, shadows,
+                                 keepDeadEntries);
+        }
+        return mergeSingleThreaded(bucketManager, oldBucket, newBucket,
+                                   shadows, keepDeadEntries, true);
+    }
+
+    if (fileSize(oldBucket->getFilename()) +
+            fileSize(newBucket->getFilename()) >=
+        BucketMergePipeline::MIN_INPUT_BYTES)
+    {
+        return BucketMergePipeline::merge(bucketManager, oldBucket, newBucket,
+                                          shadows, keepDeadEntries);
+    }
+    return mergeSingleThreaded(bucketManager, oldBucket, newBucket, shadows,
+                               keepDeadEntries);
+}
+
+std::shared_ptr<Bucket>
+Bucket::mergeSingleThreaded(
+    BucketManager& bucketManager, std::shared_ptr<Bucket> const& oldBucket,
+    std::shared_ptr<Bucket> const& newBucket,
+    std::vector<std::shared_ptr<Bucket>> const& shadows, bool keepDeadEntries,
+    bool resident)
+{
+    // This is the key operation in the scheme: merging two (read-only)
+    // buckets together into a new 3rd bucket, while calculating its hash,
+    // in a single pass.
+
+    assert(oldBucket);
+    assert(newBucket);
+
+    BucketInputIterator oi(oldBucket);
+    BucketInputIterator ni(newBucket);
+
+    std::vector<BucketInputIterator> shadowIterators(shadows.begin(),
+                                                     shadows.end());
+
+    auto timer = bucketManager.getMergeTimer().TimeScope();
+    BucketOutputIterator out(bucketManager.getTmpDir(), keepDeadEntries,
+                             resident,
+                             oldBucket->getMaxEntryCount() +
+                                 newBucket->getMaxEntryCount());
+    mergeEntries(out, oi, ni, shadowIterators);
     return out.getBucket(bucketManager);
 }
 }
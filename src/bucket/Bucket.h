@@ -4,12 +4,17 @@
 // under the Apache License, Version 2.0. See the COPYING file at the root
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
+#include "bucket/BucketIndex.h"
 #include "bucket/LedgerCmp.h"
 #include "crypto/Hex.h"
 #include "overlay/StellarXDR.h"
 #include "util/NonCopyable.h"
 #include "util/XDRStream.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace spn
 {
@@ -18,7 +23,9 @@ namespace spn
  * Bucket is an immutable container for a sorted set of "Entries" (object ID,
  * hash, xdr-message tuples) which is designed to be held in a shared_ptr<>
  * which is referenced between threads, to minimize copying. It is therefore
- * imperative that it be _really_ immutable, not just faking it.
+ * imperative that it be _really_ immutable, not just faking it. The one
+ * exception is that a bucket's entries may be loaded into memory after the
+ * fact (see makeResident), which does not change what the bucket holds.
  *
  * Two buckets can be merged together efficiently (in a single pass): elements
  * from the newer bucket overwrite elements from the older bucket, the rest are
@@ -29,6 +36,7 @@ class Application;
 class BucketManager;
 class BucketList;
 class Database;
+class MappedFile;
 
 class Bucket : public std::enable_shared_from_this<Bucket>,
                public NonMovableOrCopyable
@@ -36,6 +44,19 @@ class Bucket : public std::enable_shared_from_this<Bucket>,
 
     std::string const mFilename;
     Hash const mHash;
+    // The entries of the file, when they are also kept in memory. Only ever
+    // set from null, by makeResident; always read with std::atomic_load.
+    std::shared_ptr<std::vector<BucketEntry> const> mEntries;
+    std::atomic<size_t> mResidentBytes{0};
+    // Number of entries in the file, or 0 if not known.
+    size_t const mEntryCount{0};
+
+    // Set up by the first lookup, as most buckets are never looked in.
+    mutable std::once_flag mLookupReady;
+    mutable std::unique_ptr<BucketIndex const> mIndex;
+    mutable std::unique_ptr<MappedFile> mLookupFile;
+
+    void prepareLookup() const;
 
   public:
     // Create an empty bucket. The empty bucket has hash '000000...' and its
@@ -44,12 +65,43 @@ class Bucket : public std::enable_shared_from_this<Bucket>,
 
     // Construct a bucket with a given filename and hash. Asserts that the file
     // exists, but does not check that the hash is the bucket's hash. Caller
-    // needs to ensure that.
-    Bucket(std::string const& filename, Hash const& hash);
+    // needs to ensure that. If `entries` is set, it must hold the entries of
+    // the file, in order; they are then read from memory rather than from the
+    // file by merges. `nEntries` is the number of entries of the file, if
+    // known.
+    Bucket(std::string const& filename, Hash const& hash,
+           std::shared_ptr<std::vector<BucketEntry> const> entries = nullptr,
+           size_t nEntries = 0);
+
+    ~Bucket();
 
     Hash const& getHash() const;
     std::string const& getFilename() const;
 
+    // Returns the entries of the bucket if they are resident in memory (which
+    // the empty bucket's always are), else nullptr.
+    std::shared_ptr<std::vector<BucketEntry> const> getResidentEntries() const;
+
+    // Keeps `entries`, which must be the entries of the file, in order, in
+    // memory from now on, if the bucket's entries are not resident yet.
+    void makeResident(std::shared_ptr<std::vector<BucketEntry> const> entries);
+
+    // Returns an estimate of the memory the resident entries take: their
+    // serialized size plus that of the BucketEntry objects holding them.
+    size_t getResidentBytes() const;
+
+    // Returns the number of entries of the bucket if known, else the most
+    // its file can hold; what the index of a merge output is sized for.
+    size_t getMaxEntryCount() const;
+
+    // Returns the entry of the bucket for `key`, live or dead, or nullptr if
+    // there is none. `keyHash` is BucketIndex::keyHash(key). Reads at most
+    // one page of the file, through the bucket's index (which the first
+    // lookup reads, or builds if the bucket has none yet), or none if the
+    // entries are resident.
+    std::shared_ptr<BucketEntry const> lookup(LedgerKey const& key,
+                                              uint64_t keyHash) const;
+
     // Returns true if a BucketEntry that is key-wise identical to the given
     // BucketEntry exists in the bucket. For testing.
     bool containsBucketIdentity(BucketEntry const& id) const;
@@ -66,22 +118,37 @@ class Bucket : public std::enable_shared_from_this<Bucket>,
 
     // Create a fresh bucket from a given vector of live LedgerEntries and
     // dead LedgerEntryKeys. The bucket will be sorted, hashed, and adopted
-    // in the provided BucketManager.
+    // in the provided BucketManager. Where an entry is both live and dead,
+    // the dead one wins. The entries are moved from, so pass temporaries to
+    // avoid copying them. If `resident`, the bucket keeps them in memory.
     static std::shared_ptr<Bucket>
-    fresh(BucketManager& bucketManager,
-          std::vector<LedgerEntry> const& liveEntries,
-          std::vector<LedgerKey> const& deadEntries);
+    fresh(BucketManager& bucketManager, std::vector<LedgerEntry> liveEntries,
+          std::vector<LedgerKey> deadEntries, bool resident = false);
 
     // Merge two buckets together, producing a fresh one. Entries in `oldBucket`
     // are overridden in the fresh bucket by keywise-equal entries in
     // `newBucket`. Entries are inhibited from the fresh bucket by keywise-equal
     // entries in any of the buckets in the provided `shadows` vector.
+    //
+    // If `resident`, the fresh bucket keeps its entries in memory, and when
+    // every input has its entries in memory the merge reads none of their
+    // files. The fresh bucket is written and hashed the same either way.
     static std::shared_ptr<Bucket>
     merge(BucketManager& bucketManager,
           std::shared_ptr<Bucket> const& oldBucket,
           std::shared_ptr<Bucket> const& newBucket,
           std::vector<std::shared_ptr<Bucket>> const& shadows =
               std::vector<std::shared_ptr<Bucket>>(),
-          bool keepDeadEntries = true);
+          bool keepDeadEntries = true, bool resident = false);
+
+    // As merge, on the calling thread alone whatever the size of the inputs
+    // (merge hands large ones to BucketMergePipeline), and reading the input
+    // files even if their entries are resident. For testing.
+    static std::shared_ptr<Bucket>
+    mergeSingleThreaded(BucketManager& bucketManager,
+                        std::shared_ptr<Bucket> const& oldBucket,
+                        std::shared_ptr<Bucket> const& newBucket,
+                        std::vector<std::shared_ptr<Bucket>> const& shadows,
+                        bool keepDeadEntries, bool resident = false);
 };
 }
@@ -6,7 +6,6 @@
 #include "bucket/BucketApplicator.h"
 #include "bucket/Bucket.h"
 #include "ledger/LedgerState.h"
-#include "ledger/LedgerStateEntry.h"
 #include "main/Application.h"
 #include "util/Logging.h"
 #include "util/types.h"
@@ -14,56 +13,81 @@
 namespace spn
 {
 
+// Number of bucket entries written to the database per advance
+static size_t const BATCH_SIZE = 0x1000;
+
 BucketApplicator::BucketApplicator(Application& app,
                                    std::shared_ptr<const Bucket> bucket)
-    : mApp(app), mBucketIter(bucket)
+    : mApp(app), mBucketIter(std::make_shared<BucketInputIterator>(bucket))
+{
+    readNextBatch();
+}
+
+BucketApplicator::~BucketApplicator()
 {
+    // The background read refers to mBucketIter, so it has to finish first
+    if (mNextBatch.valid())
+    {
+        mNextBatch.wait();
+    }
 }
 
 BucketApplicator::operator bool() const
 {
-    return (bool)mBucketIter;
+    return mNextBatch.valid();
 }
 
 void
-BucketApplicator::advance()
+BucketApplicator::readNextBatch()
 {
-    LedgerState ls(mApp.getLedgerStateRoot(), false);
-    for (; mBucketIter; ++mBucketIter)
-    {
-        if ((*mBucketIter).type() == LIVEENTRY)
+    auto iter = mBucketIter;
+    using task_t = std::packaged_task<std::unique_ptr<Batch>()>;
+    auto task = std::make_shared<task_t>([iter]() {
+        auto batch = std::make_unique<Batch>();
+        for (size_t n = 0; *iter && n < BATCH_SIZE; ++(*iter), ++n)
         {
-            auto const& bucketEntry = (*mBucketIter).liveEntry();
-            auto key = LedgerEntryKey(bucketEntry);
-            auto entry = ls.load(key);
-            if (entry)
+            auto const& bucketEntry = **iter;
+            if (bucketEntry.type() == LIVEENTRY)
             {
-                entry.current() = bucketEntry;
+                batch->liveEntries.emplace_back(bucketEntry.liveEntry());
             }
             else
             {
-                ls.create(bucketEntry);
-            }
-        }
-        else
-        {
-            auto entry = ls.load((*mBucketIter).deadEntry());
-            if (entry)
-            {
-                entry.erase();
+                batch->deadEntries.emplace_back(bucketEntry.deadEntry());
             }
         }
-        if ((++mSize & 0xff) == 0xff)
-        {
-            break;
-        }
+        batch->atEnd = !*iter;
+        return batch;
+    });
+
+    mNextBatch = task->get_future();
+    mApp.postOnBackgroundThread(bind(&task_t::operator(), task));
+}
+
+size_t
+BucketApplicator::advance()
+{
+    // The batch is decoded on the shared worker pool, where it may be queued
+    // behind merges; rather than blocking the main thread on it, let the
+    // caller reschedule and try again.
+    if (mNextBatch.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready)
+    {
+        return 0;
     }
-    ls.commit();
 
-    if (!mBucketIter || (mSize & 0xfff) == 0xfff)
+    auto batch = mNextBatch.get();
+    if (!batch->atEnd)
     {
-        CLOG(INFO, "Bucket")
-            << "Bucket-apply: committed " << mSize << " entries";
+        readNextBatch();
     }
+
+    mApp.getLedgerStateRoot().writeBucketEntries(batch->liveEntries,
+                                                 batch->deadEntries);
+
+    size_t n = batch->liveEntries.size() + batch->deadEntries.size();
+    mSize += n;
+    CLOG(INFO, "Bucket") << "Bucket-apply: committed " << mSize << " entries";
+    return n;
 }
 }
@@ -7,6 +7,7 @@
 #include "bucket/Bucket.h"
 #include "bucket/BucketInputIterator.h"
 #include "util/XDRStream.h"
+#include <future>
 #include <memory>
 
 namespace spn
@@ -17,16 +18,38 @@ class Application;
 // Class that represents a single apply-bucket-to-database operation in
 // progress. Used during history catchup to split up the task of applying
 // bucket into scheduler-friendly, bite-sized pieces.
+//
+// Buckets are applied oldest first, so every entry of a bucket replaces
+// whatever an older bucket left in the database. Entries are therefore written
+// blindly, in batches with one statement per entry type, without being loaded
+// first. Reading and decoding the next batch from the bucket file happens on a
+// background thread while the current batch is written on the main thread;
+// the main thread never waits for that read.
 
 class BucketApplicator
 {
+    struct Batch
+    {
+        std::vector<LedgerEntry> liveEntries;
+        std::vector<LedgerKey> deadEntries;
+        bool atEnd{false};
+    };
+
     Application& mApp;
-    BucketInputIterator mBucketIter;
+    std::shared_ptr<BucketInputIterator> mBucketIter;
+    std::future<std::unique_ptr<Batch>> mNextBatch;
     size_t mSize{0};
 
+    void readNextBatch();
+
   public:
     BucketApplicator(Application& app, std::shared_ptr<const Bucket> bucket);
+    ~BucketApplicator();
     operator bool() const;
-    void advance();
+
+    // Writes the next batch of entries to the database and returns how many
+    // entries it contained. Returns 0 without writing anything if the next
+    // batch is still being read; the caller should simply call again later.
+    size_t advance();
 };
 }
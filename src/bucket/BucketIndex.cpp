@@ -0,0 +1,244 @@
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "bucket/BucketIndex.h"
+#include "bucket/LedgerCmp.h"
+#include "util/Fs.h"
+#include "util/Logging.h"
+#include "util/MappedFile.h"
+#include "util/XDRStream.h"
+#include "util/types.h"
+#include "xdrpp/marshal.h"
+#include <algorithm>
+
+namespace spn
+{
+
+namespace
+{
+LedgerKey
+entryKey(BucketEntry const& entry)
+{
+    return entry.type() == LIVEENTRY ? LedgerEntryKey(entry.liveEntry())
+                                     : entry.deadEntry();
+}
+
+// Calls f with each of the BLOOM_HASHES bits of a filter of `nBits` bits that
+// the key of `keyHash` sets, derived from it by double hashing.
+template <typename F>
+void
+forEachBloomBit(uint64_t keyHash, uint64_t nBits, F f)
+{
+    // second hash: the splitmix64 finalizer of the first one, made odd
+    uint64_t h2 = keyHash;
+    h2 = (h2 ^ (h2 >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h2 = (h2 ^ (h2 >> 27)) * 0x94d049bb133111ebULL;
+    h2 = (h2 ^ (h2 >> 31)) | 1;
+    for (size_t i = 0; i < BucketIndex::BLOOM_HASHES; ++i)
+    {
+        f((keyHash + i * h2) % nBits);
+    }
+}
+}
+
+BucketIndex::Builder::Builder(size_t expectedEntries)
+{
+    uint64_t nBits = std::max<uint64_t>(
+        64, static_cast<uint64_t>(expectedEntries) * BLOOM_BITS_PER_KEY);
+    mBloom.resize((nBits + 7) / 8, 0);
+}
+
+void
+BucketIndex::Builder::add(BucketEntry const& entry, uint64_t offset)
+{
+    auto key = entryKey(entry);
+    if (mEntries++ % PAGE_ENTRIES == 0)
+    {
+        mPages.emplace_back(key, offset);
+    }
+    auto& bloom = mBloom;
+    forEachBloomBit(keyHash(key), bloom.size() * 8, [&bloom](uint64_t bit) {
+        bloom[bit / 8] |= static_cast<uint8_t>(1 << (bit % 8));
+    });
+}
+
+std::unique_ptr<BucketIndex const>
+BucketIndex::Builder::finish(uint64_t fileSize)
+{
+    std::unique_ptr<BucketIndex> index(new BucketIndex());
+    index->mFileSize = fileSize;
+    index->mPageKeys.reserve(mPages.size());
+    index->mPageOffsets.reserve(mPages.size());
+    for (auto& p : mPages)
+    {
+        index->mPageKeys.emplace_back(std::move(p.first));
+        index->mPageOffsets.emplace_back(p.second);
+    }
+    index->mBloom = std::move(mBloom);
+
+    mPages.clear();
+    mBloom.clear();
+    mEntries = 0;
+    return index;
+}
+
+std::string
+BucketIndex::filename(std::string const& bucketFilename)
+{
+    return bucketFilename + ".index";
+}
+
+uint64_t
+BucketIndex::keyHash(LedgerKey const& key)
+{
+    // FNV-1a of the key's XDR: cheap, and the same everywhere, as filters are
+    // saved to disk.
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (auto b : xdr::xdr_to_opaque(key))
+    {
+        h ^= b;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+std::unique_ptr<BucketIndex const>
+BucketIndex::load(std::string const& bucketFilename, uint64_t fileSize)
+{
+    auto name = filename(bucketFilename);
+    if (!fs::exists(name))
+    {
+        return nullptr;
+    }
+
+    std::unique_ptr<BucketIndex> index(new BucketIndex());
+    uint64_t nPages = 0;
+    try
+    {
+        XDRInputFileStream in;
+        in.open(name);
+        if (!in.readOne(index->mFileSize) || index->mFileSize != fileSize ||
+            !in.readOne(index->mBloom) || !in.readOne(nPages))
+        {
+            CLOG(WARNING, "Bucket") << "Ignoring stale index file " << name;
+            return nullptr;
+        }
+        index->mPageKeys.resize(nPages);
+        index->mPageOffsets.resize(nPages);
+        for (uint64_t i = 0; i < nPages; ++i)
+        {
+            if (!in.readOne(index->mPageKeys[i]) ||
+                !in.readOne(index->mPageOffsets[i]))
+            {
+                CLOG(WARNING, "Bucket")
+                    << "Ignoring truncated index file " << name;
+                return nullptr;
+            }
+        }
+    }
+    catch (std::runtime_error& e)
+    {
+        CLOG(WARNING, "Bucket")
+            << "Ignoring unreadable index file " << name << ": " << e.what();
+        return nullptr;
+    }
+    return index;
+}
+
+std::unique_ptr<BucketIndex const>
+BucketIndex::build(std::string const& bucketFilename)
+{
+    CLOG(DEBUG, "Bucket") << "Building index of " << bucketFilename;
+    MappedFile file(bucketFilename);
+    ByteSlice data(file.data(), file.size());
+
+    // count the records first, through their headers only, to size the
+    // bloom filter
+    size_t nEntries = 0;
+    for (size_t offset = 0;;)
+    {
+        auto record = XDRInputMappedFileStream::recordAt(data, offset);
+        if (record.empty())
+        {
+            break;
+        }
+        ++nEntries;
+        offset += record.size();
+    }
+
+    Builder builder(nEntries);
+    uint64_t offset = 0;
+    BucketEntry entry;
+    for (;;)
+    {
+        auto record = XDRInputMappedFileStream::recordAt(data, offset);
+        if (record.empty())
+        {
+            break;
+        }
+        xdr::xdr_get g(record.data() + 4, record.end());
+        xdr::xdr_argpack_archive(g, entry);
+        builder.add(entry, offset);
+        offset += record.size();
+    }
+    return builder.finish(offset);
+}
+
+size_t
+BucketIndex::maxEntryCount(uint64_t fileSize)
+{
+    // the smallest record: a dead entry for an account, with its size header
+    BucketEntry smallest;
+    smallest.type(DEADENTRY);
+    smallest.deadEntry().type(ACCOUNT);
+    return static_cast<size_t>(fileSize / (4 + xdr::xdr_size(smallest)));
+}
+
+void
+BucketIndex::save(std::string const& bucketFilename) const
+{
+    XDROutputFileStream out;
+    out.open(filename(bucketFilename));
+    out.writeOne(mFileSize);
+    out.writeOne(mBloom);
+    out.writeOne(static_cast<uint64_t>(mPageKeys.size()));
+    for (size_t i = 0; i < mPageKeys.size(); ++i)
+    {
+        out.writeOne(mPageKeys[i]);
+        out.writeOne(mPageOffsets[i]);
+    }
+    out.close();
+}
+
+bool
+BucketIndex::mayContain(uint64_t keyHash) const
+{
+    if (mBloom.empty())
+    {
+        return false;
+    }
+    bool found = true;
+    forEachBloomBit(keyHash, mBloom.size() * 8, [&](uint64_t bit) {
+        found = found && (mBloom[bit / 8] & (1 << (bit % 8))) != 0;
+    });
+    return found;
+}
+
+bool
+BucketIndex::findPage(LedgerKey const& key, uint64_t& begin,
+                      uint64_t& end) const
+{
+    // the last page whose first key is not after `key`
+    auto it = std::upper_bound(mPageKeys.begin(), mPageKeys.end(), key,
+                               LedgerEntryIdCmp());
+    if (it == mPageKeys.begin())
+    {
+        return false;
+    }
+    size_t page = (it - mPageKeys.begin()) - 1;
+    begin = mPageOffsets[page];
+    end = page + 1 < mPageOffsets.size() ? mPageOffsets[page + 1] : mFileSize;
+    return true;
+}
+}
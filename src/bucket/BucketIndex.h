@@ -0,0 +1,108 @@
+#pragma once
+
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/NonCopyable.h"
+#include "xdr/Stellar-ledger.h"
+#include "xdrpp/types.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace spn
+{
+
+/**
+ * Index of the entries of a bucket file, for looking keys up without reading
+ * the whole file: the key and file offset of the first entry of every page of
+ * PAGE_ENTRIES entries, and a bloom filter of all the keys, which rules out
+ * most buckets that do not hold a key without reading any of their pages.
+ *
+ * BucketOutputIterator builds the index of each bucket it writes, and the
+ * BucketManager saves it next to the bucket file (see filename()) when it
+ * adopts a bucket of at least MIN_SAVED_FILE_SIZE bytes; a bucket only reads
+ * it the first time it is looked in. Buckets that come without one, such as
+ * small or downloaded ones, have theirs built in memory by reading the file
+ * then.
+ */
+class BucketIndex : NonMovableOrCopyable
+{
+  public:
+    static size_t const PAGE_ENTRIES = 64;
+    static size_t const BLOOM_BITS_PER_KEY = 10;
+    static size_t const BLOOM_HASHES = 7;
+    // Indexes of smaller bucket files, which make up the lower levels of the
+    // bucket list, are not saved: those are cheap to read through, and are
+    // replaced within a few ledgers anyway.
+    static uint64_t const MIN_SAVED_FILE_SIZE = 1024 * 1024;
+
+    // Builds the index of a bucket file as it is written. Only the first key
+    // of each page is kept; the other keys go straight into the bloom filter.
+    class Builder
+    {
+        std::vector<std::pair<LedgerKey, uint64_t>> mPages;
+        xdr::opaque_vec<> mBloom;
+        size_t mEntries{0};
+
+      public:
+        // The bloom filter is sized for `expectedEntries`; more entries make
+        // it less selective, not wrong.
+        explicit Builder(size_t expectedEntries);
+
+        // Adds `entry`, written at `offset` in the file; entries are added in
+        // file order.
+        void add(BucketEntry const& entry, uint64_t offset);
+
+        // `fileSize` is the size of the whole file.
+        std::unique_ptr<BucketIndex const> finish(uint64_t fileSize);
+    };
+
+    // The index file of bucket file `bucketFilename`.
+    static std::string filename(std::string const& bucketFilename);
+
+    // Hash of `key` the bloom filters are probed with. It is computed once
+    // per lookup and shared by all the buckets searched.
+    static uint64_t keyHash(LedgerKey const& key);
+
+    // Reads the index saved for `bucketFilename`, of `fileSize` bytes, or
+    // returns nullptr if there is none or it does not match the file.
+    static std::unique_ptr<BucketIndex const>
+    load(std::string const& bucketFilename, uint64_t fileSize);
+
+    // Builds the index of `bucketFilename` by reading it through.
+    static std::unique_ptr<BucketIndex const>
+    build(std::string const& bucketFilename);
+
+    // The most entries a bucket file of `fileSize` bytes can hold.
+    static size_t maxEntryCount(uint64_t fileSize);
+
+    void save(std::string const& bucketFilename) const;
+
+    // Returns false if the bucket certainly has no entry for the key of
+    // `keyHash`.
+    bool mayContain(uint64_t keyHash) const;
+
+    // Finds the page of the file an entry for `key` would be in, as the range
+    // [begin, end) of file offsets. Returns false if `key` sorts before every
+    // entry in the bucket.
+    bool findPage(LedgerKey const& key, uint64_t& begin, uint64_t& end) const;
+
+    size_t
+    getPageCount() const
+    {
+        return mPageKeys.size();
+    }
+
+  private:
+    std::vector<LedgerKey> mPageKeys;
+    std::vector<uint64_t> mPageOffsets;
+    xdr::opaque_vec<> mBloom;
+    uint64_t mFileSize{0};
+
+    BucketIndex() = default;
+};
+}
@@ -14,14 +14,21 @@ namespace spn
 void
 BucketInputIterator::loadEntry()
 {
-    if (mIn.readOne(mEntry))
-    {
-        mEntryPtr = &mEntry;
-    }
-    else
+    auto record = mIn.readRecord();
+    if (record.empty())
     {
         mEntryPtr = nullptr;
+        mRecordData = nullptr;
+        mRecordSize = 0;
+        return;
     }
+
+    xdr::xdr_get g(record.data() + 4, record.end());
+    xdr::xdr_argpack_archive(g, mEntry);
+    g.done();
+    mEntryPtr = &mEntry;
+    mRecordData = record.data();
+    mRecordSize = record.size();
 }
 
 BucketInputIterator::operator bool() const
@@ -34,6 +41,12 @@ BucketEntry const& BucketInputIterator::operator*()
     return *mEntryPtr;
 }
 
+ByteSlice
+BucketInputIterator::currentRecord() const
+{
+    return ByteSlice(mRecordData, mRecordSize);
+}
+
 BucketInputIterator::BucketInputIterator(std::shared_ptr<Bucket const> bucket)
     : mBucket(bucket), mEntryPtr(nullptr)
 {
@@ -60,7 +73,34 @@ BucketInputIterator& BucketInputIterator::operator++()
     else
     {
         mEntryPtr = nullptr;
+        mRecordData = nullptr;
+        mRecordSize = 0;
     }
     return *this;
 }
+
+bool
+isShadowed(BucketEntry const& entry, std::vector<BucketInputIterator>& shadows)
+{
+    BucketEntryIdCmp cmp;
+    for (auto& si : shadows)
+    {
+        // Advance the shadowIterator while it's less than the candidate
+        while (si && cmp(*si, entry))
+        {
+            ++si;
+        }
+        // We have stepped si forward to the point that either si is exhausted,
+        // or else *si >= entry; we now check the opposite direction to see if
+        // we have equality.
+        if (si && !cmp(entry, *si))
+        {
+            // If so, then entry is shadowed in at least one level. There is
+            // no need to advance the other iterators, they will advance as
+            // and if necessary in future calls.
+            return true;
+        }
+    }
+    return false;
+}
 }
@@ -9,6 +9,7 @@
 #include "xdr/Stellar-ledger.h"
 
 #include <memory>
+#include <vector>
 
 namespace spn
 {
@@ -24,8 +25,10 @@ class BucketInputIterator
     // pointer. If
     // non-null, it points to mEntry.
     BucketEntry const* mEntryPtr;
-    XDRInputFileStream mIn;
+    XDRInputMappedFileStream mIn;
     BucketEntry mEntry;
+    uint8_t const* mRecordData{nullptr};
+    size_t mRecordSize{0};
 
     void loadEntry();
 
@@ -34,10 +37,21 @@ class BucketInputIterator
 
     BucketEntry const& operator*();
 
+    // Serialized form of the current entry, as stored in the bucket file;
+    // points into the file mapping and is valid until the iterator is
+    // destroyed.
+    ByteSlice currentRecord() const;
+
     BucketInputIterator(std::shared_ptr<Bucket const> bucket);
 
     ~BucketInputIterator();
 
     BucketInputIterator& operator++();
 };
+
+// Returns true if an entry keywise-equal to `entry` is in any of the buckets
+// read by `shadows`. The iterators are advanced past whatever sorts before
+// `entry`, so successive calls must be made in sorted order.
+bool isShadowed(BucketEntry const& entry,
+                std::vector<BucketInputIterator>& shadows);
 }
@@ -10,6 +10,7 @@
 #include "crypto/Random.h"
 #include "crypto/SHA.h"
 #include "main/Application.h"
+#include "main/Config.h"
 #include "util/Logging.h"
 #include "util/XDRStream.h"
 #include "util/types.h"
@@ -120,7 +121,8 @@ BucketLevel::prepare(Application& app, uint32_t currLedger,
     }
 
     mNextCurr = FutureBucket(app, curr, snap, shadows,
-                             BucketList::keepDeadEntries(mLevel));
+                             BucketList::keepDeadEntries(mLevel), mLevel,
+                             BucketList::nextCommitLedger(currLedger, mLevel));
     assert(mNextCurr.isMerging());
 }
 
@@ -165,6 +167,20 @@ BucketList::levelHalf(uint32_t level)
     return levelSize(level) >> 1;
 }
 
+uint32_t
+BucketList::nextCommitLedger(uint32_t ledger, uint32_t level)
+{
+    if (level == 0)
+    {
+        return ledger;
+    }
+    // level commits what it prepared whenever the level above it spills
+    auto const half = levelHalf(level - 1);
+    auto const next = mask(ledger, half) + half;
+    assert(levelShouldSpill(next, level - 1));
+    return next;
+}
+
 uint32_t
 BucketList::mask(uint32_t v, uint32_t m)
 {
@@ -294,6 +310,23 @@ BucketList::getHash() const
     return hsh->finish();
 }
 
+std::shared_ptr<BucketEntry const>
+BucketList::lookup(LedgerKey const& key) const
+{
+    auto keyHash = BucketIndex::keyHash(key);
+    for (auto const& lev : mLevels)
+    {
+        for (auto const& b : {lev.getCurr(), lev.getSnap()})
+        {
+            if (auto entry = b->lookup(key, keyHash))
+            {
+                return entry;
+            }
+        }
+    }
+    return nullptr;
+}
+
 bool
 BucketList::levelShouldSpill(uint32_t ledger, uint32_t level)
 {
@@ -313,6 +346,12 @@ BucketList::keepDeadEntries(uint32_t level)
     return level < BucketList::kNumLevels - 1;
 }
 
+bool
+BucketList::keepResident(Application& app, uint32_t level)
+{
+    return level < app.getConfig().BUCKETLIST_RESIDENT_LEVELS;
+}
+
 BucketLevel const&
 BucketList::getLevel(uint32_t i) const
 {
@@ -327,8 +366,8 @@ BucketList::getLevel(uint32_t i)
 
 void
 BucketList::addBatch(Application& app, uint32_t currLedger,
-                     std::vector<LedgerEntry> const& liveEntries,
-                     std::vector<LedgerKey> const& deadEntries)
+                     std::vector<LedgerEntry> liveEntries,
+                     std::vector<LedgerKey> deadEntries)
 {
     assert(currLedger > 0);
 
@@ -417,13 +456,14 @@ BucketList::addBatch(Application& app, uint32_t currLedger,
     assert(shadows.size() == 0);
     mLevels[0].prepare(
         app, currLedger,
-        Bucket::fresh(app.getBucketManager(), liveEntries, deadEntries),
+        Bucket::fresh(app.getBucketManager(), std::move(liveEntries),
+                      std::move(deadEntries), keepResident(app, 0)),
         shadows);
     mLevels[0].commit();
 }
 
 void
-BucketList::restartMerges(Application& app)
+BucketList::restartMerges(Application& app, uint32_t currLedger)
 {
     for (uint32_t i = 0; i < static_cast<uint32>(mLevels.size()); i++)
     {
@@ -431,7 +471,8 @@ BucketList::restartMerges(Application& app)
         auto& next = level.getNext();
         if (next.hasHashes() && !next.isLive())
         {
-            next.makeLive(app, keepDeadEntries(i));
+            next.makeLive(app, keepDeadEntries(i), i,
+                          nextCommitLedger(currLedger, i));
             if (next.isMerging())
             {
                 CLOG(INFO, "Bucket")
@@ -321,9 +321,17 @@ class BucketList
     // should spill curr->snap and start merging snap into its next level.
     static bool levelShouldSpill(uint32_t ledger, uint32_t level);
 
+    // Returns the ledger whose close commits the merge into `level` that is
+    // pending after the close of `ledger`.
+    static uint32_t nextCommitLedger(uint32_t ledger, uint32_t level);
+
     // Returns true if at given `level` dead entries should be kept.
     static bool keepDeadEntries(uint32_t level);
 
+    // Returns true if buckets at given `level` keep their entries in memory
+    // (see Config::BUCKETLIST_RESIDENT_LEVELS).
+    static bool keepResident(Application& app, uint32_t level);
+
     // Create a new BucketList with every `kNumLevels` levels, each with
     // an empty bucket in `curr` and `snap`.
     BucketList();
@@ -339,11 +347,18 @@ class BucketList
     // of the concatenation of the hashes of the `curr` and `snap` buckets.
     Hash getHash() const;
 
+    // Returns the newest entry for `key` in the bucketlist: live, or dead if
+    // the key was last deleted, or nullptr if no bucket has an entry for it.
+    // Searches curr then snap of each level, from level 0 down, stopping at
+    // the first bucket that has one (see Bucket::lookup).
+    std::shared_ptr<BucketEntry const> lookup(LedgerKey const& key) const;
+
     // Restart any merges that might be running on background worker threads,
     // merging buckets between levels. This needs to be called after forcing a
     // BucketList to adopt a new state, either at application restart or when
-    // catching up from buckets loaded over the network.
-    void restartMerges(Application& app);
+    // catching up from buckets loaded over the network. `currLedger` is the
+    // last ledger closed in the adopted state.
+    void restartMerges(Application& app, uint32_t currLedger);
 
     // Add a batch of live and dead entries to the bucketlist, representing the
     // entries effected by closing `currLedger`. The bucketlist will incorporate
@@ -351,7 +366,7 @@ class BucketList
     // for any levels that should have spilled due to passing through
     // `currLedger`.
     void addBatch(Application& app, uint32_t currLedger,
-                  std::vector<LedgerEntry> const& liveEntries,
-                  std::vector<LedgerKey> const& deadEntries);
+                  std::vector<LedgerEntry> liveEntries,
+                  std::vector<LedgerKey> deadEntries);
 };
 }
@@ -16,6 +16,7 @@ namespace spn
 
 class Application;
 class BucketList;
+class BucketMergeScheduler;
 struct LedgerHeader;
 struct HistoryArchiveState;
 
@@ -55,6 +56,10 @@ class BucketManager : NonMovableOrCopyable
     virtual BucketList& getBucketList() = 0;
 
     virtual medida::Timer& getMergeTimer() = 0;
+    virtual medida::Timer& getFreshTimer() = 0;
+
+    // The queue bucket merges wait in for a worker thread.
+    virtual BucketMergeScheduler& getMergeScheduler() = 0;
 
     // Get a reference to a persistent bucket (in the BucketManager's bucket
     // directory), from the BucketManager's shared bucket-set.
@@ -64,12 +69,23 @@ class BucketManager : NonMovableOrCopyable
     // otherwise move `filename` to the bucket directory, stored under `hash`,
     // and return a new bucket pointing to that.
     //
+    // If `entries` is set, they are the entries of the file, and the new bucket
+    // keeps them resident. An existing bucket with the same hash is returned
+    // instead, and made resident with `entries` if it was not already.
+    //
+    // If `index` is set, it is the BucketIndex of the file, and is saved next
+    // to the new bucket if the file is at least
+    // BucketIndex::MIN_SAVED_FILE_SIZE bytes.
+    //
     // This method is mostly-threadsafe -- assuming you don't destruct the
     // BucketManager mid-call -- and is intended to be called from both main and
     // worker threads. Very carefully.
     virtual std::shared_ptr<Bucket>
     adoptFileAsBucket(std::string const& filename, uint256 const& hash,
-                      size_t nObjects = 0, size_t nBytes = 0) = 0;
+                      size_t nObjects = 0, size_t nBytes = 0,
+                      std::shared_ptr<std::vector<BucketEntry> const> entries =
+                          nullptr,
+                      std::unique_ptr<BucketIndex const> index = nullptr) = 0;
 
     // Return a bucket by hash if we have it, else return nullptr.
     virtual std::shared_ptr<Bucket> getBucketByHash(uint256 const& hash) = 0;
@@ -82,8 +98,8 @@ class BucketManager : NonMovableOrCopyable
 
     // Feed a new batch of entries to the bucket list.
     virtual void addBatch(Application& app, uint32_t currLedger,
-                          std::vector<LedgerEntry> const& liveEntries,
-                          std::vector<LedgerKey> const& deadEntries) = 0;
+                          std::vector<LedgerEntry> liveEntries,
+                          std::vector<LedgerKey> deadEntries) = 0;
 
     // Update the given LedgerHeader's bucketListHash to reflect the current
     // state of the bucket list.
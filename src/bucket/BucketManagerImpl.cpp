@@ -62,10 +62,21 @@ BucketManagerImpl::BucketManagerImpl(Application& app)
           {"bucket", "batch", "objectsadded"}, "object"))
     , mBucketAddBatch(app.getMetrics().NewTimer({"bucket", "batch", "addtime"}))
     , mBucketSnapMerge(app.getMetrics().NewTimer({"bucket", "snap", "merge"}))
+    , mBucketFresh(app.getMetrics().NewTimer({"bucket", "batch", "fresh"}))
     , mSharedBucketsSize(
           app.getMetrics().NewCounter({"bucket", "memory", "shared"}))
+    , mMergeScheduler(app)
 
 {
+    // a deeper level can take over a resident bucket unchanged when a merge
+    // into it has the same output, and then holds its entries too; so once
+    // there are resident levels, every level is reported
+    for (uint32_t i = 0;
+         BucketList::keepResident(app, 0) && i < BucketList::kNumLevels; ++i)
+    {
+        mResidentBytes.push_back(&app.getMetrics().NewCounter(
+            {"bucket", "memory", "level-" + std::to_string(i)}));
+    }
 }
 
 const std::string BucketManagerImpl::kLockFilename = "spn-core.lock";
@@ -81,7 +92,7 @@ bucketBasename(std::string const& bucketHexHash)
 bool
 isBucketFile(std::string const& name)
 {
-    static std::regex re("^bucket-[a-z0-9]{64}\\.xdr(\\.gz)?$");
+    static std::regex re("^bucket-[a-z0-9]{64}\\.xdr(\\.gz|\\.index)?$");
     return std::regex_match(name, re);
 };
 
@@ -159,10 +170,23 @@ BucketManagerImpl::getMergeTimer()
     return mBucketSnapMerge;
 }
 
+medida::Timer&
+BucketManagerImpl::getFreshTimer()
+{
+    return mBucketFresh;
+}
+
+BucketMergeScheduler&
+BucketManagerImpl::getMergeScheduler()
+{
+    return mMergeScheduler;
+}
+
 std::shared_ptr<Bucket>
-BucketManagerImpl::adoptFileAsBucket(std::string const& filename,
-                                     uint256 const& hash, size_t nObjects,
-                                     size_t nBytes)
+BucketManagerImpl::adoptFileAsBucket(
+    std::string const& filename, uint256 const& hash, size_t nObjects,
+    size_t nBytes, std::shared_ptr<std::vector<BucketEntry> const> entries,
+    std::unique_ptr<BucketIndex const> index)
 {
     std::lock_guard<std::recursive_mutex> lock(mBucketMutex);
     // Check to see if we have an existing bucket (either in-memory or on-disk)
@@ -175,6 +199,12 @@ BucketManagerImpl::adoptFileAsBucket(std::string const& filename,
             auto timer = LogSlowExecution("Delete redundant bucket");
             std::remove(filename.c_str());
         }
+        // the caller asked for a resident bucket: the existing one has the
+        // same entries, so it keeps the ones at hand
+        if (entries)
+        {
+            b->makeResident(std::move(entries));
+        }
     }
     else
     {
@@ -195,7 +225,15 @@ BucketManagerImpl::adoptFileAsBucket(std::string const& filename,
             }
         }
 
-        b = std::make_shared<Bucket>(canonicalName, hash);
+        if (index && nBytes >= BucketIndex::MIN_SAVED_FILE_SIZE)
+        {
+            // saved for the first lookup in the bucket, which is then the
+            // only one to read it
+            index->save(canonicalName);
+        }
+
+        b = std::make_shared<Bucket>(canonicalName, hash, std::move(entries),
+                                     nObjects);
         {
             mSharedBuckets.insert(std::make_pair(hash, b));
             mSharedBucketsSize.set_count(mSharedBuckets.size());
@@ -353,14 +391,17 @@ BucketManagerImpl::forgetUnreferencedBuckets()
             CLOG(TRACE, "Bucket")
                 << "BucketManager::forgetUnreferencedBuckets dropping "
                 << filename;
+            // destroys the bucket, and the mapping of its file that lookups
+            // hold, which would keep it from being removed on Windows
+            mSharedBuckets.erase(j);
             if (!filename.empty() && !mApp.getConfig().DISABLE_BUCKET_GC)
             {
                 CLOG(TRACE, "Bucket") << "removing bucket file: " << filename;
                 std::remove(filename.c_str());
                 auto gzfilename = filename + ".gz";
                 std::remove(gzfilename.c_str());
+                std::remove(BucketIndex::filename(filename).c_str());
             }
-            mSharedBuckets.erase(j);
         }
     }
     mSharedBucketsSize.set_count(mSharedBuckets.size());
@@ -368,12 +409,25 @@ BucketManagerImpl::forgetUnreferencedBuckets()
 
 void
 BucketManagerImpl::addBatch(Application& app, uint32_t currLedger,
-                            std::vector<LedgerEntry> const& liveEntries,
-                            std::vector<LedgerKey> const& deadEntries)
+                            std::vector<LedgerEntry> liveEntries,
+                            std::vector<LedgerKey> deadEntries)
 {
     auto timer = mBucketAddBatch.TimeScope();
     mBucketObjectInsertBatch.Mark(liveEntries.size());
-    mBucketList.addBatch(app, currLedger, liveEntries, deadEntries);
+    mBucketList.addBatch(app, currLedger, std::move(liveEntries),
+                         std::move(deadEntries));
+    reportResidentMemory();
+}
+
+void
+BucketManagerImpl::reportResidentMemory()
+{
+    for (uint32_t i = 0; i < mResidentBytes.size(); ++i)
+    {
+        auto const& level = mBucketList.getLevel(i);
+        mResidentBytes[i]->set_count(level.getCurr()->getResidentBytes() +
+                                     level.getSnap()->getResidentBytes());
+    }
 }
 
 // updates the given LedgerHeader to reflect the current state of the bucket
@@ -442,8 +496,9 @@ BucketManagerImpl::assumeState(HistoryArchiveState const& has)
         mBucketList.getLevel(i).setNext(has.currentBuckets.at(i).next);
     }
 
-    mBucketList.restartMerges(mApp);
+    mBucketList.restartMerges(mApp, has.currentLedger);
     cleanupStaleFiles();
+    reportResidentMemory();
 }
 
 void
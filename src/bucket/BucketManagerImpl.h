@@ -2,6 +2,7 @@
 
 #include "bucket/BucketList.h"
 #include "bucket/BucketManager.h"
+#include "bucket/BucketMergeScheduler.h"
 #include "overlay/StellarXDR.h"
 
 #include <map>
@@ -43,10 +44,15 @@ class BucketManagerImpl : public BucketManager
     medida::Meter& mBucketObjectInsertBatch;
     medida::Timer& mBucketAddBatch;
     medida::Timer& mBucketSnapMerge;
+    medida::Timer& mBucketFresh;
     medida::Counter& mSharedBucketsSize;
+    BucketMergeScheduler mMergeScheduler;
+    // one per level, if any is resident
+    std::vector<medida::Counter*> mResidentBytes;
 
     std::set<Hash> getReferencedBuckets() const;
     void cleanupStaleFiles();
+    void reportResidentMemory();
 
   protected:
     void calculateSkipValues(LedgerHeader& currentHeader);
@@ -60,16 +66,18 @@ class BucketManagerImpl : public BucketManager
     std::string const& getBucketDir() override;
     BucketList& getBucketList() override;
     medida::Timer& getMergeTimer() override;
-    std::shared_ptr<Bucket> adoptFileAsBucket(std::string const& filename,
-                                              uint256 const& hash,
-                                              size_t nObjects,
-                                              size_t nBytes) override;
+    medida::Timer& getFreshTimer() override;
+    BucketMergeScheduler& getMergeScheduler() override;
+    std::shared_ptr<Bucket> adoptFileAsBucket(
+        std::string const& filename, uint256 const& hash, size_t nObjects,
+        size_t nBytes, std::shared_ptr<std::vector<BucketEntry> const> entries,
+        std::unique_ptr<BucketIndex const> index) override;
     std::shared_ptr<Bucket> getBucketByHash(uint256 const& hash) override;
 
     void forgetUnreferencedBuckets() override;
     void addBatch(Application& app, uint32_t currLedger,
-                  std::vector<LedgerEntry> const& liveEntries,
-                  std::vector<LedgerKey> const& deadEntries) override;
+                  std::vector<LedgerEntry> liveEntries,
+                  std::vector<LedgerKey> deadEntries) override;
     void snapshotLedger(LedgerHeader& currentHeader) override;
 
     std::vector<std::string>
@@ -0,0 +1,411 @@
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "bucket/BucketMergePipeline.h"
+#include "bucket/Bucket.h"
+#include "bucket/BucketInputIterator.h"
+#include "bucket/BucketManager.h"
+#include "bucket/BucketOutputIterator.h"
+#include "bucket/LedgerCmp.h"
+#include "medida/timer.h"
+#include "util/XDRStream.h"
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace spn
+{
+
+namespace
+{
+
+// A queue that makes its producer wait while it holds QUEUE_DEPTH items, and
+// its consumer while it is empty.
+template <typename T> class BoundedQueue
+{
+    std::mutex mMutex;
+    std::condition_variable mChanged;
+    std::deque<T> mItems;
+    bool mClosed{false};
+    bool mCancelled{false};
+
+  public:
+    // Returns false, dropping `item`, if the queue was cancelled.
+    bool
+    push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mChanged.wait(lock, [this]() {
+            return mCancelled ||
+                   mItems.size() < BucketMergePipeline::QUEUE_DEPTH;
+        });
+        if (mCancelled)
+        {
+            return false;
+        }
+        mItems.emplace_back(std::move(item));
+        mChanged.notify_all();
+        return true;
+    }
+
+    // Returns false once the queue is closed and drained, or cancelled.
+    bool
+    pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mChanged.wait(lock, [this]() {
+            return mCancelled || mClosed || !mItems.empty();
+        });
+        if (mCancelled || mItems.empty())
+        {
+            return false;
+        }
+        item = std::move(mItems.front());
+        mItems.pop_front();
+        mChanged.notify_all();
+        return true;
+    }
+
+    // Nothing more will be pushed.
+    void
+    close()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mClosed = true;
+        mChanged.notify_all();
+    }
+
+    // Turns both sides away, after an error in some stage.
+    void
+    cancel()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCancelled = true;
+        mItems.clear();
+        mChanged.notify_all();
+    }
+};
+
+struct DecodedBatch
+{
+    std::vector<BucketEntry> mEntries;
+    // the records mEntries were decoded from, in the input file mapping
+    std::vector<ByteSlice> mRecords;
+};
+
+typedef std::shared_ptr<DecodedBatch const> DecodedBatchPtr;
+// entries to write, as positions in the batches they were decoded in
+typedef std::vector<std::pair<DecodedBatchPtr, size_t>> RecordBatch;
+
+// The queues and threads of one merge. Destroying it stops and joins the
+// threads, whatever state they are in.
+class Stages
+{
+    std::vector<std::thread> mThreads;
+    std::mutex mErrorMutex;
+    std::exception_ptr mError;
+
+  public:
+    BoundedQueue<DecodedBatchPtr> mOld;
+    BoundedQueue<DecodedBatchPtr> mNew;
+    BoundedQueue<RecordBatch> mOut;
+
+    ~Stages()
+    {
+        cancel();
+        join();
+    }
+
+    void
+    start(std::function<void()> stage)
+    {
+        mThreads.emplace_back([this, stage]() {
+            try
+            {
+                stage();
+            }
+            catch (...)
+            {
+                fail(std::current_exception());
+            }
+        });
+    }
+
+    void
+    fail(std::exception_ptr error)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mErrorMutex);
+            if (!mError)
+            {
+                mError = error;
+            }
+        }
+        cancel();
+    }
+
+    void
+    cancel()
+    {
+        mOld.cancel();
+        mNew.cancel();
+        mOut.cancel();
+    }
+
+    void
+    join()
+    {
+        for (auto& t : mThreads)
+        {
+            if (t.joinable())
+            {
+                t.join();
+            }
+        }
+    }
+
+    // Waits for every stage to be done, and rethrows the first error any of
+    // them ran into.
+    void
+    finish()
+    {
+        join();
+        if (mError)
+        {
+            std::rethrow_exception(mError);
+        }
+    }
+};
+
+void
+decode(XDRInputMappedFileStream& in, BoundedQueue<DecodedBatchPtr>& out)
+{
+    auto newBatch = []() {
+        auto batch = std::make_shared<DecodedBatch>();
+        batch->mEntries.reserve(BucketMergePipeline::BATCH_SIZE);
+        batch->mRecords.reserve(BucketMergePipeline::BATCH_SIZE);
+        return batch;
+    };
+
+    auto batch = newBatch();
+    for (;;)
+    {
+        auto record = in.readRecord();
+        if (record.empty())
+        {
+            break;
+        }
+        batch->mEntries.emplace_back();
+        xdr::xdr_get g(record.data() + 4, record.end());
+        xdr::xdr_argpack_archive(g, batch->mEntries.back());
+        g.done();
+        batch->mRecords.emplace_back(record);
+
+        if (batch->mEntries.size() == BucketMergePipeline::BATCH_SIZE)
+        {
+            if (!out.push(std::move(batch)))
+            {
+                return;
+            }
+            batch = newBatch();
+        }
+    }
+    if (!batch->mEntries.empty())
+    {
+        out.push(std::move(batch));
+    }
+    out.close();
+}
+
+// Walks the entries of the batches a decode stage produces.
+class Cursor
+{
+    BoundedQueue<DecodedBatchPtr>& mQueue;
+    DecodedBatchPtr mBatch;
+    size_t mPos{0};
+
+    void
+    nextBatch()
+    {
+        mPos = 0;
+        if (!mQueue.pop(mBatch))
+        {
+            mBatch.reset();
+        }
+    }
+
+  public:
+    explicit Cursor(BoundedQueue<DecodedBatchPtr>& queue) : mQueue(queue)
+    {
+        nextBatch();
+    }
+
+    operator bool() const
+    {
+        return mBatch != nullptr;
+    }
+
+    BucketEntry const& operator*() const
+    {
+        return mBatch->mEntries[mPos];
+    }
+
+    DecodedBatchPtr const&
+    batch() const
+    {
+        return mBatch;
+    }
+
+    size_t
+    pos() const
+    {
+        return mPos;
+    }
+
+    Cursor& operator++()
+    {
+        if (++mPos == mBatch->mEntries.size())
+        {
+            nextBatch();
+        }
+        return *this;
+    }
+};
+}
+
+std::shared_ptr<Bucket>
+BucketMergePipeline::merge(
+    BucketManager& bucketManager, std::shared_ptr<Bucket> const& oldBucket,
+    std::shared_ptr<Bucket> const& newBucket,
+    std::vector<std::shared_ptr<Bucket>> const& shadows, bool keepDeadEntries)
+{
+    assert(oldBucket);
+    assert(newBucket);
+
+    auto timer = bucketManager.getMergeTimer().TimeScope();
+
+    // Records point into the input mappings until the writer is done, so
+    // these outlive the stages.
+    XDRInputMappedFileStream oldIn, newIn;
+    if (!oldBucket->getFilename().empty())
+    {
+        oldIn.open(oldBucket->getFilename());
+    }
+    if (!newBucket->getFilename().empty())
+    {
+        newIn.open(newBucket->getFilename());
+    }
+    std::vector<BucketInputIterator> shadowIterators(shadows.begin(),
+                                                     shadows.end());
+    BucketOutputIterator out(bucketManager.getTmpDir(), keepDeadEntries,
+                             false,
+                             oldBucket->getMaxEntryCount() +
+                                 newBucket->getMaxEntryCount());
+
+    Stages stages;
+    stages.start([&]() { decode(oldIn, stages.mOld); });
+    stages.start([&]() { decode(newIn, stages.mNew); });
+    stages.start([&]() {
+        RecordBatch batch;
+        while (stages.mOut.pop(batch))
+        {
+            for (auto const& item : batch)
+            {
+                auto const& decoded = *item.first;
+                out.putRecord(decoded.mEntries[item.second],
+                              decoded.mRecords[item.second]);
+            }
+        }
+    });
+
+    // The merge stage: the loop of Bucket::merge, with the buffering that
+    // BucketOutputIterator::put does (so that of entries of equal identity
+    // the last one is written) done on entries still in their batches.
+    RecordBatch records;
+    records.reserve(BATCH_SIZE);
+    auto emit = [&](DecodedBatchPtr const& batch, size_t pos) {
+        records.emplace_back(batch, pos);
+        if (records.size() == BATCH_SIZE)
+        {
+            stages.mOut.push(std::move(records));
+            records = RecordBatch();
+            records.reserve(BATCH_SIZE);
+        }
+    };
+
+    BucketEntryIdCmp cmp;
+    DecodedBatchPtr buffered;
+    size_t bufferedPos = 0;
+    auto maybePut = [&](Cursor const& in) {
+        BucketEntry const& entry = *in;
+        if (isShadowed(entry, shadowIterators) ||
+            (!keepDeadEntries && entry.type() == DEADENTRY))
+        {
+            return;
+        }
+        if (buffered)
+        {
+            auto const& prev = buffered->mEntries[bufferedPos];
+            assert(!cmp(entry, prev));
+            if (cmp(prev, entry))
+            {
+                emit(buffered, bufferedPos);
+            }
+        }
+        buffered = in.batch();
+        bufferedPos = in.pos();
+    };
+
+    Cursor oi(stages.mOld);
+    Cursor ni(stages.mNew);
+    while (oi || ni)
+    {
+        if (!ni)
+        {
+            maybePut(oi);
+            ++oi;
+        }
+        else if (!oi)
+        {
+            maybePut(ni);
+            ++ni;
+        }
+        else if (cmp(*oi, *ni))
+        {
+            maybePut(oi);
+            ++oi;
+        }
+        else if (cmp(*ni, *oi))
+        {
+            maybePut(ni);
+            ++ni;
+        }
+        else
+        {
+            // same key, take new
+            maybePut(ni);
+            ++oi;
+            ++ni;
+        }
+    }
+    if (buffered)
+    {
+        emit(buffered, bufferedPos);
+    }
+    if (!records.empty())
+    {
+        stages.mOut.push(std::move(records));
+    }
+    stages.mOut.close();
+
+    // a stage that failed cut the queues short, so this throws before the
+    // incomplete output could be adopted
+    stages.finish();
+    return out.getBucket(bucketManager);
+}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <memory>
+#include <vector>
+
+namespace spn
+{
+
+class Bucket;
+class BucketManager;
+
+/**
+ * Bucket::merge split into stages, each on a thread of its own, connected by
+ * bounded queues of batches of entries:
+ *
+ *   decode old ---\
+ *                  +--> merge, drop shadowed --> hash and write
+ *   decode new ---/
+ *
+ * The merge stage runs on the calling thread. Entries are copied to the
+ * output as the records they were read as, as the single-threaded merge does,
+ * so no stage serializes anything; the output file, and so its hash, is
+ * byte-identical to what Bucket::merge produces from the same inputs. The
+ * write stage also builds the output's BucketIndex.
+ *
+ * Starting the threads only pays off for large inputs: Bucket::merge hands
+ * merges of at least MIN_INPUT_BYTES over to this.
+ */
+class BucketMergePipeline
+{
+  public:
+    // entries per batch, and batches a queue holds before its producer waits
+    static size_t const BATCH_SIZE = 1024;
+    static size_t const QUEUE_DEPTH = 8;
+
+    static size_t const MIN_INPUT_BYTES = size_t(64) << 20;
+
+    // As Bucket::merge. An error in any stage stops all of them, and is
+    // rethrown here.
+    static std::shared_ptr<Bucket>
+    merge(BucketManager& bucketManager,
+          std::shared_ptr<Bucket> const& oldBucket,
+          std::shared_ptr<Bucket> const& newBucket,
+          std::vector<std::shared_ptr<Bucket>> const& shadows,
+          bool keepDeadEntries);
+};
+}
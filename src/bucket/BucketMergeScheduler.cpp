@@ -0,0 +1,133 @@
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "bucket/BucketMergeScheduler.h"
+#include "main/Application.h"
+#include "util/Logging.h"
+
+#include "medida/counter.h"
+#include "medida/metrics_registry.h"
+#include "medida/timer.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace spn
+{
+
+namespace
+{
+size_t
+maxLargeMerges()
+{
+    // the application runs one worker thread per core; keep one of them for
+    // the smaller merges, which would otherwise all wait behind large ones
+    // on a two-core host
+    size_t workers = std::thread::hardware_concurrency();
+    size_t limit = BucketMergeScheduler::MAX_LARGE_MERGES;
+    return std::max<size_t>(1, std::min(limit, workers > 0 ? workers - 1 : 0));
+}
+}
+
+BucketMergeScheduler::BucketMergeScheduler(Application& app)
+    : mApp(app)
+    , mMaxLargeMerges(maxLargeMerges())
+    , mQueueSize(
+          app.getMetrics().NewCounter({"bucket", "merge-queue", "size"}))
+{
+}
+
+bool
+BucketMergeScheduler::isLarge(uint32_t level)
+{
+    return level >= LARGE_MERGE_LEVEL;
+}
+
+BucketMergeScheduler::LevelMetrics const&
+BucketMergeScheduler::getLevelMetrics(uint32_t level)
+{
+    auto it = mLevelMetrics.find(level);
+    if (it == mLevelMetrics.end())
+    {
+        auto name = "level-" + std::to_string(level);
+        auto& metrics = mApp.getMetrics();
+        LevelMetrics m{&metrics.NewTimer({"bucket", "merge-wait", name}),
+                       &metrics.NewTimer({"bucket", "merge-time", name})};
+        it = mLevelMetrics.emplace(level, m).first;
+    }
+    return it->second;
+}
+
+void
+BucketMergeScheduler::schedule(uint32_t level, uint32_t commitLedger,
+                               std::function<void()> merge)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueue.emplace(Priority{commitLedger, level, mNextArrival++},
+                       Merge{level, std::move(merge),
+                             std::chrono::steady_clock::now(),
+                             getLevelMetrics(level)});
+        mQueueSize.set_count(mQueue.size());
+    }
+    CLOG(TRACE, "Bucket") << "Queued merge into level " << level
+                          << " for ledger " << commitLedger;
+    mApp.postOnBackgroundThread([this]() { runNext(); });
+}
+
+size_t
+BucketMergeScheduler::queued() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mQueue.size();
+}
+
+void
+BucketMergeScheduler::runNext()
+{
+    Merge merge;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mQueue.begin();
+        if (mRunningLarge >= mMaxLargeMerges)
+        {
+            while (it != mQueue.end() && isLarge(it->second.mLevel))
+            {
+                ++it;
+            }
+        }
+        if (it == mQueue.end())
+        {
+            ++mIdleTasks;
+            return;
+        }
+        merge = std::move(it->second);
+        mQueue.erase(it);
+        mQueueSize.set_count(mQueue.size());
+        if (isLarge(merge.mLevel))
+        {
+            ++mRunningLarge;
+        }
+    }
+
+    merge.mMetrics.mWait->Update(std::chrono::steady_clock::now() -
+                                 merge.mQueued);
+    {
+        auto timer = merge.mMetrics.mRun->TimeScope();
+        merge.mRun();
+    }
+
+    if (isLarge(merge.mLevel))
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        --mRunningLarge;
+        // hand the slot to a large merge that had to be left queued
+        if (mIdleTasks > 0)
+        {
+            --mIdleTasks;
+            mApp.postOnBackgroundThread([this]() { runNext(); });
+        }
+    }
+}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/NonCopyable.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+namespace medida
+{
+class Counter;
+class Timer;
+}
+
+namespace spn
+{
+
+class Application;
+
+/**
+ * Runs bucket merges on the worker threads, most urgent first.
+ *
+ * Each merge is queued with the ledger whose close commits its output, and so
+ * waits for it (see BucketList::nextCommitLedger). schedule() posts one task
+ * per merge to the worker threads, but the task runs whichever queued merge
+ * is needed soonest at the time it starts, so that a level-1 merge needed at
+ * the next ledger never waits for a level-9 merge needed in a week.
+ *
+ * At most MAX_LARGE_MERGES merges into levels LARGE_MERGE_LEVEL and deeper run
+ * at a time, to bound the disk bandwidth they take, and never so many that
+ * they hold every worker thread (see getMaxLargeMerges()); a task that only
+ * finds such merges while that many run leaves them for the task that the end
+ * of a running one posts. Smaller merges never wait on them.
+ */
+class BucketMergeScheduler : NonMovableOrCopyable
+{
+  public:
+    static uint32_t const LARGE_MERGE_LEVEL = 6;
+    static size_t const MAX_LARGE_MERGES = 2;
+
+    explicit BucketMergeScheduler(Application& app);
+
+    // Queues `merge`, the merge into level `level` that the close of
+    // `commitLedger` will commit.
+    void schedule(uint32_t level, uint32_t commitLedger,
+                  std::function<void()> merge);
+
+    // Number of merges queued and not started yet.
+    size_t queued() const;
+
+    // Number of large merges run at a time: MAX_LARGE_MERGES, but leaving at
+    // least one worker thread to the other merges, unless there is only one.
+    size_t
+    getMaxLargeMerges() const
+    {
+        return mMaxLargeMerges;
+    }
+
+  private:
+    struct LevelMetrics
+    {
+        medida::Timer* mWait;
+        medida::Timer* mRun;
+    };
+
+    struct Merge
+    {
+        uint32_t mLevel;
+        std::function<void()> mRun;
+        std::chrono::steady_clock::time_point mQueued;
+        LevelMetrics mMetrics;
+    };
+
+    // commit ledger, level, then order of arrival
+    typedef std::tuple<uint32_t, uint32_t, uint64_t> Priority;
+
+    Application& mApp;
+    size_t const mMaxLargeMerges;
+    mutable std::mutex mMutex;
+    std::map<Priority, Merge> mQueue;
+    uint64_t mNextArrival{0};
+    size_t mRunningLarge{0};
+    // tasks that found nothing they could run
+    size_t mIdleTasks{0};
+
+    // the map itself is not thread-safe: entries are only created, by
+    // schedule(), on the main thread; merges only use the timers they were
+    // handed
+    std::map<uint32_t, LevelMetrics> mLevelMetrics;
+    medida::Counter& mQueueSize;
+
+    static bool isLarge(uint32_t level);
+    LevelMetrics const& getLevelMetrics(uint32_t level);
+    void runNext();
+};
+}
@@ -33,19 +33,51 @@ randomBucketName(std::string const& tmpDir)
  * hashes them while writing to either destination. Produces a Bucket when done.
  */
 BucketOutputIterator::BucketOutputIterator(std::string const& tmpDir,
-                                           bool keepDeadEntries)
+                                           bool keepDeadEntries,
+                                           bool resident,
+                                           size_t expectedEntries)
     : mFilename(randomBucketName(tmpDir))
     , mBuf(nullptr)
     , mHasher(SHA256::create())
     , mKeepDeadEntries(keepDeadEntries)
+    , mResident(resident ? std::make_shared<std::vector<BucketEntry>>()
+                         : nullptr)
+    , mIndex(expectedEntries)
 {
     CLOG(TRACE, "Bucket") << "BucketOutputIterator opening file to write: "
                           << mFilename;
     mOut.open(mFilename);
 }
 
+void
+BucketOutputIterator::writeBuffered()
+{
+    mIndex.add(*mBuf, mBytesPut);
+    if (mBufRecordData)
+    {
+        mOut.writeRecord(ByteSlice(mBufRecordData, mBufRecordSize),
+                         mHasher.get(), &mBytesPut);
+    }
+    else
+    {
+        mOut.writeOne(*mBuf, mHasher.get(), &mBytesPut);
+    }
+    if (mResident)
+    {
+        // *mBuf is overwritten or dropped next
+        mResident->emplace_back(std::move(*mBuf));
+    }
+    mObjectsPut++;
+}
+
 void
 BucketOutputIterator::put(BucketEntry const& e)
+{
+    put(e, ByteSlice(nullptr, 0));
+}
+
+void
+BucketOutputIterator::put(BucketEntry const& e, ByteSlice const& record)
 {
     if (!mKeepDeadEntries && e.type() == DEADENTRY)
     {
@@ -63,8 +95,7 @@ BucketOutputIterator::put(BucketEntry const& e)
         // merely replace (same identity), the buffered entry.
         if (mCmp(*mBuf, e))
         {
-            mOut.writeOne(*mBuf, mHasher.get(), &mBytesPut);
-            mObjectsPut++;
+            writeBuffered();
         }
     }
     else
@@ -74,6 +105,18 @@ BucketOutputIterator::put(BucketEntry const& e)
 
     // In any case, replace *mBuf with e.
     *mBuf = e;
+    mBufRecordData = record.empty() ? nullptr : record.data();
+    mBufRecordSize = record.size();
+}
+
+void
+BucketOutputIterator::putRecord(BucketEntry const& e, ByteSlice const& record)
+{
+    assert(!mBuf);
+    assert(!mResident);
+    mIndex.add(e, mBytesPut);
+    mOut.writeRecord(record, mHasher.get(), &mBytesPut);
+    mObjectsPut++;
 }
 
 std::shared_ptr<Bucket>
@@ -82,9 +125,9 @@ BucketOutputIterator::getBucket(BucketManager& bucketManager)
     assert(mOut);
     if (mBuf)
     {
-        mOut.writeOne(*mBuf, mHasher.get(), &mBytesPut);
-        mObjectsPut++;
+        writeBuffered();
         mBuf.reset();
+        mBufRecordData = nullptr;
     }
 
     mOut.close();
@@ -96,7 +139,12 @@ BucketOutputIterator::getBucket(BucketManager& bucketManager)
         std::remove(mFilename.c_str());
         return std::make_shared<Bucket>();
     }
+    if (mResident)
+    {
+        mResident->shrink_to_fit();
+    }
     return bucketManager.adoptFileAsBucket(mFilename, mHasher->finish(),
-                                           mObjectsPut, mBytesPut);
+                                           mObjectsPut, mBytesPut, mResident,
+                                           mIndex.finish(mBytesPut));
 }
 }
@@ -4,12 +4,14 @@
 // under the Apache License, Version 2.0. See the COPYING file at the root
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
+#include "bucket/BucketIndex.h"
 #include "bucket/LedgerCmp.h"
 #include "util/XDRStream.h"
 #include "xdr/Stellar-ledger.h"
 
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace spn
 {
@@ -25,16 +27,38 @@ class BucketOutputIterator
     XDROutputFileStream mOut;
     BucketEntryIdCmp mCmp;
     std::unique_ptr<BucketEntry> mBuf;
+    // Serialized form of *mBuf when it came from an input bucket that
+    // outlives this iterator, so it can be copied out verbatim.
+    uint8_t const* mBufRecordData{nullptr};
+    size_t mBufRecordSize{0};
     std::unique_ptr<SHA256> mHasher;
     size_t mBytesPut{0};
     size_t mObjectsPut{0};
     bool mKeepDeadEntries{true};
+    // What has been written, when the bucket keeps its entries resident.
+    std::shared_ptr<std::vector<BucketEntry>> mResident;
+    BucketIndex::Builder mIndex;
+
+    void writeBuffered();
 
   public:
-    BucketOutputIterator(std::string const& tmpDir, bool keepDeadEntries);
+    // If `resident`, the bucket keeps the entries written in memory as well.
+    // The bucket's index is sized for `expectedEntries` entries.
+    BucketOutputIterator(std::string const& tmpDir, bool keepDeadEntries,
+                         bool resident = false, size_t expectedEntries = 0);
 
     void put(BucketEntry const& e);
 
+    // As put(e), where record is e's serialized form as read from another
+    // bucket file (see BucketInputIterator::currentRecord). The record must
+    // stay valid until getBucket is called.
+    void put(BucketEntry const& e, ByteSlice const& record);
+
+    // Writes `record`, the serialized form of `e`, as is: the caller has
+    // already ordered, deduplicated and filtered the entries, and must not
+    // mix this with put(). Not for resident buckets.
+    void putRecord(BucketEntry const& e, ByteSlice const& record);
+
     std::shared_ptr<Bucket> getBucket(BucketManager& bucketManager);
 };
 }
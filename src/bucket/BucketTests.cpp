@@ -7,10 +7,14 @@
 // else.
 #include "util/asio.h"
 #include "bucket/Bucket.h"
+#include "bucket/BucketIndex.h"
 #include "bucket/BucketInputIterator.h"
 #include "bucket/BucketList.h"
 #include "bucket/BucketManager.h"
 #include "bucket/BucketManagerImpl.h"
+#include "bucket/BucketMergeScheduler.h"
+#include "bucket/BucketMergePipeline.h"
+#include "bucket/BucketOutputIterator.h"
 #include "bucket/LedgerCmp.h"
 #include "crypto/Hex.h"
 #include "database/Database.h"
@@ -20,6 +24,7 @@
 #include "ledger/LedgerTestUtils.h"
 #include "lib/catch.hpp"
 #include "main/Application.h"
+#include "medida/counter.h"
 #include "medida/meter.h"
 #include "medida/metrics_registry.h"
 #include "medida/timer.h"
@@ -27,12 +32,23 @@
 #include "test/test.h"
 #include "util/Fs.h"
 #include "util/Logging.h"
+#include "util/MappedFile.h"
 #include "util/Timer.h"
 #include "util/TmpDir.h"
+#include "util/XDROperators.h"
 #include "util/types.h"
 #include "xdrpp/autocheck.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
 #include <future>
+#include <map>
+#include <mutex>
+#include <thread>
 
 using namespace spn;
 
@@ -284,6 +300,81 @@ TEST_CASE("bucket list", "[bucket]")
     }
 }
 
+TEST_CASE("resident bucket list levels", "[bucket]")
+{
+    VirtualClock clock;
+    Config cfg(getTestConfig(0));
+    Config residentCfg(getTestConfig(1));
+    residentCfg.BUCKETLIST_RESIDENT_LEVELS = 3;
+    Application::pointer app = createTestApplication(clock, cfg);
+    Application::pointer residentApp =
+        createTestApplication(clock, residentCfg);
+
+    BucketList bl;
+    BucketList residentBl;
+    autocheck::generator<std::vector<LedgerKey>> deadGen;
+    for (uint32_t i = 1; i < 300; ++i)
+    {
+        clock.crank(false);
+        auto live = LedgerTestUtils::generateValidLedgerEntries(8);
+        auto dead = deadGen(5);
+        bl.addBatch(*app, i, live, dead);
+        residentBl.addBatch(*residentApp, i, live, dead);
+        REQUIRE(bl.getHash() == residentBl.getHash());
+
+        for (uint32_t j = 0; j < BucketList::kNumLevels; ++j)
+        {
+            auto const& lev = residentBl.getLevel(j);
+            for (auto const& b : {lev.getCurr(), lev.getSnap()})
+            {
+                if (b->getFilename().empty())
+                {
+                    continue;
+                }
+                REQUIRE(fs::exists(b->getFilename()));
+                // (deeper levels can get level 2's buckets as they are, so
+                // may hold resident ones too)
+                if (j < residentCfg.BUCKETLIST_RESIDENT_LEVELS)
+                {
+                    auto entries = b->getResidentEntries();
+                    REQUIRE(entries);
+                    REQUIRE(b->getResidentBytes() > 0);
+                    auto counts = b->countLiveAndDeadEntries();
+                    REQUIRE(entries->size() == counts.first + counts.second);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("adopting a resident copy makes a known bucket resident",
+          "[bucket]")
+{
+    VirtualClock clock;
+    Config const& cfg = getTestConfig();
+    Application::pointer app = createTestApplication(clock, cfg);
+    auto& bm = app->getBucketManager();
+
+    auto live = LedgerTestUtils::generateValidLedgerEntries(10);
+    auto b1 = Bucket::fresh(bm, live, {});
+    REQUIRE(!b1->getResidentEntries());
+    REQUIRE(b1->getResidentBytes() == 0);
+
+    auto b2 = Bucket::fresh(bm, live, {}, true);
+    REQUIRE(b2 == b1);
+    auto entries = b1->getResidentEntries();
+    REQUIRE(entries);
+    REQUIRE(entries->size() == live.size());
+    REQUIRE(b1->getResidentBytes() > 0);
+    for (auto const& e : live)
+    {
+        auto key = LedgerEntryKey(e);
+        auto found = b1->lookup(key, BucketIndex::keyHash(key));
+        REQUIRE(found);
+        REQUIRE(found->liveEntry() == e);
+    }
+}
+
 TEST_CASE("bucket list shadowing", "[bucket]")
 {
     VirtualClock clock;
@@ -635,6 +726,38 @@ clearFutures(Application::pointer app, BucketList& bl)
     }
 }
 
+TEST_CASE("fresh bucket matches merge of live and dead parts", "[bucket]")
+{
+    VirtualClock clock;
+    Config const& cfg = getTestConfig();
+    Application::pointer app = createTestApplication(clock, cfg);
+    auto& bm = app->getBucketManager();
+
+    autocheck::generator<LedgerKey> deadGen;
+    auto live = LedgerTestUtils::generateValidLedgerEntries(100);
+    std::vector<LedgerKey> dead(20);
+    for (auto& e : dead)
+    {
+        e = deadGen(5);
+    }
+    // some keys are both live and dead
+    for (size_t i = 0; i < live.size(); i += 10)
+    {
+        dead.emplace_back(LedgerEntryKey(live[i]));
+    }
+
+    auto& fresh = bm.getFreshTimer();
+    auto freshBefore = fresh.count();
+    auto b = Bucket::fresh(bm, live, dead);
+    REQUIRE(fresh.count() == freshBefore + 1);
+
+    std::vector<LedgerEntry> noLive;
+    std::vector<LedgerKey> noDead;
+    auto merged = Bucket::merge(bm, Bucket::fresh(bm, live, noDead),
+                                Bucket::fresh(bm, noLive, dead));
+    REQUIRE(b->getHash() == merged->getHash());
+}
+
 TEST_CASE("bucketmanager ownership", "[bucket]")
 {
     VirtualClock clock;
@@ -1029,6 +1152,148 @@ TEST_CASE("BucketList check bucket sizes", "[bucket][count]")
     }
 }
 
+TEST_CASE("BucketList merges commit at the next spill above them",
+          "[bucket][count]")
+{
+    std::default_random_engine gen;
+    std::uniform_int_distribution<uint32_t> dist(
+        1, std::numeric_limits<uint32_t>::max() / 2);
+    for (uint32_t i = 0; i < 1000; ++i)
+    {
+        uint32_t ledger = dist(gen);
+        REQUIRE(BucketList::nextCommitLedger(ledger, 0) == ledger);
+        for (uint32_t level = 1; level < BucketList::kNumLevels; ++level)
+        {
+            uint32_t next = BucketList::nextCommitLedger(ledger, level);
+            REQUIRE(next > ledger);
+            REQUIRE(next - ledger <= BucketList::levelHalf(level - 1));
+            REQUIRE(BucketList::levelShouldSpill(next, level - 1));
+            if (level < 5)
+            {
+                for (uint32_t l = ledger + 1; l < next; ++l)
+                {
+                    REQUIRE(!BucketList::levelShouldSpill(l, level - 1));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("bucket merge scheduler", "[bucket]")
+{
+    VirtualClock clock;
+    Config cfg(getTestConfig());
+    Application::pointer app = createTestApplication(clock, cfg);
+    auto& scheduler = app->getBucketManager().getMergeScheduler();
+    auto& level0Time =
+        app->getMetrics().NewTimer({"bucket", "merge-time", "level-0"});
+    auto level0Before = level0Time.count();
+
+    std::mutex mutex;
+    size_t runningLarge = 0;
+    size_t maxRunningLarge = 0;
+    std::atomic<size_t> done{0};
+    size_t const nMerges = 20;
+    for (uint32_t i = 0; i < nMerges; ++i)
+    {
+        uint32_t level = i % BucketList::kNumLevels;
+        bool large = level >= BucketMergeScheduler::LARGE_MERGE_LEVEL;
+        scheduler.schedule(level, 100 - i, [&, large]() {
+            if (large)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                maxRunningLarge = std::max(maxRunningLarge, ++runningLarge);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            if (large)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --runningLarge;
+            }
+            ++done;
+        });
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (done < nMerges && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    REQUIRE(done == nMerges);
+    REQUIRE(scheduler.queued() == 0);
+    REQUIRE(maxRunningLarge <= scheduler.getMaxLargeMerges());
+    REQUIRE(scheduler.getMaxLargeMerges() <=
+            BucketMergeScheduler::MAX_LARGE_MERGES);
+    REQUIRE(app->getMetrics()
+                .NewCounter({"bucket", "merge-queue", "size"})
+                .count() == 0);
+    REQUIRE(level0Time.count() >= level0Before + 2);
+}
+
+TEST_CASE("bucket merge scheduler runs most urgent merges first", "[bucket]")
+{
+    VirtualClock clock;
+    Config cfg(getTestConfig());
+    Application::pointer app = createTestApplication(clock, cfg);
+    auto& scheduler = app->getBucketManager().getMergeScheduler();
+
+    auto waitUntil = [](std::function<bool()> done) {
+        auto deadline =
+            std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        while (!done() && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return done();
+    };
+
+    // hold every worker thread with a merge that waits for its gate, so that
+    // everything below is queued before any of it runs
+    size_t const workers = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::promise<void>> gates(workers);
+    std::atomic<size_t> held{0};
+    for (auto& gate : gates)
+    {
+        auto open = gate.get_future().share();
+        scheduler.schedule(0, 0, [&held, open]() {
+            ++held;
+            open.wait();
+        });
+    }
+    REQUIRE(waitUntil([&]() { return held == workers; }));
+
+    std::mutex mutex;
+    std::vector<std::pair<uint32_t, uint32_t>> order;
+    std::vector<std::pair<uint32_t, uint32_t>> expected;
+    size_t const nMerges = 20;
+    for (uint32_t i = 0; i < nMerges; ++i)
+    {
+        uint32_t level = (i * 3) % BucketList::kNumLevels;
+        uint32_t commitLedger = 100 + (i * 7) % 5;
+        expected.emplace_back(commitLedger, level);
+        scheduler.schedule(level, commitLedger, [&, level, commitLedger]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.emplace_back(commitLedger, level);
+        });
+    }
+    std::sort(expected.begin(), expected.end());
+    REQUIRE(scheduler.queued() == nMerges);
+
+    // free a single worker, which then runs the queued merges one at a time
+    gates[0].set_value();
+    bool ran = waitUntil([&]() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return order.size() == nMerges;
+    });
+    for (size_t i = 1; i < workers; ++i)
+    {
+        gates[i].set_value();
+    }
+    REQUIRE(ran);
+    REQUIRE(order == expected);
+    REQUIRE(scheduler.queued() == 0);
+}
+
 TEST_CASE("bucket apply", "[bucket]")
 {
     VirtualClock clock;
@@ -1071,6 +1336,69 @@ TEST_CASE("bucket apply", "[bucket]")
     }
 }
 
+TEST_CASE("bucket apply replaces entries blindly", "[bucket]")
+{
+    VirtualClock clock;
+    Config cfg(getTestConfig());
+    Application::pointer app = createTestApplication(clock, cfg);
+    app->start();
+
+    // More entries than fit in one batch, of every type
+    std::vector<LedgerEntry> live(5000), noLive;
+    std::vector<LedgerKey> dead, noDead;
+    for (size_t i = 0; i < live.size(); ++i)
+    {
+        live[i] = LedgerTestUtils::generateValidLedgerEntry(5);
+        live[i].lastModifiedLedgerSeq = 1;
+        if (live[i].data.type() == OFFER)
+        {
+            live[i].data.offer().offerID = i + 1;
+        }
+    }
+    std::sort(live.begin(), live.end(), [](auto const& lhs, auto const& rhs) {
+        return LedgerEntryIdCmp{}(lhs.data, rhs.data);
+    });
+    live.erase(std::unique(live.begin(), live.end(),
+                           [](auto const& lhs, auto const& rhs) {
+                               return LedgerEntryKey(lhs) ==
+                                      LedgerEntryKey(rhs);
+                           }),
+               live.end());
+
+    auto countAll = [&]() {
+        auto& root = app->getLedgerStateRoot();
+        return root.countObjects(ACCOUNT) + root.countObjects(DATA) +
+               root.countObjects(OFFER) + root.countObjects(TRUSTLINE);
+    };
+    auto initialCount = countAll();
+
+    Bucket::fresh(app->getBucketManager(), live, noDead)->apply(*app);
+    REQUIRE(countAll() == initialCount + live.size());
+
+    // Applying newer versions of the same entries replaces them
+    for (auto& e : live)
+    {
+        e.lastModifiedLedgerSeq = 2;
+        dead.emplace_back(LedgerEntryKey(e));
+    }
+    Bucket::fresh(app->getBucketManager(), live, noDead)->apply(*app);
+    REQUIRE(countAll() == initialCount + live.size());
+    for (size_t i = 0; i < live.size(); i += 97)
+    {
+        auto stored =
+            app->getLedgerStateRoot().getNewestVersion(LedgerEntryKey(live[i]));
+        REQUIRE(stored);
+        REQUIRE(*stored == live[i]);
+    }
+
+    // Dead entries are deleted, and ignored when already gone
+    auto death = Bucket::fresh(app->getBucketManager(), noLive, dead);
+    death->apply(*app);
+    REQUIRE(countAll() == initialCount);
+    death->apply(*app);
+    REQUIRE(countAll() == initialCount);
+}
+
 TEST_CASE("bucket apply bench", "[bucketbench][!hide]")
 {
     auto runtest = [](Config::TestDbMode mode) {
@@ -1110,3 +1438,495 @@ TEST_CASE("bucket apply bench", "[bucketbench][!hide]")
     }
 #endif
 }
+
+TEST_CASE("mapped bucket reader matches stream reader", "[bucket]")
+{
+    VirtualClock clock;
+    Config const& cfg = getTestConfig();
+    Application::pointer app = createTestApplication(clock, cfg);
+    auto& bm = app->getBucketManager();
+
+    autocheck::generator<LedgerKey> deadGen;
+    std::vector<LedgerEntry> live(1000);
+    std::vector<LedgerKey> dead(100);
+    for (auto& e : live)
+        e = LedgerTestUtils::generateValidLedgerEntry(3);
+    for (auto& e : dead)
+        e = deadGen(3);
+    auto b1 = Bucket::fresh(bm, live, dead);
+
+    for (auto& e : live)
+        e = LedgerTestUtils::generateValidLedgerEntry(3);
+    for (auto& e : dead)
+        e = deadGen(3);
+    auto b2 = Bucket::merge(bm, b1, Bucket::fresh(bm, live, dead));
+
+    for (auto const& b : {b1, b2})
+    {
+        XDRInputFileStream in;
+        in.open(b->getFilename());
+        BucketInputIterator iter(b);
+        BucketEntry e;
+        size_t n = 0;
+        while (in.readOne(e))
+        {
+            REQUIRE(iter);
+            REQUIRE(*iter == e);
+            auto record = iter.currentRecord();
+            auto bytes = xdr::xdr_to_opaque(e);
+            REQUIRE(record.size() == bytes.size() + 4);
+            REQUIRE(std::equal(bytes.begin(), bytes.end(), record.data() + 4));
+            ++iter;
+            ++n;
+        }
+        REQUIRE(!iter);
+        REQUIRE(n > 0);
+
+        // Merged output copies records verbatim, so the file must still hash
+        // to the bucket's hash.
+        auto hasher = SHA256::create();
+        MappedFile mapped(b->getFilename());
+        hasher->add(mapped.bytes());
+        REQUIRE(hasher->finish() == b->getHash());
+    }
+}
+
+TEST_CASE("mapped reader rejects records without the last fragment bit",
+          "[bucket]")
+{
+    VirtualClock clock;
+    Config const& cfg = getTestConfig();
+    Application::pointer app = createTestApplication(clock, cfg);
+    TmpDir dir(app->getTmpDirManager().tmpDir("xdr-record-mark"));
+
+    auto writeRecord = [&](std::string const& name, char mark) {
+        auto filename = dir.getName() + "/" + name;
+        std::ofstream out(filename, std::ios::binary);
+        char const record[] = {mark, 0, 0, 4, 1, 2, 3, 4};
+        out.write(record, sizeof(record));
+        return filename;
+    };
+
+    XDRInputMappedFileStream in;
+    in.open(writeRecord("last.xdr", '\x80'));
+    REQUIRE(in.readRecord().size() == 8);
+    REQUIRE(in.readRecord().empty());
+
+    in.open(writeRecord("fragment.xdr", 0));
+    REQUIRE_THROWS_AS(in.readRecord(), xdr::xdr_runtime_error);
+}
+
+TEST_CASE("bucket read bench", "[bucketbench][!hide]")
+{
+    VirtualClock clock;
+    Config const& cfg = getTestConfig();
+    Application::pointer app = createTestApplication(clock, cfg);
+
+    // Entry order does not matter to the readers, so build a multi-GB file by
+    // writing the same batch of random entries repeatedly.
+    size_t const targetBytes = size_t(2) << 30;
+    std::vector<BucketEntry> batch(10000);
+    for (auto& e : batch)
+    {
+        e.type(LIVEENTRY);
+        e.liveEntry() = LedgerTestUtils::generateValidLedgerEntry(5);
+    }
+
+    TmpDir dir(app->getTmpDirManager().tmpDir("bucket-read-bench"));
+    std::string filename = dir.getName() + "/bench.xdr";
+    size_t fileBytes = 0;
+    {
+        XDROutputFileStream out;
+        out.open(filename);
+        while (fileBytes < targetBytes)
+        {
+            for (auto const& e : batch)
+            {
+                out.writeOne(e, nullptr, &fileBytes);
+            }
+        }
+    }
+    CLOG(INFO, "Bucket") << "Bench file size: " << fileBytes << " bytes";
+
+    auto report = [&](std::string const& name, size_t n,
+                      std::chrono::steady_clock::time_point start) {
+        std::chrono::duration<double> secs =
+            std::chrono::steady_clock::now() - start;
+        CLOG(INFO, "Bucket")
+            << name << ": read " << n << " entries in " << secs.count()
+            << "s, " << (fileBytes / (1024.0 * 1024.0)) / secs.count()
+            << " MB/s";
+    };
+
+    size_t streamCount = 0;
+    {
+        auto start = std::chrono::steady_clock::now();
+        XDRInputFileStream in;
+        in.open(filename);
+        BucketEntry e;
+        while (in.readOne(e))
+        {
+            ++streamCount;
+        }
+        report("ifstream", streamCount, start);
+    }
+
+    size_t mappedCount = 0;
+    {
+        auto start = std::chrono::steady_clock::now();
+        XDRInputMappedFileStream in;
+        in.open(filename);
+        BucketEntry e;
+        while (in.readOne(e))
+        {
+            ++mappedCount;
+        }
+        report("mmap", mappedCount, start);
+    }
+    REQUIRE(streamCount == mappedCount);
+
+    {
+        auto start = std::chrono::steady_clock::now();
+        XDRInputMappedFileStream in;
+        in.open(filename);
+        size_t n = 0;
+        while (!in.readRecord().empty())
+        {
+            ++n;
+        }
+        report("mmap records only", n, start);
+        REQUIRE(n == mappedCount);
+    }
+}
+
+TEST_CASE("pipelined merge matches single-threaded merge", "[bucket]")
+{
+    VirtualClock clock;
+    Config const& cfg = getTestConfig();
+    Application::pointer app = createTestApplication(clock, cfg);
+    auto& bm = app->getBucketManager();
+
+    // more entries than fit in a batch, with some keys in several buckets
+    autocheck::generator<LedgerKey> deadGen;
+    auto makeBucket = [&](std::vector<LedgerEntry> const& common) {
+        auto live = LedgerTestUtils::generateValidLedgerEntries(3000);
+        live.insert(live.end(), common.begin(), common.end());
+        std::vector<LedgerKey> dead(300);
+        for (auto& e : dead)
+        {
+            e = deadGen(5);
+        }
+        return Bucket::fresh(bm, live, dead);
+    };
+    auto common = LedgerTestUtils::generateValidLedgerEntries(500);
+    auto oldBucket = makeBucket(common);
+    for (auto& e : common)
+    {
+        e.lastModifiedLedgerSeq++;
+    }
+    auto newBucket = makeBucket(common);
+    auto shadow = makeBucket(
+        {common.begin(), common.begin() + common.size() / 2});
+    auto empty = std::make_shared<Bucket>();
+
+    auto check = [&](std::shared_ptr<Bucket> const& o,
+                     std::shared_ptr<Bucket> const& n,
+                     std::vector<std::shared_ptr<Bucket>> const& shadows,
+                     bool keepDeadEntries) {
+        auto serial =
+            Bucket::mergeSingleThreaded(bm, o, n, shadows, keepDeadEntries);
+        auto pipelined =
+            BucketMergePipeline::merge(bm, o, n, shadows, keepDeadEntries);
+        REQUIRE(pipelined->getHash() == serial->getHash());
+        REQUIRE(pipelined->countLiveAndDeadEntries() ==
+                serial->countLiveAndDeadEntries());
+    };
+
+    SECTION("plain")
+    {
+        check(oldBucket, newBucket, {}, true);
+    }
+    SECTION("with shadows")
+    {
+        check(oldBucket, newBucket, {shadow}, true);
+    }
+    SECTION("dropping dead entries")
+    {
+        check(oldBucket, newBucket, {shadow}, false);
+    }
+    SECTION("with empty inputs")
+    {
+        check(empty, newBucket, {}, true);
+        check(oldBucket, empty, {}, true);
+        check(empty, empty, {}, true);
+    }
+}
+
+TEST_CASE("bucket merge bench", "[bucketbench][!hide]")
+{
+    VirtualClock clock;
+    Config const& cfg = getTestConfig();
+    Application::pointer app = createTestApplication(clock, cfg);
+    auto& bm = app->getBucketManager();
+
+    // entries per input bucket; BUCKET_MERGE_BENCH_ENTRIES overrides
+    size_t nEntries = 1000000;
+    if (char const* n = std::getenv("BUCKET_MERGE_BENCH_ENTRIES"))
+    {
+        nEntries = std::strtoull(n, nullptr, 10);
+    }
+
+    // Accounts are keyed by the first bytes of their IDs, so that they can
+    // be written out in order as they are generated. The new bucket has the
+    // even keys up to 2 * nEntries: half of its entries replace old ones.
+    auto makeBucket = [&](size_t step) {
+        BucketOutputIterator out(bm.getTmpDir(), true);
+        BucketEntry e;
+        e.type(LIVEENTRY);
+        e.liveEntry().data.type(ACCOUNT);
+        for (size_t i = 0; i < nEntries; ++i)
+        {
+            auto& account = e.liveEntry().data.account();
+            account = LedgerTestUtils::generateValidAccountEntry(5);
+            auto& id = account.accountID.ed25519();
+            uint64_t key = i * step;
+            for (size_t b = 0; b < sizeof(key); ++b)
+            {
+                id[b] = static_cast<uint8_t>(key >> (8 * (7 - b)));
+            }
+            out.put(e);
+        }
+        return out.getBucket(bm);
+    };
+    auto oldBucket = makeBucket(1);
+    auto newBucket = makeBucket(2);
+    CLOG(INFO, "Bucket") << "Merging buckets of " << nEntries << " entries";
+
+    auto report = [&](std::string const& name,
+                      std::chrono::steady_clock::time_point start) {
+        std::chrono::duration<double> secs =
+            std::chrono::steady_clock::now() - start;
+        CLOG(INFO, "Bucket") << name << ": " << secs.count() << "s";
+    };
+
+    std::shared_ptr<Bucket> serial, pipelined;
+    {
+        auto start = std::chrono::steady_clock::now();
+        serial =
+            Bucket::mergeSingleThreaded(bm, oldBucket, newBucket, {}, true);
+        report("single-threaded", start);
+    }
+    {
+        auto start = std::chrono::steady_clock::now();
+        pipelined =
+            BucketMergePipeline::merge(bm, oldBucket, newBucket, {}, true);
+        report("pipelined", start);
+    }
+    REQUIRE(serial->getHash() == pipelined->getHash());
+}
+
+TEST_CASE("bucket list lookup finds newest entries", "[bucket][bucketindex]")
+{
+    VirtualClock clock;
+    Config cfg(getTestConfig());
+    SECTION("on disk")
+    {
+    }
+    SECTION("resident")
+    {
+        cfg.BUCKETLIST_RESIDENT_LEVELS = 3;
+    }
+    Application::pointer app = createTestApplication(clock, cfg);
+
+    BucketList bl;
+    // what the newest entry for each key should be
+    std::map<LedgerKey, BucketEntry> expected;
+    std::default_random_engine gen;
+    for (uint32_t i = 1; i < 200; ++i)
+    {
+        clock.crank(false);
+        auto live = LedgerTestUtils::generateValidLedgerEntries(8);
+        std::vector<LedgerKey> dead;
+        if (!expected.empty())
+        {
+            std::uniform_int_distribution<size_t> dist(0, expected.size() - 1);
+            for (size_t j = 0; j < 3; ++j)
+            {
+                auto it = expected.begin();
+                std::advance(it, dist(gen));
+                dead.emplace_back(it->first);
+            }
+        }
+        for (auto const& e : live)
+        {
+            auto& be = expected[LedgerEntryKey(e)];
+            be.type(LIVEENTRY);
+            be.liveEntry() = e;
+        }
+        for (auto const& k : dead)
+        {
+            auto& be = expected[k];
+            be.type(DEADENTRY);
+            be.deadEntry() = k;
+        }
+        bl.addBatch(*app, i, live, dead);
+    }
+
+    for (auto const& kv : expected)
+    {
+        auto found = bl.lookup(kv.first);
+        REQUIRE(found);
+        REQUIRE(*found == kv.second);
+    }
+    for (auto const& e : LedgerTestUtils::generateValidLedgerEntries(100))
+    {
+        auto key = LedgerEntryKey(e);
+        if (expected.find(key) == expected.end())
+        {
+            REQUIRE(!bl.lookup(key));
+        }
+    }
+}
+
+TEST_CASE("bucket index is reloaded or rebuilt", "[bucket][bucketindex]")
+{
+    VirtualClock clock;
+    Config const& cfg = getTestConfig();
+    Application::pointer app = createTestApplication(clock, cfg);
+    auto& bm = app->getBucketManager();
+
+    // large enough for its index to be saved
+    std::vector<LedgerEntry> live;
+    size_t bytes = 0;
+    while (bytes < BucketIndex::MIN_SAVED_FILE_SIZE)
+    {
+        for (auto const& e : LedgerTestUtils::generateValidLedgerEntries(1000))
+        {
+            bytes += xdr::xdr_size(e);
+            live.emplace_back(e);
+        }
+    }
+    auto b = Bucket::fresh(bm, live, {});
+    auto indexFile = BucketIndex::filename(b->getFilename());
+    REQUIRE(fs::exists(indexFile));
+
+    auto checkLookups = [&](Bucket const& bucket) {
+        for (auto const& e : live)
+        {
+            auto key = LedgerEntryKey(e);
+            auto found = bucket.lookup(key, BucketIndex::keyHash(key));
+            REQUIRE(found);
+            REQUIRE(found->type() == LIVEENTRY);
+            REQUIRE(LedgerEntryKey(found->liveEntry()) == key);
+        }
+    };
+
+    checkLookups(*b);
+    REQUIRE(b->getMaxEntryCount() == live.size());
+    SECTION("reloaded")
+    {
+        Bucket reloaded(b->getFilename(), b->getHash());
+        checkLookups(reloaded);
+        // without a count, it is bounded by the file size
+        REQUIRE(reloaded.getMaxEntryCount() >= live.size());
+    }
+    SECTION("rebuilt")
+    {
+        std::remove(indexFile.c_str());
+        Bucket rebuilt(b->getFilename(), b->getHash());
+        checkLookups(rebuilt);
+        // lookups do not write index files
+        REQUIRE(!fs::exists(indexFile));
+    }
+    SECTION("stale index ignored")
+    {
+        auto other = Bucket::fresh(
+            bm, LedgerTestUtils::generateValidLedgerEntries(10), {});
+        BucketIndex::build(other->getFilename())->save(b->getFilename());
+        Bucket rebuilt(b->getFilename(), b->getHash());
+        checkLookups(rebuilt);
+    }
+    SECTION("small bucket index not saved")
+    {
+        auto smallLive = LedgerTestUtils::generateValidLedgerEntries(10);
+        auto small = Bucket::fresh(bm, smallLive, {});
+        auto smallIndexFile = BucketIndex::filename(small->getFilename());
+        REQUIRE(!fs::exists(smallIndexFile));
+        for (auto const& e : smallLive)
+        {
+            auto key = LedgerEntryKey(e);
+            REQUIRE(small->lookup(key, BucketIndex::keyHash(key)));
+        }
+        REQUIRE(!fs::exists(smallIndexFile));
+    }
+}
+
+TEST_CASE("bucket lookup bench", "[bucketbench][!hide]")
+{
+    VirtualClock clock;
+    Config const& cfg = getTestConfig();
+    Application::pointer app = createTestApplication(clock, cfg);
+
+    // ledgers of 100 entries added to the bucket list;
+    // BUCKET_LOOKUP_BENCH_LEDGERS overrides
+    uint32_t nLedgers = 2000;
+    if (char const* n = std::getenv("BUCKET_LOOKUP_BENCH_LEDGERS"))
+    {
+        nLedgers = static_cast<uint32_t>(std::strtoul(n, nullptr, 10));
+    }
+
+    BucketList bl;
+    std::vector<LedgerKey> keys;
+    for (uint32_t i = 1; i <= nLedgers; ++i)
+    {
+        clock.crank(false);
+        auto live = LedgerTestUtils::generateValidLedgerEntries(100);
+        for (auto const& e : live)
+        {
+            keys.emplace_back(LedgerEntryKey(e));
+        }
+        bl.addBatch(*app, i, live, {});
+    }
+    // let the pending merges finish, so that they do not compete with the
+    // lookups
+    for (uint32_t i = 0; i < BucketList::kNumLevels; ++i)
+    {
+        auto& next = bl.getLevel(i).getNext();
+        if (next.isMerging())
+        {
+            next.resolve();
+        }
+    }
+
+    std::vector<LedgerKey> missing;
+    for (auto const& e : LedgerTestUtils::generateValidLedgerEntries(10000))
+    {
+        missing.emplace_back(LedgerEntryKey(e));
+    }
+    std::shuffle(keys.begin(), keys.end(), std::default_random_engine());
+    keys.resize(std::min<size_t>(keys.size(), 10000));
+
+    auto bench = [&](std::string const& name,
+                     std::vector<LedgerKey> const& lookups) {
+        size_t hits = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (auto const& k : lookups)
+        {
+            hits += bl.lookup(k) ? 1 : 0;
+        }
+        std::chrono::duration<double, std::micro> usecs =
+            std::chrono::steady_clock::now() - start;
+        CLOG(INFO, "Bucket") << name << ": " << lookups.size()
+                             << " lookups, " << hits << " hits, "
+                             << usecs.count() / lookups.size()
+                             << "us per lookup";
+        return hits;
+    };
+
+    CLOG(INFO, "Bucket") << "Looking up keys in a bucket list of "
+                         << nLedgers << " ledgers";
+    // the first lookup in each bucket maps its file
+    bench("present keys (cold)", keys);
+    REQUIRE(bench("present keys", keys) == keys.size());
+    bench("missing keys", missing);
+}
@@ -8,6 +8,7 @@
 #include "util/asio.h"
 
 #include "bucket/Bucket.h"
+#include "bucket/BucketList.h"
 #include "bucket/BucketManager.h"
 #include "bucket/FutureBucket.h"
 #include "crypto/Hex.h"
@@ -24,7 +25,8 @@ FutureBucket::FutureBucket(Application& app,
                            std::shared_ptr<Bucket> const& curr,
                            std::shared_ptr<Bucket> const& snap,
                            std::vector<std::shared_ptr<Bucket>> const& shadows,
-                           bool keepDeadEntries)
+                           bool keepDeadEntries, uint32_t level,
+                           uint32_t commitLedger)
     : mState(FB_LIVE_INPUTS)
     , mInputCurrBucket(curr)
     , mInputSnapBucket(snap)
@@ -41,7 +43,7 @@ FutureBucket::FutureBucket(Application& app,
     {
         mInputShadowBucketHashes.push_back(binToHex(b->getHash()));
     }
-    startMerge(app, keepDeadEntries);
+    startMerge(app, keepDeadEntries, level, commitLedger);
 }
 
 void
@@ -251,7 +253,8 @@ FutureBucket::getOutputHash() const
 }
 
 void
-FutureBucket::startMerge(Application& app, bool keepDeadEntries)
+FutureBucket::startMerge(Application& app, bool keepDeadEntries,
+                         uint32_t level, uint32_t commitLedger)
 {
     // NB: startMerge starts with FutureBucket in a half-valid state; the inputs
     // are live but the merge is not yet running. So you can't call checkState()
@@ -272,15 +275,17 @@ FutureBucket::startMerge(Application& app, bool keepDeadEntries)
                           << " with snap=" << hexAbbrev(snap->getHash());
 
     BucketManager& bm = app.getBucketManager();
+    bool resident = BucketList::keepResident(app, level);
 
     using task_t = std::packaged_task<std::shared_ptr<Bucket>()>;
-    std::shared_ptr<task_t> task =
-        std::make_shared<task_t>([curr, snap, &bm, shadows, keepDeadEntries]() {
+    std::shared_ptr<task_t> task = std::make_shared<task_t>(
+        [curr, snap, &bm, shadows, keepDeadEntries, resident]() {
             CLOG(TRACE, "Bucket")
                 << "Worker merging curr=" << hexAbbrev(curr->getHash())
                 << " with snap=" << hexAbbrev(snap->getHash());
 
-            auto res = Bucket::merge(bm, curr, snap, shadows, keepDeadEntries);
+            auto res = Bucket::merge(bm, curr, snap, shadows, keepDeadEntries,
+                                     resident);
 
             CLOG(TRACE, "Bucket")
                 << "Worker finished merging curr=" << hexAbbrev(curr->getHash())
@@ -290,12 +295,14 @@ FutureBucket::startMerge(Application& app, bool keepDeadEntries)
         });
 
     mOutputBucket = task->get_future().share();
-    app.postOnBackgroundThread(bind(&task_t::operator(), task));
+    bm.getMergeScheduler().schedule(level, commitLedger,
+                                    [task]() { (*task)(); });
     checkState();
 }
 
 void
-FutureBucket::makeLive(Application& app, bool keepDeadEntries)
+FutureBucket::makeLive(Application& app, bool keepDeadEntries,
+                       uint32_t level, uint32_t commitLedger)
 {
     checkState();
     assert(!isLive());
@@ -321,7 +328,7 @@ FutureBucket::makeLive(Application& app, bool keepDeadEntries)
             mInputShadowBuckets.push_back(b);
         }
         mState = FB_LIVE_INPUTS;
-        startMerge(app, keepDeadEntries);
+        startMerge(app, keepDeadEntries, level, commitLedger);
         assert(isLive());
     }
 }
@@ -73,17 +73,20 @@ class FutureBucket
 
     void checkHashesMatch() const;
     void checkState() const;
-    void startMerge(Application& app, bool keepDeadEntries);
+    void startMerge(Application& app, bool keepDeadEntries, uint32_t level,
+                    uint32_t commitLedger);
 
     void clearInputs();
     void clearOutput();
     void setLiveOutput(std::shared_ptr<Bucket> b);
 
   public:
+    // Starts merging into BucketList level `level`, for the close of
+    // `commitLedger` to commit.
     FutureBucket(Application& app, std::shared_ptr<Bucket> const& curr,
                  std::shared_ptr<Bucket> const& snap,
                  std::vector<std::shared_ptr<Bucket>> const& shadows,
-                 bool keepDeadEntries);
+                 bool keepDeadEntries, uint32_t level, uint32_t commitLedger);
 
     FutureBucket() = default;
     FutureBucket(FutureBucket const& other) = default;
@@ -115,7 +118,9 @@ class FutureBucket
     std::shared_ptr<Bucket> resolve();
 
     // Precondition: !isLive(); transitions from FB_HASH_FOO to FB_LIVE_FOO
-    void makeLive(Application& app, bool keepDeadEntries);
+    // (restarting the merge, if any, as the constructor starts it)
+    void makeLive(Application& app, bool keepDeadEntries, uint32_t level,
+                  uint32_t commitLedger);
 
     // Return all hashes referenced by this future.
     std::vector<std::string> getHashes() const;
@@ -51,6 +51,13 @@ ApplyBucketsWork::getBucketLevel(uint32_t level)
     return mApp.getBucketManager().getBucketList().getLevel(level);
 }
 
+medida::Meter&
+ApplyBucketsWork::getLevelEntriesMeter(uint32_t level)
+{
+    return mApp.getMetrics().NewMeter(
+        {"history", "bucket-apply", "level-" + std::to_string(level)}, "entry");
+}
+
 std::shared_ptr<Bucket const>
 ApplyBucketsWork::getBucket(std::string const& hash)
 {
@@ -121,20 +128,22 @@ ApplyBucketsWork::onRun()
     //    database when the invariants for snap are checked.
     // 2. There is no reason to advance mSnapApplicator or mCurrApplicator
     //    if there is nothing to be applied.
+    size_t applied = 0;
     if (mSnapApplicator)
     {
         if (*mSnapApplicator)
         {
-            mSnapApplicator->advance();
+            applied = mSnapApplicator->advance();
         }
     }
     else if (mCurrApplicator)
     {
         if (*mCurrApplicator)
         {
-            mCurrApplicator->advance();
+            applied = mCurrApplicator->advance();
         }
     }
+    getLevelEntriesMeter(mLevel).Mark(applied);
     scheduleSuccess();
 }
 
@@ -39,6 +39,7 @@ class ApplyBucketsWork : public Work
 
     std::shared_ptr<Bucket const> getBucket(std::string const& bucketHash);
     BucketLevel& getBucketLevel(uint32_t level);
+    medida::Meter& getLevelEntriesMeter(uint32_t level);
 
   public:
     ApplyBucketsWork(
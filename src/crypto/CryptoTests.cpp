@@ -156,6 +156,39 @@ TEST_CASE("sign tests", "[crypto]")
     CHECK(!PubKeyUtils::verifySig(pk, sig, msg));
 }
 
+TEST_CASE("batch signature verification", "[crypto]")
+{
+    PubKeyUtils::clearVerifySigCache();
+    uint64_t hits = 0, misses = 0;
+    PubKeyUtils::flushVerifySigCacheCounts(hits, misses);
+
+    auto sk = SecretKey::random();
+    auto pk = sk.getPublicKey();
+    std::string msg = "hello";
+    std::string other = "helloo";
+    auto sig = sk.sign(msg);
+    auto badSig = sig;
+    badSig[4] ^= 1;
+    Signature shortSig(sig.begin(), sig.begin() + 10);
+
+    std::vector<PubKeyUtils::VerifySigRequest> requests{
+        {pk, sig, msg},   {pk, sig, other},     {pk, badSig, msg},
+        {pk, sig, msg},   {pk, shortSig, msg}};
+    auto expected = std::vector<bool>{true, false, false, true, false};
+
+    CHECK(PubKeyUtils::verifySigBatch(requests) == expected);
+    PubKeyUtils::flushVerifySigCacheCounts(hits, misses);
+    CHECK(hits == 0);
+    CHECK(misses == 4);
+
+    // everything is cached now, including for single verification
+    CHECK(PubKeyUtils::verifySigBatch(requests) == expected);
+    CHECK(PubKeyUtils::verifySig(pk, sig, msg));
+    PubKeyUtils::flushVerifySigCacheCounts(hits, misses);
+    CHECK(hits == 5);
+    CHECK(misses == 0);
+}
+
 struct SignVerifyTestcase
 {
     SecretKey key;
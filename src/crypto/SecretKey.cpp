@@ -11,8 +11,11 @@
 #include "transactions/SignatureUtils.h"
 #include "util/HashOfHash.h"
 #include "util/lrucache.hpp"
+#include <array>
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
 #include <sodium.h>
 #include <type_traits>
 
@@ -29,24 +32,78 @@ namespace spn
 // to the state of the process; caching its results centrally
 // makes all signature-verification in the program faster and
 // has no effect on correctness.
+//
+// Signatures are verified from the main thread and from worker threads, so
+// the cache is split into shards, each behind its own mutex, picked by the
+// first byte of the cache key (a sha256, so evenly spread). Hit and miss
+// counts are plain atomics.
+
+namespace
+{
+size_t const VERIFY_SIG_CACHE_SHARDS = 16;
+
+size_t const VERIFY_SIG_CACHE_SHARD_SIZE =
+    Config::DEFAULT_VERIFY_SIG_CACHE_SIZE / VERIFY_SIG_CACHE_SHARDS;
+
+struct VerifySigCacheShard
+{
+    std::mutex mMutex;
+    size_t mMaxSize{VERIFY_SIG_CACHE_SHARD_SIZE};
+    cache::lru_cache<Hash, bool> mCache{VERIFY_SIG_CACHE_SHARD_SIZE};
+};
+
+std::array<VerifySigCacheShard, VERIFY_SIG_CACHE_SHARDS> gVerifySigCache;
+std::atomic<uint64_t> gVerifyCacheHit{0};
+std::atomic<uint64_t> gVerifyCacheMiss{0};
 
-static std::mutex gVerifySigCacheMutex;
-static cache::lru_cache<Hash, bool> gVerifySigCache(0xffff);
-static std::unique_ptr<SHA256> gHasher = SHA256::create();
-static uint64_t gVerifyCacheHit = 0;
-static uint64_t gVerifyCacheMiss = 0;
+VerifySigCacheShard&
+verifySigCacheShard(Hash const& cacheKey)
+{
+    return gVerifySigCache[cacheKey[0] % VERIFY_SIG_CACHE_SHARDS];
+}
 
-static Hash
+Hash
 verifySigCacheKey(PublicKey const& key, Signature const& signature,
                   ByteSlice const& bin)
 {
     assert(key.type() == PUBLIC_KEY_TYPE_ED25519);
 
-    gHasher->reset();
-    gHasher->add(key.ed25519());
-    gHasher->add(signature);
-    gHasher->add(bin);
-    return gHasher->finish();
+    static thread_local std::unique_ptr<SHA256> hasher = SHA256::create();
+    hasher->reset();
+    hasher->add(key.ed25519());
+    hasher->add(signature);
+    hasher->add(bin);
+    return hasher->finish();
+}
+
+bool
+verifySigCacheLookup(Hash const& cacheKey, bool& ok)
+{
+    auto& shard = verifySigCacheShard(cacheKey);
+    std::lock_guard<std::mutex> guard(shard.mMutex);
+    if (shard.mCache.exists(cacheKey))
+    {
+        ok = shard.mCache.get(cacheKey);
+        return true;
+    }
+    return false;
+}
+
+void
+verifySigCacheStore(Hash const& cacheKey, bool ok)
+{
+    auto& shard = verifySigCacheShard(cacheKey);
+    std::lock_guard<std::mutex> guard(shard.mMutex);
+    shard.mCache.put(cacheKey, ok);
+}
+
+bool
+verifySigUncached(PublicKey const& key, Signature const& signature,
+                  ByteSlice const& bin)
+{
+    return crypto_sign_verify_detached(signature.data(), bin.data(),
+                                       bin.size(), key.ed25519().data()) == 0;
+}
 }
 
 SecretKey::SecretKey() : mKeyType(PUBLIC_KEY_TYPE_ED25519)
@@ -193,18 +250,34 @@ SecretKey::fromStrKeySeed(std::string const& strKeySeed)
 void
 PubKeyUtils::clearVerifySigCache()
 {
-    std::lock_guard<std::mutex> guard(gVerifySigCacheMutex);
-    gVerifySigCache.clear();
+    for (auto& shard : gVerifySigCache)
+    {
+        std::lock_guard<std::mutex> guard(shard.mMutex);
+        shard.mCache.clear();
+    }
+}
+
+void
+PubKeyUtils::setVerifySigCacheSize(size_t size)
+{
+    size_t perShard =
+        (size + VERIFY_SIG_CACHE_SHARDS - 1) / VERIFY_SIG_CACHE_SHARDS;
+    for (auto& shard : gVerifySigCache)
+    {
+        std::lock_guard<std::mutex> guard(shard.mMutex);
+        if (shard.mMaxSize != perShard)
+        {
+            shard.mMaxSize = perShard;
+            shard.mCache = cache::lru_cache<Hash, bool>(perShard);
+        }
+    }
 }
 
 void
 PubKeyUtils::flushVerifySigCacheCounts(uint64_t& hits, uint64_t& misses)
 {
-    std::lock_guard<std::mutex> guard(gVerifySigCacheMutex);
-    hits = gVerifyCacheHit;
-    misses = gVerifyCacheMiss;
-    gVerifyCacheHit = 0;
-    gVerifyCacheMiss = 0;
+    hits = gVerifyCacheHit.exchange(0);
+    misses = gVerifyCacheMiss.exchange(0);
 }
 
 std::string
@@ -285,23 +358,65 @@ PubKeyUtils::verifySig(PublicKey const& key, Signature const& signature,
     }
 
     auto cacheKey = verifySigCacheKey(key, signature, bin);
+    bool ok;
+    if (verifySigCacheLookup(cacheKey, ok))
+    {
+        ++gVerifyCacheHit;
+        return ok;
+    }
 
+    ++gVerifyCacheMiss;
+    ok = verifySigUncached(key, signature, bin);
+    verifySigCacheStore(cacheKey, ok);
+    return ok;
+}
+
+std::vector<bool>
+PubKeyUtils::verifySigBatch(std::vector<VerifySigRequest> const& requests)
+{
+    std::vector<bool> results(requests.size(), false);
+    std::vector<std::pair<size_t, Hash>> misses;
+    uint64_t hits = 0;
+
+    // First pass: answer everything the cache knows, without verifying.
+    for (size_t i = 0; i < requests.size(); ++i)
     {
-        std::lock_guard<std::mutex> guard(gVerifySigCacheMutex);
-        if (gVerifySigCache.exists(cacheKey))
+        auto const& r = requests[i];
+        assert(r.mKey.type() == PUBLIC_KEY_TYPE_ED25519);
+        if (r.mSignature.size() != 64)
+        {
+            continue;
+        }
+        auto cacheKey = verifySigCacheKey(r.mKey, r.mSignature, r.mBin);
+        bool ok;
+        if (verifySigCacheLookup(cacheKey, ok))
+        {
+            results[i] = ok;
+            ++hits;
+        }
+        else
         {
-            ++gVerifyCacheHit;
-            return gVerifySigCache.get(cacheKey);
+            misses.emplace_back(i, cacheKey);
         }
     }
+    gVerifyCacheHit += hits;
+    gVerifyCacheMiss += misses.size();
 
-    ++gVerifyCacheMiss;
-    bool ok =
-        (crypto_sign_verify_detached(signature.data(), bin.data(), bin.size(),
-                                     key.ed25519().data()) == 0);
-    std::lock_guard<std::mutex> guard(gVerifySigCacheMutex);
-    gVerifySigCache.put(cacheKey, ok);
-    return ok;
+    // Second pass: verify the misses, skipping repeats within the batch.
+    std::unordered_map<Hash, bool> verified;
+    for (auto const& m : misses)
+    {
+        auto it = verified.find(m.second);
+        if (it == verified.end())
+        {
+            auto const& r = requests[m.first];
+            bool ok = verifySigUncached(r.mKey, r.mSignature, r.mBin);
+            it = verified.emplace(m.second, ok).first;
+            verifySigCacheStore(m.second, ok);
+        }
+        results[m.first] = it->second;
+    }
+    return results;
 }
 
 PublicKey
@@ -4,6 +4,7 @@
 // under the Apache License, Version 2.0. See the COPYING file at the root
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
+#include "crypto/ByteSlice.h"
 #include "crypto/KeyUtils.h"
 #include "util/XDROperators.h"
 #include "xdr/Stellar-types.h"
@@ -11,11 +12,11 @@
 #include <array>
 #include <functional>
 #include <ostream>
+#include <vector>
 
 namespace spn
 {
 
-class ByteSlice;
 struct SecretValue;
 struct SignerKey;
 
@@ -101,7 +102,21 @@ namespace PubKeyUtils
 bool verifySig(PublicKey const& key, Signature const& signature,
                ByteSlice const& bin);
 
+struct VerifySigRequest
+{
+    PublicKey const& mKey;
+    Signature const& mSignature;
+    ByteSlice mBin;
+};
+
+// As verifySig, for each request in turn; cache lookups for the whole batch
+// are done first, then only the misses are verified.
+std::vector<bool> verifySigBatch(std::vector<VerifySigRequest> const& requests);
+
 void clearVerifySigCache();
+// Sets the total number of results the (process-wide) cache keeps; clears it
+// if the size changes.
+void setVerifySigCacheSize(size_t size);
 void flushVerifySigCacheCounts(uint64_t& hits, uint64_t& misses);
 
 PublicKey random();
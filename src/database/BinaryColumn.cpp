@@ -0,0 +1,125 @@
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "database/BinaryColumn.h"
+#include <sodium.h>
+#include <stdexcept>
+
+namespace spn
+{
+
+bool
+isBinaryColumnNative(soci::session& sess)
+{
+    return sess.get_backend_name() == "sqlite3";
+}
+
+BinaryUse::BinaryUse(soci::session& sess) : mSqlite(isBinaryColumnNative(sess))
+{
+    if (mSqlite)
+    {
+        mBlob = std::make_unique<soci::blob>(sess);
+    }
+}
+
+void
+BinaryUse::set(ByteSlice const& bytes)
+{
+    if (mSqlite)
+    {
+        mBlob->trim(0);
+        if (!bytes.empty())
+        {
+            mBlob->write(0, reinterpret_cast<char const*>(bytes.data()),
+                         bytes.size());
+        }
+        return;
+    }
+
+    mHex.resize(2 + bytes.size() * 2 + 1);
+    mHex[0] = '\\';
+    mHex[1] = 'x';
+    sodium_bin2hex(&mHex[2], mHex.size() - 2, bytes.data(), bytes.size());
+    // drop the terminator written by sodium_bin2hex
+    mHex.pop_back();
+}
+
+soci::details::use_type_ptr
+BinaryUse::use()
+{
+    if (mSqlite)
+    {
+        return soci::use(*mBlob);
+    }
+    return soci::use(mHex);
+}
+
+soci::details::use_type_ptr
+BinaryUse::use(soci::indicator& ind)
+{
+    if (mSqlite)
+    {
+        return soci::use(*mBlob, ind);
+    }
+    return soci::use(mHex, ind);
+}
+
+BinaryInto::BinaryInto(soci::session& sess)
+    : mSqlite(isBinaryColumnNative(sess))
+{
+    if (mSqlite)
+    {
+        mBlob = std::make_unique<soci::blob>(sess);
+    }
+}
+
+soci::details::into_type_ptr
+BinaryInto::into()
+{
+    if (mSqlite)
+    {
+        return soci::into(*mBlob);
+    }
+    return soci::into(mHex);
+}
+
+soci::details::into_type_ptr
+BinaryInto::into(soci::indicator& ind)
+{
+    if (mSqlite)
+    {
+        return soci::into(*mBlob, ind);
+    }
+    return soci::into(mHex, ind);
+}
+
+ByteSlice
+BinaryInto::bytes()
+{
+    if (mSqlite)
+    {
+        mBytes.resize(mBlob->get_len());
+        if (!mBytes.empty())
+        {
+            mBlob->read(0, reinterpret_cast<char*>(mBytes.data()),
+                        mBytes.size());
+        }
+        return mBytes;
+    }
+
+    if (mHex.size() < 2 || mHex[0] != '\\' || mHex[1] != 'x')
+    {
+        throw std::runtime_error("unexpected BYTEA encoding");
+    }
+    size_t binLen = 0;
+    mBytes.resize((mHex.size() - 2) / 2);
+    if (sodium_hex2bin(mBytes.data(), mBytes.size(), mHex.data() + 2,
+                       mHex.size() - 2, nullptr, &binLen, nullptr) != 0 ||
+        binLen != mBytes.size())
+    {
+        throw std::runtime_error("could not decode BYTEA value");
+    }
+    return mBytes;
+}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "crypto/ByteSlice.h"
+#include "util/NonCopyable.h"
+#include <memory>
+#include <soci.h>
+#include <vector>
+#include <xdrpp/marshal.h>
+
+namespace spn
+{
+
+/**
+ * Raw XDR is stored in BLOB columns on SQLite and BYTEA columns on PostgreSQL.
+ *
+ * SQLite values travel through soci::blob, which soci binds with
+ * sqlite3_bind_blob and reads back from sqlite3_column_blob. soci's PostgreSQL
+ * backend only speaks the text protocol, where BYTEA is carried as "\x"
+ * followed by hex; it is converted from/into the caller's bytes directly, with
+ * no intermediate base64 string.
+ */
+bool isBinaryColumnNative(soci::session& sess);
+
+// Input parameter holding the bytes of a single binary column value.
+class BinaryUse : NonCopyable
+{
+    bool const mSqlite;
+    std::unique_ptr<soci::blob> mBlob;
+    std::string mHex;
+
+  public:
+    explicit BinaryUse(soci::session& sess);
+
+    void set(ByteSlice const& bytes);
+
+    soci::details::use_type_ptr use();
+    soci::details::use_type_ptr use(soci::indicator& ind);
+};
+
+// Output target for a binary column; the fetched bytes are kept in a buffer
+// that is reused from one row to the next.
+class BinaryInto : NonCopyable
+{
+    bool const mSqlite;
+    std::unique_ptr<soci::blob> mBlob;
+    std::string mHex;
+    std::vector<uint8_t> mBytes;
+
+  public:
+    explicit BinaryInto(soci::session& sess);
+
+    soci::details::into_type_ptr into();
+    soci::details::into_type_ptr into(soci::indicator& ind);
+
+    // Bytes of the value fetched for the current row; valid until the next
+    // fetch.
+    ByteSlice bytes();
+
+    template <typename T>
+    void
+    unpack(T& out)
+    {
+        auto b = bytes();
+        xdr::xdr_get g(b.data(), b.data() + b.size());
+        xdr_argpack_archive(g, out);
+        g.done();
+    }
+};
+}
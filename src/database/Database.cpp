@@ -5,6 +5,7 @@
 #include "database/Database.h"
 #include "crypto/Hex.h"
 #include "database/DatabaseConnectionString.h"
+#include "database/DatabaseUtils.h"
 #include "main/Application.h"
 #include "main/Config.h"
 #include "overlay/StellarXDR.h"
@@ -51,7 +52,7 @@ using namespace std;
 
 bool Database::gDriversRegistered = false;
 
-static unsigned long const SCHEMA_VERSION = 7;
+static unsigned long const SCHEMA_VERSION = 9;
 
 static void
 setSerializable(soci::session& sess)
@@ -154,6 +155,22 @@ Database::applySchemaUpgrade(unsigned long vers)
                     "CHECK (sellingliabilities >= 0)";
         break;
 
+    case 8:
+        mSession << "ALTER TABLE accounts ADD signers "
+                 << (isSqlite() ? "BLOB" : "BYTEA");
+        mApp.getLedgerStateRoot().writeSignersTableIntoAccountsTable();
+        mSession << "DROP TABLE IF EXISTS signers";
+        break;
+
+    case 9:
+        DatabaseUtils::convertBase64ColumnsToBinary(
+            *this, "txhistory", {"txbody", "txresult", "txmeta"});
+        DatabaseUtils::convertBase64ColumnsToBinary(*this, "txfeehistory",
+                                                    {"txchanges"});
+        DatabaseUtils::convertBase64ColumnsToBinary(*this, "scphistory",
+                                                    {"envelope"});
+        break;
+
     default:
         throw std::runtime_error("Unknown DB schema version");
         break;
@@ -255,6 +272,16 @@ Database::getUpdateTimer(std::string const& entityName)
         .TimeScope();
 }
 
+medida::TimerContext
+Database::getUpsertTimer(std::string const& entityName)
+{
+    mEntityTypes.insert(entityName);
+    mQueryMeter.Mark();
+    return mApp.getMetrics()
+        .NewTimer({"database", "upsert", entityName})
+        .TimeScope();
+}
+
 void
 Database::setCurrentTransactionReadOnly()
 {
@@ -426,7 +453,8 @@ Database::getQueryMeter()
 std::chrono::nanoseconds
 Database::totalQueryTime() const
 {
-    std::vector<std::string> qtypes = {"insert", "delete", "select", "update"};
+    std::vector<std::string> qtypes = {"insert", "delete", "select", "update",
+                                       "upsert"};
     std::chrono::nanoseconds nsq(0);
     for (auto const& q : qtypes)
     {
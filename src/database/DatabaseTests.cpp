@@ -4,7 +4,9 @@
 
 #include "util/asio.h"
 #include "crypto/Hex.h"
+#include "database/BinaryColumn.h"
 #include "database/Database.h"
+#include "database/DatabaseUtils.h"
 #include "lib/catch.hpp"
 #include "main/Application.h"
 #include "main/Config.h"
@@ -12,6 +14,7 @@
 #include "test/test.h"
 #include "util/Logging.h"
 #include "util/Timer.h"
+#include "util/Decoder.h"
 #include "util/TmpDir.h"
 #include <random>
 
@@ -337,3 +340,126 @@ TEST_CASE("schema test", "[db]")
     auto av = db.getAppSchemaVersion();
     REQUIRE(dbv == av);
 }
+
+TEST_CASE("binary columns", "[db]")
+{
+    Config const& cfg = getTestConfig(0, Config::TESTDB_IN_MEMORY_SQLITE);
+
+    VirtualClock clock;
+    Application::pointer app = createTestApplication(clock, cfg);
+
+    auto& db = app->getDatabase();
+    auto& session = db.getSession();
+
+    // payloads with embedded zero bytes, as XDR usually has
+    std::vector<std::vector<uint8_t>> payloads = {
+        {0, 0, 0, 1}, {1, 2, 0, 0, 0, 3, 255}, std::vector<uint8_t>(4096, 0)};
+
+    session << "DROP TABLE IF EXISTS test";
+    session << "CREATE TABLE test (id INT, payload TEXT)";
+
+    SECTION("round trip")
+    {
+        BinaryUse use(session);
+        for (int i = 0; i < static_cast<int>(payloads.size()); ++i)
+        {
+            use.set(payloads[i]);
+            session << "INSERT INTO test (id, payload) VALUES (:i, :p)",
+                soci::use(i), use.use();
+        }
+    }
+
+    SECTION("base64 upgrade")
+    {
+        for (int i = 0; i < static_cast<int>(payloads.size()); ++i)
+        {
+            std::string b64 = decoder::encode_b64(payloads[i]);
+            session << "INSERT INTO test (id, payload) VALUES (:i, :p)",
+                soci::use(i), soci::use(b64);
+        }
+        DatabaseUtils::convertBase64ColumnsToBinary(db, "test", {"payload"});
+    }
+
+    int id;
+    BinaryInto into(session);
+    soci::statement st = (session.prepare << "SELECT id, payload FROM test "
+                                             "ORDER BY id",
+                          soci::into(id), into.into());
+    st.execute(true);
+    size_t n = 0;
+    while (st.got_data())
+    {
+        auto bytes = into.bytes();
+        REQUIRE(std::vector<uint8_t>(bytes.begin(), bytes.end()) ==
+                payloads.at(id));
+        ++n;
+        st.fetch();
+    }
+    REQUIRE(n == payloads.size());
+}
+
+TEST_CASE("postgres array literals", "[db]")
+{
+    using DatabaseUtils::toPGArray;
+
+    std::vector<std::string> strings = {"plain", "",      "a,b",
+                                        "{x}",   "NULL",  "say \"hi\"",
+                                        "c:\\d", "\\\"", " padded "};
+    std::string const quoted = "{\"plain\",\"\",\"a,b\",\"{x}\",\"NULL\","
+                               "\"say \\\"hi\\\"\",\"c:\\\\d\",\"\\\\\\\"\","
+                               "\" padded \"}";
+
+    SECTION("strings are quoted and escaped")
+    {
+        REQUIRE(toPGArray(std::vector<std::string>{}) == "{}");
+        REQUIRE(toPGArray(strings) == quoted);
+    }
+
+    SECTION("null elements")
+    {
+        std::vector<soci::indicator> inds = {soci::i_ok, soci::i_null,
+                                             soci::i_ok};
+        REQUIRE(toPGArray(std::vector<std::string>{"a", "b", "c"}, inds) ==
+                "{\"a\",NULL,\"c\"}");
+        REQUIRE(toPGArray(std::vector<int64_t>{1, -2, 3}, inds) ==
+                "{1,NULL,3}");
+        REQUIRE(toPGArray(std::vector<int32_t>{}) == "{}");
+    }
+
+#ifdef USE_POSTGRES
+    SECTION("postgres parses them back")
+    {
+        Config const& cfg = getTestConfig(0, Config::TESTDB_POSTGRESQL);
+        VirtualClock clock;
+        Application::pointer app = createTestApplication(clock, cfg);
+        auto& session = app->getDatabase().getSession();
+
+        auto values = strings;
+        values.emplace_back("dropped");
+        std::vector<soci::indicator> inds(values.size(), soci::i_ok);
+        inds.back() = soci::i_null;
+        std::string literal = toPGArray(values, inds);
+
+        std::string value;
+        soci::indicator ind;
+        soci::statement st =
+            (session.prepare << "SELECT v FROM unnest(:a::TEXT[]) "
+                                "WITH ORDINALITY AS t(v, n) ORDER BY n",
+             soci::use(literal), soci::into(value, ind));
+        st.execute(true);
+        size_t n = 0;
+        while (st.got_data())
+        {
+            REQUIRE(n < values.size());
+            REQUIRE(ind == inds[n]);
+            if (ind == soci::i_ok)
+            {
+                REQUIRE(value == values[n]);
+            }
+            ++n;
+            st.fetch();
+        }
+        REQUIRE(n == values.size());
+    }
+#endif
+}
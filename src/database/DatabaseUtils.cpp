@@ -3,6 +3,8 @@
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
 #include "DatabaseUtils.h"
+#include "database/BinaryColumn.h"
+#include "util/Decoder.h"
 
 namespace spn
 {
@@ -30,5 +32,93 @@ deleteOldEntriesHelper(soci::session& sess, uint32_t ledgerSeq, uint32_t count,
              << " <= " << m;
     }
 }
+
+void
+convertBase64ColumnsToBinary(Database& db, std::string const& tableName,
+                             std::vector<std::string> const& columns)
+{
+    auto& sess = db.getSession();
+    if (!db.isSqlite())
+    {
+        for (auto const& c : columns)
+        {
+            sess << "ALTER TABLE " << tableName << " ALTER COLUMN " << c
+                 << " TYPE BYTEA USING decode(" << c << ", 'base64')";
+        }
+        return;
+    }
+
+    // SQLite can neither change the type of a column nor decode base64, so the
+    // values are rewritten here in rowid order. TEXT affinity stores BLOB
+    // values as they are, so the declared column type can stay.
+    size_t const batchSize = 1000;
+    BinaryUse value(sess);
+    for (auto const& c : columns)
+    {
+        long long lastRowID = 0;
+        for (;;)
+        {
+            std::vector<long long> rowIDs(batchSize);
+            std::vector<std::string> values(batchSize);
+            sess << "SELECT rowid, " << c << " FROM " << tableName
+                 << " WHERE rowid > :last ORDER BY rowid LIMIT " << batchSize,
+                soci::into(rowIDs), soci::into(values), soci::use(lastRowID);
+            if (rowIDs.empty())
+            {
+                break;
+            }
+
+            std::vector<uint8_t> bytes;
+            for (size_t i = 0; i < rowIDs.size(); ++i)
+            {
+                decoder::decode_b64(values[i], bytes);
+                value.set(bytes);
+                sess << "UPDATE " << tableName << " SET " << c
+                     << " = :v WHERE rowid = :id",
+                    value.use(), soci::use(rowIDs[i]);
+            }
+            lastRowID = rowIDs.back();
+        }
+    }
+}
+
+std::string
+toPGArray(std::vector<std::string> const& values,
+          std::vector<soci::indicator> const& indicators)
+{
+    std::string res = "{";
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        if (i != 0)
+        {
+            res += ",";
+        }
+        if (i < indicators.size() && indicators[i] == soci::i_null)
+        {
+            res += "NULL";
+            continue;
+        }
+        // Quote every element so that empty strings and strings containing
+        // delimiters survive, escaping the characters special inside quotes
+        res += "\"";
+        for (char c : values[i])
+        {
+            if (c == '"' || c == '\\')
+            {
+                res += '\\';
+            }
+            res += c;
+        }
+        res += "\"";
+    }
+    res += "}";
+    return res;
+}
+
+std::string
+toPGArray(std::vector<std::string> const& values)
+{
+    return toPGArray(values, {});
+}
+}
 }
-}
\ No newline at end of file
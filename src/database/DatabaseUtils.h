@@ -13,5 +13,49 @@ namespace DatabaseUtils
 void deleteOldEntriesHelper(soci::session& sess, uint32_t ledgerSeq,
                             uint32_t count, std::string const& tableName,
                             std::string const& ledgerSeqColumn);
+
+// Schema upgrade helper: turn TEXT columns holding base64-encoded XDR into raw
+// binary (BYTEA on PostgreSQL, BLOB values on SQLite).
+void convertBase64ColumnsToBinary(Database& db, std::string const& tableName,
+                                  std::vector<std::string> const& columns);
+
+// Render a column of values as a PostgreSQL array literal, suitable for binding
+// as a single parameter and expanding with unnest() in a bulk statement. Null
+// entries are rendered as NULL when a matching indicator vector is provided.
+std::string toPGArray(std::vector<std::string> const& values,
+                      std::vector<soci::indicator> const& indicators);
+std::string toPGArray(std::vector<std::string> const& values);
+
+template <typename T>
+std::string
+toPGArray(std::vector<T> const& values,
+          std::vector<soci::indicator> const& indicators)
+{
+    std::string res = "{";
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        if (i != 0)
+        {
+            res += ",";
+        }
+        if (i < indicators.size() && indicators[i] == soci::i_null)
+        {
+            res += "NULL";
+        }
+        else
+        {
+            res += std::to_string(values[i]);
+        }
+    }
+    res += "}";
+    return res;
+}
+
+template <typename T>
+std::string
+toPGArray(std::vector<T> const& values)
+{
+    return toPGArray(values, {});
+}
 }
 }
@@ -55,20 +55,11 @@ HerderImpl::SCPMetrics::SCPMetrics(Application& app)
           app.getMetrics().NewMeter({"scp", "envelope", "receive"}, "envelope"))
     , mCumulativeStatements(app.getMetrics().NewCounter(
           {"scp", "memory", "cumulative-statements"}))
-
-    , mHerderPendingTxs0(
-          app.getMetrics().NewCounter({"herder", "pending-txs", "age0"}))
-    , mHerderPendingTxs1(
-          app.getMetrics().NewCounter({"herder", "pending-txs", "age1"}))
-    , mHerderPendingTxs2(
-          app.getMetrics().NewCounter({"herder", "pending-txs", "age2"}))
-    , mHerderPendingTxs3(
-          app.getMetrics().NewCounter({"herder", "pending-txs", "age3"}))
 {
 }
 
 HerderImpl::HerderImpl(Application& app)
-    : mPendingTransactions(4)
+    : mPendingTransactions(app)
     , mPendingEnvelopes(app, *this)
     , mHerderSCPDriver(app, *this, mUpgrades, mPendingEnvelopes)
     , mLastSlotSaved(0)
@@ -128,34 +119,6 @@ HerderImpl::bootstrap()
     ledgerClosed();
 }
 
-static uint64_t
-countTxs(HerderImpl::AccountTxMap const& acc)
-{
-    uint64_t sz = 0;
-    for (auto const& a : acc)
-    {
-        sz += a.second->mTransactions.size();
-    }
-    return sz;
-}
-
-static std::shared_ptr<HerderImpl::TxMap>
-findOrAdd(HerderImpl::AccountTxMap& acc, AccountID const& aid)
-{
-    std::shared_ptr<HerderImpl::TxMap> txmap = nullptr;
-    auto i = acc.find(aid);
-    if (i == acc.end())
-    {
-        txmap = std::make_shared<HerderImpl::TxMap>();
-        acc.insert(std::make_pair(aid, txmap));
-    }
-    else
-    {
-        txmap = i->second;
-    }
-    return txmap;
-}
-
 void
 HerderImpl::valueExternalized(uint64 slotIndex, StellarValue const& value)
 {
@@ -283,31 +246,6 @@ HerderImpl::emitEnvelope(SCPEnvelope const& envelope)
     startRebroadcastTimer();
 }
 
-void
-HerderImpl::TxMap::addTx(TransactionFramePtr tx)
-{
-    auto const& h = tx->getFullHash();
-    if (mTransactions.find(h) != mTransactions.end())
-    {
-        return;
-    }
-    mTransactions.insert(std::make_pair(h, tx));
-    mMaxSeq = std::max(tx->getSeqNum(), mMaxSeq);
-    mTotalFees += tx->getFee();
-}
-
-void
-HerderImpl::TxMap::recalculate()
-{
-    mMaxSeq = 0;
-    mTotalFees = 0;
-    for (auto const& pair : mTransactions)
-    {
-        mMaxSeq = std::max(pair.second->getSeqNum(), mMaxSeq);
-        mTotalFees += pair.second->getFee();
-    }
-}
-
 Herder::TransactionSubmitStatus
 HerderImpl::recvTransaction(TransactionFramePtr tx)
 {
@@ -316,23 +254,17 @@ HerderImpl::recvTransaction(TransactionFramePtr tx)
 
     // determine if we have seen this tx before and if not if it has the right
     // seq num
+    if (mPendingTransactions.contains(txID))
+    {
+        return TX_STATUS_DUPLICATE;
+    }
+
     int64_t totFee = tx->getFee();
     SequenceNumber highSeq = 0;
-
-    for (auto& map : mPendingTransactions)
+    if (auto pending = mPendingTransactions.getAccount(acc))
     {
-        auto i = map.find(acc);
-        if (i != map.end())
-        {
-            auto& txmap = i->second;
-            auto j = txmap->mTransactions.find(txID);
-            if (j != txmap->mTransactions.end())
-            {
-                return TX_STATUS_DUPLICATE;
-            }
-            totFee += txmap->mTotalFees;
-            highSeq = std::max(highSeq, txmap->mMaxSeq);
-        }
+        totFee += pending->mTotalFees;
+        highSeq = pending->getMaxSeq();
     }
 
     {
@@ -354,8 +286,7 @@ HerderImpl::recvTransaction(TransactionFramePtr tx)
         CLOG(TRACE, "Herder") << "recv transaction " << hexAbbrev(txID)
                               << " for " << KeyUtils::toShortString(acc);
 
-    auto txmap = findOrAdd(mPendingTransactions[0], acc);
-    txmap->addTx(tx);
+    mPendingTransactions.add(tx);
 
     return TX_STATUS_PENDING;
 }
@@ -588,44 +519,7 @@ HerderImpl::ledgerClosed()
 void
 HerderImpl::removeReceivedTxs(std::vector<TransactionFramePtr> const& dropTxs)
 {
-    for (auto& m : mPendingTransactions)
-    {
-        if (m.empty())
-        {
-            continue;
-        }
-
-        std::set<std::shared_ptr<TxMap>> toRecalculate;
-
-        for (auto const& tx : dropTxs)
-        {
-            auto const& acc = tx->getSourceID();
-            auto const& txID = tx->getFullHash();
-            auto i = m.find(acc);
-            if (i != m.end())
-            {
-                auto& txs = i->second->mTransactions;
-                auto j = txs.find(txID);
-                if (j != txs.end())
-                {
-                    txs.erase(j);
-                    if (txs.empty())
-                    {
-                        m.erase(i);
-                    }
-                    else
-                    {
-                        toRecalculate.insert(i->second);
-                    }
-                }
-            }
-        }
-
-        for (auto txm : toRecalculate)
-        {
-            txm->recalculate();
-        }
-    }
+    mPendingTransactions.remove(dropTxs);
 }
 
 bool
@@ -683,17 +577,8 @@ HerderImpl::getCurrentLedgerSeq() const
 SequenceNumber
 HerderImpl::getMaxSeqInPendingTxs(AccountID const& acc)
 {
-    SequenceNumber highSeq = 0;
-    for (auto const& m : mPendingTransactions)
-    {
-        auto i = m.find(acc);
-        if (i == m.end())
-        {
-            continue;
-        }
-        highSeq = std::max(i->second->mMaxSeq, highSeq);
-    }
-    return highSeq;
+    auto pending = mPendingTransactions.getAccount(acc);
+    return pending ? pending->getMaxSeq() : 0;
 }
 
 // called to take a position during the next round
@@ -708,26 +593,45 @@ HerderImpl::triggerNextLedger(uint32_t ledgerSeqToTrigger)
         return;
     }
 
-    // our first choice for this round's set is all the tx we have collected
-    // during last ledger close
+    // our first choice for this round's set is the tx we have collected,
+    // best paying accounts first, until there are enough valid ones to fill
+    // a ledger. Validity only depends on the account's own transactions, so
+    // each batch of accounts is trimmed on its own.
     auto const& lcl = mLedgerManager.getLastClosedLedgerHeader();
     auto proposedSet = std::make_shared<TxSetFrame>(lcl.hash);
+    size_t const maxTxs = lcl.header.maxTxSetSize;
 
-    for (auto const& m : mPendingTransactions)
-    {
-        for (auto const& pair : m)
+    std::vector<TransactionFramePtr> removed;
+    TxSetFrame batch(lcl.hash);
+    auto addBatch = [&]() {
+        if (batch.size() == 0)
         {
-            for (auto const& tx : pair.second->mTransactions)
+            return;
+        }
+        batch.trimInvalid(mApp, removed);
+        for (auto const& tx : batch.mTransactions)
+        {
+            proposedSet->add(tx);
+        }
+        batch.mTransactions.clear();
+    };
+    mPendingTransactions.forEachAccountByFeeRate(
+        [&](std::vector<TransactionQueue::Entry> const& txs) {
+            for (auto const& e : txs)
             {
-                proposedSet->add(tx.second);
+                batch.add(e.mTx);
             }
-        }
-    }
-
-    std::vector<TransactionFramePtr> removed;
-    proposedSet->trimInvalid(mApp, removed);
+            if (proposedSet->size() + batch.size() < maxTxs)
+            {
+                return true;
+            }
+            addBatch();
+            return proposedSet->size() < maxTxs;
+        });
+    addBatch();
     removeReceivedTxs(removed);
 
+    proposedSet->sortForHash();
     proposedSet->surgePricingFilter(mApp);
 
     if (!proposedSet->checkValid(mApp))
@@ -1052,38 +956,21 @@ HerderImpl::updatePendingTransactions(
     // remove all these tx from mPendingTransactions
     removeReceivedTxs(applied);
 
-    // drop the highest level
-    mPendingTransactions.erase(--mPendingTransactions.end());
-
-    // shift entries up
-    mPendingTransactions.emplace_front();
+    // age entries, dropping the oldest
+    mPendingTransactions.shift();
 
     // rebroadcast entries, sorted in apply-order to maximize chances of
     // propagation
     {
         Hash h;
         TxSetFrame toBroadcast(h);
-        for (auto const& l : mPendingTransactions)
-        {
-            for (auto const& pair : l)
-            {
-                for (auto const& tx : pair.second->mTransactions)
-                {
-                    toBroadcast.add(tx.second);
-                }
-            }
-        }
+        toBroadcast.mTransactions = mPendingTransactions.getTransactions();
         for (auto tx : toBroadcast.sortForApply())
         {
             auto msg = tx->toStellarMessage();
             mApp.getOverlayManager().broadcastMessage(msg);
         }
     }
-
-    mSCPMetrics.mHerderPendingTxs0.set_count(countTxs(mPendingTransactions[0]));
-    mSCPMetrics.mHerderPendingTxs1.set_count(countTxs(mPendingTransactions[1]));
-    mSCPMetrics.mHerderPendingTxs2.set_count(countTxs(mPendingTransactions[2]));
-    mSCPMetrics.mHerderPendingTxs3.set_count(countTxs(mPendingTransactions[3]));
 }
 
 void
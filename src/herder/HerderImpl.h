@@ -7,6 +7,7 @@
 #include "PendingEnvelopes.h"
 #include "herder/Herder.h"
 #include "herder/HerderSCPDriver.h"
+#include "herder/TransactionQueue.h"
 #include "herder/Upgrades.h"
 #include "util/Timer.h"
 #include "util/XDROperators.h"
@@ -90,16 +91,6 @@ class HerderImpl : public Herder
     Json::Value getJsonQuorumInfo(NodeID const& id, bool summary,
                                   uint64 index) override;
 
-    struct TxMap
-    {
-        SequenceNumber mMaxSeq{0};
-        int64_t mTotalFees{0};
-        std::unordered_map<Hash, TransactionFramePtr> mTransactions;
-        void addTx(TransactionFramePtr);
-        void recalculate();
-    };
-    typedef std::unordered_map<AccountID, std::shared_ptr<TxMap>> AccountTxMap;
-
   private:
     void ledgerClosed();
     void removeReceivedTxs(std::vector<TransactionFramePtr> const& txs);
@@ -110,11 +101,9 @@ class HerderImpl : public Herder
 
     void processSCPQueueUpToIndex(uint64 slotIndex);
 
-    // 0- tx we got during ledger close
-    // 1- one ledger ago. rebroadcast
-    // 2- two ledgers ago. rebroadcast
-    // ...
-    std::deque<AccountTxMap> mPendingTransactions;
+    // transactions waiting to get into a ledger; those received during the
+    // last ledger close are age 0, older ones are rebroadcast
+    TransactionQueue mPendingTransactions;
 
     void
     updatePendingTransactions(std::vector<TransactionFramePtr> const& applied);
@@ -164,12 +153,6 @@ class HerderImpl : public Herder
         // SCP maps: Slots and Nodes
         medida::Counter& mCumulativeStatements;
 
-        // Pending tx buffer sizes
-        medida::Counter& mHerderPendingTxs0;
-        medida::Counter& mHerderPendingTxs1;
-        medida::Counter& mHerderPendingTxs2;
-        medida::Counter& mHerderPendingTxs3;
-
         SCPMetrics(Application& app);
     };
 
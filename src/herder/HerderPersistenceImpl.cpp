@@ -4,6 +4,7 @@
 
 #include "herder/HerderPersistenceImpl.h"
 #include "crypto/Hex.h"
+#include "database/BinaryColumn.h"
 #include "database/Database.h"
 #include "database/DatabaseUtils.h"
 #include "herder/Herder.h"
@@ -46,6 +47,8 @@ HerderPersistenceImpl::saveSCPHistory(uint32_t seq,
 
     soci::transaction txscope(db.getSession());
 
+    BinaryUse envelope(db.getSession());
+
     {
         auto prepClean = db.getPreparedStatement(
             "DELETE FROM scphistory WHERE ledgerseq =:l");
@@ -67,10 +70,7 @@ HerderPersistenceImpl::saveSCPHistory(uint32_t seq,
 
         std::string nodeIDStrKey = KeyUtils::toStrKey(e.statement.nodeID);
 
-        auto envelopeBytes(xdr::xdr_to_opaque(e));
-
-        std::string envelopeEncoded;
-        envelopeEncoded = decoder::encode_b64(envelopeBytes);
+        envelope.set(xdr::xdr_to_opaque(e));
 
         auto prepEnv =
             db.getPreparedStatement("INSERT INTO scphistory "
@@ -80,7 +80,7 @@ HerderPersistenceImpl::saveSCPHistory(uint32_t seq,
         auto& st = prepEnv.statement();
         st.exchange(soci::use(nodeIDStrKey));
         st.exchange(soci::use(seq));
-        st.exchange(soci::use(envelopeEncoded));
+        st.exchange(envelope.use());
         st.define_and_bind();
         {
             auto timer = db.getInsertTimer("scphistory");
@@ -167,14 +167,14 @@ HerderPersistence::copySCPHistoryToStream(Database& db, soci::session& sess,
 
         // fetch SCP messages from history
         {
-            std::string envB64;
+            BinaryInto envelope(sess);
 
             auto timer = db.getSelectTimer("scphistory");
 
             soci::statement st =
                 (sess.prepare << "SELECT envelope FROM scphistory "
                                  "WHERE ledgerseq = :cur ORDER BY nodeid",
-                 soci::into(envB64), soci::use(curLedgerSeq));
+                 envelope.into(), soci::use(curLedgerSeq));
 
             st.execute(true);
 
@@ -182,12 +182,7 @@ HerderPersistence::copySCPHistoryToStream(Database& db, soci::session& sess,
             {
                 curEnvs.emplace_back();
                 auto& env = curEnvs.back();
-
-                std::vector<uint8_t> envBytes;
-                decoder::decode_b64(envB64, envBytes);
-
-                xdr::xdr_get g1(&envBytes.front(), &envBytes.back() + 1);
-                xdr_argpack_archive(g1, env);
+                envelope.unpack(env);
 
                 // record new quorum sets encountered
                 Hash const& qSetHash =
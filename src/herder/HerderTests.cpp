@@ -12,6 +12,7 @@
 #include "test/TestUtils.h"
 #include "test/test.h"
 
+#include "crypto/Hex.h"
 #include "crypto/SHA.h"
 #include "database/Database.h"
 #include "ledger/LedgerHeaderUtils.h"
@@ -360,6 +361,77 @@ TEST_CASE("txset", "[herder]")
     }
 }
 
+TEST_CASE("txset parallel validation", "[herder][txset]")
+{
+    // validates the same transaction set serially and in parallel, in two
+    // identical ledgers, and compares every outcome
+    auto validate = [](bool parallel) {
+        Config cfg(getTestConfig());
+        cfg.PARALLEL_TX_SET_VALIDATION = parallel;
+
+        VirtualClock clock;
+        Application::pointer app = createTestApplication(clock, cfg);
+        app->start();
+
+        auto root = TestAccount::createRoot(*app);
+        auto minBalance = app->getLedgerManager().getLastMinBalance(0);
+        auto fee = app->getLedgerManager().getLastTxFee();
+
+        std::vector<TestAccount> accounts;
+        for (int i = 0; i < 8; i++)
+        {
+            std::string name = "A";
+            name += '0' + (char)i;
+            // A3 can only pay for one transaction
+            accounts.emplace_back(
+                root.create(name, minBalance + (i == 3 ? fee : 100 * fee)));
+        }
+
+        TxSetFramePtr txSet = std::make_shared<TxSetFrame>(
+            app->getLedgerManager().getLastClosedLedgerHeader().hash);
+        for (size_t i = 0; i < accounts.size(); i++)
+        {
+            for (int j = 0; j < 3; j++)
+            {
+                auto tx = accounts[i].tx({payment(root, 1)});
+                if (i == 1 && j == 2)
+                {
+                    // sequence gap
+                    tx->getEnvelope().tx.seqNum += 5;
+                }
+                txSet->add(tx);
+            }
+        }
+        // operation source that did not sign
+        auto op = payment(root, 1);
+        op.sourceAccount.activate() = accounts[6].getPublicKey();
+        txSet->add(accounts[2].tx({op}));
+        // source account that does not exist
+        auto missing = TestAccount{*app, getAccount("missing")};
+        txSet->add(missing.tx({payment(root, 1)}));
+        txSet->sortForHash();
+
+        std::vector<std::string> res;
+        res.emplace_back(txSet->checkValid(*app) ? "valid" : "invalid");
+        std::vector<TransactionFramePtr> trimmed;
+        txSet->trimInvalid(*app, trimmed);
+        for (auto const& tx : trimmed)
+        {
+            res.emplace_back(binToHex(tx->getFullHash()) + " " +
+                             std::to_string(tx->getResultCode()));
+        }
+        res.emplace_back(binToHex(txSet->getContentsHash()));
+        res.emplace_back(txSet->checkValid(*app) ? "valid" : "invalid");
+        return res;
+    };
+
+    auto serial = validate(false);
+    REQUIRE(serial.front() == "invalid");
+    REQUIRE(serial.back() == "valid");
+    REQUIRE(serial.size() > 4);
+    REQUIRE(validate(true) == serial);
+}
+
 // under surge
 // over surge
 // make sure it drops the correct txs
@@ -0,0 +1,251 @@
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "herder/TransactionQueue.h"
+#include "main/Application.h"
+
+#include "medida/counter.h"
+#include "medida/meter.h"
+#include "medida/metrics_registry.h"
+#include "medida/timer.h"
+
+#include <algorithm>
+
+namespace spn
+{
+
+namespace
+{
+TransactionQueue::FeeRate
+getFeeRate(TransactionFrame const& tx)
+{
+    // the operation frames of a transaction received from the network are
+    // only built by checkValid, so count the operations of the envelope
+    return {tx.getFee(),
+            std::max<int64_t>(1, tx.getEnvelope().tx.operations.size())};
+}
+
+bool
+lessFeeRate(TransactionQueue::FeeRate const& a,
+            TransactionQueue::FeeRate const& b)
+{
+    return a.mFee * b.mOps < b.mFee * a.mOps;
+}
+}
+
+bool
+TransactionQueue::PriorityOrder::
+operator()(std::pair<FeeRate, AccountID> const& a,
+           std::pair<FeeRate, AccountID> const& b) const
+{
+    if (lessFeeRate(b.first, a.first))
+    {
+        return true;
+    }
+    if (lessFeeRate(a.first, b.first))
+    {
+        return false;
+    }
+    return a.second < b.second;
+}
+
+TransactionQueue::TransactionQueue(Application& app)
+    : mApp(app)
+    , mSize(app.getMetrics().NewCounter({"herder", "pending-txs", "count"}))
+    , mEvicted(app.getMetrics().NewMeter({"herder", "pending-txs", "evicted"},
+                                         "transaction"))
+    , mTimeInQueue(
+          app.getMetrics().NewTimer({"herder", "pending-txs", "time-in-queue"}))
+{
+    for (size_t age = 0; age < MAX_AGE; ++age)
+    {
+        mAgeCounters[age] = &app.getMetrics().NewCounter(
+            {"herder", "pending-txs", "age" + std::to_string(age)});
+    }
+}
+
+bool
+TransactionQueue::contains(Hash const& fullHash) const
+{
+    return mKnownTxs.find(fullHash) != mKnownTxs.end();
+}
+
+TransactionQueue::AccountTxs const*
+TransactionQueue::getAccount(AccountID const& account) const
+{
+    auto it = mAccounts.find(account);
+    return it == mAccounts.end() ? nullptr : &it->second;
+}
+
+void
+TransactionQueue::add(TransactionFramePtr tx)
+{
+    auto inserted = mKnownTxs.insert(tx->getFullHash()).second;
+    assert(inserted);
+
+    auto const& accountID = tx->getSourceID();
+    auto& acc = mAccounts[accountID];
+    auto rate = getFeeRate(*tx);
+    if (acc.mTxs.empty())
+    {
+        acc.mMinFeeRate = rate;
+    }
+    else
+    {
+        mByFeeRate.erase(std::make_pair(acc.mMinFeeRate, accountID));
+        if (lessFeeRate(rate, acc.mMinFeeRate))
+        {
+            acc.mMinFeeRate = rate;
+        }
+    }
+    acc.mTotalFees += tx->getFee();
+
+    auto seq = tx->getSeqNum();
+    auto pos = std::upper_bound(acc.mTxs.begin(), acc.mTxs.end(), seq,
+                                [](SequenceNumber s, Entry const& e) {
+                                    return s < e.mTx->getSeqNum();
+                                });
+    acc.mTxs.insert(pos, Entry{std::move(tx), 0, mApp.getClock().now()});
+    mByFeeRate.emplace(acc.mMinFeeRate, accountID);
+
+    ++mSizeByAge[0];
+    updateMetrics();
+}
+
+size_t
+TransactionQueue::eraseIf(std::map<AccountID, AccountTxs>::iterator it,
+                          std::function<bool(Entry const&)> const& pred)
+{
+    auto& acc = it->second;
+    auto now = mApp.getClock().now();
+    auto keep = std::stable_partition(
+        acc.mTxs.begin(), acc.mTxs.end(),
+        [&](Entry const& e) { return !pred(e); });
+    size_t erased = acc.mTxs.end() - keep;
+    if (erased == 0)
+    {
+        return 0;
+    }
+
+    for (auto e = keep; e != acc.mTxs.end(); ++e)
+    {
+        mKnownTxs.erase(e->mTx->getFullHash());
+        --mSizeByAge[e->mAge];
+        mTimeInQueue.Update(now - e->mReceived);
+    }
+    mByFeeRate.erase(std::make_pair(acc.mMinFeeRate, it->first));
+    acc.mTxs.erase(keep, acc.mTxs.end());
+
+    acc.mTotalFees = 0;
+    for (auto e = acc.mTxs.begin(); e != acc.mTxs.end(); ++e)
+    {
+        auto rate = getFeeRate(*e->mTx);
+        if (e == acc.mTxs.begin() || lessFeeRate(rate, acc.mMinFeeRate))
+        {
+            acc.mMinFeeRate = rate;
+        }
+        acc.mTotalFees += e->mTx->getFee();
+    }
+    if (!acc.mTxs.empty())
+    {
+        mByFeeRate.emplace(acc.mMinFeeRate, it->first);
+    }
+    return erased;
+}
+
+void
+TransactionQueue::remove(std::vector<TransactionFramePtr> const& txs)
+{
+    std::map<AccountID, std::unordered_set<Hash>> byAccount;
+    for (auto const& tx : txs)
+    {
+        if (contains(tx->getFullHash()))
+        {
+            byAccount[tx->getSourceID()].insert(tx->getFullHash());
+        }
+    }
+
+    for (auto const& hashes : byAccount)
+    {
+        auto it = mAccounts.find(hashes.first);
+        assert(it != mAccounts.end());
+        eraseIf(it, [&](Entry const& e) {
+            return hashes.second.find(e.mTx->getFullHash()) !=
+                   hashes.second.end();
+        });
+        if (it->second.mTxs.empty())
+        {
+            mAccounts.erase(it);
+        }
+    }
+    updateMetrics();
+}
+
+void
+TransactionQueue::shift()
+{
+    size_t evicted = 0;
+    for (auto it = mAccounts.begin(); it != mAccounts.end();)
+    {
+        evicted += eraseIf(
+            it, [](Entry const& e) { return e.mAge + 1 == MAX_AGE; });
+        if (it->second.mTxs.empty())
+        {
+            it = mAccounts.erase(it);
+            continue;
+        }
+        for (auto& e : it->second.mTxs)
+        {
+            ++e.mAge;
+        }
+        ++it;
+    }
+    mEvicted.Mark(evicted);
+
+    for (size_t age = MAX_AGE - 1; age > 0; --age)
+    {
+        mSizeByAge[age] = mSizeByAge[age - 1];
+    }
+    mSizeByAge[0] = 0;
+    updateMetrics();
+}
+
+void
+TransactionQueue::forEachAccountByFeeRate(
+    std::function<bool(std::vector<Entry> const&)> const& f) const
+{
+    for (auto const& key : mByFeeRate)
+    {
+        if (!f(mAccounts.at(key.second).mTxs))
+        {
+            break;
+        }
+    }
+}
+
+std::vector<TransactionFramePtr>
+TransactionQueue::getTransactions() const
+{
+    std::vector<TransactionFramePtr> res;
+    res.reserve(size());
+    for (auto const& acc : mAccounts)
+    {
+        for (auto const& e : acc.second.mTxs)
+        {
+            res.emplace_back(e.mTx);
+        }
+    }
+    return res;
+}
+
+void
+TransactionQueue::updateMetrics()
+{
+    mSize.set_count(size());
+    for (size_t age = 0; age < MAX_AGE; ++age)
+    {
+        mAgeCounters[age]->set_count(mSizeByAge[age]);
+    }
+}
+}
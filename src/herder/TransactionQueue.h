@@ -0,0 +1,142 @@
+#pragma once
+
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "transactions/TransactionFrame.h"
+#include "util/HashOfHash.h"
+#include "util/NonCopyable.h"
+#include "util/Timer.h"
+#include "util/XDROperators.h"
+
+#include <functional>
+#include <map>
+#include <set>
+#include <unordered_set>
+#include <vector>
+
+namespace medida
+{
+class Counter;
+class Meter;
+class Timer;
+}
+
+namespace spn
+{
+
+class Application;
+
+/**
+ * Transactions received by the herder that are waiting to get into a ledger.
+ *
+ * Every transaction is indexed by its full hash, so duplicates are found
+ * without looking at any account. The transactions of each source account
+ * form a chain ordered by sequence number, which caches the highest sequence
+ * number and the total fees the account has committed to. Accounts are in
+ * turn ordered by the lowest fee per operation any of their transactions
+ * pays -- the order surge pricing keeps transactions in -- so the best
+ * candidates for the next transaction set can be had without sorting the
+ * whole queue.
+ *
+ * Transactions age by one each time a ledger closes, and are dropped once
+ * they reach MAX_AGE.
+ */
+class TransactionQueue : NonMovableOrCopyable
+{
+  public:
+    static size_t const MAX_AGE = 4;
+
+    struct Entry
+    {
+        TransactionFramePtr mTx;
+        uint32_t mAge;
+        VirtualClock::time_point mReceived;
+    };
+
+    // Fee per operation, kept as a fraction so that comparisons are exact.
+    struct FeeRate
+    {
+        int64_t mFee;
+        int64_t mOps;
+    };
+
+    struct AccountTxs
+    {
+        // ordered by sequence number
+        std::vector<Entry> mTxs;
+        int64_t mTotalFees{0};
+        FeeRate mMinFeeRate{0, 1};
+
+        SequenceNumber
+        getMaxSeq() const
+        {
+            return mTxs.empty() ? 0 : mTxs.back().mTx->getSeqNum();
+        }
+    };
+
+    explicit TransactionQueue(Application& app);
+
+    bool contains(Hash const& fullHash) const;
+
+    // Returns nullptr if there is nothing queued for `account`.
+    AccountTxs const* getAccount(AccountID const& account) const;
+
+    // Queues `tx`, which must not be queued already.
+    void add(TransactionFramePtr tx);
+
+    // Removes the transactions in `txs` that are queued: they were applied
+    // or are no longer valid.
+    void remove(std::vector<TransactionFramePtr> const& txs);
+
+    // Called when a ledger closes: ages every transaction by one and drops
+    // those that reached MAX_AGE.
+    void shift();
+
+    // Calls `f` with the transactions of each account, highest fee rate
+    // first, until it returns false.
+    void forEachAccountByFeeRate(
+        std::function<bool(std::vector<Entry> const&)> const& f) const;
+
+    std::vector<TransactionFramePtr> getTransactions() const;
+
+    size_t
+    size() const
+    {
+        return mKnownTxs.size();
+    }
+
+    size_t
+    sizeOfAge(uint32_t age) const
+    {
+        return mSizeByAge[age];
+    }
+
+  private:
+    struct PriorityOrder
+    {
+        bool operator()(
+            std::pair<FeeRate, AccountID> const& a,
+            std::pair<FeeRate, AccountID> const& b) const;
+    };
+
+    Application& mApp;
+
+    std::unordered_set<Hash> mKnownTxs;
+    std::map<AccountID, AccountTxs> mAccounts;
+    std::set<std::pair<FeeRate, AccountID>, PriorityOrder> mByFeeRate;
+    size_t mSizeByAge[MAX_AGE] = {};
+
+    medida::Counter& mSize;
+    medida::Counter* mAgeCounters[MAX_AGE];
+    medida::Meter& mEvicted;
+    medida::Timer& mTimeInQueue;
+
+    // Drops the entries of `acc` for which `pred` holds, and refreshes its
+    // cached totals and priority; returns the number dropped.
+    size_t eraseIf(std::map<AccountID, AccountTxs>::iterator acc,
+                   std::function<bool(Entry const&)> const& pred);
+    void updateMetrics();
+};
+}
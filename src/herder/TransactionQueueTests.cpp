@@ -0,0 +1,146 @@
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "herder/TransactionQueue.h"
+#include "lib/catch.hpp"
+#include "main/Application.h"
+#include "test/TestAccount.h"
+#include "test/TestUtils.h"
+#include "test/TxTests.h"
+#include "test/test.h"
+
+#include "medida/counter.h"
+#include "medida/meter.h"
+#include "medida/metrics_registry.h"
+
+using namespace spn;
+using namespace spn::txtest;
+
+TEST_CASE("TransactionQueue", "[herder][txqueue]")
+{
+    VirtualClock clock;
+    Application::pointer app = createTestApplication(clock, getTestConfig());
+
+    auto root = TestAccount::createRoot(*app);
+    auto a = TestAccount{*app, getAccount("A"), 1};
+    auto b = TestAccount{*app, getAccount("B"), 1};
+
+    auto makeTx = [&](TestAccount& acc, uint32_t feeMultiplier, int ops = 1) {
+        std::vector<Operation> operations(ops, payment(root, 1));
+        auto tx = acc.tx(operations);
+        tx->getEnvelope().tx.fee *= feeMultiplier;
+        return tx;
+    };
+
+    TransactionQueue queue(*app);
+
+    auto a1 = makeTx(a, 1);
+    auto a2 = makeTx(a, 3);
+    auto b1 = makeTx(b, 2, 2);
+    // out of sequence order on purpose
+    queue.add(a2);
+    queue.add(a1);
+    queue.add(b1);
+
+    REQUIRE(queue.size() == 3);
+    REQUIRE(queue.contains(a1->getFullHash()));
+    REQUIRE(!queue.contains(makeTx(a, 1)->getFullHash()));
+
+    auto pendingA = queue.getAccount(a1->getSourceID());
+    REQUIRE(pendingA);
+    REQUIRE(pendingA->mTxs.front().mTx == a1);
+    REQUIRE(pendingA->getMaxSeq() == a2->getSeqNum());
+    REQUIRE(pendingA->mTotalFees == a1->getFee() + a2->getFee());
+    REQUIRE(!queue.getAccount(root.getPublicKey()));
+
+    auto accountsByFeeRate = [&]() {
+        std::vector<AccountID> res;
+        queue.forEachAccountByFeeRate(
+            [&](std::vector<TransactionQueue::Entry> const& txs) {
+                res.emplace_back(txs.front().mTx->getSourceID());
+                return true;
+            });
+        return res;
+    };
+
+    SECTION("accounts are ordered by their lowest fee per operation")
+    {
+        // A pays the base fee on a1, B twice the base fee per operation
+        REQUIRE(accountsByFeeRate() ==
+                std::vector<AccountID>{b1->getSourceID(), a1->getSourceID()});
+
+        // without a1, A pays three times the base fee
+        queue.remove({a1});
+        REQUIRE(accountsByFeeRate() ==
+                std::vector<AccountID>{a1->getSourceID(), b1->getSourceID()});
+        REQUIRE(queue.getAccount(a1->getSourceID())->mTotalFees ==
+                a2->getFee());
+        REQUIRE(!queue.contains(a1->getFullHash()));
+
+        queue.remove({a2});
+        REQUIRE(accountsByFeeRate() ==
+                std::vector<AccountID>{b1->getSourceID()});
+        REQUIRE(!queue.getAccount(a1->getSourceID()));
+        REQUIRE(queue.size() == 1);
+    }
+
+    SECTION("fee rates count every operation")
+    {
+        // same fee per operation, so the account IDs break the tie; the
+        // multi-operation transaction goes to the account that sorts last
+        auto c = TestAccount{*app, getAccount("C"), 1};
+        auto d = TestAccount{*app, getAccount("D"), 1};
+        auto& single = c.getPublicKey() < d.getPublicKey() ? c : d;
+        auto& multi = c.getPublicKey() < d.getPublicKey() ? d : c;
+
+        TransactionQueue feeQueue(*app);
+        auto singleTx = makeTx(single, 1);
+        auto multiTx = makeTx(multi, 1, 3);
+        REQUIRE(multiTx->getFee() == 3 * singleTx->getFee());
+        feeQueue.add(multiTx);
+        feeQueue.add(singleTx);
+
+        std::vector<AccountID> order;
+        feeQueue.forEachAccountByFeeRate(
+            [&](std::vector<TransactionQueue::Entry> const& txs) {
+                order.emplace_back(txs.front().mTx->getSourceID());
+                return true;
+            });
+        REQUIRE(order == std::vector<AccountID>{single.getPublicKey(),
+                                                multi.getPublicKey()});
+    }
+
+    SECTION("transactions age out")
+    {
+        auto& evicted = app->getMetrics().NewMeter(
+            {"herder", "pending-txs", "evicted"}, "transaction");
+        auto& age0 =
+            app->getMetrics().NewCounter({"herder", "pending-txs", "age0"});
+        auto& age1 =
+            app->getMetrics().NewCounter({"herder", "pending-txs", "age1"});
+        auto evictedBefore = evicted.count();
+
+        REQUIRE(age0.count() == 3);
+        queue.shift();
+        auto a3 = makeTx(a, 1);
+        queue.add(a3);
+        REQUIRE(age0.count() == 1);
+        REQUIRE(age1.count() == 3);
+
+        for (size_t i = 1; i < TransactionQueue::MAX_AGE; ++i)
+        {
+            queue.shift();
+        }
+        REQUIRE(evicted.count() - evictedBefore == 3);
+        REQUIRE(queue.size() == 1);
+        REQUIRE(queue.contains(a3->getFullHash()));
+        REQUIRE(queue.getAccount(a3->getSourceID())->mTotalFees ==
+                a3->getFee());
+        REQUIRE(queue.sizeOfAge(TransactionQueue::MAX_AGE - 1) == 1);
+
+        queue.shift();
+        REQUIRE(queue.size() == 0);
+        REQUIRE(accountsByFeeRate().empty());
+    }
+}
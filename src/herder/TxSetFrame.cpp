@@ -11,6 +11,7 @@
 #include "ledger/LedgerState.h"
 #include "ledger/LedgerStateEntry.h"
 #include "ledger/LedgerStateHeader.h"
+#include "ledger/LedgerStateSnapshot.h"
 #include "main/Application.h"
 #include "main/Config.h"
 #include "transactions/TransactionUtils.h"
@@ -18,6 +19,12 @@
 #include "util/XDROperators.h"
 #include "xdrpp/marshal.h"
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
 
 #include "xdrpp/printer.h"
 
@@ -136,26 +143,6 @@ TxSetFrame::sortForApply()
     return retList;
 }
 
-struct SurgeSorter
-{
-    map<AccountID, double>& mAccountFeeMap;
-    SurgeSorter(map<AccountID, double>& afm) : mAccountFeeMap(afm)
-    {
-    }
-
-    bool
-    operator()(TransactionFramePtr const& tx1, TransactionFramePtr const& tx2)
-    {
-        if (tx1->getSourceID() == tx2->getSourceID())
-            return tx1->getSeqNum() < tx2->getSeqNum();
-        double fee1 = mAccountFeeMap[tx1->getSourceID()];
-        double fee2 = mAccountFeeMap[tx2->getSourceID()];
-        if (fee1 == fee2)
-            return tx1->getSourceID() < tx2->getSourceID();
-        return fee1 > fee2;
-    }
-};
-
 void
 TxSetFrame::surgePricingFilter(Application& app)
 {
@@ -167,31 +154,191 @@ TxSetFrame::surgePricingFilter(Application& app)
         CLOG(WARNING, "Herder")
             << "surge pricing in effect! " << mTransactions.size();
 
-        // determine the fee ratio for each account
-        map<AccountID, double> accountFeeMap;
+        // group the tx by account, and determine the fee ratio for each
+        // account: the lowest one any of its tx pays
+        struct AccountTxs
+        {
+            AccountID const* mAccount;
+            double mFeeRatio;
+            vector<TransactionFramePtr> mTxs;
+        };
+        map<AccountID, AccountTxs> accounts;
         for (auto& tx : mTransactions)
         {
             double fee = tx->getFee();
             double minFee = (double)tx->getMinFee(header);
             double r = fee / minFee;
 
-            double now = accountFeeMap[tx->getSourceID()];
-            if (now == 0)
-                accountFeeMap[tx->getSourceID()] = r;
-            else if (r < now)
-                accountFeeMap[tx->getSourceID()] = r;
+            auto& acc = accounts[tx->getSourceID()];
+            if (acc.mTxs.empty() || r < acc.mFeeRatio)
+            {
+                acc.mFeeRatio = r;
+            }
+            acc.mTxs.push_back(tx);
+        }
+
+        // keep the tx of the accounts paying the most, in sequence order,
+        // until the set is full: only as many accounts as needed come off
+        // the heap
+        vector<AccountTxs*> heap;
+        heap.reserve(accounts.size());
+        for (auto& acc : accounts)
+        {
+            acc.second.mAccount = &acc.first;
+            heap.push_back(&acc.second);
+        }
+        auto lowerPriority = [](AccountTxs const* a, AccountTxs const* b) {
+            if (a->mFeeRatio == b->mFeeRatio)
+                return *b->mAccount < *a->mAccount;
+            return a->mFeeRatio < b->mFeeRatio;
+        };
+        std::make_heap(heap.begin(), heap.end(), lowerPriority);
+
+        std::unordered_set<TransactionFrame const*> kept;
+        while (kept.size() < max && !heap.empty())
+        {
+            std::pop_heap(heap.begin(), heap.end(), lowerPriority);
+            auto& txs = heap.back()->mTxs;
+            heap.pop_back();
+            std::sort(txs.begin(), txs.end(), SeqSorter);
+            for (auto iter = txs.begin();
+                 iter != txs.end() && kept.size() < max; iter++)
+            {
+                kept.insert(iter->get());
+            }
         }
 
-        // sort tx by amount of fee they have paid
-        // remove the bottom that aren't paying enough
-        std::vector<TransactionFramePtr> tempList = mTransactions;
-        std::sort(tempList.begin(), tempList.end(), SurgeSorter(accountFeeMap));
+        // remove the bottom that aren't paying enough, keeping the order
+        // of the others
+        mTransactions.erase(
+            std::remove_if(mTransactions.begin(), mTransactions.end(),
+                           [&](TransactionFramePtr const& tx) {
+                               return kept.find(tx.get()) == kept.end();
+                           }),
+            mTransactions.end());
+        mHashIsValid = false;
+    }
+}
+
+namespace
+{
+// What checking the transactions of one source account against some ledger
+// state found, so that it can be acted upon later, on the main thread.
+struct AccountCheck
+{
+    // for each transaction in sequence order: whether it is valid, and the
+    // sequence number it was checked against. Stops after the first invalid
+    // transaction when asked to.
+    std::vector<std::pair<bool, SequenceNumber>> mTxs;
+    bool mInsufficientBalance{false};
+};
+
+AccountCheck
+checkAccount(Application& app, AbstractLedgerState& ls,
+             std::vector<TransactionFramePtr> const& txs,
+             bool stopAtFirstInvalid)
+{
+    AccountCheck res;
+    res.mTxs.reserve(txs.size());
+
+    TransactionFramePtr lastTx;
+    SequenceNumber lastSeq = 0;
+    int64_t totFee = 0;
+    for (auto& tx : txs)
+    {
+        bool valid = tx->checkValid(app, ls, lastSeq);
+        res.mTxs.emplace_back(valid, lastSeq);
+        if (!valid)
+        {
+            if (stopAtFirstInvalid)
+            {
+                return res;
+            }
+            continue;
+        }
+        totFee += tx->getFee();
+
+        lastTx = tx;
+        lastSeq = tx->getSeqNum();
+    }
+    if (lastTx)
+    {
+        // make sure account can pay the fee for all these tx
+        auto const& source = spn::loadAccount(ls, lastTx->getSourceID());
+        res.mInsufficientBalance =
+            getAvailableBalance(ls.loadHeader(), source) < totFee;
+    }
+    return res;
+}
+
+// Accounts checked by the worker threads, each against its own view of one
+// snapshot. Whoever runs out of accounts to claim first -- the main thread
+// included -- stops, so the main thread only ever waits for accounts that
+// are actually being checked, not for workers busy with something else.
+struct ParallelAccountCheck
+{
+    Application& mApp;
+    LedgerStateSnapshot mSnapshot;
+    std::vector<std::vector<TransactionFramePtr>> const mAccounts;
+    bool const mStopAtFirstInvalid;
+
+    std::vector<AccountCheck> mResults;
+    // accounts that could not be checked against the snapshot
+    std::unique_ptr<std::atomic<bool>[]> mFailed;
+
+    std::atomic<size_t> mNext{0};
+    std::mutex mMutex;
+    std::condition_variable mDoneCV;
+    size_t mDone{0};
+
+    ParallelAccountCheck(Application& app, std::set<LedgerKey> const& keys,
+                         std::vector<std::vector<TransactionFramePtr>> accounts,
+                         bool stopAtFirstInvalid)
+        : mApp(app)
+        , mSnapshot(app.getLedgerStateRoot(), keys)
+        , mAccounts(std::move(accounts))
+        , mStopAtFirstInvalid(stopAtFirstInvalid)
+        , mResults(mAccounts.size())
+        , mFailed(std::make_unique<std::atomic<bool>[]>(mAccounts.size()))
+    {
+        for (size_t i = 0; i < mAccounts.size(); ++i)
+        {
+            mFailed[i] = false;
+        }
+    }
 
-        for (auto iter = tempList.begin() + max; iter != tempList.end(); iter++)
+    void
+    run()
+    {
+        for (size_t i = mNext++; i < mAccounts.size(); i = mNext++)
         {
-            removeTx(*iter);
+            try
+            {
+                LedgerStateSnapshot::View view(mSnapshot);
+                LedgerState ls(view);
+                mResults[i] =
+                    checkAccount(mApp, ls, mAccounts[i], mStopAtFirstInvalid);
+            }
+            catch (std::exception&)
+            {
+                mFailed[i] = true;
+            }
+
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (++mDone == mAccounts.size())
+            {
+                mDoneCV.notify_all();
+            }
         }
     }
+
+    void
+    wait()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDoneCV.wait(lock, [this] { return mDone == mAccounts.size(); });
+    }
+};
 }
 
 bool
@@ -200,10 +347,9 @@ TxSetFrame::checkOrTrim(
     std::function<bool(TransactionFramePtr, SequenceNumber)>
         processInvalidTxLambda,
     std::function<bool(std::vector<TransactionFramePtr> const&)>
-        processInsufficientBalance)
+        processInsufficientBalance,
+    bool stopAtFirstInvalid)
 {
-    LedgerState ls(app.getLedgerStateRoot());
-
     map<AccountID, vector<TransactionFramePtr>> accountTxMap;
 
     Hash lastHash;
@@ -220,39 +366,90 @@ TxSetFrame::checkOrTrim(
         lastHash = tx->getFullHash();
     }
 
+    vector<vector<TransactionFramePtr>> accounts;
+    accounts.reserve(accountTxMap.size());
     for (auto& item : accountTxMap)
     {
         // order by sequence number
         std::sort(item.second.begin(), item.second.end(), SeqSorter);
+        accounts.emplace_back(std::move(item.second));
+    }
 
-        TransactionFramePtr lastTx;
-        SequenceNumber lastSeq = 0;
-        int64_t totFee = 0;
-        for (auto& tx : item.second)
+    // Checking a transaction never changes the ledger, so the accounts can
+    // be checked in any order and on any thread, as long as their results
+    // are acted upon in account order below.
+    vector<AccountCheck> results;
+    if (app.getConfig().PARALLEL_TX_SET_VALIDATION && accounts.size() > 1)
+    {
+        std::set<LedgerKey> keys;
+        for (auto const& txs : accounts)
         {
-            if (!tx->checkValid(app, ls, lastSeq))
+            for (auto const& tx : txs)
             {
-                if (processInvalidTxLambda(tx, lastSeq))
-                    continue;
-
-                return false;
+                tx->insertLedgerKeysToPrefetch(keys);
             }
-            totFee += tx->getFee();
+        }
 
-            lastTx = tx;
-            lastSeq = tx->getSeqNum();
+        auto job = std::make_shared<ParallelAccountCheck>(
+            app, keys, accounts, stopAtFirstInvalid);
+        auto workers =
+            std::min<size_t>(std::thread::hardware_concurrency(),
+                             job->mAccounts.size() - 1);
+        for (size_t i = 0; i < workers; ++i)
+        {
+            app.postOnBackgroundThread([job]() { job->run(); });
         }
-        if (lastTx)
+        job->run();
+        job->wait();
+
+        // anything the snapshot did not capture is checked again here
+        std::unique_ptr<LedgerState> ls;
+        for (size_t i = 0; i < job->mAccounts.size(); ++i)
         {
-            // make sure account can pay the fee for all these tx
-            auto const& source =
-                spn::loadAccount(ls, lastTx->getSourceID());
-            if (getAvailableBalance(ls.loadHeader(), source) < totFee)
+            if (job->mFailed[i])
             {
-                if (!processInsufficientBalance(item.second))
-                    return false;
+                if (!ls)
+                {
+                    ls = std::make_unique<LedgerState>(
+                        app.getLedgerStateRoot());
+                }
+                job->mResults[i] = checkAccount(
+                    app, *ls, job->mAccounts[i], stopAtFirstInvalid);
             }
         }
+        results = std::move(job->mResults);
+    }
+    else
+    {
+        LedgerState ls(app.getLedgerStateRoot());
+        results.reserve(accounts.size());
+        for (auto const& txs : accounts)
+        {
+            results.emplace_back(
+                checkAccount(app, ls, txs, stopAtFirstInvalid));
+        }
+    }
+
+    for (size_t i = 0; i < accounts.size(); ++i)
+    {
+        auto const& txs = accounts[i];
+        auto const& res = results[i];
+        for (size_t j = 0; j < res.mTxs.size(); ++j)
+        {
+            if (!res.mTxs[j].first)
+            {
+                if (processInvalidTxLambda(txs[j], res.mTxs[j].second))
+                    continue;
+
+                return false;
+            }
+        }
+        assert(res.mTxs.size() == txs.size());
+        if (res.mInsufficientBalance)
+        {
+            if (!processInsufficientBalance(txs))
+                return false;
+        }
     }
 
     return true;
@@ -280,7 +477,8 @@ TxSetFrame::trimInvalid(Application& app,
             return true;
         };
 
-    checkOrTrim(app, processInvalidTxLambda, processInsufficientBalance);
+    checkOrTrim(app, processInvalidTxLambda, processInsufficientBalance,
+                false);
 }
 
 // need to make sure every account that is submitting a tx has enough to pay
@@ -326,7 +524,8 @@ TxSetFrame::checkValid(Application& app)
 
             return false;
         };
-    return checkOrTrim(app, processInvalidTxLambda, processInsufficientBalance);
+    return checkOrTrim(app, processInvalidTxLambda, processInsufficientBalance,
+                       true);
 }
 
 void
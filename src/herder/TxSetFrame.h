@@ -22,12 +22,18 @@ class TxSetFrame
 
     Hash mPreviousLedgerHash;
 
+    // Checks the transactions of each source account, on the worker threads
+    // if PARALLEL_TX_SET_VALIDATION is set, then calls the lambdas in the
+    // same order, and with the same arguments, as a serial check would.
+    // stopAtFirstInvalid tells that processInvalidTxLambda always returns
+    // false, so that no more than needed is checked.
     bool
     checkOrTrim(Application& app,
                 std::function<bool(TransactionFramePtr, SequenceNumber)>
                     processInvalidTxLambda,
                 std::function<bool(std::vector<TransactionFramePtr> const&)>
-                    processLastInvalidTxLambda);
+                    processLastInvalidTxLambda,
+                bool stopAtFirstInvalid);
 
   public:
     std::vector<TransactionFramePtr> mTransactions;
@@ -51,7 +51,9 @@ StateSnapshot::makeLive()
         auto& hb = mLocalState.currentBuckets[i];
         if (hb.next.hasHashes() && !hb.next.isLive())
         {
-            hb.next.makeLive(mApp, BucketList::keepDeadEntries(i));
+            hb.next.makeLive(
+                mApp, BucketList::keepDeadEntries(i), i,
+                BucketList::nextCommitLedger(mLocalState.currentLedger, i));
         }
     }
 }
@@ -9,11 +9,10 @@
 #include "main/Application.h"
 #include "util/Fs.h"
 #include "util/Logging.h"
+#include "util/MappedFile.h"
 #include <medida/meter.h>
 #include <medida/metrics_registry.h>
 
-#include <fstream>
-
 namespace spn
 {
 
@@ -49,23 +48,28 @@ VerifyBucketWork::onStart()
     app.postOnBackgroundThread([&app, filename, handler, hash]() {
         auto hasher = SHA256::create();
         asio::error_code ec;
-        char buf[4096];
         {
-            // ensure that the stream gets its own scope to avoid race with
+            // ensure that the mapping gets its own scope to avoid race with
             // main thread
-            std::ifstream in(filename, std::ifstream::binary);
-            while (in)
+            uint256 vHash;
+            try
+            {
+                MappedFile in(filename);
+                hasher->add(in.bytes());
+                vHash = hasher->finish();
+            }
+            catch (std::runtime_error const& e)
             {
-                in.read(buf, sizeof(buf));
-                hasher->add(ByteSlice(buf, in.gcount()));
+                CLOG(WARNING, "History")
+                    << "FAILED reading " << filename << ": " << e.what();
+                ec = std::make_error_code(std::errc::io_error);
             }
-            uint256 vHash = hasher->finish();
-            if (vHash == hash)
+            if (!ec && vHash == hash)
             {
                 CLOG(DEBUG, "History") << "Verified hash (" << hexAbbrev(hash)
                                        << ") for " << filename;
             }
-            else
+            else if (!ec)
             {
                 CLOG(WARNING, "History")
                     << "FAILED verifying hash for " << filename;
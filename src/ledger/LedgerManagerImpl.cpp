@@ -272,6 +272,7 @@ LedgerManagerImpl::loadLastKnownLedger(
                 else
                 {
                     mApp.getBucketManager().assumeState(has);
+                    mApp.getLedgerStateRoot().loadInflationVoteTally();
                     {
                         LedgerState ls(mApp.getLedgerStateRoot());
                         auto header = ls.loadHeader();
@@ -826,6 +827,15 @@ LedgerManagerImpl::closeLedger(LedgerCloseData const& ledgerData)
     // sorted such that sequence numbers are respected
     vector<TransactionFramePtr> txs = ledgerData.getTxSet()->sortForApply();
 
+    // load every account and trust line the transactions are likely to touch
+    // with a few bulk queries, rather than one query per entry during apply
+    std::set<LedgerKey> keysToPrefetch;
+    for (auto const& tx : txs)
+    {
+        tx->insertLedgerKeysToPrefetch(keysToPrefetch);
+    }
+    ls.prefetch(keysToPrefetch);
+
     // first, charge fees
     processFeesSeqNums(txs, ls);
 
@@ -11,11 +11,17 @@
 #include "ledger/LedgerStateEntry.h"
 #include "ledger/LedgerStateHeader.h"
 #include "ledger/LedgerStateImpl.h"
+#include "medida/histogram.h"
+#include "medida/meter.h"
+#include "medida/metrics_registry.h"
+#include "medida/timer.h"
 #include "util/GlobalChecks.h"
 #include "util/XDROperators.h"
 #include "util/types.h"
 #include "xdr/Stellar-ledger-entries.h"
 #include "xdrpp/marshal.h"
+#include <algorithm>
+#include <iterator>
 #include <soci.h>
 
 namespace spn
@@ -64,6 +70,12 @@ EntryIterator::entry() const
     return getImpl()->entry();
 }
 
+std::shared_ptr<LedgerEntry> const&
+EntryIterator::entryPtr() const
+{
+    return getImpl()->entryPtr();
+}
+
 bool
 EntryIterator::entryExists() const
 {
@@ -198,7 +210,9 @@ LedgerState::Impl::commitChild(EntryIterator iter)
             auto const& key = iter.key();
             if (iter.entryExists())
             {
-                mEntry[key] = std::make_shared<LedgerEntry>(iter.entry());
+                // The child is sealed and discarded once it has committed, so
+                // the entry can be adopted rather than copied
+                mEntry[key] = iter.entryPtr();
             }
             else if (!mParent.getNewestVersion(key))
             { // Created in this LedgerState
@@ -963,6 +977,32 @@ LedgerState::Impl::loadWithoutRecord(LedgerState& self, LedgerKey const& key)
     return ConstLedgerStateEntry(impl);
 }
 
+void
+LedgerState::prefetch(std::set<LedgerKey> const& keys)
+{
+    getImpl()->prefetch(keys);
+}
+
+void
+LedgerState::Impl::prefetch(std::set<LedgerKey> const& keys)
+{
+    throwIfSealed();
+    throwIfChild();
+
+    std::set<LedgerKey> missing;
+    for (auto const& key : keys)
+    {
+        if (mEntry.find(key) == mEntry.end())
+        {
+            missing.insert(key);
+        }
+    }
+    if (!missing.empty())
+    {
+        mParent.prefetch(missing);
+    }
+}
+
 void
 LedgerState::rollback()
 {
@@ -1026,22 +1066,21 @@ LedgerState::Impl::maybeUpdateLastModified() const
     throwIfSealed();
     throwIfChild();
 
-    // Note: We do a deep copy here since a shallow copy would not be exception
-    // safe.
+    // Note: We do a deep copy of every entry whose last modified needs to be
+    // updated since modifying it in place would not be exception safe. Other
+    // entries are shared, which is safe because they are not modified.
     EntryMap entries;
     for (auto const& kv : mEntry)
     {
         auto const& key = kv.first;
-        std::shared_ptr<LedgerEntry> entry;
-        if (kv.second)
+        std::shared_ptr<LedgerEntry> entry = kv.second;
+        if (entry && mShouldUpdateLastModified &&
+            entry->lastModifiedLedgerSeq != mHeader->ledgerSeq)
         {
             entry = std::make_shared<LedgerEntry>(*kv.second);
-            if (mShouldUpdateLastModified)
-            {
-                entry->lastModifiedLedgerSeq = mHeader->ledgerSeq;
-            }
+            entry->lastModifiedLedgerSeq = mHeader->ledgerSeq;
         }
-        entries.emplace(key, entry);
+        entries.emplace_hint(entries.end(), key, entry);
     }
     return entries;
 }
@@ -1099,6 +1138,12 @@ LedgerState::Impl::EntryIteratorImpl::entry() const
     return *(mIter->second);
 }
 
+std::shared_ptr<LedgerEntry> const&
+LedgerState::Impl::EntryIteratorImpl::entryPtr() const
+{
+    return mIter->second;
+}
+
 bool
 LedgerState::Impl::EntryIteratorImpl::entryExists() const
 {
@@ -1112,19 +1157,29 @@ LedgerState::Impl::EntryIteratorImpl::key() const
 }
 
 // Implementation of LedgerStateRoot ------------------------------------------
-LedgerStateRoot::LedgerStateRoot(Database& db, size_t entryCacheSize,
-                                 size_t bestOfferCacheSize)
-    : mImpl(std::make_unique<Impl>(db, entryCacheSize, bestOfferCacheSize))
+LedgerStateRoot::LedgerStateRoot(Database& db,
+                                 medida::MetricsRegistry& metrics,
+                                 size_t entryCacheSize)
+    : mImpl(std::make_unique<Impl>(db, metrics, entryCacheSize))
 {
 }
 
-LedgerStateRoot::Impl::Impl(Database& db, size_t entryCacheSize,
-                            size_t bestOfferCacheSize)
+LedgerStateRoot::Impl::Impl(Database& db, medida::MetricsRegistry& metrics,
+                            size_t entryCacheSize)
     : mDatabase(db)
     , mHeader(std::make_unique<LedgerHeader>())
     , mEntryCache(entryCacheSize)
-    , mBestOffersCache(bestOfferCacheSize)
     , mChild(nullptr)
+    , mCommitFlushTimer(metrics.NewTimer({"ledger", "commit", "flush"}))
+    , mCommitBatchSize(metrics.NewHistogram({"ledger", "commit", "batch-size"}))
+    , mEntryCacheHit(
+          metrics.NewMeter({"ledger", "entry-cache", "hit"}, "entry"))
+    , mEntryCacheMiss(
+          metrics.NewMeter({"ledger", "entry-cache", "miss"}, "entry"))
+    , mEntryCacheEvict(
+          metrics.NewMeter({"ledger", "entry-cache", "evict"}, "entry"))
+    , mPrefetchHitRate(
+          metrics.NewHistogram({"ledger", "prefetch", "hit-rate"}))
 {
 }
 
@@ -1179,28 +1234,72 @@ LedgerStateRoot::Impl::commitChild(EntryIterator iter)
     // guarantee, so use std::unique_ptr<...>::swap to achieve it
     auto childHeader = std::make_unique<LedgerHeader>(mChild->getHeader());
 
+    // Group the changes by entry type and by operation so that each group can
+    // be flushed with a single statement. The pointers refer to data owned by
+    // the child, which outlives this call.
+    struct BulkChanges
+    {
+        std::vector<LedgerEntry const*> upserts;
+        std::vector<LedgerKey const*> deletes;
+    };
+    BulkChanges accounts, data, offers, trustLines;
+
     try
     {
         for (; (bool)iter; ++iter)
         {
             auto const& key = iter.key();
+            BulkChanges* changes = nullptr;
             switch (key.type())
             {
             case ACCOUNT:
-                storeAccount(iter);
+                changes = &accounts;
                 break;
             case DATA:
-                storeData(iter);
+                changes = &data;
                 break;
             case OFFER:
-                storeOffer(iter);
+                changes = &offers;
                 break;
             case TRUSTLINE:
-                storeTrustLine(iter);
+                changes = &trustLines;
                 break;
             default:
                 throw std::runtime_error("Unknown key type");
             }
+
+            if (iter.entryExists())
+            {
+                changes->upserts.emplace_back(&iter.entry());
+            }
+            else
+            {
+                changes->deletes.emplace_back(&key);
+            }
+        }
+
+        for (auto const* changes : {&accounts, &data, &offers, &trustLines})
+        {
+            if (!changes->upserts.empty())
+            {
+                mCommitBatchSize.Update(changes->upserts.size());
+            }
+            if (!changes->deletes.empty())
+            {
+                mCommitBatchSize.Update(changes->deletes.size());
+            }
+        }
+
+        {
+            auto timer = mCommitFlushTimer.TimeScope();
+            bulkUpsertAccounts(accounts.upserts);
+            bulkDeleteAccounts(accounts.deletes);
+            bulkUpsertData(data.upserts);
+            bulkDeleteData(data.deletes);
+            bulkUpsertOffers(offers.upserts);
+            bulkDeleteOffers(offers.deletes);
+            bulkUpsertTrustLines(trustLines.upserts);
+            bulkDeleteTrustLines(trustLines.deletes);
         }
 
         mTransaction->commit();
@@ -1217,9 +1316,13 @@ LedgerStateRoot::Impl::commitChild(EntryIterator iter)
             "unknown fatal error during commit to LedgerStateRoot");
     }
 
-    // Clearing the cache does not throw
-    mBestOffersCache.clear();
-    mEntryCache.clear();
+    // The caches are brought up to date with the committed changes rather
+    // than cleared, so that entries which are accessed every ledger stay warm.
+    // updateCachesAfterCommit does not throw
+    updateCachesAfterCommit(accounts.upserts, accounts.deletes);
+    updateCachesAfterCommit(data.upserts, data.deletes);
+    updateCachesAfterCommit(offers.upserts, offers.deletes);
+    updateCachesAfterCommit(trustLines.upserts, trustLines.deletes);
 
     // std::unique_ptr<...>::reset does not throw
     mTransaction.reset();
@@ -1229,6 +1332,58 @@ LedgerStateRoot::Impl::commitChild(EntryIterator iter)
     mChild = nullptr;
 }
 
+void
+LedgerStateRoot::Impl::updateCachesAfterCommit(
+    std::vector<LedgerEntry const*> const& upserts,
+    std::vector<LedgerKey const*> const& deletes) const
+{
+    try
+    {
+        for (auto const* entry : upserts)
+        {
+            auto key = LedgerEntryKey(*entry);
+            auto committed = std::make_shared<LedgerEntry const>(*entry);
+            putInEntryCache(getEntryCacheKey(key), committed);
+            if (key.type() == OFFER && mOrderBook)
+            {
+                // The offer may have changed price or even asset pair, so it
+                // is removed before the new version is added
+                removeFromOrderBook(*mOrderBook, key.offer().offerID);
+                addToOrderBook(*mOrderBook, committed);
+            }
+            else if (key.type() == ACCOUNT && mInflationVoteTally)
+            {
+                // Same for the balance and inflation destination of a voter
+                removeInflationVote(*mInflationVoteTally,
+                                    key.account().accountID);
+                addInflationVote(*mInflationVoteTally,
+                                 committed->data.account());
+            }
+        }
+        for (auto const* key : deletes)
+        {
+            putInEntryCache(getEntryCacheKey(*key), nullptr);
+            if (key->type() == OFFER && mOrderBook)
+            {
+                removeFromOrderBook(*mOrderBook, key->offer().offerID);
+            }
+            else if (key->type() == ACCOUNT && mInflationVoteTally)
+            {
+                removeInflationVote(*mInflationVoteTally,
+                                    key->account().accountID);
+            }
+        }
+    }
+    catch (...)
+    {
+        // Clearing the cache and resetting the order book and inflation vote
+        // tally do not throw
+        mEntryCache.clear();
+        mOrderBook.reset();
+        mInflationVoteTally.reset();
+    }
+}
+
 std::string
 LedgerStateRoot::Impl::tableFromLedgerEntryType(LedgerEntryType let)
 {
@@ -1303,14 +1458,8 @@ LedgerStateRoot::Impl::deleteObjectsModifiedOnOrAfterLedger(
     using namespace soci;
     throwIfChild();
     mEntryCache.clear();
-    mBestOffersCache.clear();
-
-    {
-        std::string query =
-            "DELETE FROM signers WHERE accountid IN"
-            " (SELECT accountid FROM accounts WHERE lastmodified >= :v1)";
-        mDatabase.getSession() << query, use(ledger);
-    }
+    mOrderBook.reset();
+    mInflationVoteTally.reset();
 
     for (auto let : {ACCOUNT, DATA, TRUSTLINE, OFFER})
     {
@@ -1344,6 +1493,12 @@ LedgerStateRoot::dropTrustLines()
     mImpl->dropTrustLines();
 }
 
+void
+LedgerStateRoot::writeSignersTableIntoAccountsTable()
+{
+    mImpl->writeSignersTableIntoAccountsTable();
+}
+
 std::map<LedgerKey, LedgerEntry>
 LedgerStateRoot::getAllOffers()
 {
@@ -1385,65 +1540,25 @@ LedgerStateRoot::getBestOffer(Asset const& buying, Asset const& selling,
     return mImpl->getBestOffer(buying, selling, exclude);
 }
 
-static std::shared_ptr<LedgerEntry const>
-findIncludedOffer(std::list<LedgerEntry>::const_iterator iter,
-                  std::list<LedgerEntry>::const_iterator const& end,
-                  std::set<LedgerKey> const& exclude)
-{
-    for (; iter != end; ++iter)
-    {
-        auto key = LedgerEntryKey(*iter);
-        if (exclude.find(key) == exclude.end())
-        {
-            return std::make_shared<LedgerEntry const>(*iter);
-        }
-    }
-    return {};
-}
-
 std::shared_ptr<LedgerEntry const>
 LedgerStateRoot::Impl::getBestOffer(Asset const& buying, Asset const& selling,
                                     std::set<LedgerKey>& exclude)
 {
-    // Note: Elements of mBestOffersCache are properly sorted lists of the best
-    // offers for a certain asset pair. This function maintaints the invariant
-    // that the lists of best offers remain properly sorted. The sort order is
-    // that determined by loadBestOffers and isBetterOffer (both induce the same
-    // order).
-    BestOffersCacheEntry emptyCacheEntry{{}, false};
-    auto& cached = getFromBestOffersCache(buying, selling, emptyCacheEntry);
-    auto& offers = cached.bestOffers;
-
-    auto res = findIncludedOffer(offers.cbegin(), offers.cend(), exclude);
-
-    size_t const BATCH_SIZE = 5;
-    while (!res && !cached.allLoaded)
+    auto& orderBook = getOrderBook();
+    auto iter = orderBook.offersByAssets.find(std::make_pair(buying, selling));
+    if (iter == orderBook.offersByAssets.end())
     {
-        std::list<LedgerEntry>::const_iterator newOfferIter;
-        try
-        {
-            newOfferIter = loadBestOffers(offers, buying, selling, BATCH_SIZE,
-                                          offers.size());
-        }
-        catch (std::exception& e)
-        {
-            printErrorAndAbort(
-                "fatal error when getting best offer from LedgerStateRoot: ",
-                e.what());
-        }
-        catch (...)
-        {
-            printErrorAndAbort("unknown fatal error when getting best offer "
-                               "from LedgerStateRoot");
-        }
+        return {};
+    }
 
-        if (std::distance(newOfferIter, offers.cend()) < BATCH_SIZE)
+    for (auto const& offer : iter->second)
+    {
+        if (exclude.find(LedgerEntryKey(*offer)) == exclude.end())
         {
-            cached.allLoaded = true;
+            return offer;
         }
-        res = findIncludedOffer(newOfferIter, offers.cend(), exclude);
     }
-    return res;
+    return {};
 }
 
 std::map<LedgerKey, LedgerEntry>
@@ -1505,7 +1620,16 @@ LedgerStateRoot::Impl::getInflationWinners(size_t maxWinners, int64_t minVotes)
 {
     try
     {
-        return loadInflationWinners(maxWinners, minVotes);
+        std::vector<InflationWinner> winners;
+        for (auto const& kv : getInflationVoteTally().ranking)
+        {
+            if (winners.size() >= maxWinners || kv.first.first < minVotes)
+            {
+                break;
+            }
+            winners.push_back({kv.second, kv.first.first});
+        }
+        return winners;
     }
     catch (std::exception& e)
     {
@@ -1532,8 +1656,10 @@ LedgerStateRoot::Impl::getNewestVersion(LedgerKey const& key) const
     auto cacheKey = getEntryCacheKey(key);
     if (mEntryCache.exists(cacheKey))
     {
+        mEntryCacheHit.Mark();
         return getFromEntryCache(cacheKey);
     }
+    mEntryCacheMiss.Mark();
 
     std::shared_ptr<LedgerEntry const> entry;
     try
@@ -1573,89 +1699,215 @@ LedgerStateRoot::Impl::getNewestVersion(LedgerKey const& key) const
 }
 
 void
-LedgerStateRoot::rollbackChild()
+LedgerStateRoot::loadInflationVoteTally()
 {
-    mImpl->rollbackChild();
+    mImpl->loadInflationVoteTally();
 }
 
 void
-LedgerStateRoot::Impl::rollbackChild()
+LedgerStateRoot::Impl::loadInflationVoteTally()
 {
-    try
+    getInflationVoteTally();
+}
+
+void
+LedgerStateRoot::writeBucketEntries(std::vector<LedgerEntry> const& liveEntries,
+                                    std::vector<LedgerKey> const& deadEntries)
+{
+    mImpl->writeBucketEntries(liveEntries, deadEntries);
+}
+
+void
+LedgerStateRoot::Impl::writeBucketEntries(
+    std::vector<LedgerEntry> const& liveEntries,
+    std::vector<LedgerKey> const& deadEntries)
+{
+    throwIfChild();
+    mEntryCache.clear();
+    mOrderBook.reset();
+    mInflationVoteTally.reset();
+
+    std::vector<LedgerEntry const*> accounts, data, offers, trustLines;
+    for (auto const& entry : liveEntries)
     {
-        mTransaction->rollback();
-        mTransaction.reset();
+        switch (entry.data.type())
+        {
+        case ACCOUNT:
+            accounts.emplace_back(&entry);
+            break;
+        case DATA:
+            data.emplace_back(&entry);
+            break;
+        case OFFER:
+            offers.emplace_back(&entry);
+            break;
+        case TRUSTLINE:
+            trustLines.emplace_back(&entry);
+            break;
+        default:
+            throw std::runtime_error("Unknown key type");
+        }
     }
-    catch (std::exception& e)
+
+    std::vector<LedgerKey const*> deadAccounts, deadData, deadOffers,
+        deadTrustLines;
+    for (auto const& key : deadEntries)
     {
-        printErrorAndAbort(
-            "fatal error when rolling back child of LedgerStateRoot: ",
-            e.what());
+        switch (key.type())
+        {
+        case ACCOUNT:
+            deadAccounts.emplace_back(&key);
+            break;
+        case DATA:
+            deadData.emplace_back(&key);
+            break;
+        case OFFER:
+            deadOffers.emplace_back(&key);
+            break;
+        case TRUSTLINE:
+            deadTrustLines.emplace_back(&key);
+            break;
+        default:
+            throw std::runtime_error("Unknown key type");
+        }
     }
-    catch (...)
+
+    soci::transaction sqlTx(mDatabase.getSession());
     {
-        printErrorAndAbort(
-            "unknown fatal error when rolling back child of LedgerStateRoot");
+        auto timer = mCommitFlushTimer.TimeScope();
+        bulkUpsertAccounts(accounts);
+        bulkDeleteAccounts(deadAccounts, false);
+        bulkUpsertData(data);
+        bulkDeleteData(deadData, false);
+        bulkUpsertOffers(offers);
+        bulkDeleteOffers(deadOffers, false);
+        bulkUpsertTrustLines(trustLines);
+        bulkDeleteTrustLines(deadTrustLines, false);
     }
+    sqlTx.commit();
+}
 
-    mChild = nullptr;
+void
+LedgerStateRoot::prefetch(std::set<LedgerKey> const& keys)
+{
+    mImpl->prefetch(keys);
 }
 
 void
-LedgerStateRoot::Impl::storeAccount(EntryIterator const& iter)
+LedgerStateRoot::Impl::prefetch(std::set<LedgerKey> const& keys)
 {
-    if (iter.entryExists())
+    if (keys.empty())
     {
-        auto const previous = getNewestVersion(iter.key());
-        insertOrUpdateAccount(iter.entry(), !previous);
-        storeSigners(iter.entry(), previous);
+        return;
     }
-    else
+
+    size_t cached = 0;
+    std::vector<LedgerKey> accounts, trustLines, others;
+    for (auto const& key : keys)
     {
-        deleteAccount(iter.key());
+        if (mEntryCache.exists(getEntryCacheKey(key)))
+        {
+            ++cached;
+            continue;
+        }
+
+        switch (key.type())
+        {
+        case ACCOUNT:
+            accounts.emplace_back(key);
+            break;
+        case TRUSTLINE:
+        {
+            // Keys that would make loadTrustLine throw are not prefetched
+            auto const& tl = key.trustLine();
+            if (tl.asset.type() != ASSET_TYPE_NATIVE &&
+                isAssetValid(tl.asset) && !(tl.accountID == getIssuer(tl.asset)))
+            {
+                trustLines.emplace_back(key);
+            }
+            break;
+        }
+        default:
+            others.emplace_back(key);
+            break;
+        }
     }
-}
+    mPrefetchHitRate.Update(cached * 100 / keys.size());
 
-void
-LedgerStateRoot::Impl::storeData(EntryIterator const& iter)
-{
-    if (iter.entryExists())
+    std::vector<LedgerEntry> entries;
+    try
     {
-        auto const previous = getNewestVersion(iter.key());
-        insertOrUpdateData(iter.entry(), !previous);
+        auto loadedAccounts = loadAccounts(accounts);
+        auto loadedTrustLines = loadTrustLines(trustLines);
+        entries.reserve(loadedAccounts.size() + loadedTrustLines.size());
+        std::move(loadedAccounts.begin(), loadedAccounts.end(),
+                  std::back_inserter(entries));
+        std::move(loadedTrustLines.begin(), loadedTrustLines.end(),
+                  std::back_inserter(entries));
     }
-    else
+    catch (std::exception& e)
     {
-        deleteData(iter.key());
+        printErrorAndAbort(
+            "fatal error when prefetching ledger entries in LedgerStateRoot: ",
+            e.what());
+    }
+    catch (...)
+    {
+        printErrorAndAbort("unknown fatal error when prefetching ledger "
+                           "entries in LedgerStateRoot");
     }
-}
 
-void
-LedgerStateRoot::Impl::storeOffer(EntryIterator const& iter)
-{
-    if (iter.entryExists())
+    // Keys which were not found are cached as absent, exactly as
+    // getNewestVersion would have done
+    std::set<LedgerKey> notFound(accounts.begin(), accounts.end());
+    notFound.insert(trustLines.begin(), trustLines.end());
+    for (auto& le : entries)
     {
-        auto const previous = getNewestVersion(iter.key());
-        insertOrUpdateOffer(iter.entry(), !previous);
+        auto key = LedgerEntryKey(le);
+        notFound.erase(key);
+        putInEntryCache(getEntryCacheKey(key),
+                        std::make_shared<LedgerEntry const>(std::move(le)));
     }
-    else
+    for (auto const& key : notFound)
     {
-        deleteOffer(iter.key());
+        putInEntryCache(getEntryCacheKey(key), nullptr);
+    }
+
+    // There is no bulk query for the remaining types, so they are loaded one
+    // at a time
+    for (auto const& key : others)
+    {
+        getNewestVersion(key);
     }
 }
 
 void
-LedgerStateRoot::Impl::storeTrustLine(EntryIterator const& iter)
+LedgerStateRoot::rollbackChild()
 {
-    if (iter.entryExists())
+    mImpl->rollbackChild();
+}
+
+void
+LedgerStateRoot::Impl::rollbackChild()
+{
+    try
     {
-        auto const previous = getNewestVersion(iter.key());
-        insertOrUpdateTrustLine(iter.entry(), !previous);
+        mTransaction->rollback();
+        mTransaction.reset();
     }
-    else
+    catch (std::exception& e)
     {
-        deleteTrustLine(iter.key());
+        printErrorAndAbort(
+            "fatal error when rolling back child of LedgerStateRoot: ",
+            e.what());
+    }
+    catch (...)
+    {
+        printErrorAndAbort(
+            "unknown fatal error when rolling back child of LedgerStateRoot");
     }
+
+    mChild = nullptr;
 }
 
 LedgerStateRoot::Impl::EntryCacheKey
@@ -1685,7 +1937,13 @@ LedgerStateRoot::Impl::putInEntryCache(
 {
     try
     {
+        bool isNew = !mEntryCache.exists(cacheKey);
+        auto size = mEntryCache.size();
         mEntryCache.put(cacheKey, entry);
+        if (isNew && mEntryCache.size() <= size)
+        {
+            mEntryCacheEvict.Mark();
+        }
     }
     catch (...)
     {
@@ -1694,27 +1952,170 @@ LedgerStateRoot::Impl::putInEntryCache(
     }
 }
 
-LedgerStateRoot::Impl::BestOffersCacheEntry&
-LedgerStateRoot::Impl::getFromBestOffersCache(
-    Asset const& buying, Asset const& selling,
-    BestOffersCacheEntry& defaultValue) const
+bool
+LedgerStateRoot::Impl::IsBetterOfferComparator::operator()(
+    std::shared_ptr<LedgerEntry const> const& lhs,
+    std::shared_ptr<LedgerEntry const> const& rhs) const
+{
+    return isBetterOffer(*lhs, *rhs);
+}
+
+LedgerStateRoot::Impl::OrderBook&
+LedgerStateRoot::Impl::getOrderBook() const
 {
+    if (mOrderBook)
+    {
+        return *mOrderBook;
+    }
+
+    auto orderBook = std::make_unique<OrderBook>();
     try
     {
-        auto cacheKey = binToHex(xdr::xdr_to_opaque(buying)) +
-                        binToHex(xdr::xdr_to_opaque(selling));
-        if (!mBestOffersCache.exists(cacheKey))
+        for (auto& offer : loadAllOffers())
         {
-            mBestOffersCache.put(cacheKey, defaultValue);
+            addToOrderBook(*orderBook,
+                           std::make_shared<LedgerEntry const>(std::move(offer)));
         }
-        return mBestOffersCache.exists(cacheKey)
-                   ? mBestOffersCache.get(cacheKey)
-                   : defaultValue;
+    }
+    catch (std::exception& e)
+    {
+        printErrorAndAbort(
+            "fatal error when loading order book in LedgerStateRoot: ",
+            e.what());
     }
     catch (...)
     {
-        mBestOffersCache.clear();
-        throw;
+        printErrorAndAbort(
+            "unknown fatal error when loading order book in LedgerStateRoot");
+    }
+
+    mOrderBook = std::move(orderBook);
+    return *mOrderBook;
+}
+
+void
+LedgerStateRoot::Impl::addToOrderBook(
+    OrderBook& orderBook, std::shared_ptr<LedgerEntry const> const& offer)
+{
+    auto const& oe = offer->data.offer();
+    auto res = orderBook.offersByID.emplace(oe.offerID, offer);
+    if (!res.second)
+    {
+        throw std::runtime_error("Offer already in order book");
+    }
+    orderBook.offersByAssets[std::make_pair(oe.buying, oe.selling)].emplace(
+        offer);
+}
+
+void
+LedgerStateRoot::Impl::removeFromOrderBook(OrderBook& orderBook,
+                                           uint64_t offerID)
+{
+    auto idIter = orderBook.offersByID.find(offerID);
+    if (idIter == orderBook.offersByID.end())
+    {
+        return;
+    }
+
+    auto const& oe = idIter->second->data.offer();
+    auto assetsIter =
+        orderBook.offersByAssets.find(std::make_pair(oe.buying, oe.selling));
+    assetsIter->second.erase(idIter->second);
+    if (assetsIter->second.empty())
+    {
+        orderBook.offersByAssets.erase(assetsIter);
+    }
+    orderBook.offersByID.erase(idIter);
+}
+
+LedgerStateRoot::Impl::InflationVoteTally&
+LedgerStateRoot::Impl::getInflationVoteTally() const
+{
+    if (mInflationVoteTally)
+    {
+        return *mInflationVoteTally;
+    }
+
+    auto tally = std::make_unique<InflationVoteTally>();
+    try
+    {
+        loadInflationVotes(*tally);
+    }
+    catch (std::exception& e)
+    {
+        printErrorAndAbort("fatal error when loading inflation vote tally in "
+                           "LedgerStateRoot: ",
+                           e.what());
+    }
+    catch (...)
+    {
+        printErrorAndAbort("unknown fatal error when loading inflation vote "
+                           "tally in LedgerStateRoot");
+    }
+
+    mInflationVoteTally = std::move(tally);
+    return *mInflationVoteTally;
+}
+
+void
+LedgerStateRoot::Impl::addInflationVote(InflationVoteTally& tally,
+                                        AccountEntry const& account)
+{
+    if (!account.inflationDest || account.balance < MIN_BALANCE_TO_VOTE)
+    {
+        return;
+    }
+
+    InflationWinner vote{*account.inflationDest, account.balance};
+    auto res = tally.votesByVoter.emplace(account.accountID, vote);
+    if (!res.second)
+    {
+        throw std::runtime_error("Voter already in inflation vote tally");
+    }
+    addToInflationVoteTotal(tally, vote.accountID, vote.votes);
+}
+
+void
+LedgerStateRoot::Impl::removeInflationVote(InflationVoteTally& tally,
+                                           AccountID const& voter)
+{
+    auto iter = tally.votesByVoter.find(voter);
+    if (iter == tally.votesByVoter.end())
+    {
+        return;
+    }
+
+    addToInflationVoteTotal(tally, iter->second.accountID,
+                            -iter->second.votes);
+    tally.votesByVoter.erase(iter);
+}
+
+void
+LedgerStateRoot::Impl::addToInflationVoteTotal(InflationVoteTally& tally,
+                                               AccountID const& destination,
+                                               int64_t votes)
+{
+    auto destinationStr = KeyUtils::toStrKey(destination);
+    auto iter = tally.totalByDestination.find(destination);
+    if (iter == tally.totalByDestination.end())
+    {
+        iter = tally.totalByDestination.emplace(destination, 0).first;
+    }
+    else
+    {
+        tally.ranking.erase(std::make_pair(iter->second, destinationStr));
+    }
+
+    iter->second += votes;
+    // Every vote is positive, so a total of zero means no votes are left
+    if (iter->second == 0)
+    {
+        tally.totalByDestination.erase(iter);
+    }
+    else
+    {
+        tally.ranking.emplace(std::make_pair(iter->second, destinationStr),
+                              destination);
     }
 }
 }
@@ -12,6 +12,11 @@
 #include <memory>
 #include <set>
 
+namespace medida
+{
+class MetricsRegistry;
+}
+
 namespace spn
 {
 
@@ -76,6 +81,11 @@ class EntryIterator
 
     LedgerEntry const& entry() const;
 
+    // entryPtr shares ownership of the entry returned by entry(), which allows
+    // a parent to adopt the entry instead of copying it. This is only valid
+    // because a child never modifies its entries once it has committed.
+    std::shared_ptr<LedgerEntry> const& entryPtr() const;
+
     bool entryExists() const;
 
     LedgerKey const& key() const;
@@ -140,6 +150,13 @@ class AbstractLedgerStateParent
     // or if the corresponding LedgerEntry has been erased.
     virtual std::shared_ptr<LedgerEntry const>
     getNewestVersion(LedgerKey const& key) const = 0;
+
+    // prefetch loads the newest version of every LedgerEntry associated with
+    // a LedgerKey in keys into the entry cache of the LedgerStateRoot, using
+    // as few queries as possible. Keys which already have a version stored in
+    // an AbstractLedgerState are skipped. prefetch never changes the result
+    // of any other function, it only makes subsequent loads cheaper.
+    virtual void prefetch(std::set<LedgerKey> const& keys) = 0;
 };
 
 // An abstraction for an object that is an AbstractLedgerStateParent and has
@@ -333,6 +350,8 @@ class LedgerState final : public AbstractLedgerState
 
     ConstLedgerStateEntry loadWithoutRecord(LedgerKey const& key) override;
 
+    void prefetch(std::set<LedgerKey> const& keys) override;
+
     void rollback() override;
 
     void rollbackChild() override;
@@ -346,8 +365,8 @@ class LedgerStateRoot : public AbstractLedgerStateParent
     std::unique_ptr<Impl> const mImpl;
 
   public:
-    explicit LedgerStateRoot(Database& db, size_t entryCacheSize = 4096,
-                             size_t bestOfferCacheSize = 64);
+    explicit LedgerStateRoot(Database& db, medida::MetricsRegistry& metrics,
+                             size_t entryCacheSize = 4096);
 
     virtual ~LedgerStateRoot();
 
@@ -366,6 +385,11 @@ class LedgerStateRoot : public AbstractLedgerStateParent
     void dropOffers();
     void dropTrustLines();
 
+    // Moves the signers of every account from the signers table into the
+    // signers column of the accounts table. Used by the schema upgrade which
+    // drops the signers table.
+    void writeSignersTableIntoAccountsTable();
+
     std::map<LedgerKey, LedgerEntry> getAllOffers() override;
 
     std::shared_ptr<LedgerEntry const>
@@ -384,6 +408,21 @@ class LedgerStateRoot : public AbstractLedgerStateParent
     std::shared_ptr<LedgerEntry const>
     getNewestVersion(LedgerKey const& key) const override;
 
+    // Builds the in-memory inflation vote tally from the accounts table if it
+    // is not already built, so that the first inflation after startup does not
+    // have to scan the accounts table.
+    void loadInflationVoteTally();
+
+    // Writes the entries of a bucket straight to the database without loading
+    // them first: live entries are inserted or replace the stored version and
+    // dead entries are deleted if they exist, with one statement per entry
+    // type. Used to apply buckets, oldest first, during catchup. The entry
+    // cache, order book and inflation vote tally are dropped.
+    void writeBucketEntries(std::vector<LedgerEntry> const& liveEntries,
+                            std::vector<LedgerKey> const& deadEntries);
+
+    void prefetch(std::set<LedgerKey> const& keys) override;
+
     void rollbackChild() override;
 };
 }
@@ -2,25 +2,44 @@
 // under the Apache License, Version 2.0. See the COPYING file at the root
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
+#include "crypto/Hex.h"
 #include "crypto/KeyUtils.h"
 #include "crypto/SecretKey.h"
 #include "crypto/SignerKey.h"
+#include "database/BinaryColumn.h"
 #include "database/Database.h"
+#include "database/DatabaseUtils.h"
 #include "ledger/LedgerStateImpl.h"
 #include "util/Decoder.h"
 #include "util/XDROperators.h"
 #include "util/types.h"
+#include "xdrpp/marshal.h"
 
 namespace spn
 {
 
+// Signers are stored in the accounts table as a binary XDR column so that an
+// account can be loaded with one query and stored with one statement. Accounts
+// without signers store NULL.
+static void
+decodeSigners(BinaryInto& signersBin, soci::indicator signersInd,
+              xdr::xvector<Signer, 20>& signers)
+{
+    signers.clear();
+    if (signersInd == soci::i_ok)
+    {
+        signersBin.unpack(signers);
+    }
+}
+
 std::shared_ptr<LedgerEntry const>
 LedgerStateRoot::Impl::loadAccount(LedgerKey const& key) const
 {
     std::string actIDStrKey = KeyUtils::toStrKey(key.account().accountID);
 
     std::string inflationDest, homeDomain, thresholds;
-    soci::indicator inflationDestInd;
+    soci::indicator inflationDestInd, signersInd;
+    BinaryInto signers(mDatabase.getSession());
     Liabilities liabilities;
     soci::indicator buyingLiabilitiesInd, sellingLiabilitiesInd;
 
@@ -28,12 +47,10 @@ LedgerStateRoot::Impl::loadAccount(LedgerKey const& key) const
     le.data.type(ACCOUNT);
     auto& account = le.data.account();
 
-    auto prep =
-        mDatabase.getPreparedStatement("SELECT balance, seqnum, numsubentries, "
-                                       "inflationdest, homedomain, thresholds, "
-                                       "flags, lastmodified, "
-                                       "buyingliabilities, sellingliabilities "
-                                       "FROM accounts WHERE accountid=:v1");
+    auto prep = mDatabase.getPreparedStatement(
+        "SELECT balance, seqnum, numsubentries, inflationdest, homedomain, "
+        "thresholds, flags, lastmodified, buyingliabilities, "
+        "sellingliabilities, signers FROM accounts WHERE accountid=:v1");
     auto& st = prep.statement();
     st.exchange(soci::into(account.balance));
     st.exchange(soci::into(account.seqNum));
@@ -45,6 +62,7 @@ LedgerStateRoot::Impl::loadAccount(LedgerKey const& key) const
     st.exchange(soci::into(le.lastModifiedLedgerSeq));
     st.exchange(soci::into(liabilities.buying, buyingLiabilitiesInd));
     st.exchange(soci::into(liabilities.selling, sellingLiabilitiesInd));
+    st.exchange(signers.into(signersInd));
     st.exchange(soci::use(actIDStrKey));
     st.define_and_bind();
     {
@@ -68,13 +86,7 @@ LedgerStateRoot::Impl::loadAccount(LedgerKey const& key) const
             KeyUtils::fromStrKey<PublicKey>(inflationDest);
     }
 
-    account.signers.clear();
-    if (account.numSubEntries != 0)
-    {
-        auto signers = loadSigners(key);
-        account.signers.insert(account.signers.begin(), signers.begin(),
-                               signers.end());
-    }
+    decodeSigners(signers, signersInd, account.signers);
 
     assert(buyingLiabilitiesInd == sellingLiabilitiesInd);
     if (buyingLiabilitiesInd == soci::i_ok)
@@ -86,284 +98,428 @@ LedgerStateRoot::Impl::loadAccount(LedgerKey const& key) const
     return std::make_shared<LedgerEntry const>(std::move(le));
 }
 
-std::vector<Signer>
-LedgerStateRoot::Impl::loadSigners(LedgerKey const& key) const
+std::vector<LedgerEntry>
+LedgerStateRoot::Impl::loadAccounts(std::vector<LedgerKey> const& keys) const
 {
-    std::vector<Signer> res;
-
-    std::string actIDStrKey = KeyUtils::toStrKey(key.account().accountID);
-
-    std::string pubKey;
-    Signer signer;
-
-    auto prep = mDatabase.getPreparedStatement(
-        "SELECT publickey, weight FROM signers WHERE accountid =:id");
-    auto& st = prep.statement();
-    st.exchange(soci::use(actIDStrKey));
-    st.exchange(soci::into(pubKey));
-    st.exchange(soci::into(signer.weight));
-    st.define_and_bind();
+    // The keys are loaded in batches of a fixed size, padding the last batch
+    // with a repeated key, so that every query has the same text and can be
+    // served by the prepared statement cache.
+    size_t const BATCH_SIZE = 64;
+
+    std::string sql = "SELECT accountid, balance, seqnum, numsubentries, "
+                      "inflationdest, homedomain, thresholds, flags, "
+                      "lastmodified, buyingliabilities, sellingliabilities, "
+                      "signers FROM accounts WHERE accountid IN (";
+    for (size_t i = 0; i < BATCH_SIZE; ++i)
     {
-        auto timer = mDatabase.getSelectTimer("signer");
-        st.execute(true);
+        sql += (i == 0 ? ":v" : ", :v") + std::to_string(i);
     }
-    while (st.got_data())
+    sql += ")";
+
+    std::vector<LedgerEntry> res;
+    for (size_t begin = 0; begin < keys.size(); begin += BATCH_SIZE)
     {
-        signer.key = KeyUtils::fromStrKey<SignerKey>(pubKey);
-        res.push_back(signer);
-        st.fetch();
-    }
+        std::vector<std::string> accountIDs;
+        for (size_t i = begin; i < begin + BATCH_SIZE; ++i)
+        {
+            auto const& key = keys[std::min(i, keys.size() - 1)];
+            accountIDs.emplace_back(KeyUtils::toStrKey(key.account().accountID));
+        }
+
+        std::string accountID, inflationDest, homeDomain, thresholds;
+        soci::indicator inflationDestInd, signersInd;
+        BinaryInto signers(mDatabase.getSession());
+        Liabilities liabilities;
+        soci::indicator buyingLiabilitiesInd, sellingLiabilitiesInd;
+
+        LedgerEntry le;
+        le.data.type(ACCOUNT);
+        auto& account = le.data.account();
+
+        auto prep = mDatabase.getPreparedStatement(sql);
+        auto& st = prep.statement();
+        st.exchange(soci::into(accountID));
+        st.exchange(soci::into(account.balance));
+        st.exchange(soci::into(account.seqNum));
+        st.exchange(soci::into(account.numSubEntries));
+        st.exchange(soci::into(inflationDest, inflationDestInd));
+        st.exchange(soci::into(homeDomain));
+        st.exchange(soci::into(thresholds));
+        st.exchange(soci::into(account.flags));
+        st.exchange(soci::into(le.lastModifiedLedgerSeq));
+        st.exchange(soci::into(liabilities.buying, buyingLiabilitiesInd));
+        st.exchange(soci::into(liabilities.selling, sellingLiabilitiesInd));
+        st.exchange(signers.into(signersInd));
+        for (auto const& id : accountIDs)
+        {
+            st.exchange(soci::use(id));
+        }
+        st.define_and_bind();
+        {
+            auto timer = mDatabase.getSelectTimer("account");
+            st.execute(true);
+        }
+        while (st.got_data())
+        {
+            account.accountID = KeyUtils::fromStrKey<PublicKey>(accountID);
+            account.homeDomain = homeDomain;
+
+            bn::decode_b64(thresholds.begin(), thresholds.end(),
+                           account.thresholds.begin());
+
+            account.inflationDest.reset();
+            if (inflationDestInd == soci::i_ok)
+            {
+                account.inflationDest.activate() =
+                    KeyUtils::fromStrKey<PublicKey>(inflationDest);
+            }
+
+            decodeSigners(signers, signersInd, account.signers);
 
-    std::sort(res.begin(), res.end(), [](Signer const& lhs, Signer const& rhs) {
-        return lhs.key < rhs.key;
-    });
+            assert(buyingLiabilitiesInd == sellingLiabilitiesInd);
+            account.ext.v(0);
+            if (buyingLiabilitiesInd == soci::i_ok)
+            {
+                account.ext.v(1);
+                account.ext.v1().liabilities = liabilities;
+            }
+
+            res.emplace_back(le);
+            st.fetch();
+        }
+    }
     return res;
 }
 
-std::vector<InflationWinner>
-LedgerStateRoot::Impl::loadInflationWinners(size_t maxWinners,
-                                            int64_t minBalance) const
+void
+LedgerStateRoot::Impl::loadInflationVotes(InflationVoteTally& tally) const
 {
-    InflationWinner w;
-    std::string inflationDest;
+    std::string accountID, inflationDest;
+    AccountEntry account;
+    account.inflationDest.activate();
 
     auto prep = mDatabase.getPreparedStatement(
-        "SELECT sum(balance) AS votes, inflationdest"
-        " FROM accounts WHERE inflationdest IS NOT NULL"
-        " AND balance >= 1000000000 GROUP BY inflationdest"
-        " ORDER BY votes DESC, inflationdest DESC LIMIT :lim");
+        "SELECT accountid, inflationdest, balance FROM accounts"
+        " WHERE inflationdest IS NOT NULL AND balance >= 1000000000");
     auto& st = prep.statement();
-    st.exchange(soci::into(w.votes));
+    st.exchange(soci::into(accountID));
     st.exchange(soci::into(inflationDest));
-    st.exchange(soci::use(maxWinners));
+    st.exchange(soci::into(account.balance));
     st.define_and_bind();
     st.execute(true);
 
-    std::vector<InflationWinner> winners;
     while (st.got_data())
     {
-        w.accountID = KeyUtils::fromStrKey<PublicKey>(inflationDest);
-        if (w.votes < minBalance)
-        {
-            break;
-        }
-        winners.push_back(w);
+        account.accountID = KeyUtils::fromStrKey<PublicKey>(accountID);
+        *account.inflationDest = KeyUtils::fromStrKey<PublicKey>(inflationDest);
+        addInflationVote(tally, account);
         st.fetch();
     }
-    return winners;
 }
 
 void
-LedgerStateRoot::Impl::insertOrUpdateAccount(LedgerEntry const& entry,
-                                             bool isInsert)
+LedgerStateRoot::Impl::bulkUpsertAccounts(
+    std::vector<LedgerEntry const*> const& entries)
 {
-    auto const& account = entry.data.account();
-    std::string actIDStrKey = KeyUtils::toStrKey(account.accountID);
-
-    soci::indicator inflation_ind = soci::i_null;
-    std::string inflationDestStrKey;
-    if (account.inflationDest)
+    if (entries.empty())
     {
-        inflationDestStrKey = KeyUtils::toStrKey(*account.inflationDest);
-        inflation_ind = soci::i_ok;
+        return;
     }
 
-    Liabilities liabilities;
-    soci::indicator liabilitiesInd = soci::i_null;
-    if (account.ext.v() == 1)
-    {
-        liabilities = account.ext.v1().liabilities;
-        liabilitiesInd = soci::i_ok;
-    }
-
-    std::string thresholds(decoder::encode_b64(account.thresholds));
-    std::string homeDomain(account.homeDomain);
-
-    std::string sql;
-    if (isInsert)
+    size_t const n = entries.size();
+    std::vector<std::string> accountIDs, inflationDests, homeDomains,
+        thresholds;
+    std::vector<xdr::opaque_vec<>> signers;
+    std::vector<int64_t> balances, seqNums, buyingLiabilities,
+        sellingLiabilities;
+    std::vector<int32_t> numSubEntries, flags, lastModifieds;
+    std::vector<soci::indicator> inflationDestInds, liabilitiesInds,
+        signersInds;
+    accountIDs.reserve(n);
+    inflationDests.reserve(n);
+    homeDomains.reserve(n);
+    thresholds.reserve(n);
+    signers.reserve(n);
+    balances.reserve(n);
+    seqNums.reserve(n);
+    buyingLiabilities.reserve(n);
+    sellingLiabilities.reserve(n);
+    numSubEntries.reserve(n);
+    flags.reserve(n);
+    lastModifieds.reserve(n);
+    inflationDestInds.reserve(n);
+    liabilitiesInds.reserve(n);
+    signersInds.reserve(n);
+
+    for (auto const* entry : entries)
     {
-        sql = "INSERT INTO accounts ( accountid, balance, seqnum, "
-              "numsubentries, inflationdest, homedomain, thresholds, flags, "
-              "lastmodified, buyingliabilities, sellingliabilities ) "
-              "VALUES ( :id, :v1, :v2, :v3, :v4, :v5, :v6, :v7, :v8, :v9, :v10 "
-              ")";
-    }
-    else
-    {
-        sql = "UPDATE accounts SET balance = :v1, seqnum = :v2, "
-              "numsubentries = :v3, inflationdest = :v4, homedomain = :v5, "
-              "thresholds = :v6, flags = :v7, lastmodified = :v8, "
-              "buyingliabilities = :v9, sellingliabilities = :v10 "
-              "WHERE accountid = :id";
-    }
-    auto prep = mDatabase.getPreparedStatement(sql);
-    soci::statement& st = prep.statement();
-    st.exchange(soci::use(actIDStrKey, "id"));
-    st.exchange(soci::use(account.balance, "v1"));
-    st.exchange(soci::use(account.seqNum, "v2"));
-    st.exchange(soci::use(account.numSubEntries, "v3"));
-    st.exchange(soci::use(inflationDestStrKey, inflation_ind, "v4"));
-    st.exchange(soci::use(homeDomain, "v5"));
-    st.exchange(soci::use(thresholds, "v6"));
-    st.exchange(soci::use(account.flags, "v7"));
-    st.exchange(soci::use(entry.lastModifiedLedgerSeq, "v8"));
-    st.exchange(soci::use(liabilities.buying, liabilitiesInd, "v9"));
-    st.exchange(soci::use(liabilities.selling, liabilitiesInd, "v10"));
-    st.define_and_bind();
-    {
-        auto timer = isInsert ? mDatabase.getInsertTimer("account")
-                              : mDatabase.getUpdateTimer("account");
-        st.execute(true);
-    }
-    if (st.get_affected_rows() != 1)
-    {
-        throw std::runtime_error("Could not update data in SQL");
-    }
-}
+        auto const& account = entry->data.account();
+        accountIDs.emplace_back(KeyUtils::toStrKey(account.accountID));
+        balances.emplace_back(account.balance);
+        seqNums.emplace_back(account.seqNum);
+        numSubEntries.emplace_back(
+            static_cast<int32_t>(account.numSubEntries));
+        if (account.inflationDest)
+        {
+            inflationDests.emplace_back(
+                KeyUtils::toStrKey(*account.inflationDest));
+            inflationDestInds.emplace_back(soci::i_ok);
+        }
+        else
+        {
+            inflationDests.emplace_back();
+            inflationDestInds.emplace_back(soci::i_null);
+        }
+        homeDomains.emplace_back(account.homeDomain);
+        thresholds.emplace_back(decoder::encode_b64(account.thresholds));
+        flags.emplace_back(static_cast<int32_t>(account.flags));
+        lastModifieds.emplace_back(
+            static_cast<int32_t>(entry->lastModifiedLedgerSeq));
+        if (account.ext.v() == 1)
+        {
+            auto const& liabilities = account.ext.v1().liabilities;
+            buyingLiabilities.emplace_back(liabilities.buying);
+            sellingLiabilities.emplace_back(liabilities.selling);
+            liabilitiesInds.emplace_back(soci::i_ok);
+        }
+        else
+        {
+            buyingLiabilities.emplace_back(0);
+            sellingLiabilities.emplace_back(0);
+            liabilitiesInds.emplace_back(soci::i_null);
+        }
 
-void
-LedgerStateRoot::Impl::storeSigners(
-    LedgerEntry const& entry,
-    std::shared_ptr<LedgerEntry const> const& previous)
-{
-    auto const& account = entry.data.account();
-    std::string actIDStrKey = KeyUtils::toStrKey(account.accountID);
-    assert(std::adjacent_find(account.signers.begin(), account.signers.end(),
-                              [](Signer const& lhs, Signer const& rhs) {
-                                  return !(lhs.key < rhs.key);
-                              }) == account.signers.end());
-
-    std::vector<Signer> signers;
-    if (previous)
-    {
-        signers = previous->data.account().signers;
-        assert(std::adjacent_find(signers.begin(), signers.end(),
+        assert(std::adjacent_find(account.signers.begin(),
+                                  account.signers.end(),
                                   [](Signer const& lhs, Signer const& rhs) {
                                       return !(lhs.key < rhs.key);
-                                  }) == signers.end());
+                                  }) == account.signers.end());
+        if (account.signers.empty())
+        {
+            signers.emplace_back();
+            signersInds.emplace_back(soci::i_null);
+        }
+        else
+        {
+            signers.emplace_back(xdr::xdr_to_opaque(account.signers));
+            signersInds.emplace_back(soci::i_ok);
+        }
     }
 
-    auto it_new = account.signers.begin();
-    auto it_old = signers.begin();
-    while (it_new != account.signers.end() || it_old != signers.end())
+    long long affected = 0;
+    if (mDatabase.isSqlite())
     {
-        bool updated = false, added = false;
-
-        if (it_old == signers.end())
+        // soci cannot bind a vector of blobs: the rows are written with NULL
+        // signers in bulk, then the signers are filled in one row at a time
+        // for the accounts that have any.
+        auto prep = mDatabase.getPreparedStatement(
+            "INSERT OR REPLACE INTO accounts ( accountid, balance, seqnum, "
+            "numsubentries, inflationdest, homedomain, thresholds, flags, "
+            "lastmodified, buyingliabilities, sellingliabilities, signers ) "
+            "VALUES ( :id, :v1, :v2, :v3, :v4, :v5, :v6, :v7, :v8, :v9, :v10, "
+            "NULL )");
+        auto& st = prep.statement();
+        st.exchange(soci::use(accountIDs, "id"));
+        st.exchange(soci::use(balances, "v1"));
+        st.exchange(soci::use(seqNums, "v2"));
+        st.exchange(soci::use(numSubEntries, "v3"));
+        st.exchange(soci::use(inflationDests, inflationDestInds, "v4"));
+        st.exchange(soci::use(homeDomains, "v5"));
+        st.exchange(soci::use(thresholds, "v6"));
+        st.exchange(soci::use(flags, "v7"));
+        st.exchange(soci::use(lastModifieds, "v8"));
+        st.exchange(soci::use(buyingLiabilities, liabilitiesInds, "v9"));
+        st.exchange(soci::use(sellingLiabilities, liabilitiesInds, "v10"));
+        st.define_and_bind();
         {
-            added = true;
+            auto timer = mDatabase.getUpsertTimer("account");
+            st.execute(true);
         }
-        else if (it_new != account.signers.end())
+        affected = st.get_affected_rows();
+
+        std::string accountID;
+        BinaryUse signersBin(mDatabase.getSession());
+        auto prepSigners = mDatabase.getPreparedStatement(
+            "UPDATE accounts SET signers = :v1 WHERE accountid = :id");
+        auto& stSigners = prepSigners.statement();
+        stSigners.exchange(signersBin.use());
+        stSigners.exchange(soci::use(accountID));
+        stSigners.define_and_bind();
+        auto timer = mDatabase.getUpsertTimer("account");
+        for (size_t i = 0; i < n; ++i)
         {
-            updated = (it_new->key == it_old->key);
-            if (!updated)
+            if (signersInds[i] == soci::i_ok)
             {
-                added = (it_new->key < it_old->key);
+                accountID = accountIDs[i];
+                signersBin.set(signers[i]);
+                stSigners.execute(true);
             }
         }
-        else
+    }
+    else
+    {
+        std::string strAccountIDs = DatabaseUtils::toPGArray(accountIDs);
+        std::string strBalances = DatabaseUtils::toPGArray(balances);
+        std::string strSeqNums = DatabaseUtils::toPGArray(seqNums);
+        std::string strNumSubEntries = DatabaseUtils::toPGArray(numSubEntries);
+        std::string strInflationDests =
+            DatabaseUtils::toPGArray(inflationDests, inflationDestInds);
+        std::string strHomeDomains = DatabaseUtils::toPGArray(homeDomains);
+        std::string strThresholds = DatabaseUtils::toPGArray(thresholds);
+        std::string strFlags = DatabaseUtils::toPGArray(flags);
+        std::string strLastModifieds = DatabaseUtils::toPGArray(lastModifieds);
+        std::string strBuyingLiabilities =
+            DatabaseUtils::toPGArray(buyingLiabilities, liabilitiesInds);
+        std::string strSellingLiabilities =
+            DatabaseUtils::toPGArray(sellingLiabilities, liabilitiesInds);
+        // BYTEA values travel as "\x" followed by hex inside the array
+        std::vector<std::string> signersHex;
+        signersHex.reserve(n);
+        for (auto const& s : signers)
         {
-            // deleted
+            signersHex.emplace_back("\\x" + binToHex(s));
         }
+        std::string strSigners =
+            DatabaseUtils::toPGArray(signersHex, signersInds);
 
-        if (updated)
-        {
-            if (it_new->weight != it_old->weight)
-            {
-                std::string signerStrKey = KeyUtils::toStrKey(it_new->key);
-                auto timer = mDatabase.getUpdateTimer("signer");
-                auto prep = mDatabase.getPreparedStatement(
-                    "UPDATE signers set weight=:v1 WHERE "
-                    "accountid=:v2 AND publickey=:v3");
-                auto& st = prep.statement();
-                st.exchange(soci::use(it_new->weight));
-                st.exchange(soci::use(actIDStrKey));
-                st.exchange(soci::use(signerStrKey));
-                st.define_and_bind();
-                st.execute(true);
-                if (st.get_affected_rows() != 1)
-                {
-                    throw std::runtime_error("Could not update data in SQL");
-                }
-            }
-            it_new++;
-            it_old++;
-        }
-        else if (added)
+        auto prep = mDatabase.getPreparedStatement(
+            "WITH r AS (SELECT unnest(:id::TEXT[]), unnest(:v1::BIGINT[]), "
+            "unnest(:v2::BIGINT[]), unnest(:v3::INT[]), unnest(:v4::TEXT[]), "
+            "unnest(:v5::TEXT[]), unnest(:v6::TEXT[]), unnest(:v7::INT[]), "
+            "unnest(:v8::INT[]), unnest(:v9::BIGINT[]), "
+            "unnest(:v10::BIGINT[]), unnest(:v11::BYTEA[])) "
+            "INSERT INTO accounts ( accountid, balance, seqnum, "
+            "numsubentries, inflationdest, homedomain, thresholds, flags, "
+            "lastmodified, buyingliabilities, sellingliabilities, signers ) "
+            "SELECT * FROM r ON CONFLICT (accountid) DO UPDATE SET "
+            "balance = excluded.balance, seqnum = excluded.seqnum, "
+            "numsubentries = excluded.numsubentries, "
+            "inflationdest = excluded.inflationdest, "
+            "homedomain = excluded.homedomain, "
+            "thresholds = excluded.thresholds, flags = excluded.flags, "
+            "lastmodified = excluded.lastmodified, "
+            "buyingliabilities = excluded.buyingliabilities, "
+            "sellingliabilities = excluded.sellingliabilities, "
+            "signers = excluded.signers");
+        auto& st = prep.statement();
+        st.exchange(soci::use(strAccountIDs, "id"));
+        st.exchange(soci::use(strBalances, "v1"));
+        st.exchange(soci::use(strSeqNums, "v2"));
+        st.exchange(soci::use(strNumSubEntries, "v3"));
+        st.exchange(soci::use(strInflationDests, "v4"));
+        st.exchange(soci::use(strHomeDomains, "v5"));
+        st.exchange(soci::use(strThresholds, "v6"));
+        st.exchange(soci::use(strFlags, "v7"));
+        st.exchange(soci::use(strLastModifieds, "v8"));
+        st.exchange(soci::use(strBuyingLiabilities, "v9"));
+        st.exchange(soci::use(strSellingLiabilities, "v10"));
+        st.exchange(soci::use(strSigners, "v11"));
+        st.define_and_bind();
         {
-            // signer was added
-            std::string signerStrKey = KeyUtils::toStrKey(it_new->key);
-
-            auto prep = mDatabase.getPreparedStatement(
-                "INSERT INTO signers (accountid,publickey,weight) "
-                "VALUES (:v1,:v2,:v3)");
-            auto& st = prep.statement();
-            st.exchange(soci::use(actIDStrKey));
-            st.exchange(soci::use(signerStrKey));
-            st.exchange(soci::use(it_new->weight));
-            st.define_and_bind();
+            auto timer = mDatabase.getUpsertTimer("account");
             st.execute(true);
-            if (st.get_affected_rows() != 1)
-            {
-                throw std::runtime_error("Could not update data in SQL");
-            }
-            it_new++;
-        }
-        else
-        {
-            // signer was deleted
-            std::string signerStrKey = KeyUtils::toStrKey(it_old->key);
-
-            auto prep = mDatabase.getPreparedStatement(
-                "DELETE from signers WHERE accountid=:v2 AND publickey=:v3");
-            auto& st = prep.statement();
-            st.exchange(soci::use(actIDStrKey));
-            st.exchange(soci::use(signerStrKey));
-            st.define_and_bind();
-            {
-                auto timer = mDatabase.getDeleteTimer("signer");
-                st.execute(true);
-            }
-            if (st.get_affected_rows() != 1)
-            {
-                throw std::runtime_error("Could not update data in SQL");
-            }
-            it_old++;
         }
+        affected = st.get_affected_rows();
+    }
+    if (static_cast<size_t>(affected) != n)
+    {
+        throw std::runtime_error("Could not update data in SQL");
     }
 }
 
 void
-LedgerStateRoot::Impl::deleteAccount(LedgerKey const& key)
+LedgerStateRoot::Impl::bulkDeleteAccounts(
+    std::vector<LedgerKey const*> const& keys, bool mustExist)
 {
-    std::string actIDStrKey = KeyUtils::toStrKey(key.account().accountID);
+    if (keys.empty())
+    {
+        return;
+    }
+
+    std::vector<std::string> accountIDs;
+    accountIDs.reserve(keys.size());
+    for (auto const* key : keys)
+    {
+        accountIDs.emplace_back(KeyUtils::toStrKey(key->account().accountID));
+    }
 
+    long long affected = 0;
+    if (mDatabase.isSqlite())
     {
         auto prep = mDatabase.getPreparedStatement(
-            "DELETE FROM accounts WHERE accountid= :v1");
+            "DELETE FROM accounts WHERE accountid = :id");
         auto& st = prep.statement();
-        st.exchange(soci::use(actIDStrKey));
+        st.exchange(soci::use(accountIDs, "id"));
         st.define_and_bind();
         {
             auto timer = mDatabase.getDeleteTimer("account");
             st.execute(true);
         }
-        if (st.get_affected_rows() != 1)
-        {
-            throw std::runtime_error("Could not update data in SQL");
-        }
+        affected = st.get_affected_rows();
     }
-
+    else
     {
+        std::string strAccountIDs = DatabaseUtils::toPGArray(accountIDs);
         auto prep = mDatabase.getPreparedStatement(
-            "DELETE FROM signers WHERE accountid= :v1");
+            "DELETE FROM accounts WHERE accountid = ANY(:id::TEXT[])");
         auto& st = prep.statement();
-        st.exchange(soci::use(actIDStrKey));
+        st.exchange(soci::use(strAccountIDs, "id"));
         st.define_and_bind();
         {
-            auto timer = mDatabase.getDeleteTimer("signer");
+            auto timer = mDatabase.getDeleteTimer("account");
             st.execute(true);
         }
+        affected = st.get_affected_rows();
+    }
+    if (mustExist && static_cast<size_t>(affected) != keys.size())
+    {
+        throw std::runtime_error("Could not update data in SQL");
+    }
+}
+
+void
+LedgerStateRoot::Impl::writeSignersTableIntoAccountsTable()
+{
+    throwIfChild();
+    mEntryCache.clear();
+
+    std::map<std::string, xdr::xvector<Signer, 20>> signersByAccountID;
+    {
+        std::string accountID, pubKey;
+        Signer signer;
+        soci::statement st =
+            (mDatabase.getSession().prepare
+                 << "SELECT accountid, publickey, weight FROM signers",
+             soci::into(accountID), soci::into(pubKey),
+             soci::into(signer.weight));
+        st.execute(true);
+        while (st.got_data())
+        {
+            signer.key = KeyUtils::fromStrKey<SignerKey>(pubKey);
+            signersByAccountID[accountID].push_back(signer);
+            st.fetch();
+        }
+    }
+    if (signersByAccountID.empty())
+    {
+        return;
+    }
+
+    std::string accountID;
+    BinaryUse signers(mDatabase.getSession());
+    soci::statement st =
+        (mDatabase.getSession().prepare
+             << "UPDATE accounts SET signers = :v1 WHERE accountid = :id",
+         signers.use(), soci::use(accountID));
+    for (auto& kv : signersByAccountID)
+    {
+        std::sort(kv.second.begin(), kv.second.end(),
+                  [](Signer const& lhs, Signer const& rhs) {
+                      return lhs.key < rhs.key;
+                  });
+        accountID = kv.first;
+        signers.set(xdr::xdr_to_opaque(kv.second));
+        st.execute(true);
     }
 }
 
@@ -372,7 +528,8 @@ LedgerStateRoot::Impl::dropAccounts()
 {
     throwIfChild();
     mEntryCache.clear();
-    mBestOffersCache.clear();
+    mOrderBook.reset();
+    mInflationVoteTally.reset();
 
     mDatabase.getSession() << "DROP TABLE IF EXISTS accounts;";
     mDatabase.getSession() << "DROP TABLE IF EXISTS signers;";
@@ -5,6 +5,7 @@
 #include "crypto/KeyUtils.h"
 #include "crypto/SecretKey.h"
 #include "database/Database.h"
+#include "database/DatabaseUtils.h"
 #include "ledger/LedgerStateImpl.h"
 #include "util/Decoder.h"
 
@@ -53,59 +54,132 @@ LedgerStateRoot::Impl::loadData(LedgerKey const& key) const
 }
 
 void
-LedgerStateRoot::Impl::insertOrUpdateData(LedgerEntry const& entry,
-                                          bool isInsert)
+LedgerStateRoot::Impl::bulkUpsertData(
+    std::vector<LedgerEntry const*> const& entries)
 {
-    auto const& data = entry.data.data();
-    std::string actIDStrKey = KeyUtils::toStrKey(data.accountID);
-    std::string const& dataName = data.dataName;
-    std::string dataValue = decoder::encode_b64(data.dataValue);
+    if (entries.empty())
+    {
+        return;
+    }
+
+    std::vector<std::string> accountIDs, dataNames, dataValues;
+    std::vector<int32_t> lastModifieds;
+    accountIDs.reserve(entries.size());
+    dataNames.reserve(entries.size());
+    dataValues.reserve(entries.size());
+    lastModifieds.reserve(entries.size());
+    for (auto const* entry : entries)
+    {
+        auto const& data = entry->data.data();
+        accountIDs.emplace_back(KeyUtils::toStrKey(data.accountID));
+        dataNames.emplace_back(data.dataName);
+        dataValues.emplace_back(decoder::encode_b64(data.dataValue));
+        lastModifieds.emplace_back(
+            static_cast<int32_t>(entry->lastModifiedLedgerSeq));
+    }
 
-    std::string sql;
-    if (isInsert)
+    long long affected = 0;
+    if (mDatabase.isSqlite())
     {
-        sql = "INSERT INTO accountdata "
-              "(accountid,dataname,datavalue,lastmodified)"
-              " VALUES (:aid,:dn,:dv,:lm)";
+        auto prep = mDatabase.getPreparedStatement(
+            "INSERT OR REPLACE INTO accountdata "
+            "(accountid,dataname,datavalue,lastmodified)"
+            " VALUES (:aid,:dn,:dv,:lm)");
+        auto& st = prep.statement();
+        st.exchange(soci::use(accountIDs, "aid"));
+        st.exchange(soci::use(dataNames, "dn"));
+        st.exchange(soci::use(dataValues, "dv"));
+        st.exchange(soci::use(lastModifieds, "lm"));
+        st.define_and_bind();
+        {
+            auto timer = mDatabase.getUpsertTimer("data");
+            st.execute(true);
+        }
+        affected = st.get_affected_rows();
     }
     else
     {
-        sql = "UPDATE accountdata SET datavalue=:dv,lastmodified=:lm "
-              " WHERE accountid=:aid AND dataname=:dn";
+        std::string strAccountIDs = DatabaseUtils::toPGArray(accountIDs);
+        std::string strDataNames = DatabaseUtils::toPGArray(dataNames);
+        std::string strDataValues = DatabaseUtils::toPGArray(dataValues);
+        std::string strLastModifieds = DatabaseUtils::toPGArray(lastModifieds);
+        auto prep = mDatabase.getPreparedStatement(
+            "WITH r AS (SELECT unnest(:aid::TEXT[]), unnest(:dn::TEXT[]), "
+            "unnest(:dv::TEXT[]), unnest(:lm::INT[])) "
+            "INSERT INTO accountdata "
+            "(accountid,dataname,datavalue,lastmodified) "
+            "SELECT * FROM r ON CONFLICT (accountid,dataname) DO UPDATE SET "
+            "datavalue = excluded.datavalue, "
+            "lastmodified = excluded.lastmodified");
+        auto& st = prep.statement();
+        st.exchange(soci::use(strAccountIDs, "aid"));
+        st.exchange(soci::use(strDataNames, "dn"));
+        st.exchange(soci::use(strDataValues, "dv"));
+        st.exchange(soci::use(strLastModifieds, "lm"));
+        st.define_and_bind();
+        {
+            auto timer = mDatabase.getUpsertTimer("data");
+            st.execute(true);
+        }
+        affected = st.get_affected_rows();
     }
-
-    auto prep = mDatabase.getPreparedStatement(sql);
-    auto& st = prep.statement();
-    st.exchange(soci::use(actIDStrKey, "aid"));
-    st.exchange(soci::use(dataName, "dn"));
-    st.exchange(soci::use(dataValue, "dv"));
-    st.exchange(soci::use(entry.lastModifiedLedgerSeq, "lm"));
-    st.define_and_bind();
-    st.execute(true);
-    if (st.get_affected_rows() != 1)
+    if (static_cast<size_t>(affected) != entries.size())
     {
         throw std::runtime_error("could not update SQL");
     }
 }
 
 void
-LedgerStateRoot::Impl::deleteData(LedgerKey const& key)
+LedgerStateRoot::Impl::bulkDeleteData(std::vector<LedgerKey const*> const& keys,
+                                      bool mustExist)
 {
-    auto const& data = key.data();
-    std::string actIDStrKey = KeyUtils::toStrKey(data.accountID);
-    std::string const& dataName = data.dataName;
+    if (keys.empty())
+    {
+        return;
+    }
 
-    auto prep = mDatabase.getPreparedStatement(
-        "DELETE FROM accountdata WHERE accountid=:id AND dataname=:s");
-    auto& st = prep.statement();
-    st.exchange(soci::use(actIDStrKey));
-    st.exchange(soci::use(dataName));
-    st.define_and_bind();
+    std::vector<std::string> accountIDs, dataNames;
+    accountIDs.reserve(keys.size());
+    dataNames.reserve(keys.size());
+    for (auto const* key : keys)
+    {
+        accountIDs.emplace_back(KeyUtils::toStrKey(key->data().accountID));
+        dataNames.emplace_back(key->data().dataName);
+    }
+
+    long long affected = 0;
+    if (mDatabase.isSqlite())
+    {
+        auto prep = mDatabase.getPreparedStatement(
+            "DELETE FROM accountdata WHERE accountid=:id AND dataname=:s");
+        auto& st = prep.statement();
+        st.exchange(soci::use(accountIDs, "id"));
+        st.exchange(soci::use(dataNames, "s"));
+        st.define_and_bind();
+        {
+            auto timer = mDatabase.getDeleteTimer("data");
+            st.execute(true);
+        }
+        affected = st.get_affected_rows();
+    }
+    else
     {
-        auto timer = mDatabase.getDeleteTimer("data");
-        st.execute(true);
+        std::string strAccountIDs = DatabaseUtils::toPGArray(accountIDs);
+        std::string strDataNames = DatabaseUtils::toPGArray(dataNames);
+        auto prep = mDatabase.getPreparedStatement(
+            "DELETE FROM accountdata WHERE (accountid, dataname) IN "
+            "(SELECT unnest(:id::TEXT[]), unnest(:s::TEXT[]))");
+        auto& st = prep.statement();
+        st.exchange(soci::use(strAccountIDs, "id"));
+        st.exchange(soci::use(strDataNames, "s"));
+        st.define_and_bind();
+        {
+            auto timer = mDatabase.getDeleteTimer("data");
+            st.execute(true);
+        }
+        affected = st.get_affected_rows();
     }
-    if (st.get_affected_rows() != 1)
+    if (mustExist && static_cast<size_t>(affected) != keys.size())
     {
         throw std::runtime_error("Could not update data in SQL");
     }
@@ -116,7 +190,7 @@ LedgerStateRoot::Impl::dropData()
 {
     throwIfChild();
     mEntryCache.clear();
-    mBestOffersCache.clear();
+    mOrderBook.reset();
 
     mDatabase.getSession() << "DROP TABLE IF EXISTS accountdata;";
     mDatabase.getSession() << "CREATE TABLE accountdata"
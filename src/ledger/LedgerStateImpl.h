@@ -2,9 +2,19 @@
 // under the Apache License, Version 2.0. See the COPYING file at the root
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
+#include "crypto/SecretKey.h"
 #include "database/Database.h"
 #include "ledger/LedgerState.h"
 #include "util/lrucache.hpp"
+#include <unordered_map>
+
+namespace medida
+{
+class Histogram;
+class Meter;
+class MetricsRegistry;
+class Timer;
+}
 
 namespace spn
 {
@@ -22,6 +32,8 @@ class EntryIterator::AbstractImpl
 
     virtual LedgerEntry const& entry() const = 0;
 
+    virtual std::shared_ptr<LedgerEntry> const& entryPtr() const = 0;
+
     virtual bool entryExists() const = 0;
 
     virtual LedgerKey const& key() const = 0;
@@ -130,8 +142,7 @@ class LedgerState::Impl
     //   modified
     // - the entry cache may be, but is not guaranteed to be, modified or even
     //   cleared
-    // - the best offers cache may be, but is not guaranteed to be, modified or
-    //   even cleared
+    // - the order book may be, but is not guaranteed to be, unloaded
     std::shared_ptr<LedgerEntry const>
     getBestOffer(Asset const& buying, Asset const& selling,
                  std::set<LedgerKey>& exclude);
@@ -209,8 +220,7 @@ class LedgerState::Impl
     //   modified
     // - the entry cache may be, but is not guaranteed to be, modified or even
     //   cleared
-    // - the best offers cache may be, but is not guaranteed to be, modified or
-    //   even cleared
+    // - the order book may be, but is not guaranteed to be, unloaded
     LedgerStateEntry loadBestOffer(LedgerState& self, Asset const& buying,
                                    Asset const& selling);
 
@@ -234,6 +244,14 @@ class LedgerState::Impl
     ConstLedgerStateEntry loadWithoutRecord(LedgerState& self,
                                             LedgerKey const& key);
 
+    // prefetch has the basic exception safety guarantee. If it throws an
+    // exception, then
+    // - the prepared statement cache may be, but is not guaranteed to be,
+    //   modified
+    // - the entry cache may be, but is not guaranteed to be, modified or even
+    //   cleared.
+    void prefetch(std::set<LedgerKey> const& keys);
+
     // rollback does not throw
     void rollback();
 
@@ -259,6 +277,8 @@ class LedgerState::Impl::EntryIteratorImpl : public EntryIterator::AbstractImpl
 
     LedgerEntry const& entry() const override;
 
+    std::shared_ptr<LedgerEntry> const& entryPtr() const override;
+
     bool entryExists() const override;
 
     LedgerKey const& key() const override;
@@ -280,59 +300,96 @@ class LedgerStateRoot::Impl
     typedef cache::lru_cache<EntryCacheKey, std::shared_ptr<LedgerEntry const>>
         EntryCache;
 
-    typedef std::string BestOffersCacheKey;
-    struct BestOffersCacheEntry
+    // The order book holds every offer in the database, grouped by (buying,
+    // selling) asset pair and sorted within each group by the order induced
+    // by isBetterOffer. It is loaded from the database on first use and then
+    // updated with the offers committed by each child.
+    struct IsBetterOfferComparator
+    {
+        bool operator()(std::shared_ptr<LedgerEntry const> const& lhs,
+                        std::shared_ptr<LedgerEntry const> const& rhs) const;
+    };
+    typedef std::set<std::shared_ptr<LedgerEntry const>,
+                     IsBetterOfferComparator>
+        SortedOffers;
+    struct OrderBook
+    {
+        std::map<std::pair<Asset, Asset>, SortedOffers> offersByAssets;
+        std::unordered_map<uint64_t, std::shared_ptr<LedgerEntry const>>
+            offersByID;
+    };
+
+    static int64_t const MIN_BALANCE_TO_VOTE = 1000000000;
+
+    // The inflation vote tally holds the vote of every account that has an
+    // inflation destination and a balance of at least MIN_BALANCE_TO_VOTE, and
+    // the resulting total for every destination ranked by votes and then by
+    // destination, both descending. It is loaded from the database on first
+    // use and then updated with the accounts committed by each child.
+    struct InflationVoteTally
     {
-        std::list<LedgerEntry> bestOffers;
-        bool allLoaded;
+        typedef std::pair<int64_t, std::string> Rank;
+
+        // voter -> (destination, votes)
+        std::unordered_map<AccountID, InflationWinner> votesByVoter;
+        std::unordered_map<AccountID, int64_t> totalByDestination;
+        std::map<Rank, AccountID, std::greater<Rank>> ranking;
     };
-    typedef cache::lru_cache<std::string, BestOffersCacheEntry> BestOffersCache;
 
     Database& mDatabase;
     std::unique_ptr<LedgerHeader> mHeader;
     mutable EntryCache mEntryCache;
-    mutable BestOffersCache mBestOffersCache;
+    mutable std::unique_ptr<OrderBook> mOrderBook;
+    mutable std::unique_ptr<InflationVoteTally> mInflationVoteTally;
     std::unique_ptr<soci::transaction> mTransaction;
     AbstractLedgerState* mChild;
 
+    medida::Timer& mCommitFlushTimer;
+    medida::Histogram& mCommitBatchSize;
+
+    medida::Meter& mEntryCacheHit;
+    medida::Meter& mEntryCacheMiss;
+    medida::Meter& mEntryCacheEvict;
+    medida::Histogram& mPrefetchHitRate;
+
     void throwIfChild() const;
 
     std::shared_ptr<LedgerEntry const> loadAccount(LedgerKey const& key) const;
     std::shared_ptr<LedgerEntry const> loadData(LedgerKey const& key) const;
     std::shared_ptr<LedgerEntry const> loadOffer(LedgerKey const& key) const;
     std::vector<LedgerEntry> loadAllOffers() const;
-    std::list<LedgerEntry>::const_iterator
-    loadOffers(StatementContext& prep, std::list<LedgerEntry>& offers) const;
-    std::list<LedgerEntry>::const_iterator
-    loadBestOffers(std::list<LedgerEntry>& offers, Asset const& buying,
-                   Asset const& selling, size_t numOffers, size_t offset) const;
     std::vector<LedgerEntry>
     loadOffersByAccountAndAsset(AccountID const& accountID,
                                 Asset const& asset) const;
     std::vector<LedgerEntry> loadOffers(StatementContext& prep) const;
-    std::vector<Signer> loadSigners(LedgerKey const& key) const;
-    std::vector<InflationWinner> loadInflationWinners(size_t maxWinners,
-                                                      int64_t minBalance) const;
+    void loadInflationVotes(InflationVoteTally& tally) const;
     std::shared_ptr<LedgerEntry const>
     loadTrustLine(LedgerKey const& key) const;
 
-    void storeAccount(EntryIterator const& iter);
-    void storeData(EntryIterator const& iter);
-    void storeOffer(EntryIterator const& iter);
-    void storeTrustLine(EntryIterator const& iter);
-
-    void storeSigners(LedgerEntry const& entry,
-                      std::shared_ptr<LedgerEntry const> const& previous);
-
-    void deleteAccount(LedgerKey const& key);
-    void deleteData(LedgerKey const& key);
-    void deleteOffer(LedgerKey const& key);
-    void deleteTrustLine(LedgerKey const& key);
-
-    void insertOrUpdateAccount(LedgerEntry const& entry, bool isInsert);
-    void insertOrUpdateData(LedgerEntry const& entry, bool isInsert);
-    void insertOrUpdateOffer(LedgerEntry const& entry, bool isInsert);
-    void insertOrUpdateTrustLine(LedgerEntry const& entry, bool isInsert);
+    // loadAccounts and loadTrustLines return every entry associated with one
+    // of keys that exists in the database, using one query per batch of keys.
+    std::vector<LedgerEntry>
+    loadAccounts(std::vector<LedgerKey> const& keys) const;
+    std::vector<LedgerEntry>
+    loadTrustLines(std::vector<LedgerKey> const& keys) const;
+
+    // The bulk operations below write every change of a single entry type
+    // committed by a child in one statement. They throw if the number of rows
+    // affected does not match the number of entries, except for deletes with
+    // mustExist set to false.
+    void bulkUpsertAccounts(std::vector<LedgerEntry const*> const& entries);
+    void bulkUpsertData(std::vector<LedgerEntry const*> const& entries);
+    void bulkUpsertOffers(std::vector<LedgerEntry const*> const& entries);
+    void bulkUpsertTrustLines(std::vector<LedgerEntry const*> const& entries);
+
+    void bulkDeleteAccounts(std::vector<LedgerKey const*> const& keys,
+                            bool mustExist = true);
+    void bulkDeleteData(std::vector<LedgerKey const*> const& keys,
+                        bool mustExist = true);
+    void bulkDeleteOffers(std::vector<LedgerKey const*> const& keys,
+                          bool mustExist = true);
+    void bulkDeleteTrustLines(std::vector<LedgerKey const*> const& keys,
+                              bool mustExist = true);
 
     static std::string tableFromLedgerEntryType(LedgerEntryType let);
 
@@ -342,13 +399,35 @@ class LedgerStateRoot::Impl
     void putInEntryCache(EntryCacheKey const& key,
                          std::shared_ptr<LedgerEntry const> const& entry) const;
 
-    BestOffersCacheEntry&
-    getFromBestOffersCache(Asset const& buying, Asset const& selling,
-                           BestOffersCacheEntry& defaultValue) const;
+    // getOrderBook loads the order book if it is not already loaded
+    OrderBook& getOrderBook() const;
+    static void addToOrderBook(OrderBook& orderBook,
+                               std::shared_ptr<LedgerEntry const> const& offer);
+    static void removeFromOrderBook(OrderBook& orderBook, uint64_t offerID);
+
+    // getInflationVoteTally loads the inflation vote tally if it is not
+    // already loaded
+    InflationVoteTally& getInflationVoteTally() const;
+    static void addInflationVote(InflationVoteTally& tally,
+                                 AccountEntry const& account);
+    static void removeInflationVote(InflationVoteTally& tally,
+                                    AccountID const& voter);
+    static void addToInflationVoteTotal(InflationVoteTally& tally,
+                                        AccountID const& destination,
+                                        int64_t votes);
+
+    // updateCachesAfterCommit replaces the cached version of every entry in
+    // upserts and deletes by its committed version, and applies the committed
+    // offers to the order book and the committed accounts to the inflation
+    // vote tally. It does not throw, but the entry cache is cleared and the
+    // order book and inflation vote tally are unloaded if an update fails.
+    void updateCachesAfterCommit(
+        std::vector<LedgerEntry const*> const& upserts,
+        std::vector<LedgerKey const*> const& deletes) const;
 
   public:
     // Constructor has the strong exception safety guarantee
-    Impl(Database& db, size_t entryCacheSize, size_t bestOfferCacheSize);
+    Impl(Database& db, medida::MetricsRegistry& metrics, size_t entryCacheSize);
 
     ~Impl();
 
@@ -373,6 +452,9 @@ class LedgerStateRoot::Impl
     void dropOffers();
     void dropTrustLines();
 
+    // writeSignersTableIntoAccountsTable has no exception safety guarantees.
+    void writeSignersTableIntoAccountsTable();
+
     // getAllOffers has the basic exception safety guarantee. If it throws an
     // exception, then
     // - the prepared statement cache may be, but is not guaranteed to be,
@@ -385,8 +467,7 @@ class LedgerStateRoot::Impl
     //   modified
     // - the entry cache may be, but is not guaranteed to be, modified or even
     //   cleared
-    // - the best offers cache may be, but is not guaranteed to be, modified or
-    //   even cleared
+    // - the order book may be, but is not guaranteed to be, unloaded
     std::shared_ptr<LedgerEntry const>
     getBestOffer(Asset const& buying, Asset const& selling,
                  std::set<LedgerKey>& exclude);
@@ -416,6 +497,21 @@ class LedgerStateRoot::Impl
     std::shared_ptr<LedgerEntry const>
     getNewestVersion(LedgerKey const& key) const;
 
+    // loadInflationVoteTally has the strong exception safety guarantee.
+    void loadInflationVoteTally();
+
+    // writeBucketEntries has no exception safety guarantees.
+    void writeBucketEntries(std::vector<LedgerEntry> const& liveEntries,
+                            std::vector<LedgerKey> const& deadEntries);
+
+    // prefetch has the basic exception safety guarantee. If it throws an
+    // exception, then
+    // - the prepared statement cache may be, but is not guaranteed to be,
+    //   modified
+    // - the entry cache may be, but is not guaranteed to be, modified or even
+    //   cleared.
+    void prefetch(std::set<LedgerKey> const& keys);
+
     // rollbackChild has the strong exception safety guarantee.
     void rollbackChild();
 };
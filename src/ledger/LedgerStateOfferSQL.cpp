@@ -5,6 +5,7 @@
 #include "crypto/KeyUtils.h"
 #include "crypto/SecretKey.h"
 #include "database/Database.h"
+#include "database/DatabaseUtils.h"
 #include "ledger/LedgerStateImpl.h"
 #include "util/XDROperators.h"
 #include "util/types.h"
@@ -92,94 +93,8 @@ LedgerStateRoot::Impl::loadAllOffers() const
     return offers;
 }
 
-std::list<LedgerEntry>::const_iterator
-LedgerStateRoot::Impl::loadBestOffers(std::list<LedgerEntry>& offers,
-                                      Asset const& buying, Asset const& selling,
-                                      size_t numOffers, size_t offset) const
-{
-    std::string sql = "SELECT sellerid, offerid, "
-                      "sellingassettype, sellingassetcode, sellingissuer, "
-                      "buyingassettype, buyingassetcode, buyingissuer, "
-                      "amount, pricen, priced, flags, lastmodified "
-                      "FROM offers ";
-
-    std::string sellingAssetCode, sellingIssuerStrKey;
-    if (selling.type() == ASSET_TYPE_NATIVE)
-    {
-        sql += " WHERE sellingassettype = 0 AND sellingissuer IS NULL";
-    }
-    else
-    {
-        if (selling.type() == ASSET_TYPE_CREDIT_ALPHANUM4)
-        {
-            assetCodeToStr(selling.alphaNum4().assetCode, sellingAssetCode);
-            sellingIssuerStrKey =
-                KeyUtils::toStrKey(selling.alphaNum4().issuer);
-        }
-        else if (selling.type() == ASSET_TYPE_CREDIT_ALPHANUM12)
-        {
-            assetCodeToStr(selling.alphaNum12().assetCode, sellingAssetCode);
-            sellingIssuerStrKey =
-                KeyUtils::toStrKey(selling.alphaNum12().issuer);
-        }
-        else
-        {
-            throw std::runtime_error("unknown asset type");
-        }
-        sql += " WHERE sellingassetcode = :sac AND sellingissuer = :si";
-    }
-
-    std::string buyingAssetCode, buyingIssuerStrKey;
-    if (buying.type() == ASSET_TYPE_NATIVE)
-    {
-        sql += " AND buyingassettype = 0 AND buyingissuer IS NULL";
-    }
-    else
-    {
-        if (buying.type() == ASSET_TYPE_CREDIT_ALPHANUM4)
-        {
-            assetCodeToStr(buying.alphaNum4().assetCode, buyingAssetCode);
-            buyingIssuerStrKey = KeyUtils::toStrKey(buying.alphaNum4().issuer);
-        }
-        else if (buying.type() == ASSET_TYPE_CREDIT_ALPHANUM12)
-        {
-            assetCodeToStr(buying.alphaNum12().assetCode, buyingAssetCode);
-            buyingIssuerStrKey = KeyUtils::toStrKey(buying.alphaNum12().issuer);
-        }
-        else
-        {
-            throw std::runtime_error("unknown asset type");
-        }
-        sql += " AND buyingassetcode = :bac AND buyingissuer = :bi";
-    }
-
-    // price is an approximation of the actual n/d (truncated math, 15 digits)
-    // ordering by offerid gives precendence to older offers for fairness
-    sql += " ORDER BY price, offerid LIMIT :n OFFSET :o";
-
-    auto prep = mDatabase.getPreparedStatement(sql);
-    auto& st = prep.statement();
-    if (selling.type() != ASSET_TYPE_NATIVE)
-    {
-        st.exchange(soci::use(sellingAssetCode, "sac"));
-        st.exchange(soci::use(sellingIssuerStrKey, "si"));
-    }
-    if (buying.type() != ASSET_TYPE_NATIVE)
-    {
-        st.exchange(soci::use(buyingAssetCode, "bac"));
-        st.exchange(soci::use(buyingIssuerStrKey, "bi"));
-    }
-    st.exchange(soci::use(numOffers, "n"));
-    st.exchange(soci::use(offset, "o"));
-
-    {
-        auto timer = mDatabase.getSelectTimer("offer");
-        return loadOffers(prep, offers);
-    }
-}
-
-// Note: The order induced by this function must match the order used in the
-// SQL query for loadBestOffers above.
+// Note: This function determines the order of the offers in the order book
+// maintained by LedgerStateRoot.
 bool
 isBetterOffer(LedgerEntry const& lhsEntry, LedgerEntry const& rhsEntry)
 {
@@ -304,171 +219,224 @@ LedgerStateRoot::Impl::loadOffers(StatementContext& prep) const
     return offers;
 }
 
-std::list<LedgerEntry>::const_iterator
-LedgerStateRoot::Impl::loadOffers(StatementContext& prep,
-                                  std::list<LedgerEntry>& offers) const
+static void
+getAssetStrings(Asset const& asset, std::string& assetCode,
+                std::string& issuerStrKey, soci::indicator& ind)
 {
-    std::string actIDStrKey;
-    unsigned int sellingAssetType, buyingAssetType;
-    std::string sellingAssetCode, buyingAssetCode, sellingIssuerStrKey,
-        buyingIssuerStrKey;
-    soci::indicator sellingAssetCodeIndicator, buyingAssetCodeIndicator,
-        sellingIssuerIndicator, buyingIssuerIndicator;
-
-    LedgerEntry le;
-    le.data.type(OFFER);
-    OfferEntry& oe = le.data.offer();
-
-    auto& st = prep.statement();
-    st.exchange(soci::into(actIDStrKey));
-    st.exchange(soci::into(oe.offerID));
-    st.exchange(soci::into(sellingAssetType));
-    st.exchange(soci::into(sellingAssetCode, sellingAssetCodeIndicator));
-    st.exchange(soci::into(sellingIssuerStrKey, sellingIssuerIndicator));
-    st.exchange(soci::into(buyingAssetType));
-    st.exchange(soci::into(buyingAssetCode, buyingAssetCodeIndicator));
-    st.exchange(soci::into(buyingIssuerStrKey, buyingIssuerIndicator));
-    st.exchange(soci::into(oe.amount));
-    st.exchange(soci::into(oe.price.n));
-    st.exchange(soci::into(oe.price.d));
-    st.exchange(soci::into(oe.flags));
-    st.exchange(soci::into(le.lastModifiedLedgerSeq));
-    st.define_and_bind();
-    st.execute(true);
-
-    auto iterNext = offers.cend();
-    while (st.got_data())
+    if (asset.type() == ASSET_TYPE_CREDIT_ALPHANUM4)
     {
-        oe.sellerID = KeyUtils::fromStrKey<PublicKey>(actIDStrKey);
-        processAsset(oe.selling, (AssetType)sellingAssetType,
-                     sellingIssuerStrKey, sellingIssuerIndicator,
-                     sellingAssetCode, sellingAssetCodeIndicator);
-        processAsset(oe.buying, (AssetType)buyingAssetType, buyingIssuerStrKey,
-                     buyingIssuerIndicator, buyingAssetCode,
-                     buyingAssetCodeIndicator);
-
-        if (iterNext == offers.cend())
-        {
-            iterNext = offers.emplace(iterNext, le);
-        }
-        else
-        {
-            offers.emplace_back(le);
-        }
-        st.fetch();
+        issuerStrKey = KeyUtils::toStrKey(asset.alphaNum4().issuer);
+        assetCodeToStr(asset.alphaNum4().assetCode, assetCode);
+        ind = soci::i_ok;
     }
-
-    return iterNext;
-}
-
-void
-LedgerStateRoot::Impl::insertOrUpdateOffer(LedgerEntry const& entry,
-                                           bool isInsert)
-{
-    auto const& offer = entry.data.offer();
-    std::string actIDStrKey = KeyUtils::toStrKey(offer.sellerID);
-
-    unsigned int sellingType = offer.selling.type();
-    unsigned int buyingType = offer.buying.type();
-    std::string sellingIssuerStrKey, buyingIssuerStrKey;
-    std::string sellingAssetCode, buyingAssetCode;
-    soci::indicator selling_ind = soci::i_null, buying_ind = soci::i_null;
-    double price = double(offer.price.n) / double(offer.price.d);
-
-    if (sellingType == ASSET_TYPE_CREDIT_ALPHANUM4)
+    else if (asset.type() == ASSET_TYPE_CREDIT_ALPHANUM12)
     {
-        sellingIssuerStrKey =
-            KeyUtils::toStrKey(offer.selling.alphaNum4().issuer);
-        assetCodeToStr(offer.selling.alphaNum4().assetCode, sellingAssetCode);
-        selling_ind = soci::i_ok;
+        issuerStrKey = KeyUtils::toStrKey(asset.alphaNum12().issuer);
+        assetCodeToStr(asset.alphaNum12().assetCode, assetCode);
+        ind = soci::i_ok;
     }
-    else if (sellingType == ASSET_TYPE_CREDIT_ALPHANUM12)
+    else
     {
-        sellingIssuerStrKey =
-            KeyUtils::toStrKey(offer.selling.alphaNum12().issuer);
-        assetCodeToStr(offer.selling.alphaNum12().assetCode, sellingAssetCode);
-        selling_ind = soci::i_ok;
+        ind = soci::i_null;
     }
+}
 
-    if (buyingType == ASSET_TYPE_CREDIT_ALPHANUM4)
-    {
-        buyingIssuerStrKey =
-            KeyUtils::toStrKey(offer.buying.alphaNum4().issuer);
-        assetCodeToStr(offer.buying.alphaNum4().assetCode, buyingAssetCode);
-        buying_ind = soci::i_ok;
-    }
-    else if (buyingType == ASSET_TYPE_CREDIT_ALPHANUM12)
+void
+LedgerStateRoot::Impl::bulkUpsertOffers(
+    std::vector<LedgerEntry const*> const& entries)
+{
+    if (entries.empty())
     {
-        buyingIssuerStrKey =
-            KeyUtils::toStrKey(offer.buying.alphaNum12().issuer);
-        assetCodeToStr(offer.buying.alphaNum12().assetCode, buyingAssetCode);
-        buying_ind = soci::i_ok;
+        return;
     }
 
-    std::string sql;
-    if (isInsert)
-    {
-        sql = "INSERT INTO offers (sellerid,offerid,"
-              "sellingassettype,sellingassetcode,sellingissuer,"
-              "buyingassettype,buyingassetcode,buyingissuer,"
-              "amount,pricen,priced,price,flags,lastmodified) VALUES "
-              "(:sid,:oid,:sat,:sac,:si,:bat,:bac,:bi,:a,:pn,:pd,:p,:f,:l)";
-    }
-    else
+    size_t const n = entries.size();
+    std::vector<std::string> sellerIDs, sellingAssetCodes(n),
+        sellingIssuers(n), buyingAssetCodes(n), buyingIssuers(n);
+    std::vector<soci::indicator> sellingInds(n), buyingInds(n);
+    std::vector<int64_t> offerIDs, amounts;
+    std::vector<int32_t> sellingTypes, buyingTypes, priceNs, priceDs, flags,
+        lastModifieds;
+    std::vector<double> prices;
+    sellerIDs.reserve(n);
+    offerIDs.reserve(n);
+    amounts.reserve(n);
+    sellingTypes.reserve(n);
+    buyingTypes.reserve(n);
+    priceNs.reserve(n);
+    priceDs.reserve(n);
+    flags.reserve(n);
+    lastModifieds.reserve(n);
+    prices.reserve(n);
+    for (size_t i = 0; i < n; ++i)
     {
-        sql = "UPDATE offers SET sellingassettype=:sat,"
-              "sellingassetcode=:sac,sellingissuer=:si,"
-              "buyingassettype=:bat,buyingassetcode=:bac,buyingissuer=:bi,"
-              "amount=:a,pricen=:pn,priced=:pd,price=:p,flags=:f,"
-              "lastmodified=:l WHERE offerid=:oid";
+        auto const& offer = entries[i]->data.offer();
+        sellerIDs.emplace_back(KeyUtils::toStrKey(offer.sellerID));
+        offerIDs.emplace_back(static_cast<int64_t>(offer.offerID));
+        sellingTypes.emplace_back(static_cast<int32_t>(offer.selling.type()));
+        getAssetStrings(offer.selling, sellingAssetCodes[i], sellingIssuers[i],
+                        sellingInds[i]);
+        buyingTypes.emplace_back(static_cast<int32_t>(offer.buying.type()));
+        getAssetStrings(offer.buying, buyingAssetCodes[i], buyingIssuers[i],
+                        buyingInds[i]);
+        amounts.emplace_back(offer.amount);
+        priceNs.emplace_back(offer.price.n);
+        priceDs.emplace_back(offer.price.d);
+        prices.emplace_back(double(offer.price.n) / double(offer.price.d));
+        flags.emplace_back(static_cast<int32_t>(offer.flags));
+        lastModifieds.emplace_back(
+            static_cast<int32_t>(entries[i]->lastModifiedLedgerSeq));
     }
 
-    auto prep = mDatabase.getPreparedStatement(sql);
-    auto& st = prep.statement();
-    if (isInsert)
+    long long affected = 0;
+    if (mDatabase.isSqlite())
     {
-        st.exchange(soci::use(actIDStrKey, "sid"));
+        auto prep = mDatabase.getPreparedStatement(
+            "INSERT OR REPLACE INTO offers (sellerid,offerid,"
+            "sellingassettype,sellingassetcode,sellingissuer,"
+            "buyingassettype,buyingassetcode,buyingissuer,"
+            "amount,pricen,priced,price,flags,lastmodified) VALUES "
+            "(:sid,:oid,:sat,:sac,:si,:bat,:bac,:bi,:a,:pn,:pd,:p,:f,:l)");
+        auto& st = prep.statement();
+        st.exchange(soci::use(sellerIDs, "sid"));
+        st.exchange(soci::use(offerIDs, "oid"));
+        st.exchange(soci::use(sellingTypes, "sat"));
+        st.exchange(soci::use(sellingAssetCodes, sellingInds, "sac"));
+        st.exchange(soci::use(sellingIssuers, sellingInds, "si"));
+        st.exchange(soci::use(buyingTypes, "bat"));
+        st.exchange(soci::use(buyingAssetCodes, buyingInds, "bac"));
+        st.exchange(soci::use(buyingIssuers, buyingInds, "bi"));
+        st.exchange(soci::use(amounts, "a"));
+        st.exchange(soci::use(priceNs, "pn"));
+        st.exchange(soci::use(priceDs, "pd"));
+        st.exchange(soci::use(prices, "p"));
+        st.exchange(soci::use(flags, "f"));
+        st.exchange(soci::use(lastModifieds, "l"));
+        st.define_and_bind();
+        {
+            auto timer = mDatabase.getUpsertTimer("offer");
+            st.execute(true);
+        }
+        affected = st.get_affected_rows();
     }
-    st.exchange(soci::use(offer.offerID, "oid"));
-    st.exchange(soci::use(sellingType, "sat"));
-    st.exchange(soci::use(sellingAssetCode, selling_ind, "sac"));
-    st.exchange(soci::use(sellingIssuerStrKey, selling_ind, "si"));
-    st.exchange(soci::use(buyingType, "bat"));
-    st.exchange(soci::use(buyingAssetCode, buying_ind, "bac"));
-    st.exchange(soci::use(buyingIssuerStrKey, buying_ind, "bi"));
-    st.exchange(soci::use(offer.amount, "a"));
-    st.exchange(soci::use(offer.price.n, "pn"));
-    st.exchange(soci::use(offer.price.d, "pd"));
-    st.exchange(soci::use(price, "p"));
-    st.exchange(soci::use(offer.flags, "f"));
-    st.exchange(soci::use(entry.lastModifiedLedgerSeq, "l"));
-    st.define_and_bind();
+    else
     {
-        auto timer = isInsert ? mDatabase.getInsertTimer("offer")
-                              : mDatabase.getUpdateTimer("offer");
-        st.execute(true);
+        std::string strSellerIDs = DatabaseUtils::toPGArray(sellerIDs);
+        std::string strOfferIDs = DatabaseUtils::toPGArray(offerIDs);
+        std::string strSellingTypes = DatabaseUtils::toPGArray(sellingTypes);
+        std::string strSellingAssetCodes =
+            DatabaseUtils::toPGArray(sellingAssetCodes, sellingInds);
+        std::string strSellingIssuers =
+            DatabaseUtils::toPGArray(sellingIssuers, sellingInds);
+        std::string strBuyingTypes = DatabaseUtils::toPGArray(buyingTypes);
+        std::string strBuyingAssetCodes =
+            DatabaseUtils::toPGArray(buyingAssetCodes, buyingInds);
+        std::string strBuyingIssuers =
+            DatabaseUtils::toPGArray(buyingIssuers, buyingInds);
+        std::string strAmounts = DatabaseUtils::toPGArray(amounts);
+        std::string strPriceNs = DatabaseUtils::toPGArray(priceNs);
+        std::string strPriceDs = DatabaseUtils::toPGArray(priceDs);
+        std::string strFlags = DatabaseUtils::toPGArray(flags);
+        std::string strLastModifieds = DatabaseUtils::toPGArray(lastModifieds);
+
+        // price is recomputed server-side from pricen and priced so that the
+        // array encoding does not have to round-trip doubles through text
+        auto prep = mDatabase.getPreparedStatement(
+            "WITH r AS (SELECT unnest(:sid::TEXT[]) AS sid, "
+            "unnest(:oid::BIGINT[]) AS oid, unnest(:sat::INT[]) AS sat, "
+            "unnest(:sac::TEXT[]) AS sac, unnest(:si::TEXT[]) AS si, "
+            "unnest(:bat::INT[]) AS bat, unnest(:bac::TEXT[]) AS bac, "
+            "unnest(:bi::TEXT[]) AS bi, unnest(:a::BIGINT[]) AS a, "
+            "unnest(:pn::INT[]) AS pn, unnest(:pd::INT[]) AS pd, "
+            "unnest(:f::INT[]) AS f, unnest(:l::INT[]) AS l) "
+            "INSERT INTO offers (sellerid,offerid,"
+            "sellingassettype,sellingassetcode,sellingissuer,"
+            "buyingassettype,buyingassetcode,buyingissuer,"
+            "amount,pricen,priced,price,flags,lastmodified) "
+            "SELECT sid, oid, sat, sac, si, bat, bac, bi, a, pn, pd, "
+            "CAST(pn AS DOUBLE PRECISION) / CAST(pd AS DOUBLE PRECISION), "
+            "f, l FROM r ON CONFLICT (offerid) DO UPDATE SET "
+            "sellingassettype = excluded.sellingassettype, "
+            "sellingassetcode = excluded.sellingassetcode, "
+            "sellingissuer = excluded.sellingissuer, "
+            "buyingassettype = excluded.buyingassettype, "
+            "buyingassetcode = excluded.buyingassetcode, "
+            "buyingissuer = excluded.buyingissuer, "
+            "amount = excluded.amount, pricen = excluded.pricen, "
+            "priced = excluded.priced, price = excluded.price, "
+            "flags = excluded.flags, lastmodified = excluded.lastmodified");
+        auto& st = prep.statement();
+        st.exchange(soci::use(strSellerIDs, "sid"));
+        st.exchange(soci::use(strOfferIDs, "oid"));
+        st.exchange(soci::use(strSellingTypes, "sat"));
+        st.exchange(soci::use(strSellingAssetCodes, "sac"));
+        st.exchange(soci::use(strSellingIssuers, "si"));
+        st.exchange(soci::use(strBuyingTypes, "bat"));
+        st.exchange(soci::use(strBuyingAssetCodes, "bac"));
+        st.exchange(soci::use(strBuyingIssuers, "bi"));
+        st.exchange(soci::use(strAmounts, "a"));
+        st.exchange(soci::use(strPriceNs, "pn"));
+        st.exchange(soci::use(strPriceDs, "pd"));
+        st.exchange(soci::use(strFlags, "f"));
+        st.exchange(soci::use(strLastModifieds, "l"));
+        st.define_and_bind();
+        {
+            auto timer = mDatabase.getUpsertTimer("offer");
+            st.execute(true);
+        }
+        affected = st.get_affected_rows();
     }
-    if (st.get_affected_rows() != 1)
+    if (static_cast<size_t>(affected) != n)
     {
         throw std::runtime_error("could not update SQL");
     }
 }
 
 void
-LedgerStateRoot::Impl::deleteOffer(LedgerKey const& key)
+LedgerStateRoot::Impl::bulkDeleteOffers(
+    std::vector<LedgerKey const*> const& keys, bool mustExist)
 {
-    auto const& offer = key.offer();
+    if (keys.empty())
+    {
+        return;
+    }
 
-    auto prep =
-        mDatabase.getPreparedStatement("DELETE FROM offers WHERE offerid=:s");
-    auto& st = prep.statement();
-    st.exchange(soci::use(offer.offerID));
-    st.define_and_bind();
+    std::vector<int64_t> offerIDs;
+    offerIDs.reserve(keys.size());
+    for (auto const* key : keys)
+    {
+        offerIDs.emplace_back(static_cast<int64_t>(key->offer().offerID));
+    }
+
+    long long affected = 0;
+    if (mDatabase.isSqlite())
+    {
+        auto prep = mDatabase.getPreparedStatement(
+            "DELETE FROM offers WHERE offerid=:s");
+        auto& st = prep.statement();
+        st.exchange(soci::use(offerIDs, "s"));
+        st.define_and_bind();
+        {
+            auto timer = mDatabase.getDeleteTimer("offer");
+            st.execute(true);
+        }
+        affected = st.get_affected_rows();
+    }
+    else
     {
-        auto timer = mDatabase.getDeleteTimer("offer");
-        st.execute(true);
+        std::string strOfferIDs = DatabaseUtils::toPGArray(offerIDs);
+        auto prep = mDatabase.getPreparedStatement(
+            "DELETE FROM offers WHERE offerid = ANY(:s::BIGINT[])");
+        auto& st = prep.statement();
+        st.exchange(soci::use(strOfferIDs, "s"));
+        st.define_and_bind();
+        {
+            auto timer = mDatabase.getDeleteTimer("offer");
+            st.execute(true);
+        }
+        affected = st.get_affected_rows();
     }
-    if (st.get_affected_rows() != 1)
+    if (mustExist && static_cast<size_t>(affected) != keys.size())
     {
         throw std::runtime_error("Could not update data in SQL");
     }
@@ -479,7 +447,7 @@ LedgerStateRoot::Impl::dropOffers()
 {
     throwIfChild();
     mEntryCache.clear();
-    mBestOffersCache.clear();
+    mOrderBook.reset();
 
     mDatabase.getSession() << "DROP TABLE IF EXISTS offers;";
     mDatabase.getSession()
@@ -0,0 +1,97 @@
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "ledger/LedgerStateSnapshot.h"
+
+namespace spn
+{
+
+LedgerStateSnapshot::LedgerStateSnapshot(AbstractLedgerStateParent& parent,
+                                         std::set<LedgerKey> const& keys)
+    : mHeader(parent.getHeader())
+{
+    parent.prefetch(keys);
+    for (auto const& key : keys)
+    {
+        mEntries.emplace(key, parent.getNewestVersion(key));
+    }
+}
+
+LedgerStateSnapshot::View::View(LedgerStateSnapshot const& snapshot)
+    : mSnapshot(snapshot), mChild(nullptr)
+{
+}
+
+void
+LedgerStateSnapshot::View::addChild(AbstractLedgerState& child)
+{
+    if (mChild)
+    {
+        throw std::runtime_error("LedgerStateSnapshot::View already has child");
+    }
+    mChild = &child;
+}
+
+void
+LedgerStateSnapshot::View::commitChild(EntryIterator iter)
+{
+    throw std::runtime_error("LedgerStateSnapshot::View is read-only");
+}
+
+void
+LedgerStateSnapshot::View::rollbackChild()
+{
+    mChild = nullptr;
+}
+
+std::map<LedgerKey, LedgerEntry>
+LedgerStateSnapshot::View::getAllOffers()
+{
+    throw Miss();
+}
+
+std::shared_ptr<LedgerEntry const>
+LedgerStateSnapshot::View::getBestOffer(Asset const& buying,
+                                        Asset const& selling,
+                                        std::set<LedgerKey>& exclude)
+{
+    throw Miss();
+}
+
+std::map<LedgerKey, LedgerEntry>
+LedgerStateSnapshot::View::getOffersByAccountAndAsset(AccountID const& account,
+                                                      Asset const& asset)
+{
+    throw Miss();
+}
+
+LedgerHeader const&
+LedgerStateSnapshot::View::getHeader() const
+{
+    return mSnapshot.mHeader;
+}
+
+std::vector<InflationWinner>
+LedgerStateSnapshot::View::getInflationWinners(size_t maxWinners,
+                                               int64_t minBalance)
+{
+    throw Miss();
+}
+
+std::shared_ptr<LedgerEntry const>
+LedgerStateSnapshot::View::getNewestVersion(LedgerKey const& key) const
+{
+    auto iter = mSnapshot.mEntries.find(key);
+    if (iter == mSnapshot.mEntries.end())
+    {
+        throw Miss();
+    }
+    return iter->second;
+}
+
+void
+LedgerStateSnapshot::View::prefetch(std::set<LedgerKey> const& keys)
+{
+}
+}
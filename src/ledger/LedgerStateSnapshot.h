@@ -0,0 +1,78 @@
+#pragma once
+
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "ledger/LedgerState.h"
+#include "util/NonCopyable.h"
+#include "util/XDROperators.h"
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+
+namespace spn
+{
+
+// A read-only copy of the header and of a chosen set of entries of an
+// AbstractLedgerStateParent, taken on the thread that owns that parent. Once
+// made, the copy is immutable and any number of threads can read it at once,
+// each through a View of its own (a LedgerState needs a parent to itself).
+//
+// Only the captured entries can be loaded through a View: anything else,
+// including the offer and inflation queries, throws Miss, and the caller is
+// expected to redo that piece of work against the real ledger state. Views
+// never accept commits.
+class LedgerStateSnapshot : public NonMovableOrCopyable
+{
+    LedgerHeader const mHeader;
+    // nullptr records an entry that does not exist
+    std::map<LedgerKey, std::shared_ptr<LedgerEntry const>> mEntries;
+
+  public:
+    class Miss : public std::runtime_error
+    {
+      public:
+        Miss() : std::runtime_error("entry not in LedgerStateSnapshot")
+        {
+        }
+    };
+
+    class View : public AbstractLedgerStateParent
+    {
+        LedgerStateSnapshot const& mSnapshot;
+        AbstractLedgerState* mChild;
+
+      public:
+        explicit View(LedgerStateSnapshot const& snapshot);
+
+        void addChild(AbstractLedgerState& child) override;
+        void commitChild(EntryIterator iter) override;
+        void rollbackChild() override;
+
+        std::map<LedgerKey, LedgerEntry> getAllOffers() override;
+        std::shared_ptr<LedgerEntry const>
+        getBestOffer(Asset const& buying, Asset const& selling,
+                     std::set<LedgerKey>& exclude) override;
+        std::map<LedgerKey, LedgerEntry>
+        getOffersByAccountAndAsset(AccountID const& account,
+                                   Asset const& asset) override;
+
+        LedgerHeader const& getHeader() const override;
+
+        std::vector<InflationWinner>
+        getInflationWinners(size_t maxWinners, int64_t minBalance) override;
+
+        std::shared_ptr<LedgerEntry const>
+        getNewestVersion(LedgerKey const& key) const override;
+
+        void prefetch(std::set<LedgerKey> const& keys) override;
+    };
+
+    // Copies the header of `parent` and the newest version of every entry in
+    // `keys`. `parent` must not have a child.
+    LedgerStateSnapshot(AbstractLedgerStateParent& parent,
+                        std::set<LedgerKey> const& keys);
+};
+}
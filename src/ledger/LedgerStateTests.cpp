@@ -8,13 +8,18 @@
 #include "ledger/LedgerTestUtils.h"
 #include "lib/catch.hpp"
 #include "main/Application.h"
+#include "medida/meter.h"
+#include "medida/metrics_registry.h"
 #include "test/TestUtils.h"
 #include "test/test.h"
 #include "transactions/TransactionUtils.h"
+#include "util/Logging.h"
 #include "util/XDROperators.h"
+#include <chrono>
 #include <map>
 #include <memory>
 #include <queue>
+#include <random>
 #include <set>
 #include <xdrpp/autocheck.h>
 
@@ -403,7 +408,6 @@ TEST_CASE("LedgerState round trip", "[ledgerstate]")
             VirtualClock clock;
             auto cfg = getTestConfig();
             cfg.ENTRY_CACHE_SIZE = 0;
-            cfg.BEST_OFFERS_CACHE_SIZE = 0;
             auto app = createTestApplication(clock, cfg);
             app->start();
 
@@ -686,7 +690,6 @@ testInflationWinners(
         VirtualClock clock;
         auto cfg = getTestConfig();
         cfg.ENTRY_CACHE_SIZE = 0;
-        cfg.BEST_OFFERS_CACHE_SIZE = 0;
         auto app = createTestApplication(clock, cfg);
         app->start();
         testAtRoot(*app);
@@ -1264,7 +1267,6 @@ testAllOffers(
         VirtualClock clock;
         auto cfg = getTestConfig();
         cfg.ENTRY_CACHE_SIZE = 0;
-        cfg.BEST_OFFERS_CACHE_SIZE = 0;
         auto app = createTestApplication(clock, cfg);
         app->start();
         testAtRoot(*app);
@@ -1516,7 +1518,6 @@ testBestOffer(
         VirtualClock clock;
         auto cfg = getTestConfig();
         cfg.ENTRY_CACHE_SIZE = 0;
-        cfg.BEST_OFFERS_CACHE_SIZE = 0;
         auto app = createTestApplication(clock, cfg);
         app->start();
         testAtRoot(*app);
@@ -1758,7 +1759,6 @@ testOffersByAccountAndAsset(
         VirtualClock clock;
         auto cfg = getTestConfig();
         cfg.ENTRY_CACHE_SIZE = 0;
-        cfg.BEST_OFFERS_CACHE_SIZE = 0;
         auto app = createTestApplication(clock, cfg);
         app->start();
         testAtRoot(*app);
@@ -2016,3 +2016,487 @@ TEST_CASE("LedgerStateEntry and LedgerStateHeader move assignment",
         }
     }
 }
+
+TEST_CASE("LedgerStateRoot caches survive commit", "[ledgerstate]")
+{
+    VirtualClock clock;
+    auto app = createTestApplication(clock, getTestConfig());
+    app->start();
+
+    auto& root = app->getLedgerStateRoot();
+    auto& hit = app->getMetrics().NewMeter({"ledger", "entry-cache", "hit"},
+                                           "entry");
+    auto& miss = app->getMetrics().NewMeter({"ledger", "entry-cache", "miss"},
+                                            "entry");
+
+    LedgerEntry le = LedgerTestUtils::generateValidLedgerEntry();
+    LedgerKey key = LedgerEntryKey(le);
+    {
+        LedgerState ls(root, false);
+        ls.create(le);
+        ls.commit();
+    }
+
+    SECTION("created entry is served from the cache")
+    {
+        auto hits = hit.count();
+        auto misses = miss.count();
+        REQUIRE(*root.getNewestVersion(key) == le);
+        REQUIRE(hit.count() == hits + 1);
+        REQUIRE(miss.count() == misses);
+    }
+
+    SECTION("modified entry is served from the cache")
+    {
+        LedgerEntry modified = le;
+        modified.lastModifiedLedgerSeq++;
+        {
+            LedgerState ls(root, false);
+            ls.load(key).current() = modified;
+            ls.commit();
+        }
+
+        auto hits = hit.count();
+        auto misses = miss.count();
+        REQUIRE(*root.getNewestVersion(key) == modified);
+        REQUIRE(hit.count() == hits + 1);
+        REQUIRE(miss.count() == misses);
+    }
+
+    SECTION("erased entry is served from the cache")
+    {
+        {
+            LedgerState ls(root, false);
+            ls.erase(key);
+            ls.commit();
+        }
+
+        auto hits = hit.count();
+        auto misses = miss.count();
+        REQUIRE(!root.getNewestVersion(key));
+        REQUIRE(hit.count() == hits + 1);
+        REQUIRE(miss.count() == misses);
+    }
+
+    SECTION("rolled back changes are not cached")
+    {
+        LedgerEntry modified = le;
+        modified.lastModifiedLedgerSeq++;
+        {
+            LedgerState ls(root, false);
+            ls.load(key).current() = modified;
+        }
+        REQUIRE(*root.getNewestVersion(key) == le);
+    }
+}
+
+TEST_CASE("LedgerState prefetch", "[ledgerstate]")
+{
+    VirtualClock clock;
+    auto app = createTestApplication(clock, getTestConfig());
+    app->start();
+
+    auto& root = app->getLedgerStateRoot();
+    auto& miss = app->getMetrics().NewMeter({"ledger", "entry-cache", "miss"},
+                                            "entry");
+
+    std::map<LedgerKey, LedgerEntry> existing;
+    std::set<LedgerKey> keys;
+    {
+        LedgerState ls(root, false);
+        for (auto le : LedgerTestUtils::generateValidLedgerEntries(200))
+        {
+            auto key = LedgerEntryKey(le);
+            if (!keys.insert(key).second)
+            {
+                continue;
+            }
+
+            // Every other entry is left out of the database
+            if (keys.size() % 2 == 0)
+            {
+                le.lastModifiedLedgerSeq = 1;
+                ls.create(le);
+                existing.emplace(key, le);
+            }
+        }
+        ls.commit();
+    }
+
+    // Nothing was modified on or after ledger 2, so this only clears the
+    // caches
+    root.deleteObjectsModifiedOnOrAfterLedger(2);
+
+    {
+        LedgerState ls(root);
+        ls.prefetch(keys);
+    }
+
+    for (auto const& key : keys)
+    {
+        auto misses = miss.count();
+        auto newest = root.getNewestVersion(key);
+        if (key.type() == ACCOUNT || key.type() == TRUSTLINE)
+        {
+            REQUIRE(miss.count() == misses);
+        }
+
+        auto iter = existing.find(key);
+        if (iter == existing.end())
+        {
+            REQUIRE(!newest);
+        }
+        else
+        {
+            REQUIRE(newest);
+            REQUIRE(*newest == iter->second);
+        }
+    }
+}
+
+TEST_CASE("LedgerStateRoot order book tracks commits", "[ledgerstate]")
+{
+    VirtualClock clock;
+    auto app = createTestApplication(clock, getTestConfig());
+    app->start();
+
+    auto& root = app->getLedgerStateRoot();
+
+    auto offer1 = LedgerTestUtils::generateValidLedgerEntry();
+    offer1.data.type(OFFER);
+    offer1.data.offer() = LedgerTestUtils::generateValidOfferEntry();
+    offer1.data.offer().offerID = 1;
+    offer1.data.offer().price = Price{1, 1};
+    auto offer2 = offer1;
+    offer2.data.offer().offerID = 2;
+    offer2.data.offer().price = Price{2, 1};
+
+    auto const& buying = offer1.data.offer().buying;
+    auto const& selling = offer1.data.offer().selling;
+    auto bestOffer = [&]() {
+        std::set<LedgerKey> exclude;
+        return root.getBestOffer(buying, selling, exclude);
+    };
+
+    // Load the order book before anything is committed
+    REQUIRE(!bestOffer());
+
+    {
+        LedgerState ls(root, false);
+        ls.create(offer1);
+        ls.create(offer2);
+        ls.commit();
+    }
+    REQUIRE(*bestOffer() == offer1);
+
+    SECTION("modified price")
+    {
+        {
+            LedgerState ls(root, false);
+            ls.load(LedgerEntryKey(offer1)).current().data.offer().price =
+                Price{3, 1};
+            ls.commit();
+        }
+        REQUIRE(*bestOffer() == offer2);
+    }
+
+    SECTION("modified assets")
+    {
+        {
+            LedgerState ls(root, false);
+            auto& oe = ls.load(LedgerEntryKey(offer1)).current().data.offer();
+            std::swap(oe.buying, oe.selling);
+            ls.commit();
+        }
+        REQUIRE(*bestOffer() == offer2);
+
+        std::set<LedgerKey> exclude;
+        auto moved = root.getBestOffer(selling, buying, exclude);
+        REQUIRE(moved);
+        REQUIRE(moved->data.offer().offerID == 1);
+    }
+
+    SECTION("erased")
+    {
+        {
+            LedgerState ls(root, false);
+            ls.erase(LedgerEntryKey(offer1));
+            ls.commit();
+        }
+        REQUIRE(*bestOffer() == offer2);
+    }
+
+    SECTION("rolled back")
+    {
+        {
+            LedgerState ls(root, false);
+            ls.erase(LedgerEntryKey(offer1));
+        }
+        REQUIRE(*bestOffer() == offer1);
+    }
+}
+
+TEST_CASE("LedgerStateRoot inflation vote tally tracks commits",
+          "[ledgerstate]")
+{
+    int64_t const MIN_VOTES = 1000000000;
+
+    VirtualClock clock;
+    auto app = createTestApplication(clock, getTestConfig());
+    app->start();
+
+    auto& root = app->getLedgerStateRoot();
+    root.loadInflationVoteTally();
+
+    auto a1 = LedgerTestUtils::generateValidAccountEntry().accountID;
+    auto a2 = LedgerTestUtils::generateValidAccountEntry().accountID;
+    auto a3 = LedgerTestUtils::generateValidAccountEntry().accountID;
+    auto a4 = LedgerTestUtils::generateValidAccountEntry().accountID;
+
+    auto toTuples = [](std::vector<InflationWinner> const& winners) {
+        std::vector<std::tuple<AccountID, int64_t>> res;
+        for (auto const& w : winners)
+        {
+            res.emplace_back(w.accountID, w.votes);
+        }
+        return res;
+    };
+
+    // Every round is committed to the root, after which the maintained tally
+    // must agree with a tally rebuilt from the database
+    std::vector<std::map<AccountID, std::pair<AccountID, int64_t>>> rounds = {
+        {{a1, {a3, MIN_VOTES + 3}}, {a2, {a3, MIN_VOTES + 7}}},
+        {{a1, {a4, MIN_VOTES + 20}}},
+        {{a2, {a4, MIN_VOTES - 1}}},
+        {{a3, {a1, 2 * MIN_VOTES}}, {a4, {a2, 2 * MIN_VOTES}}},
+        {{a1, {a4, 0}}},
+        {{a2, {a3, 3 * MIN_VOTES}}}};
+    for (auto const& updates : rounds)
+    {
+        {
+            LedgerState ls(root);
+            applyLedgerStateUpdates(ls, updates);
+            ls.commit();
+        }
+
+        LedgerStateRoot rebuilt(app->getDatabase(), app->getMetrics(), 0);
+        for (int64_t minVotes : {int64_t(0), MIN_VOTES, 2 * MIN_VOTES + 1})
+        {
+            REQUIRE(toTuples(root.getInflationWinners(10, minVotes)) ==
+                    toTuples(rebuilt.getInflationWinners(10, minVotes)));
+            REQUIRE(toTuples(root.getInflationWinners(1, minVotes)) ==
+                    toTuples(rebuilt.getInflationWinners(1, minVotes)));
+        }
+    }
+}
+
+TEST_CASE("LedgerStateRoot bulk writes", "[ledgerstate]")
+{
+    auto runTest = [](Config::TestDbMode mode) {
+        VirtualClock clock;
+        auto app = createTestApplication(clock, getTestConfig(0, mode));
+        app->start();
+        auto& root = app->getLedgerStateRoot();
+
+        // one entry of each kind per key, and a data name that needs quoting
+        // in a PostgreSQL array literal
+        std::map<LedgerKey, LedgerEntry> entries;
+        for (auto const& le : LedgerTestUtils::generateValidLedgerEntries(100))
+        {
+            entries.emplace(LedgerEntryKey(le), le);
+        }
+        LedgerEntry quoted;
+        quoted.data.type(DATA);
+        quoted.data.data() = LedgerTestUtils::generateValidDataEntry();
+        quoted.data.data().dataName = "a \"b\" \\c, {d}";
+        entries.emplace(LedgerEntryKey(quoted), quoted);
+
+        // read back through a root of its own, so from the database rather
+        // than from the caches of `root`
+        auto checkStored = [&](std::map<LedgerKey, LedgerEntry> const& live,
+                               std::vector<LedgerKey> const& dead) {
+            LedgerStateRoot stored(app->getDatabase(), app->getMetrics(), 0);
+            for (auto const& kv : live)
+            {
+                auto le = stored.getNewestVersion(kv.first);
+                REQUIRE(le);
+                REQUIRE(*le == kv.second);
+            }
+            for (auto const& key : dead)
+            {
+                REQUIRE(!stored.getNewestVersion(key));
+            }
+        };
+
+        std::vector<LedgerEntry> live;
+        for (auto const& kv : entries)
+        {
+            live.emplace_back(kv.second);
+        }
+        root.writeBucketEntries(live, {});
+        checkStored(entries, {});
+
+        // every row already exists: each is replaced, and counted once
+        for (auto& le : live)
+        {
+            le = generateLedgerEntryWithSameKey(le);
+            entries[LedgerEntryKey(le)] = le;
+        }
+        root.writeBucketEntries(live, {});
+        checkStored(entries, {});
+
+        // half of the entries are deleted, along with keys that were never
+        // stored, which bucket application tolerates
+        std::vector<LedgerKey> dead;
+        for (auto iter = entries.begin(); iter != entries.end();)
+        {
+            dead.emplace_back(iter->first);
+            iter = entries.erase(iter);
+            if (iter != entries.end())
+            {
+                ++iter;
+            }
+        }
+        for (auto const& le : LedgerTestUtils::generateValidLedgerEntries(20))
+        {
+            auto key = LedgerEntryKey(le);
+            if (entries.find(key) == entries.end())
+            {
+                dead.emplace_back(key);
+            }
+        }
+        root.writeBucketEntries({}, dead);
+        checkStored(entries, dead);
+        root.writeBucketEntries({}, dead);
+        checkStored(entries, dead);
+
+        // the commit path writes the same way: upserts of new and existing
+        // rows, and deletes of existing ones
+        {
+            LedgerState ls(root, false);
+            for (auto& kv : entries)
+            {
+                kv.second = generateLedgerEntryWithSameKey(kv.second);
+                ls.load(kv.first).current() = kv.second;
+            }
+            for (auto const& key : dead)
+            {
+                LedgerEntry le;
+                le.data.type(key.type());
+                switch (key.type())
+                {
+                case ACCOUNT:
+                    le.data.account().accountID = key.account().accountID;
+                    break;
+                case DATA:
+                    le.data.data().accountID = key.data().accountID;
+                    le.data.data().dataName = key.data().dataName;
+                    break;
+                case OFFER:
+                    le.data.offer().sellerID = key.offer().sellerID;
+                    le.data.offer().offerID = key.offer().offerID;
+                    break;
+                case TRUSTLINE:
+                    le.data.trustLine().accountID = key.trustLine().accountID;
+                    le.data.trustLine().asset = key.trustLine().asset;
+                    break;
+                default:
+                    REQUIRE(false);
+                }
+                le = generateLedgerEntryWithSameKey(le);
+                ls.create(le);
+                entries.emplace(key, le);
+            }
+            ls.commit();
+        }
+        checkStored(entries, {});
+
+        std::vector<LedgerKey> erased;
+        {
+            LedgerState ls(root, false);
+            for (auto const& kv : entries)
+            {
+                ls.erase(kv.first);
+                erased.emplace_back(kv.first);
+            }
+            ls.commit();
+        }
+        checkStored({}, erased);
+    };
+
+    SECTION("sqlite")
+    {
+        runTest(Config::TESTDB_IN_MEMORY_SQLITE);
+    }
+#ifdef USE_POSTGRES
+    SECTION("postgresql")
+    {
+        runTest(Config::TESTDB_POSTGRESQL);
+    }
+#endif
+}
+
+TEST_CASE("LedgerState nested commit benchmark", "[ledgerstate][bench][!hide]")
+{
+    size_t const NUM_ACCOUNTS = 10000;
+    size_t const NUM_TXS = 1000;
+    size_t const NUM_OPS = 3;
+    size_t const NUM_LEDGERS = 10;
+
+    VirtualClock clock;
+    auto app = createTestApplication(clock, getTestConfig());
+    app->start();
+    auto& root = app->getLedgerStateRoot();
+
+    std::vector<LedgerKey> keys;
+    {
+        LedgerState ls(root);
+        for (size_t i = 0; i < NUM_ACCOUNTS; ++i)
+        {
+            LedgerEntry le;
+            le.data.type(ACCOUNT);
+            le.data.account() = LedgerTestUtils::generateValidAccountEntry(5);
+            if (ls.loadWithoutRecord(LedgerEntryKey(le)))
+            {
+                continue;
+            }
+            keys.emplace_back(LedgerEntryKey(le));
+            ls.create(le);
+        }
+        ls.commit();
+    }
+
+    std::default_random_engine gen;
+    std::uniform_int_distribution<size_t> keyDist(0, keys.size() - 1);
+    auto touch = [&](AbstractLedgerState& ls) {
+        auto entry = ls.load(keys[keyDist(gen)]);
+        ++entry.current().data.account().seqNum;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t ledger = 0; ledger < NUM_LEDGERS; ++ledger)
+    {
+        LedgerState lsLedger(root);
+        for (size_t tx = 0; tx < NUM_TXS; ++tx)
+        {
+            LedgerState lsTx(lsLedger);
+            touch(lsTx);
+            for (size_t op = 0; op < NUM_OPS; ++op)
+            {
+                LedgerState lsOp(lsTx);
+                touch(lsOp);
+                touch(lsOp);
+                lsOp.commit();
+            }
+            lsTx.commit();
+        }
+        lsLedger.getLiveEntries();
+        lsLedger.commit();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    LOG(INFO) << "Applied " << NUM_LEDGERS << " ledgers of " << NUM_TXS
+              << " transactions with " << NUM_OPS << " operations each in "
+              << elapsed.count() << " ms";
+}
@@ -5,6 +5,7 @@
 #include "crypto/KeyUtils.h"
 #include "crypto/SecretKey.h"
 #include "database/Database.h"
+#include "database/DatabaseUtils.h"
 #include "ledger/LedgerStateImpl.h"
 #include "util/XDROperators.h"
 #include "util/types.h"
@@ -82,117 +83,303 @@ LedgerStateRoot::Impl::loadTrustLine(LedgerKey const& key) const
     return std::make_shared<LedgerEntry>(std::move(le));
 }
 
-void
-LedgerStateRoot::Impl::insertOrUpdateTrustLine(LedgerEntry const& entry,
-                                               bool isInsert)
+static void
+getTrustLineStrings(AccountID const& accountID, Asset const& asset,
+                    std::string& accountIDStr, std::string& issuerStr,
+                    std::string& assetCodeStr)
 {
-    auto const& tl = entry.data.trustLine();
-
-    std::string actIDStrKey = KeyUtils::toStrKey(tl.accountID);
-    unsigned int assetType = tl.asset.type();
-    std::string issuerStr, assetCode;
-    if (tl.asset.type() == ASSET_TYPE_CREDIT_ALPHANUM4)
+    accountIDStr = KeyUtils::toStrKey(accountID);
+    if (asset.type() == ASSET_TYPE_CREDIT_ALPHANUM4)
     {
-        issuerStr = KeyUtils::toStrKey(tl.asset.alphaNum4().issuer);
-        assetCodeToStr(tl.asset.alphaNum4().assetCode, assetCode);
+        issuerStr = KeyUtils::toStrKey(asset.alphaNum4().issuer);
+        assetCodeToStr(asset.alphaNum4().assetCode, assetCodeStr);
     }
-    else if (tl.asset.type() == ASSET_TYPE_CREDIT_ALPHANUM12)
+    else if (asset.type() == ASSET_TYPE_CREDIT_ALPHANUM12)
     {
-        issuerStr = KeyUtils::toStrKey(tl.asset.alphaNum12().issuer);
-        assetCodeToStr(tl.asset.alphaNum12().assetCode, assetCode);
+        issuerStr = KeyUtils::toStrKey(asset.alphaNum12().issuer);
+        assetCodeToStr(asset.alphaNum12().assetCode, assetCodeStr);
     }
-    if (actIDStrKey == issuerStr)
+    if (accountIDStr == issuerStr)
     {
         throw std::runtime_error("Issuer's own trustline should not be used "
                                  "outside of OperationFrame");
     }
+}
 
-    Liabilities liabilities;
-    soci::indicator liabilitiesInd = soci::i_null;
-    if (tl.ext.v() == 1)
+std::vector<LedgerEntry>
+LedgerStateRoot::Impl::loadTrustLines(std::vector<LedgerKey> const& keys) const
+{
+    // The keys are loaded in batches of a fixed size, padding the last batch
+    // with a repeated key, so that every query has the same text and can be
+    // served by the prepared statement cache.
+    size_t const BATCH_SIZE = 32;
+
+    std::string sql = "SELECT accountid, issuer, assetcode, tlimit, balance, "
+                      "flags, lastmodified, buyingliabilities, "
+                      "sellingliabilities FROM trustlines WHERE ";
+    for (size_t i = 0; i < BATCH_SIZE; ++i)
     {
-        liabilities = tl.ext.v1().liabilities;
-        liabilitiesInd = soci::i_ok;
+        auto idx = std::to_string(i);
+        sql += (i == 0 ? "(" : " OR (");
+        sql += "accountid = :id" + idx + " AND issuer = :issuer" + idx +
+               " AND assetcode = :asset" + idx + ")";
     }
 
-    std::string sql;
-    if (isInsert)
+    std::vector<LedgerEntry> res;
+    for (size_t begin = 0; begin < keys.size(); begin += BATCH_SIZE)
     {
-        sql = "INSERT INTO trustlines "
-              "(accountid, assettype, issuer, assetcode, balance, tlimit, "
-              "flags, lastmodified, buyingliabilities, sellingliabilities) "
-              "VALUES (:id, :at, :iss, :ac, :b, :tl, :f, :lm, :bl, :sl)";
+        std::vector<std::string> accountIDs(BATCH_SIZE), issuers(BATCH_SIZE),
+            assetCodes(BATCH_SIZE);
+        std::map<std::tuple<std::string, std::string, std::string>,
+                 LedgerKey const*>
+            keysByStrings;
+        for (size_t i = 0; i < BATCH_SIZE; ++i)
+        {
+            auto const& key = keys[std::min(begin + i, keys.size() - 1)];
+            getTrustLineStrings(key.trustLine().accountID,
+                                key.trustLine().asset, accountIDs[i],
+                                issuers[i], assetCodes[i]);
+            keysByStrings[std::make_tuple(accountIDs[i], issuers[i],
+                                          assetCodes[i])] = &key;
+        }
+
+        std::string accountID, issuer, assetCode;
+        Liabilities liabilities;
+        soci::indicator buyingLiabilitiesInd, sellingLiabilitiesInd;
+
+        LedgerEntry le;
+        le.data.type(TRUSTLINE);
+        TrustLineEntry& tl = le.data.trustLine();
+
+        auto prep = mDatabase.getPreparedStatement(sql);
+        auto& st = prep.statement();
+        st.exchange(soci::into(accountID));
+        st.exchange(soci::into(issuer));
+        st.exchange(soci::into(assetCode));
+        st.exchange(soci::into(tl.limit));
+        st.exchange(soci::into(tl.balance));
+        st.exchange(soci::into(tl.flags));
+        st.exchange(soci::into(le.lastModifiedLedgerSeq));
+        st.exchange(soci::into(liabilities.buying, buyingLiabilitiesInd));
+        st.exchange(soci::into(liabilities.selling, sellingLiabilitiesInd));
+        for (size_t i = 0; i < BATCH_SIZE; ++i)
+        {
+            st.exchange(soci::use(accountIDs[i]));
+            st.exchange(soci::use(issuers[i]));
+            st.exchange(soci::use(assetCodes[i]));
+        }
+        st.define_and_bind();
+        {
+            auto timer = mDatabase.getSelectTimer("trust");
+            st.execute(true);
+        }
+        while (st.got_data())
+        {
+            auto const& key = *keysByStrings.at(
+                std::make_tuple(accountID, issuer, assetCode));
+            tl.accountID = key.trustLine().accountID;
+            tl.asset = key.trustLine().asset;
+
+            assert(buyingLiabilitiesInd == sellingLiabilitiesInd);
+            tl.ext.v(0);
+            if (buyingLiabilitiesInd == soci::i_ok)
+            {
+                tl.ext.v(1);
+                tl.ext.v1().liabilities = liabilities;
+            }
+
+            res.emplace_back(le);
+            st.fetch();
+        }
     }
-    else
+    return res;
+}
+
+void
+LedgerStateRoot::Impl::bulkUpsertTrustLines(
+    std::vector<LedgerEntry const*> const& entries)
+{
+    if (entries.empty())
     {
-        sql = "UPDATE trustlines "
-              "SET balance=:b, tlimit=:tl, flags=:f, lastmodified=:lm, "
-              "buyingliabilities=:bl, sellingliabilities=:sl "
-              "WHERE accountid=:id AND issuer=:iss AND assetcode=:ac";
+        return;
     }
-    auto prep = mDatabase.getPreparedStatement(sql);
-    auto& st = prep.statement();
-    st.exchange(soci::use(actIDStrKey, "id"));
-    if (isInsert)
-    {
-        st.exchange(soci::use(assetType, "at"));
-    }
-    st.exchange(soci::use(issuerStr, "iss"));
-    st.exchange(soci::use(assetCode, "ac"));
-    st.exchange(soci::use(tl.balance, "b"));
-    st.exchange(soci::use(tl.limit, "tl"));
-    st.exchange(soci::use(tl.flags, "f"));
-    st.exchange(soci::use(entry.lastModifiedLedgerSeq, "lm"));
-    st.exchange(soci::use(liabilities.buying, liabilitiesInd, "bl"));
-    st.exchange(soci::use(liabilities.selling, liabilitiesInd, "sl"));
-    st.define_and_bind();
+
+    size_t const n = entries.size();
+    std::vector<std::string> accountIDs(n), issuers(n), assetCodes(n);
+    std::vector<int32_t> assetTypes, flags, lastModifieds;
+    std::vector<int64_t> balances, limits, buyingLiabilities,
+        sellingLiabilities;
+    std::vector<soci::indicator> liabilitiesInds;
+    assetTypes.reserve(n);
+    flags.reserve(n);
+    lastModifieds.reserve(n);
+    balances.reserve(n);
+    limits.reserve(n);
+    buyingLiabilities.reserve(n);
+    sellingLiabilities.reserve(n);
+    liabilitiesInds.reserve(n);
+    for (size_t i = 0; i < n; ++i)
     {
-        auto timer = isInsert ? mDatabase.getInsertTimer("trust")
-                              : mDatabase.getUpdateTimer("trust");
-        st.execute(true);
+        auto const& tl = entries[i]->data.trustLine();
+        getTrustLineStrings(tl.accountID, tl.asset, accountIDs[i], issuers[i],
+                            assetCodes[i]);
+        assetTypes.emplace_back(static_cast<int32_t>(tl.asset.type()));
+        balances.emplace_back(tl.balance);
+        limits.emplace_back(tl.limit);
+        flags.emplace_back(static_cast<int32_t>(tl.flags));
+        lastModifieds.emplace_back(
+            static_cast<int32_t>(entries[i]->lastModifiedLedgerSeq));
+        if (tl.ext.v() == 1)
+        {
+            auto const& liabilities = tl.ext.v1().liabilities;
+            buyingLiabilities.emplace_back(liabilities.buying);
+            sellingLiabilities.emplace_back(liabilities.selling);
+            liabilitiesInds.emplace_back(soci::i_ok);
+        }
+        else
+        {
+            buyingLiabilities.emplace_back(0);
+            sellingLiabilities.emplace_back(0);
+            liabilitiesInds.emplace_back(soci::i_null);
+        }
+    }
+
+    long long affected = 0;
+    if (mDatabase.isSqlite())
+    {
+        auto prep = mDatabase.getPreparedStatement(
+            "INSERT OR REPLACE INTO trustlines "
+            "(accountid, assettype, issuer, assetcode, balance, tlimit, "
+            "flags, lastmodified, buyingliabilities, sellingliabilities) "
+            "VALUES (:id, :at, :iss, :ac, :b, :tl, :f, :lm, :bl, :sl)");
+        auto& st = prep.statement();
+        st.exchange(soci::use(accountIDs, "id"));
+        st.exchange(soci::use(assetTypes, "at"));
+        st.exchange(soci::use(issuers, "iss"));
+        st.exchange(soci::use(assetCodes, "ac"));
+        st.exchange(soci::use(balances, "b"));
+        st.exchange(soci::use(limits, "tl"));
+        st.exchange(soci::use(flags, "f"));
+        st.exchange(soci::use(lastModifieds, "lm"));
+        st.exchange(soci::use(buyingLiabilities, liabilitiesInds, "bl"));
+        st.exchange(soci::use(sellingLiabilities, liabilitiesInds, "sl"));
+        st.define_and_bind();
+        {
+            auto timer = mDatabase.getUpsertTimer("trust");
+            st.execute(true);
+        }
+        affected = st.get_affected_rows();
     }
-    if (st.get_affected_rows() != 1)
+    else
+    {
+        std::string strAccountIDs = DatabaseUtils::toPGArray(accountIDs);
+        std::string strAssetTypes = DatabaseUtils::toPGArray(assetTypes);
+        std::string strIssuers = DatabaseUtils::toPGArray(issuers);
+        std::string strAssetCodes = DatabaseUtils::toPGArray(assetCodes);
+        std::string strBalances = DatabaseUtils::toPGArray(balances);
+        std::string strLimits = DatabaseUtils::toPGArray(limits);
+        std::string strFlags = DatabaseUtils::toPGArray(flags);
+        std::string strLastModifieds = DatabaseUtils::toPGArray(lastModifieds);
+        std::string strBuyingLiabilities =
+            DatabaseUtils::toPGArray(buyingLiabilities, liabilitiesInds);
+        std::string strSellingLiabilities =
+            DatabaseUtils::toPGArray(sellingLiabilities, liabilitiesInds);
+        auto prep = mDatabase.getPreparedStatement(
+            "WITH r AS (SELECT unnest(:id::TEXT[]), unnest(:at::INT[]), "
+            "unnest(:iss::TEXT[]), unnest(:ac::TEXT[]), "
+            "unnest(:b::BIGINT[]), unnest(:tl::BIGINT[]), "
+            "unnest(:f::INT[]), unnest(:lm::INT[]), "
+            "unnest(:bl::BIGINT[]), unnest(:sl::BIGINT[])) "
+            "INSERT INTO trustlines "
+            "(accountid, assettype, issuer, assetcode, balance, tlimit, "
+            "flags, lastmodified, buyingliabilities, sellingliabilities) "
+            "SELECT * FROM r "
+            "ON CONFLICT (accountid, issuer, assetcode) DO UPDATE SET "
+            "assettype = excluded.assettype, balance = excluded.balance, "
+            "tlimit = excluded.tlimit, flags = excluded.flags, "
+            "lastmodified = excluded.lastmodified, "
+            "buyingliabilities = excluded.buyingliabilities, "
+            "sellingliabilities = excluded.sellingliabilities");
+        auto& st = prep.statement();
+        st.exchange(soci::use(strAccountIDs, "id"));
+        st.exchange(soci::use(strAssetTypes, "at"));
+        st.exchange(soci::use(strIssuers, "iss"));
+        st.exchange(soci::use(strAssetCodes, "ac"));
+        st.exchange(soci::use(strBalances, "b"));
+        st.exchange(soci::use(strLimits, "tl"));
+        st.exchange(soci::use(strFlags, "f"));
+        st.exchange(soci::use(strLastModifieds, "lm"));
+        st.exchange(soci::use(strBuyingLiabilities, "bl"));
+        st.exchange(soci::use(strSellingLiabilities, "sl"));
+        st.define_and_bind();
+        {
+            auto timer = mDatabase.getUpsertTimer("trust");
+            st.execute(true);
+        }
+        affected = st.get_affected_rows();
+    }
+    if (static_cast<size_t>(affected) != n)
     {
         throw std::runtime_error("Could not update data in SQL");
     }
 }
 
 void
-LedgerStateRoot::Impl::deleteTrustLine(LedgerKey const& key)
+LedgerStateRoot::Impl::bulkDeleteTrustLines(
+    std::vector<LedgerKey const*> const& keys, bool mustExist)
 {
-    auto const& tl = key.trustLine();
-
-    std::string actIDStrKey = KeyUtils::toStrKey(tl.accountID);
-    std::string issuerStr, assetCode;
-    if (tl.asset.type() == ASSET_TYPE_CREDIT_ALPHANUM4)
+    if (keys.empty())
     {
-        issuerStr = KeyUtils::toStrKey(tl.asset.alphaNum4().issuer);
-        assetCodeToStr(tl.asset.alphaNum4().assetCode, assetCode);
+        return;
     }
-    else if (tl.asset.type() == ASSET_TYPE_CREDIT_ALPHANUM12)
+
+    size_t const n = keys.size();
+    std::vector<std::string> accountIDs(n), issuers(n), assetCodes(n);
+    for (size_t i = 0; i < n; ++i)
     {
-        issuerStr = KeyUtils::toStrKey(tl.asset.alphaNum12().issuer);
-        assetCodeToStr(tl.asset.alphaNum12().assetCode, assetCode);
+        auto const& tl = keys[i]->trustLine();
+        getTrustLineStrings(tl.accountID, tl.asset, accountIDs[i], issuers[i],
+                            assetCodes[i]);
     }
-    if (actIDStrKey == issuerStr)
+
+    long long affected = 0;
+    if (mDatabase.isSqlite())
     {
-        throw std::runtime_error("Issuer's own trustline should not be used "
-                                 "outside of OperationFrame");
+        auto prep = mDatabase.getPreparedStatement(
+            "DELETE FROM trustlines "
+            "WHERE accountid=:v1 AND issuer=:v2 AND assetcode=:v3");
+        auto& st = prep.statement();
+        st.exchange(soci::use(accountIDs, "v1"));
+        st.exchange(soci::use(issuers, "v2"));
+        st.exchange(soci::use(assetCodes, "v3"));
+        st.define_and_bind();
+        {
+            auto timer = mDatabase.getDeleteTimer("trust");
+            st.execute(true);
+        }
+        affected = st.get_affected_rows();
     }
-
-    auto prep = mDatabase.getPreparedStatement(
-        "DELETE FROM trustlines "
-        "WHERE accountid=:v1 AND issuer=:v2 AND assetcode=:v3");
-    auto& st = prep.statement();
-    st.exchange(soci::use(actIDStrKey));
-    st.exchange(soci::use(issuerStr));
-    st.exchange(soci::use(assetCode));
-    st.define_and_bind();
+    else
     {
-        auto timer = mDatabase.getDeleteTimer("trust");
-        st.execute(true);
+        std::string strAccountIDs = DatabaseUtils::toPGArray(accountIDs);
+        std::string strIssuers = DatabaseUtils::toPGArray(issuers);
+        std::string strAssetCodes = DatabaseUtils::toPGArray(assetCodes);
+        auto prep = mDatabase.getPreparedStatement(
+            "DELETE FROM trustlines WHERE (accountid, issuer, assetcode) IN "
+            "(SELECT unnest(:v1::TEXT[]), unnest(:v2::TEXT[]), "
+            "unnest(:v3::TEXT[]))");
+        auto& st = prep.statement();
+        st.exchange(soci::use(strAccountIDs, "v1"));
+        st.exchange(soci::use(strIssuers, "v2"));
+        st.exchange(soci::use(strAssetCodes, "v3"));
+        st.define_and_bind();
+        {
+            auto timer = mDatabase.getDeleteTimer("trust");
+            st.execute(true);
+        }
+        affected = st.get_affected_rows();
     }
-    if (st.get_affected_rows() != 1)
+    if (mustExist && static_cast<size_t>(affected) != n)
     {
         throw std::runtime_error("Could not update data in SQL");
     }
@@ -203,7 +390,7 @@ LedgerStateRoot::Impl::dropTrustLines()
 {
     throwIfChild();
     mEntryCache.clear();
-    mBestOffersCache.clear();
+    mOrderBook.reset();
 
     mDatabase.getSession() << "DROP TABLE IF EXISTS trustlines;";
     mDatabase.getSession()
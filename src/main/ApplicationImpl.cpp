@@ -122,7 +122,8 @@ ApplicationImpl::initialize()
     mBanManager = BanManager::create(*this);
     mStatusManager = std::make_unique<StatusManager>();
     mLedgerStateRoot = std::make_unique<LedgerStateRoot>(
-        *mDatabase, mConfig.ENTRY_CACHE_SIZE, mConfig.BEST_OFFERS_CACHE_SIZE);
+        *mDatabase, getMetrics(), mConfig.ENTRY_CACHE_SIZE);
+    PubKeyUtils::setVerifySigCacheSize(mConfig.VERIFY_SIG_CACHE_SIZE);
 
     BucketListIsConsistentWithDatabase::registerInvariant(*this);
     AccountSubEntriesCountIsValid::registerInvariant(*this);
@@ -45,7 +45,7 @@ Config::Config() : NODE_SEED(SecretKey::random())
     LEDGER_PROTOCOL_VERSION = CURRENT_LEDGER_PROTOCOL_VERSION;
 
     OVERLAY_PROTOCOL_MIN_VERSION = 7;
-    OVERLAY_PROTOCOL_VERSION = 7;
+    OVERLAY_PROTOCOL_VERSION = 8;
 
     VERSION_STR = STELLAR_CORE_VERSION;
 
@@ -65,6 +65,7 @@ Config::Config() : NODE_SEED(SecretKey::random())
     FAILURE_SAFETY = -1;
     UNSAFE_QUORUM = false;
     DISABLE_BUCKET_GC = false;
+    BUCKETLIST_RESIDENT_LEVELS = 0;
 
     LOG_FILE_PATH = "spn-core.%datetime{%Y.%M.%d-%H:%m:%s}.log";
     BUCKET_DIR_PATH = "buckets";
@@ -84,6 +85,7 @@ Config::Config() : NODE_SEED(SecretKey::random())
     PEER_AUTHENTICATION_TIMEOUT = 2;
     PEER_TIMEOUT = 30;
     PREFERRED_PEERS_ONLY = false;
+    FLOOD_TX_PULL_MODE = false;
 
     MINIMUM_IDLE_PERCENT = 0;
 
@@ -94,7 +96,8 @@ Config::Config() : NODE_SEED(SecretKey::random())
     NTP_SERVER = "pool.ntp.org";
 
     ENTRY_CACHE_SIZE = 4096;
-    BEST_OFFERS_CACHE_SIZE = 64;
+    VERIFY_SIG_CACHE_SIZE = DEFAULT_VERIFY_SIG_CACHE_SIZE;
+    PARALLEL_TX_SET_VALIDATION = true;
 }
 
 namespace
@@ -374,6 +377,10 @@ Config::load(std::string const& filename)
             {
                 BUCKET_DIR_PATH = readString(item);
             }
+            else if (item.first == "BUCKETLIST_RESIDENT_LEVELS")
+            {
+                BUCKETLIST_RESIDENT_LEVELS = readInt<uint32_t>(item);
+            }
             else if (item.first == "NODE_NAMES")
             {
                 auto names = readStringArray(item);
@@ -431,6 +438,10 @@ Config::load(std::string const& filename)
             {
                 PREFERRED_PEERS_ONLY = readBool(item);
             }
+            else if (item.first == "FLOOD_TX_PULL_MODE")
+            {
+                FLOOD_TX_PULL_MODE = readBool(item);
+            }
             else if (item.first == "KNOWN_PEERS")
             {
                 KNOWN_PEERS = readStringArray(item);
@@ -522,7 +533,20 @@ Config::load(std::string const& filename)
             }
             else if (item.first == "BEST_OFFERS_CACHE_SIZE")
             {
-                BEST_OFFERS_CACHE_SIZE = readInt<uint32_t>(item);
+                // best offers are now served from the in-memory order book;
+                // keep accepting the key so existing configs still load
+                readInt<uint32_t>(item);
+                LOG(WARNING) << item.first
+                             << " is deprecated and ignored - best offers "
+                                "are kept in an in-memory order book";
+            }
+            else if (item.first == "VERIFY_SIG_CACHE_SIZE")
+            {
+                VERIFY_SIG_CACHE_SIZE = readInt<uint32_t>(item, 1);
+            }
+            else if (item.first == "PARALLEL_TX_SET_VALIDATION")
+            {
+                PARALLEL_TX_SET_VALIDATION = readBool(item);
             }
             else
             {
@@ -137,6 +137,10 @@ class Config : public std::enable_shared_from_this<Config>
     // disk usage, but it is useful for recovering of nodes.
     bool DISABLE_BUCKET_GC;
 
+    // Number of BucketList levels, from level 0 down, whose buckets keep
+    // their entries in memory so that merging them reads no files.
+    uint32_t BUCKETLIST_RESIDENT_LEVELS;
+
     // Set of cursors added at each startup with value '1'.
     std::vector<std::string> KNOWN_CURSORS;
 
@@ -177,6 +181,11 @@ class Config : public std::enable_shared_from_this<Config>
     // Whether to exclude peers that are not preferred.
     bool PREFERRED_PEERS_ONLY;
 
+    // Whether transactions are flooded to peers that support it as hashes,
+    // which the peers pull the transactions they lack from, rather than in
+    // full.
+    bool FLOOD_TX_PULL_MODE;
+
     // Percentage, between 0 and 100, of system activity (measured in terms
     // of both event-loop cycles and database time) below-which the system
     // will consider itself "loaded" and attempt to shed load. Set this
@@ -212,11 +221,17 @@ class Config : public std::enable_shared_from_this<Config>
     // Data layer cache configuration
     // - ENTRY_CACHE_SIZE controls the maximum number of LedgerEntry objects
     //   that will be stored in the cache
-    // - BEST_OFFERS_CACHE_SIZE controls the maximum number of Asset pairs that
-    //   will be stored in the cache, although many LedgerEntry objects may be
-    //   associated with a single Asset pair
     size_t ENTRY_CACHE_SIZE;
-    size_t BEST_OFFERS_CACHE_SIZE;
+    // - VERIFY_SIG_CACHE_SIZE controls the maximum number of signature
+    //   verification results kept in the (process-wide) cache
+    static size_t const DEFAULT_VERIFY_SIG_CACHE_SIZE = 0xffff;
+    size_t VERIFY_SIG_CACHE_SIZE;
+
+    // Whether transaction sets are validated per source account on the
+    // worker threads, against a snapshot of the accounts involved, rather
+    // than one transaction at a time on the main thread. The outcome is the
+    // same either way.
+    bool PARALLEL_TX_SET_VALIDATION;
 
     Config();
 
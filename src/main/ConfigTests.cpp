@@ -6,6 +6,9 @@
 #include "lib/catch.hpp"
 #include "main/Config.h"
 #include "test/test.h"
+#include "util/TmpDir.h"
+
+#include <fstream>
 
 using namespace spn;
 
@@ -155,3 +158,20 @@ TEST_CASE("load example configs", "[config]")
         }
     }
 }
+
+TEST_CASE("deprecated BEST_OFFERS_CACHE_SIZE is ignored", "[config]")
+{
+    TmpDir dir("config-test");
+    std::string fn = dir.getName() + "/deprecated.cfg";
+    {
+        std::ifstream in("testdata/spn-core_example.cfg");
+        REQUIRE(in);
+        std::ofstream out(fn);
+        // top level keys must come before the first table
+        out << "BEST_OFFERS_CACHE_SIZE=64\n" << in.rdbuf();
+    }
+
+    Config c;
+    REQUIRE_NOTHROW(c.load(fn));
+    REQUIRE(c.ENTRY_CACHE_SIZE == 4096);
+}
@@ -11,17 +11,21 @@
 #include "lib/catch.hpp"
 #include "main/Application.h"
 #include "main/Config.h"
+#include "overlay/LoopbackPeer.h"
 #include "overlay/OverlayManager.h"
 #include "overlay/PeerDoor.h"
 #include "simulation/Simulation.h"
 #include "simulation/Topologies.h"
 #include "test/TestAccount.h"
+#include "test/TestUtils.h"
 #include "test/TxTests.h"
 #include "test/test.h"
 #include "util/Logging.h"
 #include "util/Timer.h"
 #include "xdrpp/marshal.h"
 
+#include <chrono>
+
 namespace spn
 {
 using namespace txtest;
@@ -31,10 +35,13 @@ TEST_CASE("Flooding", "[flood][overlay]")
     Hash networkID = sha256(getTestConfig().NETWORK_PASSPHRASE);
     Simulation::pointer simulation;
 
+    bool pullMode = false;
+
     // make closing very slow
-    auto cfgGen = [](int cfgNum) {
+    auto cfgGen = [&pullMode](int cfgNum) {
         Config cfg = getTestConfig(cfgNum);
         cfg.ARTIFICIALLY_SET_CLOSE_TIME_FOR_TESTING = 10000;
+        cfg.FLOOD_TX_PULL_MODE = pullMode;
         return cfg;
     };
 
@@ -198,6 +205,44 @@ TEST_CASE("Flooding", "[flood][overlay]")
                 test(injectTransaction, ackedTransactions);
             }
         }
+
+        SECTION("pull mode")
+        {
+            pullMode = true;
+            auto advertised = [&]() {
+                int64_t res = 0;
+                for (auto n : nodes)
+                {
+                    res += n->getMetrics()
+                               .NewMeter({"overlay", "flood", "advertised"},
+                                         "message")
+                               .count();
+                }
+                return res;
+            };
+
+            SECTION("core loopback")
+            {
+                simulation = Topologies::core(
+                    4, .666f, Simulation::OVER_LOOPBACK, networkID, cfgGen);
+                test(injectTransaction, ackedTransactions);
+                REQUIRE(advertised() > 0);
+            }
+            SECTION("outer nodes loopback")
+            {
+                simulation = Topologies::hierarchicalQuorumSimplified(
+                    5, 10, Simulation::OVER_LOOPBACK, networkID, cfgGen);
+                test(injectTransaction, ackedTransactions);
+                REQUIRE(advertised() > 0);
+            }
+            SECTION("core tcp")
+            {
+                simulation = Topologies::core(4, .666f, Simulation::OVER_TCP,
+                                              networkID, cfgGen);
+                test(injectTransaction, ackedTransactions);
+                REQUIRE(advertised() > 0);
+            }
+        }
     }
 
     SECTION("scp messages flooding")
@@ -343,4 +388,356 @@ TEST_CASE("Flooding", "[flood][overlay]")
         }
     }
 }
+
+TEST_CASE("Transactions are pulled by hash when both peers agree",
+          "[flood][overlay]")
+{
+    VirtualClock clock;
+    auto cfg1 = getTestConfig(0);
+    auto cfg2 = getTestConfig(1);
+    cfg1.FLOOD_TX_PULL_MODE = true;
+    cfg2.FLOOD_TX_PULL_MODE = true;
+
+    auto count = [](Application& app, std::string const& type,
+                    std::string const& name) {
+        return app.getMetrics()
+            .NewMeter({"overlay", type, name}, "message")
+            .count();
+    };
+
+    auto flood = [&](Application& app1, Application& app2) {
+        LoopbackPeerConnection conn(app1, app2);
+        testutil::crankSome(clock);
+        REQUIRE(conn.getInitiator()->isAuthenticated());
+        REQUIRE(conn.getAcceptor()->isAuthenticated());
+
+        auto root = TestAccount::createRoot(app1);
+        auto tx = root.tx({createAccount(SecretKey::random().getPublicKey(),
+                                         app1.getLedgerManager()
+                                             .getLastMinBalance(0))});
+        REQUIRE(app1.getHerder().recvTransaction(tx) ==
+                Herder::TX_STATUS_PENDING);
+        app1.getOverlayManager().broadcastMessage(tx->toStellarMessage());
+
+        auto received = [&]() {
+            return app2.getHerder().getMaxSeqInPendingTxs(
+                       root.getPublicKey()) == tx->getSeqNum();
+        };
+        for (int i = 0; i < 10 && !received(); ++i)
+        {
+            testutil::crankSome(clock);
+        }
+        REQUIRE(received());
+    };
+
+    SECTION("pull mode on both sides")
+    {
+        auto app1 = createTestApplication(clock, cfg1);
+        auto app2 = createTestApplication(clock, cfg2);
+        flood(*app1, *app2);
+
+        REQUIRE(count(*app1, "flood", "advertised") == 1);
+        REQUIRE(count(*app1, "send", "flood-advert") == 1);
+        REQUIRE(count(*app2, "send", "flood-demand") == 1);
+        REQUIRE(count(*app1, "send", "transaction") == 1);
+        // app2 knows that app1 has it, and does not send it back
+        REQUIRE(count(*app2, "send", "flood-advert") == 0);
+        REQUIRE(count(*app2, "send", "transaction") == 0);
+    }
+
+    SECTION("old peer")
+    {
+        cfg2.OVERLAY_PROTOCOL_VERSION =
+            Peer::FIRST_OVERLAY_VERSION_WITH_FLOOD_ADVERT - 1;
+        auto app1 = createTestApplication(clock, cfg1);
+        auto app2 = createTestApplication(clock, cfg2);
+        flood(*app1, *app2);
+
+        REQUIRE(count(*app1, "flood", "advertised") == 0);
+        REQUIRE(count(*app1, "send", "flood-advert") == 0);
+        REQUIRE(count(*app1, "send", "transaction") == 1);
+    }
+
+    SECTION("pull mode off here")
+    {
+        cfg1.FLOOD_TX_PULL_MODE = false;
+        auto app1 = createTestApplication(clock, cfg1);
+        auto app2 = createTestApplication(clock, cfg2);
+        flood(*app1, *app2);
+
+        REQUIRE(count(*app1, "flood", "advertised") == 0);
+        REQUIRE(count(*app1, "send", "transaction") == 1);
+    }
+
+    SECTION("pull mode off there")
+    {
+        // adverts are still answered by a peer that does not send any
+        cfg2.FLOOD_TX_PULL_MODE = false;
+        auto app1 = createTestApplication(clock, cfg1);
+        auto app2 = createTestApplication(clock, cfg2);
+        flood(*app1, *app2);
+
+        REQUIRE(count(*app1, "send", "flood-advert") == 1);
+        REQUIRE(count(*app2, "send", "flood-demand") == 1);
+        REQUIRE(count(*app1, "send", "transaction") == 1);
+    }
+
+    SECTION("demands are ignored when not advertising")
+    {
+        cfg1.FLOOD_TX_PULL_MODE = false;
+        auto app1 = createTestApplication(clock, cfg1);
+        auto app2 = createTestApplication(clock, cfg2);
+        LoopbackPeerConnection conn(*app1, *app2);
+        testutil::crankSome(clock);
+        REQUIRE(conn.getInitiator()->isAuthenticated());
+        REQUIRE(conn.getAcceptor()->isAuthenticated());
+
+        StellarMessage demand;
+        demand.type(FLOOD_DEMAND);
+        demand.floodDemand().txHashes.push_back(sha256("unknown tx"));
+        conn.getAcceptor()->sendMessage(demand);
+        testutil::crankSome(clock);
+
+        REQUIRE(count(*app1, "send", "dont-have") == 0);
+        REQUIRE(count(*app1, "send", "transaction") == 0);
+        REQUIRE(conn.getInitiator()->isAuthenticated());
+    }
+
+    SECTION("an advertised transaction is served once per peer")
+    {
+        auto app1 = createTestApplication(clock, cfg1);
+        auto app2 = createTestApplication(clock, cfg2);
+        LoopbackPeerConnection conn(*app1, *app2);
+        testutil::crankSome(clock);
+        REQUIRE(conn.getInitiator()->isAuthenticated());
+        REQUIRE(conn.getAcceptor()->isAuthenticated());
+
+        auto root = TestAccount::createRoot(*app1);
+        auto tx = root.tx({createAccount(SecretKey::random().getPublicKey(),
+                                         app1->getLedgerManager()
+                                             .getLastMinBalance(0))});
+        REQUIRE(app1->getHerder().recvTransaction(tx) ==
+                Herder::TX_STATUS_PENDING);
+        app1->getOverlayManager().broadcastMessage(tx->toStellarMessage());
+        for (int i = 0; i < 10 && count(*app1, "send", "transaction") == 0;
+             ++i)
+        {
+            testutil::crankSome(clock);
+        }
+        REQUIRE(count(*app1, "send", "transaction") == 1);
+
+        // demanding it again gets DONT_HAVE, not another copy
+        StellarMessage demand;
+        demand.type(FLOOD_DEMAND);
+        demand.floodDemand().txHashes.push_back(
+            sha256(xdr::xdr_to_opaque(tx->toStellarMessage())));
+        conn.getAcceptor()->sendMessage(demand);
+        testutil::crankSome(clock);
+
+        REQUIRE(count(*app1, "send", "transaction") == 1);
+        REQUIRE(count(*app1, "send", "dont-have") == 1);
+    }
+
+    SECTION("a rejected transaction is no longer demanded")
+    {
+        auto app1 = createTestApplication(clock, cfg1);
+        auto app2 = createTestApplication(clock, cfg2);
+        LoopbackPeerConnection conn(*app1, *app2);
+        testutil::crankSome(clock);
+        REQUIRE(conn.getInitiator()->isAuthenticated());
+        REQUIRE(conn.getAcceptor()->isAuthenticated());
+
+        // a sequence number gap makes app2's herder reject it
+        auto root = TestAccount::createRoot(*app1);
+        auto tx = root.tx({createAccount(SecretKey::random().getPublicKey(),
+                                         app1->getLedgerManager()
+                                             .getLastMinBalance(0))},
+                          root.nextSequenceNumber() + 10);
+        auto hash = sha256(xdr::xdr_to_opaque(tx->toStellarMessage()));
+        app1->getOverlayManager().broadcastMessage(tx->toStellarMessage());
+
+        auto& fetcher = app2->getOverlayManager().getTxFetcher();
+        auto rejected = [&]() {
+            return count(*app1, "send", "transaction") == 1 &&
+                   fetcher.getLastSeenSlotIndex(hash) == 0;
+        };
+        for (int i = 0; i < 10 && !rejected(); ++i)
+        {
+            testutil::crankSome(clock);
+        }
+        REQUIRE(count(*app2, "send", "flood-demand") == 1);
+        REQUIRE(rejected());
+        REQUIRE(app2->getHerder().getMaxSeqInPendingTxs(root.getPublicKey()) !=
+                tx->getSeqNum());
+    }
+}
+
+namespace
+{
+// Authenticated peer without a transport that only counts the messages it is
+// sent, to drive the Floodgate directly.
+class FloodCountingPeer : public Peer
+{
+  public:
+    size_t mSent{0};
+
+    FloodCountingPeer(Application& app) : Peer(app, REMOTE_CALLED_US)
+    {
+        mPeerID = PubKeyUtils::random();
+        mState = GOT_AUTH;
+    }
+
+    using Peer::drop;
+    void
+    drop(bool force = true) override
+    {
+        if (mState != CLOSING)
+        {
+            mState = CLOSING;
+            mApp.getOverlayManager().dropPeer(this);
+        }
+    }
+
+  protected:
+    void
+    queueMessage(SerializedMessage::pointer const& msg) override
+    {
+        ++mSent;
+    }
+
+    void
+    sendMessage(xdr::msg_ptr&& xdrBytes) override
+    {
+    }
+
+    PeerBareAddress
+    makeAddress(int remoteListeningPort) const override
+    {
+        return PeerBareAddress{};
+    }
+};
+
+std::shared_ptr<FloodCountingPeer>
+addCountingPeer(Application& app)
+{
+    auto peer = std::make_shared<FloodCountingPeer>(app);
+    app.getOverlayManager().addPendingPeer(peer);
+    REQUIRE(app.getOverlayManager().acceptAuthenticatedPeer(peer));
+    return peer;
+}
+
+StellarMessage
+makeFloodedTx(uint32_t i)
+{
+    StellarMessage msg;
+    msg.type(TRANSACTION);
+    msg.transaction().tx.seqNum = i;
+    return msg;
+}
+}
+
+TEST_CASE("Floodgate tracks peers told per record", "[flood][overlay]")
+{
+    VirtualClock clock;
+    Application::pointer app = createTestApplication(clock, getTestConfig());
+    auto& om = app->getOverlayManager();
+
+    auto a = addCountingPeer(*app);
+    auto b = addCountingPeer(*app);
+    auto c = addCountingPeer(*app);
+
+    auto msg = makeFloodedTx(1);
+    auto hash = sha256(xdr::xdr_to_opaque(msg));
+
+    // a sent it to us: only b and c need it
+    om.recvFloodedMsg(msg, a);
+    om.broadcastMessage(msg, false);
+    REQUIRE(a->mSent == 0);
+    REQUIRE(b->mSent == 1);
+    REQUIRE(c->mSent == 1);
+    REQUIRE(om.getPeersKnows(hash) ==
+            std::set<Peer::pointer>{a, b, c});
+
+    om.broadcastMessage(msg, true);
+    REQUIRE(b->mSent == 1);
+    REQUIRE(c->mSent == 1);
+
+    // a peer replacing a dropped one is not mistaken for it
+    b->drop();
+    b.reset();
+    auto d = addCountingPeer(*app);
+    om.broadcastMessage(msg, false);
+    REQUIRE(d->mSent == 1);
+    REQUIRE(om.getPeersKnows(hash) ==
+            std::set<Peer::pointer>{a, c, d});
+
+    // once its ledger expires, the message is new again
+    om.ledgerClosed(app->getHerder().getCurrentLedgerSeq() + 11);
+    REQUIRE(om.getPeersKnows(hash).empty());
+    om.broadcastMessage(msg, false);
+    REQUIRE(a->mSent == 1);
+    REQUIRE(c->mSent == 2);
+    REQUIRE(d->mSent == 2);
+}
+
+TEST_CASE("Floodgate bench", "[floodgatebench][!hide]")
+{
+    VirtualClock clock;
+    Config cfg = getTestConfig();
+    size_t const nPeers = 100;
+    size_t const nRecords = 100000;
+    cfg.MAX_PEER_CONNECTIONS = nPeers;
+    cfg.MAX_PENDING_CONNECTIONS = nPeers;
+    Application::pointer app = createTestApplication(clock, cfg);
+    auto& om = app->getOverlayManager();
+
+    std::vector<std::shared_ptr<FloodCountingPeer>> peers;
+    for (size_t i = 0; i < nPeers; ++i)
+    {
+        peers.emplace_back(addCountingPeer(*app));
+    }
+    std::vector<StellarMessage> msgs;
+    for (uint32_t i = 0; i < nRecords; ++i)
+    {
+        msgs.emplace_back(makeFloodedTx(i));
+    }
+
+    auto report = [&](std::string const& name,
+                      std::chrono::steady_clock::time_point start) {
+        std::chrono::duration<double> secs =
+            std::chrono::steady_clock::now() - start;
+        CLOG(INFO, "Overlay") << name << ": " << nRecords << " records, "
+                              << nPeers << " peers in " << secs.count()
+                              << "s";
+    };
+
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < nRecords; ++i)
+        {
+            om.recvFloodedMsg(msgs[i], peers[i % nPeers]);
+        }
+        report("addRecord", start);
+    }
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (auto const& msg : msgs)
+        {
+            om.broadcastMessage(msg, false);
+        }
+        report("broadcast", start);
+    }
+    {
+        auto start = std::chrono::steady_clock::now();
+        om.ledgerClosed(app->getHerder().getCurrentLedgerSeq() + 11);
+        report("clearBelow", start);
+    }
+
+    size_t sent = 0;
+    for (auto const& p : peers)
+    {
+        sent += p->mSent;
+    }
+    REQUIRE(sent == nRecords * (nPeers - 1));
+}
 }
@@ -16,12 +16,70 @@
 
 namespace spn
 {
-Floodgate::FloodRecord::FloodRecord(StellarMessage const& msg, uint32_t ledger,
-                                    Peer::pointer peer)
-    : mLedgerSeq(ledger), mMessage(msg)
+
+bool
+Floodgate::PeerSlotSet::test(uint32_t slot) const
 {
-    if (peer)
-        mPeersTold.insert(peer);
+    if (slot < 64)
+    {
+        return (mLow >> slot) & 1;
+    }
+    size_t word = slot / 64 - 1;
+    return word < mHigh.size() && ((mHigh[word] >> (slot % 64)) & 1);
+}
+
+void
+Floodgate::PeerSlotSet::set(uint32_t slot)
+{
+    if (slot < 64)
+    {
+        mLow |= uint64_t(1) << slot;
+        return;
+    }
+    size_t word = slot / 64 - 1;
+    if (word >= mHigh.size())
+    {
+        mHigh.resize(word + 1);
+    }
+    mHigh[word] |= uint64_t(1) << (slot % 64);
+}
+
+void
+Floodgate::PeerSlotSet::reset(uint32_t slot)
+{
+    if (slot < 64)
+    {
+        mLow &= ~(uint64_t(1) << slot);
+        return;
+    }
+    size_t word = slot / 64 - 1;
+    if (word < mHigh.size())
+    {
+        mHigh[word] &= ~(uint64_t(1) << (slot % 64));
+    }
+}
+
+template <typename F>
+void
+Floodgate::PeerSlotSet::forEach(F f) const
+{
+    for (uint32_t i = 0; i < 64; ++i)
+    {
+        if ((mLow >> i) & 1)
+        {
+            f(i);
+        }
+    }
+    for (size_t w = 0; w < mHigh.size(); ++w)
+    {
+        for (uint32_t i = 0; i < 64; ++i)
+        {
+            if ((mHigh[w] >> i) & 1)
+            {
+                f(static_cast<uint32_t>((w + 1) * 64 + i));
+            }
+        }
+    }
 }
 
 Floodgate::Floodgate(Application& app)
@@ -30,6 +88,10 @@ Floodgate::Floodgate(Application& app)
           app.getMetrics().NewCounter({"overlay", "memory", "flood-known"}))
     , mSendFromBroadcast(app.getMetrics().NewMeter(
           {"overlay", "flood", "broadcast"}, "message"))
+    , mAdvertFromBroadcast(app.getMetrics().NewMeter(
+          {"overlay", "flood", "advertised"}, "message"))
+    , mPullBytesSaved(Peer::getPullBytesSavedCounter(app))
+    , mByteSerialize(Peer::getByteSerializeMeter(app))
     , mShuttingDown(false)
 {
 }
@@ -38,42 +100,122 @@ Floodgate::Floodgate(Application& app)
 void
 Floodgate::clearBelow(uint32_t currentLedger)
 {
-    for (auto it = mFloodMap.cbegin(); it != mFloodMap.cend();)
+    // give one ledger of leeway
+    while (!mGenerations.empty() &&
+           mGenerations.begin()->first + 10 < currentLedger)
     {
-        // give one ledger of leeway
-        if (it->second->mLedgerSeq + 10 < currentLedger)
+        for (auto const& h : mGenerations.begin()->second)
         {
-            mFloodMap.erase(it++);
+            mFloodMap.erase(h);
+        }
+        mGenerations.erase(mGenerations.begin());
+    }
+    mFloodMapSize.set_count(mFloodMap.size());
+    retireDeadSlots(mApp.getHerder().getCurrentLedgerSeq());
+}
+
+void
+Floodgate::retireDeadSlots(uint32_t currentLedger)
+{
+    for (auto it = mSlotOfPeer.begin(); it != mSlotOfPeer.end();)
+    {
+        auto slot = it->second;
+        if (mPeerSlots[slot].expired())
+        {
+            // records up to the current ledger may still have this slot set
+            mRetiredSlots.emplace_back(currentLedger, slot);
+            it = mSlotOfPeer.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    uint32_t oldest = mGenerations.empty() ? UINT32_MAX
+                                           : mGenerations.begin()->first;
+    for (auto it = mRetiredSlots.begin(); it != mRetiredSlots.end();)
+    {
+        if (it->first < oldest)
+        {
+            mFreeSlots.emplace_back(it->second);
+            it = mRetiredSlots.erase(it);
         }
         else
         {
             ++it;
         }
     }
-    mFloodMapSize.set_count(mFloodMap.size());
 }
 
-bool
-Floodgate::addRecord(StellarMessage const& msg, Peer::pointer peer)
+uint32_t
+Floodgate::getPeerSlot(Peer::pointer const& peer)
 {
-    if (mShuttingDown)
+    auto it = mSlotOfPeer.find(peer.get());
+    if (it != mSlotOfPeer.end())
     {
-        return false;
+        if (mPeerSlots[it->second].lock() == peer)
+        {
+            return it->second;
+        }
+        // a new peer at the address of one that went away
+        mPeerSlots[it->second].reset();
+        mRetiredSlots.emplace_back(mApp.getHerder().getCurrentLedgerSeq(),
+                                   it->second);
+        mSlotOfPeer.erase(it);
+    }
+
+    uint32_t slot;
+    if (!mFreeSlots.empty())
+    {
+        slot = mFreeSlots.back();
+        mFreeSlots.pop_back();
+        mPeerSlots[slot] = peer;
     }
-    Hash index = sha256(xdr::xdr_to_opaque(msg));
+    else
+    {
+        slot = static_cast<uint32_t>(mPeerSlots.size());
+        mPeerSlots.emplace_back(peer);
+    }
+    mSlotOfPeer[peer.get()] = slot;
+    return slot;
+}
+
+Floodgate::FloodRecord&
+Floodgate::getRecord(uint256 const& index, bool& isNew)
+{
     auto result = mFloodMap.find(index);
-    if (result == mFloodMap.end())
-    { // we have never seen this message
-        mFloodMap[index] = std::make_shared<FloodRecord>(
-            msg, mApp.getHerder().getCurrentLedgerSeq(), peer);
+    isNew = result == mFloodMap.end();
+    if (isNew)
+    {
+        auto ledgerSeq = mApp.getHerder().getCurrentLedgerSeq();
+        result = mFloodMap.emplace(index, FloodRecord{ledgerSeq, {}}).first;
+        mGenerations[ledgerSeq].emplace_back(index);
         mFloodMapSize.set_count(mFloodMap.size());
-        return true;
     }
-    else
+    return result->second;
+}
+
+bool
+Floodgate::addRecord(StellarMessage const& msg, Peer::pointer peer)
+{
+    return addRecord(sha256(xdr::xdr_to_opaque(msg)), peer);
+}
+
+bool
+Floodgate::addRecord(Hash const& index, Peer::pointer peer)
+{
+    if (mShuttingDown)
     {
-        result->second->mPeersTold.insert(peer);
         return false;
     }
+    bool isNew;
+    auto& record = getRecord(index, isNew);
+    if (peer)
+    {
+        record.mPeersTold.set(getPeerSlot(peer));
+    }
+    return isNew;
 }
 
 // send message to anyone you haven't gotten it from
@@ -84,35 +226,58 @@ Floodgate::broadcast(StellarMessage const& msg, bool force)
     {
         return;
     }
-    Hash index = sha256(xdr::xdr_to_opaque(msg));
-    CLOG(TRACE, "Overlay") << "broadcast " << hexAbbrev(index);
+    // Marshal the message once; every peer sends these same bytes.
+    auto serialized = SerializedMessage::create(msg);
+    mByteSerialize.Mark(serialized->mBytes.size());
+    broadcast(serialized, force);
+}
 
-    auto result = mFloodMap.find(index);
-    if (result == mFloodMap.end() || force)
-    { // no one has sent us this message
-        FloodRecord::pointer record = std::make_shared<FloodRecord>(
-            msg, mApp.getHerder().getCurrentLedgerSeq(), Peer::pointer());
-        result = mFloodMap.insert(std::make_pair(index, record)).first;
-        mFloodMapSize.set_count(mFloodMap.size());
+void
+Floodgate::broadcast(SerializedMessage::pointer const& serialized, bool force)
+{
+    if (mShuttingDown)
+    {
+        return;
     }
-    // send it to people that haven't sent it to us
-    std::set<Peer::pointer>& peersTold = result->second->mPeersTold;
+    Hash const& index = serialized->getHash();
+    CLOG(TRACE, "Overlay") << "broadcast " << hexAbbrev(index);
+
+    // a forced broadcast of a known message still only goes to the peers
+    // that do not have it yet
+    bool isNew;
+    auto& record = getRecord(index, isNew);
+    auto& peersTold = record.mPeersTold;
+    bool canAdvertise = serialized->mMessage.type() == TRANSACTION;
 
     // make a copy, in case peers gets modified
     auto peers = mApp.getOverlayManager().getAuthenticatedPeers();
 
+    size_t told = 0;
     for (auto peer : peers)
     {
         assert(peer.second->isAuthenticated());
-        if (peersTold.find(peer.second) == peersTold.end())
+        auto slot = getPeerSlot(peer.second);
+        if (!peersTold.test(slot))
         {
-            mSendFromBroadcast.Mark();
-            peer.second->sendMessage(msg);
-            peersTold.insert(peer.second);
+            if (canAdvertise && peer.second->isPullModeEnabled())
+            {
+                mAdvertFromBroadcast.Mark();
+                record.mAdvertised = serialized;
+                record.mAdvertisedTo.set(slot);
+                peer.second->advertiseTx(index);
+                mPullBytesSaved.inc(serialized->mBytes.size() - index.size());
+            }
+            else
+            {
+                mSendFromBroadcast.Mark();
+                peer.second->sendMessage(serialized);
+            }
+            peersTold.set(slot);
+            ++told;
         }
     }
     CLOG(TRACE, "Overlay") << "broadcast " << hexAbbrev(index) << " told "
-                           << peersTold.size();
+                           << told;
 }
 
 std::set<Peer::pointer>
@@ -122,15 +287,40 @@ Floodgate::getPeersKnows(Hash const& h)
     auto record = mFloodMap.find(h);
     if (record != mFloodMap.end())
     {
-        res = record->second->mPeersTold;
+        record->second.mPeersTold.forEach([&](uint32_t slot) {
+            if (auto peer = mPeerSlots[slot].lock())
+            {
+                res.insert(peer);
+            }
+        });
     }
     return res;
 }
 
+SerializedMessage::pointer
+Floodgate::takeAdvertised(Hash const& h, Peer::pointer const& peer)
+{
+    auto record = mFloodMap.find(h);
+    auto slot = mSlotOfPeer.find(peer.get());
+    if (record == mFloodMap.end() || slot == mSlotOfPeer.end() ||
+        mPeerSlots[slot->second].lock() != peer ||
+        !record->second.mAdvertisedTo.test(slot->second))
+    {
+        return nullptr;
+    }
+    record->second.mAdvertisedTo.reset(slot->second);
+    return record->second.mAdvertised;
+}
+
 void
 Floodgate::shutdown()
 {
     mShuttingDown = true;
     mFloodMap.clear();
+    mGenerations.clear();
+    mPeerSlots.clear();
+    mSlotOfPeer.clear();
+    mRetiredSlots.clear();
+    mFreeSlots.clear();
 }
 }
@@ -5,8 +5,12 @@
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
 #include "overlay/Peer.h"
+#include "overlay/SerializedMessage.h"
 #include "overlay/StellarXDR.h"
+#include "util/HashOfHash.h"
 #include <map>
+#include <unordered_map>
+#include <vector>
 
 /**
  * FloodGate keeps track of which peers have sent us which broadcast messages,
@@ -16,9 +20,14 @@
  *
  * The broadcast message types are TRANSACTION and SCP_MESSAGE.
  *
+ * Peers in pull mode (see Peer::isPullModeEnabled) are only told the hash of
+ * a TRANSACTION; the message is then kept with its record, so that it can
+ * be sent once to each peer it was advertised to when that peer demands it.
+ *
  * All messages are marked with the ledger sequence number to which they
  * relate, and all flood-management information for a given ledger number
- * is purged from the FloodGate when the ledger closes.
+ * is purged from the FloodGate when the ledger closes. Only the hashes of the
+ * messages are kept, not the messages themselves.
  */
 
 namespace medida
@@ -31,37 +40,75 @@ namespace spn
 
 class Floodgate
 {
-    class FloodRecord
+    // Set of peer slots (see getPeerSlot); the first 64 slots need no
+    // allocation, which covers the usual number of connections.
+    class PeerSlotSet
     {
+        uint64_t mLow{0};
+        std::vector<uint64_t> mHigh;
+
       public:
-        typedef std::shared_ptr<FloodRecord> pointer;
+        bool test(uint32_t slot) const;
+        void set(uint32_t slot);
+        void reset(uint32_t slot);
+        template <typename F> void forEach(F f) const;
+    };
 
+    struct FloodRecord
+    {
         uint32_t mLedgerSeq;
-        StellarMessage mMessage;
-        std::set<Peer::pointer> mPeersTold;
-
-        FloodRecord(StellarMessage const& msg, uint32_t ledger,
-                    Peer::pointer peer);
+        PeerSlotSet mPeersTold;
+        // set once the message was advertised to some peer
+        SerializedMessage::pointer mAdvertised;
+        // peers it was advertised to that have not demanded it yet
+        PeerSlotSet mAdvertisedTo;
     };
 
-    std::map<uint256, FloodRecord::pointer> mFloodMap;
+    // Records are indexed by message hash, and grouped into generations by
+    // the ledger they were first seen in, so that expiring a ledger does
+    // not need to look at records from any other.
+    std::unordered_map<uint256, FloodRecord> mFloodMap;
+    std::map<uint32_t, std::vector<uint256>> mGenerations;
+
+    // Peers are known by a small slot number for as long as they are alive.
+    // The slot of a peer that went away is retired until every generation
+    // that could mention it has expired, and only then reused.
+    std::vector<std::weak_ptr<Peer>> mPeerSlots;
+    std::unordered_map<Peer const*, uint32_t> mSlotOfPeer;
+    std::vector<std::pair<uint32_t, uint32_t>> mRetiredSlots; // ledger, slot
+    std::vector<uint32_t> mFreeSlots;
+
     Application& mApp;
     medida::Counter& mFloodMapSize;
     medida::Meter& mSendFromBroadcast;
+    medida::Meter& mAdvertFromBroadcast;
+    medida::Counter& mPullBytesSaved;
+    medida::Meter& mByteSerialize;
     bool mShuttingDown;
 
+    FloodRecord& getRecord(uint256 const& index, bool& isNew);
+    uint32_t getPeerSlot(Peer::pointer const& peer);
+    void retireDeadSlots(uint32_t currentLedger);
+
   public:
     Floodgate(Application& app);
     // Floodgate will be cleared after every ledger close
     void clearBelow(uint32_t currentLedger);
     // returns true if this is a new record
     bool addRecord(StellarMessage const& msg, Peer::pointer fromPeer);
+    bool addRecord(Hash const& index, Peer::pointer fromPeer);
 
     void broadcast(StellarMessage const& msg, bool force);
+    void broadcast(SerializedMessage::pointer const& msg, bool force);
 
     // returns the list of peers that sent us the item with hash `h`
     std::set<Peer::pointer> getPeersKnows(Hash const& h);
 
+    // returns the message with hash `h` if it was advertised to `peer` and
+    // not handed out for that peer yet, else nullptr
+    SerializedMessage::pointer takeAdvertised(Hash const& h,
+                                              Peer::pointer const& peer);
+
     void shutdown();
 };
 }
@@ -43,6 +43,28 @@ ItemFetcher::fetch(Hash itemHash, const SCPEnvelope& envelope)
     }
 }
 
+void
+ItemFetcher::fetch(Hash itemHash, Peer::pointer peer)
+{
+    CLOG(TRACE, "Overlay") << "fetch " << hexAbbrev(itemHash) << " from "
+                           << peer->toString();
+    auto slotIndex = mApp.getHerder().getCurrentLedgerSeq();
+    auto entryIt = mTrackers.find(itemHash);
+    if (entryIt == mTrackers.end())
+    { // not being tracked
+        TrackerPtr tracker =
+            std::make_shared<Tracker>(mApp, itemHash, mAskPeer);
+        mTrackers[itemHash] = tracker;
+
+        tracker->addPeerWithItem(peer, slotIndex);
+        tracker->tryNextPeer();
+    }
+    else
+    {
+        entryIt->second->addPeerWithItem(peer, slotIndex);
+    }
+}
+
 void
 ItemFetcher::stopFetch(Hash itemHash, const SCPEnvelope& envelope)
 {
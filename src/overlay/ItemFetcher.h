@@ -31,7 +31,8 @@ using AskPeer = std::function<void(Peer::pointer, Hash)>;
 /**
  * @class ItemFetcher
  *
- * Manages asking for Transaction or Quorum sets from Peers
+ * Manages asking for Transaction or Quorum sets, or advertised transactions,
+ * from Peers
  *
  * The ItemFetcher keeps instances of the Tracker class. There exists exactly
  * one Tracker per item. The tracker is used to maintain the state of the
@@ -53,6 +54,13 @@ class ItemFetcher : private NonMovableOrCopyable
      */
     void fetch(Hash itemHash, const SCPEnvelope& envelope);
 
+    /**
+     * Fetch data identified by @p hash that @p peer said it has. Such data is
+     * only asked from the peers that said they have it, and is no longer
+     * fetched after the ledger following the one it was last advertised in.
+     */
+    void fetch(Hash itemHash, Peer::pointer peer);
+
     /**
      * Stops fetching data identified by @p hash for @p envelope. If other
      * envelopes requires this data, it is still being fetched, but
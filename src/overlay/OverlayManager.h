@@ -28,6 +28,9 @@
  *  - One-way broadcast messages informing other peers of an event:
  *    TRANSACTION and SCP_MESSAGE
  *
+ *  - Hashes of broadcast transactions, and requests for the ones the
+ *    receiver does not have: FLOOD_ADVERT and FLOOD_DEMAND
+ *
  *  - Two-way anycast messages requesting a value (by hash) or providing it:
  *    GET_TX_SET, TX_SET, GET_SCP_QUORUMSET, SCP_QUORUMSET, GET_SCP_STATE
  *
@@ -36,6 +39,11 @@
  * directly-connected peers, in sequence until satisfied. They are not
  * flooded between peers.
  *
+ * With FLOOD_TX_PULL_MODE, transactions are broadcast to the peers that
+ * support it as FLOOD_ADVERT hashes instead; a third ItemFetcher (the tx
+ * fetcher) demands each unknown transaction from the peers that advertised
+ * it, one after the other until one of them sends it.
+ *
  * Broadcasts are initiated by the Herder and sent to both the Herder _and_ the
  * local FloodGate, for propagation to other peers.
  *
@@ -46,10 +54,12 @@
 namespace spn
 {
 
+class ItemFetcher;
 class PeerAuth;
 class PeerBareAddress;
 class PeerRecord;
 class LoadManager;
+class TransactionIngress;
 
 class OverlayManager
 {
@@ -68,6 +78,10 @@ class OverlayManager
     // Herder.
     virtual void broadcastMessage(StellarMessage const& msg,
                                   bool force = false) = 0;
+    // As above, for a message that is already marshalled, such as one
+    // received from a peer: the same bytes are relayed.
+    virtual void broadcastMessage(SerializedMessage::pointer const& msg,
+                                  bool force = false) = 0;
 
     // Make a note in the FloodGate that a given peer has provided us with a
     // given broadcast message, so that it is inhibited from being resent to
@@ -75,6 +89,21 @@ class OverlayManager
     // that, call broadcastMessage, above.
     virtual void recvFloodedMsg(StellarMessage const& msg,
                                 Peer::pointer peer) = 0;
+    virtual void recvFloodedMsg(SerializedMessage::pointer const& msg,
+                                Peer::pointer peer) = 0;
+
+    // Make a note that `peer` has the transaction of flood hash `hash`, and
+    // fetch it from the peers advertising it if it is not known yet.
+    virtual void recvTxAdvert(Hash const& hash, Peer::pointer peer) = 0;
+
+    // Return the transaction message of flood hash `hash` if it was
+    // advertised to `peer`, is still known and was not returned for `peer`
+    // before; nullptr otherwise. Each peer is served an advert only once.
+    virtual SerializedMessage::pointer
+    getAdvertisedTx(Hash const& hash, Peer::pointer const& peer) = 0;
+
+    // Return the ItemFetcher demanding advertised transactions.
+    virtual ItemFetcher& getTxFetcher() = 0;
 
     // Return a list of random peers from the set of authenticated peers.
     virtual std::vector<Peer::pointer> getRandomAuthenticatedPeers() = 0;
@@ -134,6 +163,10 @@ class OverlayManager
     // Return the persistent peer-load-accounting cache.
     virtual LoadManager& getLoadManager() = 0;
 
+    // Return the stage that pre-verifies transactions received from peers
+    // before they are handed to the Herder.
+    virtual TransactionIngress& getTransactionIngress() = 0;
+
     // start up all background tasks for overlay
     virtual void start() = 0;
     // drops all connections
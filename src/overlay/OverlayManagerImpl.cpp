@@ -4,6 +4,7 @@
 
 #include "overlay/OverlayManagerImpl.h"
 #include "crypto/KeyUtils.h"
+#include "crypto/SHA.h"
 #include "crypto/SecretKey.h"
 #include "database/Database.h"
 #include "main/Application.h"
@@ -13,8 +14,10 @@
 #include "overlay/TCPPeer.h"
 #include "util/Logging.h"
 #include "util/XDROperators.h"
+#include "xdrpp/marshal.h"
 
 #include "medida/counter.h"
+#include "medida/histogram.h"
 #include "medida/meter.h"
 #include "medida/metrics_registry.h"
 
@@ -77,6 +80,12 @@ OverlayManagerImpl::OverlayManagerImpl(Application& app)
           {"overlay", "connection", "authenticated"}))
     , mTimer(app)
     , mFloodGate(app)
+    , mTransactionIngress(std::make_shared<TransactionIngress>(app))
+    , mTxFetcher(app,
+                 [](Peer::pointer peer, Hash hash) { peer->demandTx(hash); })
+    , mPullBytesSaved(Peer::getPullBytesSavedCounter(app))
+    , mPullBytesSavedPerLedger(app.getMetrics().NewHistogram(
+          {"overlay", "flood", "pull-bytes-saved-per-ledger"}))
 {
 }
 
@@ -339,6 +348,11 @@ void
 OverlayManagerImpl::ledgerClosed(uint32_t lastClosedledgerSeq)
 {
     mFloodGate.clearBelow(lastClosedledgerSeq);
+    // advertised transactions not received by now are not worth demanding
+    mTxFetcher.stopFetchingBelow(lastClosedledgerSeq);
+
+    mPullBytesSavedPerLedger.Update(mPullBytesSaved.count());
+    mPullBytesSaved.clear();
 }
 
 void
@@ -532,7 +546,45 @@ void
 OverlayManagerImpl::recvFloodedMsg(StellarMessage const& msg,
                                    Peer::pointer peer)
 {
-    mFloodGate.addRecord(msg, peer);
+    recvFloodedMsg(SerializedMessage::create(msg), peer);
+}
+
+void
+OverlayManagerImpl::recvFloodedMsg(SerializedMessage::pointer const& msg,
+                                   Peer::pointer peer)
+{
+    auto const& hash = msg->getHash();
+    mFloodGate.addRecord(hash, peer);
+    if (msg->mMessage.type() == TRANSACTION)
+    {
+        // stop demanding it, if it was advertised
+        mTxFetcher.recv(hash);
+    }
+}
+
+void
+OverlayManagerImpl::recvTxAdvert(Hash const& hash, Peer::pointer peer)
+{
+    // the advertiser is told, like the sender of a flooded message would be;
+    // a transaction that is new, or still being fetched, is fetched from it
+    bool isNew = mFloodGate.addRecord(hash, peer);
+    if (isNew || mTxFetcher.getLastSeenSlotIndex(hash) != 0)
+    {
+        mTxFetcher.fetch(hash, peer);
+    }
+}
+
+SerializedMessage::pointer
+OverlayManagerImpl::getAdvertisedTx(Hash const& hash,
+                                    Peer::pointer const& peer)
+{
+    return mFloodGate.takeAdvertised(hash, peer);
+}
+
+ItemFetcher&
+OverlayManagerImpl::getTxFetcher()
+{
+    return mTxFetcher;
 }
 
 void
@@ -542,6 +594,14 @@ OverlayManagerImpl::broadcastMessage(StellarMessage const& msg, bool force)
     mFloodGate.broadcast(msg, force);
 }
 
+void
+OverlayManagerImpl::broadcastMessage(SerializedMessage::pointer const& msg,
+                                     bool force)
+{
+    mMessagesBroadcast.Mark();
+    mFloodGate.broadcast(msg, force);
+}
+
 void
 OverlayManager::dropAll(Database& db)
 {
@@ -566,6 +626,12 @@ OverlayManagerImpl::getLoadManager()
     return mLoad;
 }
 
+TransactionIngress&
+OverlayManagerImpl::getTransactionIngress()
+{
+    return *mTransactionIngress;
+}
+
 void
 OverlayManagerImpl::shutdown()
 {
@@ -576,6 +642,7 @@ OverlayManagerImpl::shutdown()
     mShuttingDown = true;
     mDoor.close();
     mFloodGate.shutdown();
+    mTransactionIngress->shutdown();
     auto pendingPeersToStop = mPendingPeers;
     for (auto& p : pendingPeersToStop)
     {
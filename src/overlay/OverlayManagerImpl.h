@@ -14,6 +14,7 @@
 #include "overlay/ItemFetcher.h"
 #include "overlay/OverlayManager.h"
 #include "overlay/StellarXDR.h"
+#include "overlay/TransactionIngress.h"
 #include "util/Timer.h"
 #include <set>
 #include <vector>
@@ -22,6 +23,7 @@ namespace medida
 {
 class Meter;
 class Counter;
+class Histogram;
 }
 
 /*
@@ -63,6 +65,10 @@ class OverlayManagerImpl : public OverlayManager
     friend class OverlayManagerTests;
 
     Floodgate mFloodGate;
+    std::shared_ptr<TransactionIngress> mTransactionIngress;
+    ItemFetcher mTxFetcher;
+    medida::Counter& mPullBytesSaved;
+    medida::Histogram& mPullBytesSavedPerLedger;
 
   public:
     OverlayManagerImpl(Application& app);
@@ -70,6 +76,12 @@ class OverlayManagerImpl : public OverlayManager
 
     void ledgerClosed(uint32_t lastClosedledgerSeq) override;
     void recvFloodedMsg(StellarMessage const& msg, Peer::pointer peer) override;
+    void recvFloodedMsg(SerializedMessage::pointer const& msg,
+                        Peer::pointer peer) override;
+    void recvTxAdvert(Hash const& hash, Peer::pointer peer) override;
+    SerializedMessage::pointer
+    getAdvertisedTx(Hash const& hash, Peer::pointer const& peer) override;
+    ItemFetcher& getTxFetcher() override;
     void broadcastMessage(StellarMessage const& msg,
                           bool force = false) override;
     void connectTo(std::string const& addr) override;
@@ -98,6 +110,8 @@ class OverlayManagerImpl : public OverlayManager
 
     LoadManager& getLoadManager() override;
 
+    TransactionIngress& getTransactionIngress() override;
+
     void start() override;
     void shutdown() override;
 
@@ -4,6 +4,7 @@
 
 #include "BanManager.h"
 #include "crypto/KeyUtils.h"
+#include "crypto/SHA.h"
 #include "crypto/SecretKey.h"
 #include "lib/catch.hpp"
 #include "main/Application.h"
@@ -12,8 +13,11 @@
 #include "overlay/OverlayManagerImpl.h"
 #include "overlay/PeerRecord.h"
 #include "overlay/TCPPeer.h"
+#include "overlay/TransactionIngress.h"
 #include "simulation/Simulation.h"
+#include "test/TestAccount.h"
 #include "test/TestUtils.h"
+#include "test/TxTests.h"
 #include "test/test.h"
 #include "util/Logging.h"
 #include "util/Timer.h"
@@ -22,6 +26,7 @@
 #include "medida/metrics_registry.h"
 #include "medida/timer.h"
 #include "util/format.h"
+#include "xdrpp/marshal.h"
 #include <numeric>
 
 using namespace spn;
@@ -497,3 +502,142 @@ TEST_CASE("preferred peers always connect", "[overlay][connections]")
     REQUIRE(numberOfAppConnections(*simulation->getNode(vNode2NodeID)) == 1);
     REQUIRE(numberOfAppConnections(*simulation->getNode(vNode3NodeID)) == 1);
 }
+
+TEST_CASE("broadcast serializes message once", "[overlay][flood]")
+{
+    VirtualClock clock;
+    auto app1 = createTestApplication(clock, getTestConfig(0));
+    auto app2 = createTestApplication(clock, getTestConfig(1));
+    auto app3 = createTestApplication(clock, getTestConfig(2));
+
+    LoopbackPeerConnection conn2(*app1, *app2);
+    LoopbackPeerConnection conn3(*app1, *app3);
+    testutil::crankSome(clock);
+    REQUIRE(app1->getOverlayManager().getAuthenticatedPeersCount() == 2);
+
+    StellarMessage msg;
+    msg.type(TRANSACTION);
+    auto& serialized = Peer::getByteSerializeMeter(*app1);
+    auto& written = Peer::getByteWriteMeter(*app1);
+    auto serializedBefore = serialized.count();
+    auto writtenBefore = written.count();
+
+    app1->getOverlayManager().broadcastMessage(msg);
+    // Marshalled once for both peers...
+    REQUIRE(serialized.count() - serializedBefore == xdr::xdr_size(msg));
+
+    // ...each of which got a validly framed copy (or it would have dropped
+    // the connection).
+    testutil::crankSome(clock);
+    REQUIRE(written.count() - writtenBefore >= 2 * xdr::xdr_size(msg));
+    REQUIRE(conn2.getInitiator()->isAuthenticated());
+    REQUIRE(conn3.getInitiator()->isAuthenticated());
+}
+
+TEST_CASE("relayed messages keep their received bytes", "[overlay][flood]")
+{
+    VirtualClock clock;
+    auto app1 = createTestApplication(clock, getTestConfig(0));
+    auto app2 = createTestApplication(clock, getTestConfig(1));
+    auto app3 = createTestApplication(clock, getTestConfig(2));
+
+    LoopbackPeerConnection conn2(*app1, *app2);
+    LoopbackPeerConnection conn3(*app1, *app3);
+    testutil::crankSome(clock);
+    REQUIRE(app1->getOverlayManager().getAuthenticatedPeersCount() == 2);
+
+    auto root = txtest::TestAccount::createRoot(*app2);
+    auto msg = root.tx({txtest::createAccount(
+                            SecretKey::random().getPublicKey(), 1000)})
+                   ->toStellarMessage();
+    auto hash = sha256(xdr::xdr_to_opaque(msg));
+    auto& serialized = Peer::getByteSerializeMeter(*app1);
+    auto serializedBefore = serialized.count();
+
+    // app2 -> app1 -> app3
+    conn2.getAcceptor()->sendMessage(msg);
+    while (app3->getOverlayManager().getPeersKnows(hash).empty())
+    {
+        clock.crank(false);
+    }
+
+    // app1 knew the message by the hash of its bytes, and passed those on
+    // without marshalling it again
+    REQUIRE(app1->getOverlayManager().getPeersKnows(hash).size() == 2);
+    REQUIRE(serialized.count() == serializedBefore);
+    REQUIRE(conn3.getAcceptor()->isAuthenticated());
+}
+
+TEST_CASE("transaction ingress pre-verifies signatures", "[overlay][tx]")
+{
+    VirtualClock clock;
+    auto app = createTestApplication(clock, getTestConfig());
+
+    auto root = txtest::TestAccount::createRoot(*app);
+    auto tx = root.tx(
+        {txtest::createAccount(SecretKey::random().getPublicKey(), 1000)});
+    auto const& sig = tx->getEnvelope().signatures.at(0);
+
+    PubKeyUtils::clearVerifySigCache();
+    uint64_t hits = 0, misses = 0;
+    PubKeyUtils::flushVerifySigCacheCounts(hits, misses);
+
+    std::vector<TransactionFramePtr> handled;
+    auto& ingress = app->getOverlayManager().getTransactionIngress();
+    ingress.enqueue(tx, [&](TransactionFramePtr const& t) {
+        handled.emplace_back(t);
+    });
+    REQUIRE(handled.empty());
+
+    while (handled.empty())
+    {
+        clock.crank(false);
+    }
+    REQUIRE(handled[0] == tx);
+    REQUIRE(ingress.getQueueDepth() == 0);
+
+    // The master key signature is now cached.
+    PubKeyUtils::flushVerifySigCacheCounts(hits, misses);
+    REQUIRE(misses == 1);
+    REQUIRE(PubKeyUtils::verifySig(root.getPublicKey(), sig.signature,
+                                   tx->getContentsHash()));
+    PubKeyUtils::flushVerifySigCacheCounts(hits, misses);
+    REQUIRE(hits == 1);
+    REQUIRE(misses == 0);
+}
+
+TEST_CASE("transaction ingress pre-verifies operation source signatures",
+          "[overlay][tx]")
+{
+    VirtualClock clock;
+    auto app = createTestApplication(clock, getTestConfig());
+
+    auto root = txtest::TestAccount::createRoot(*app);
+    auto opSource = SecretKey::random();
+    auto op = txtest::createAccount(SecretKey::random().getPublicKey(), 1000);
+    op.sourceAccount.activate() = opSource.getPublicKey();
+    auto tx = root.tx({op});
+    tx->addSignature(opSource);
+    auto const& sig = tx->getEnvelope().signatures.at(1);
+
+    PubKeyUtils::clearVerifySigCache();
+    uint64_t hits = 0, misses = 0;
+    PubKeyUtils::flushVerifySigCacheCounts(hits, misses);
+
+    bool handled = false;
+    auto& ingress = app->getOverlayManager().getTransactionIngress();
+    ingress.enqueue(tx, [&](TransactionFramePtr const&) { handled = true; });
+    while (!handled)
+    {
+        clock.crank(false);
+    }
+
+    // Both the transaction and the operation source signatures are cached.
+    PubKeyUtils::flushVerifySigCacheCounts(hits, misses);
+    REQUIRE(misses == 2);
+    REQUIRE(PubKeyUtils::verifySig(opSource.getPublicKey(), sig.signature,
+                                   tx->getContentsHash()));
+    PubKeyUtils::flushVerifySigCacheCounts(hits, misses);
+    REQUIRE(hits == 1);
+    REQUIRE(misses == 0);
+}
@@ -14,20 +14,25 @@
 #include "ledger/LedgerManager.h"
 #include "main/Application.h"
 #include "main/Config.h"
+#include "overlay/ItemFetcher.h"
 #include "overlay/LoadManager.h"
 #include "overlay/OverlayManager.h"
 #include "overlay/PeerAuth.h"
 #include "overlay/PeerRecord.h"
 #include "overlay/StellarXDR.h"
+#include "overlay/TransactionIngress.h"
 #include "util/Logging.h"
 #include "util/XDROperators.h"
 
+#include "medida/counter.h"
 #include "medida/meter.h"
 #include "medida/metrics_registry.h"
 #include "medida/timer.h"
 
 #include "xdrpp/marshal.h"
 
+#include <algorithm>
+#include <stdexcept>
 #include <soci.h>
 #include <time.h>
 
@@ -52,6 +57,22 @@ Peer::getByteWriteMeter(Application& app)
     return app.getMetrics().NewMeter({"overlay", "byte", "write"}, "byte");
 }
 
+medida::Meter&
+Peer::getByteSerializeMeter(Application& app)
+{
+    return app.getMetrics().NewMeter({"overlay", "byte", "serialize"},
+                                     "byte");
+}
+
+medida::Counter&
+Peer::getPullBytesSavedCounter(Application& app)
+{
+    return app.getMetrics().NewCounter(
+        {"overlay", "flood", "pull-bytes-saved"});
+}
+
+std::chrono::milliseconds const Peer::TX_ADVERT_PERIOD{100};
+
 Peer::Peer(Application& app, PeerRole role)
     : mApp(app)
     , mRole(role)
@@ -60,6 +81,7 @@ Peer::Peer(Application& app, PeerRole role)
     , mIdleTimer(app)
     , mLastRead(app.getClock().now())
     , mLastWrite(app.getClock().now())
+    , mTxAdvertTimer(app)
 
     , mMessageRead(
           app.getMetrics().NewMeter({"overlay", "message", "read"}, "message"))
@@ -67,12 +89,14 @@ Peer::Peer(Application& app, PeerRole role)
           app.getMetrics().NewMeter({"overlay", "message", "write"}, "message"))
     , mByteRead(getByteReadMeter(app))
     , mByteWrite(getByteWriteMeter(app))
+    , mByteSerialize(getByteSerializeMeter(app))
     , mErrorRead(
           app.getMetrics().NewMeter({"overlay", "error", "read"}, "error"))
     , mErrorWrite(
           app.getMetrics().NewMeter({"overlay", "error", "write"}, "error"))
     , mTimeoutIdle(
           app.getMetrics().NewMeter({"overlay", "timeout", "idle"}, "timeout"))
+    , mPullBytesSaved(getPullBytesSavedCounter(app))
 
     , mRecvErrorTimer(app.getMetrics().NewTimer({"overlay", "recv", "error"}))
     , mRecvHelloTimer(app.getMetrics().NewTimer({"overlay", "recv", "hello"}))
@@ -95,6 +119,10 @@ Peer::Peer(Application& app, PeerRole role)
           app.getMetrics().NewTimer({"overlay", "recv", "scp-message"}))
     , mRecvGetSCPStateTimer(
           app.getMetrics().NewTimer({"overlay", "recv", "get-scp-state"}))
+    , mRecvFloodAdvertTimer(
+          app.getMetrics().NewTimer({"overlay", "recv", "flood-advert"}))
+    , mRecvFloodDemandTimer(
+          app.getMetrics().NewTimer({"overlay", "recv", "flood-demand"}))
 
     , mRecvSCPPrepareTimer(
           app.getMetrics().NewTimer({"overlay", "recv", "scp-prepare"}))
@@ -131,6 +159,10 @@ Peer::Peer(Application& app, PeerRole role)
           {"overlay", "send", "scp-message"}, "message"))
     , mSendGetSCPStateMeter(app.getMetrics().NewMeter(
           {"overlay", "send", "get-scp-state"}, "message"))
+    , mSendFloodAdvertMeter(app.getMetrics().NewMeter(
+          {"overlay", "send", "flood-advert"}, "message"))
+    , mSendFloodDemandMeter(app.getMetrics().NewMeter(
+          {"overlay", "send", "flood-demand"}, "message"))
 {
     auto bytes = randomBytes(mSendNonce.size());
     std::copy(bytes.begin(), bytes.end(), mSendNonce.begin());
@@ -340,6 +372,102 @@ Peer::sendGetScpState(uint32 ledgerSeq)
     sendMessage(newMsg);
 }
 
+bool
+Peer::supportsFloodAdvert() const
+{
+    return mApp.getConfig().OVERLAY_PROTOCOL_VERSION >=
+               FIRST_OVERLAY_VERSION_WITH_FLOOD_ADVERT &&
+           mRemoteOverlayVersion >= FIRST_OVERLAY_VERSION_WITH_FLOOD_ADVERT;
+}
+
+bool
+Peer::isPullModeEnabled() const
+{
+    return mApp.getConfig().FLOOD_TX_PULL_MODE && supportsFloodAdvert();
+}
+
+void
+Peer::advertiseTx(Hash const& hash)
+{
+    mTxAdvertQueue.emplace_back(hash);
+    if (mTxAdvertQueue.size() >= TX_ADVERT_VECTOR_MAX_SIZE)
+    {
+        flushTxAdverts();
+    }
+    else if (mTxAdvertQueue.size() == 1)
+    {
+        std::weak_ptr<Peer> weak = shared_from_this();
+        mTxAdvertTimer.expires_from_now(TX_ADVERT_PERIOD);
+        mTxAdvertTimer.async_wait(
+            [weak]() {
+                if (auto self = weak.lock())
+                {
+                    self->flushTxAdverts();
+                }
+            },
+            VirtualTimer::onFailureNoop);
+    }
+}
+
+void
+Peer::flushTxAdverts()
+{
+    mTxAdvertTimer.cancel();
+    if (mTxAdvertQueue.empty() || shouldAbort())
+    {
+        mTxAdvertQueue.clear();
+        return;
+    }
+
+    StellarMessage msg;
+    msg.type(FLOOD_ADVERT);
+    msg.floodAdvert().txHashes.assign(mTxAdvertQueue.begin(),
+                                      mTxAdvertQueue.end());
+    mTxAdvertQueue.clear();
+    sendMessage(msg);
+}
+
+void
+Peer::demandTx(Hash const& hash)
+{
+    // the demand costs the hash it carries
+    mPullBytesSaved.dec(hash.size());
+    mTxDemandQueue.emplace_back(hash);
+    if (mTxDemandQueue.size() >= TX_DEMAND_VECTOR_MAX_SIZE)
+    {
+        flushTxDemands();
+    }
+    else if (mTxDemandQueue.size() == 1)
+    {
+        // everything demanded while handling the current event (typically
+        // one FLOOD_ADVERT) goes out together
+        std::weak_ptr<Peer> weak = shared_from_this();
+        mApp.postOnMainThread([weak]() {
+            if (auto self = weak.lock())
+            {
+                self->flushTxDemands();
+            }
+        });
+    }
+}
+
+void
+Peer::flushTxDemands()
+{
+    if (mTxDemandQueue.empty() || shouldAbort())
+    {
+        mTxDemandQueue.clear();
+        return;
+    }
+
+    StellarMessage msg;
+    msg.type(FLOOD_DEMAND);
+    msg.floodDemand().txHashes.assign(mTxDemandQueue.begin(),
+                                      mTxDemandQueue.end());
+    mTxDemandQueue.clear();
+    sendMessage(msg);
+}
+
 void
 Peer::sendPeers()
 {
@@ -416,22 +544,34 @@ msgSummary(StellarMessage const& msg)
         }
     case GET_SCP_STATE:
         return "GET_SCP_STATE";
+    case FLOOD_ADVERT:
+        return "FLOODADVERT";
+    case FLOOD_DEMAND:
+        return "FLOODDEMAND";
     }
     return "UNKNOWN";
 }
 
 void
 Peer::sendMessage(StellarMessage const& msg)
+{
+    auto serialized = SerializedMessage::create(msg);
+    mByteSerialize.Mark(serialized->mBytes.size());
+    sendMessage(serialized);
+}
+
+void
+Peer::sendMessage(SerializedMessage::pointer const& msg)
 {
     if (Logging::logTrace("Overlay"))
         CLOG(TRACE, "Overlay")
             << "("
             << mApp.getConfig().toShortString(
                    mApp.getConfig().NODE_SEED.getPublicKey())
-            << ") send: " << msgSummary(msg)
+            << ") send: " << msgSummary(msg->mMessage)
             << " to : " << mApp.getConfig().toShortString(mPeerID);
 
-    switch (msg.type())
+    switch (msg->mMessage.type())
     {
     case ERROR_MSG:
         mSendErrorMeter.Mark();
@@ -472,19 +612,59 @@ Peer::sendMessage(StellarMessage const& msg)
     case GET_SCP_STATE:
         mSendGetSCPStateMeter.Mark();
         break;
+    case FLOOD_ADVERT:
+        mSendFloodAdvertMeter.Mark();
+        break;
+    case FLOOD_DEMAND:
+        mSendFloodDemandMeter.Mark();
+        break;
     };
 
-    AuthenticatedMessage amsg;
-    amsg.v0().message = msg;
-    if (msg.type() != HELLO && msg.type() != ERROR_MSG)
+    queueMessage(msg);
+}
+
+void
+Peer::queueMessage(SerializedMessage::pointer const& msg)
+{
+    sendMessage(frameMessage(*msg));
+}
+
+void
+Peer::sendMessage(xdr::msg_ptr&& xdrBytes)
+{
+    throw std::logic_error("Peer::sendMessage called on a transport that "
+                           "frames messages in queueMessage");
+}
+
+xdr::msg_ptr
+Peer::frameMessage(SerializedMessage const& msg)
+{
+    auto const& bytes = msg.mBytes;
+    auto const type = msg.mMessage.type();
+
+    // Lay out AuthenticatedMessage v0 around the already marshalled message:
+    // version (4 bytes), sequence (8 bytes), message, MAC (32 bytes). The MAC
+    // covers sequence and message, which are contiguous in the buffer.
+    HmacSha256Mac mac;
+    size_t const macOffset = 4 + 8 + bytes.size();
+    xdr::msg_ptr xdrBytes(xdr::message_t::alloc(macOffset + mac.mac.size()));
+    uint8_t* out = reinterpret_cast<uint8_t*>(xdrBytes->data());
+    std::fill(out, out + 4, 0);
+
+    bool const authenticated = type != HELLO && type != ERROR_MSG;
+    uint64_t const seq = authenticated ? mSendMacSeq++ : 0;
+    for (int i = 0; i < 8; ++i)
     {
-        amsg.v0().sequence = mSendMacSeq;
-        amsg.v0().mac =
-            hmacSha256(mSendMacKey, xdr::xdr_to_opaque(mSendMacSeq, msg));
-        ++mSendMacSeq;
+        out[4 + i] = static_cast<uint8_t>(seq >> (8 * (7 - i)));
     }
-    xdr::msg_ptr xdrBytes(xdr::xdr_to_msg(amsg));
-    this->sendMessage(std::move(xdrBytes));
+    std::copy(bytes.begin(), bytes.end(), out + 12);
+
+    if (authenticated)
+    {
+        mac = hmacSha256(mSendMacKey, ByteSlice(out + 4, 8 + bytes.size()));
+    }
+    std::copy(mac.mac.begin(), mac.mac.end(), out + macOffset);
+    return xdrBytes;
 }
 
 void
@@ -502,7 +682,7 @@ Peer::recvMessage(xdr::msg_ptr const& msg)
     {
         AuthenticatedMessage am;
         xdr::xdr_from_msg(msg, am);
-        recvMessage(am);
+        recvMessage(std::move(am), msg);
     }
     catch (xdr::xdr_runtime_error& e)
     {
@@ -531,14 +711,21 @@ Peer::shouldAbort() const
 }
 
 void
-Peer::recvMessage(AuthenticatedMessage const& msg)
+Peer::recvMessage(AuthenticatedMessage&& msg, ByteSlice const& frame)
 {
     if (shouldAbort())
     {
         return;
     }
 
-    if (mState >= GOT_HELLO && msg.v0().message.type() != ERROR_MSG)
+    // the frame is laid out as in frameMessage: version, sequence, message
+    // and MAC, of which the middle two are authenticated
+    auto const macOffset = frame.size() - msg.v0().mac.mac.size();
+    ByteSlice authenticated(frame.data() + 4, macOffset - 4);
+    ByteSlice message(frame.data() + 12, macOffset - 12);
+
+    auto type = msg.v0().message.type();
+    if (mState >= GOT_HELLO && type != ERROR_MSG)
     {
         if (msg.v0().sequence != mRecvMacSeq)
         {
@@ -548,9 +735,7 @@ Peer::recvMessage(AuthenticatedMessage const& msg)
             return;
         }
 
-        if (!hmacSha256Verify(
-                msg.v0().mac, mRecvMacKey,
-                xdr::xdr_to_opaque(msg.v0().sequence, msg.v0().message)))
+        if (!hmacSha256Verify(msg.v0().mac, mRecvMacKey, authenticated))
         {
             CLOG(ERROR, "Overlay") << "Message-auth check failed";
             ++mRecvMacSeq;
@@ -559,17 +744,27 @@ Peer::recvMessage(AuthenticatedMessage const& msg)
         }
         ++mRecvMacSeq;
     }
-    recvMessage(msg.v0().message);
+
+    auto serialized =
+        SerializedMessage::fromWire(std::move(msg.v0().message), message);
+    if (!serialized)
+    {
+        CLOG(DEBUG, "Overlay") << "recv: non-canonical encoding of " << type;
+        serialized = SerializedMessage::create(msg.v0().message);
+    }
+    recvMessage(serialized);
 }
 
 void
-Peer::recvMessage(StellarMessage const& spnMsg)
+Peer::recvMessage(SerializedMessage::pointer const& msg)
 {
     if (shouldAbort())
     {
         return;
     }
 
+    StellarMessage const& spnMsg = msg->mMessage;
+
     if (Logging::logTrace("Overlay"))
         CLOG(TRACE, "Overlay")
             << "("
@@ -651,7 +846,7 @@ Peer::recvMessage(StellarMessage const& spnMsg)
     case TRANSACTION:
     {
         auto t = mRecvTransactionTimer.TimeScope();
-        recvTransaction(spnMsg);
+        recvTransaction(msg);
     }
     break;
 
@@ -672,7 +867,7 @@ Peer::recvMessage(StellarMessage const& spnMsg)
     case SCP_MESSAGE:
     {
         auto t = mRecvSCPMessageTimer.TimeScope();
-        recvSCPMessage(spnMsg);
+        recvSCPMessage(msg);
     }
     break;
 
@@ -682,12 +877,32 @@ Peer::recvMessage(StellarMessage const& spnMsg)
         recvGetSCPState(spnMsg);
     }
     break;
+
+    case FLOOD_ADVERT:
+    {
+        auto t = mRecvFloodAdvertTimer.TimeScope();
+        recvFloodAdvert(spnMsg);
+    }
+    break;
+
+    case FLOOD_DEMAND:
+    {
+        auto t = mRecvFloodDemandTimer.TimeScope();
+        recvFloodDemand(spnMsg);
+    }
+    break;
     }
 }
 
 void
 Peer::recvDontHave(StellarMessage const& msg)
 {
+    if (msg.dontHave().type == TRANSACTION)
+    {
+        mApp.getOverlayManager().getTxFetcher().doesntHave(
+            msg.dontHave().reqHash, shared_from_this());
+        return;
+    }
     mApp.getHerder().peerDoesntHave(msg.dontHave().type, msg.dontHave().reqHash,
                                     shared_from_this());
 }
@@ -718,29 +933,57 @@ Peer::recvTxSet(StellarMessage const& msg)
 }
 
 void
-Peer::recvTransaction(StellarMessage const& msg)
+Peer::recvTransaction(SerializedMessage::pointer const& msg)
 {
     TransactionFramePtr transaction = TransactionFrame::makeTransactionFromWire(
-        mApp.getNetworkID(), msg.transaction());
-    if (transaction)
+        mApp.getNetworkID(), msg->mMessage.transaction());
+    if (!transaction)
     {
-        // add it to our current set
-        // and make sure it is valid
-        auto recvRes = mApp.getHerder().recvTransaction(transaction);
+        // nothing to wait for from the other peers that advertised it
+        mApp.getOverlayManager().getTxFetcher().recv(msg->getHash());
+    }
+    else
+    {
+        // signatures are checked off the main thread first; the rest of the
+        // validation happens once that is done
+        std::weak_ptr<Peer> weak = shared_from_this();
+        mApp.getOverlayManager().getTransactionIngress().enqueue(
+            transaction, [weak, msg](TransactionFramePtr const& tx) {
+                auto self = weak.lock();
+                if (self && !self->shouldAbort())
+                {
+                    self->recvVerifiedTransaction(msg, tx);
+                }
+            });
+    }
+}
 
-        if (recvRes == Herder::TX_STATUS_PENDING ||
-            recvRes == Herder::TX_STATUS_DUPLICATE)
-        {
-            // record that this peer sent us this transaction
-            mApp.getOverlayManager().recvFloodedMsg(msg, shared_from_this());
+void
+Peer::recvVerifiedTransaction(SerializedMessage::pointer const& msg,
+                              TransactionFramePtr const& transaction)
+{
+    // add it to our current set
+    // and make sure it is valid
+    auto recvRes = mApp.getHerder().recvTransaction(transaction);
 
-            if (recvRes == Herder::TX_STATUS_PENDING)
-            {
-                // if it's a new transaction, broadcast it
-                mApp.getOverlayManager().broadcastMessage(msg);
-            }
+    if (recvRes == Herder::TX_STATUS_PENDING ||
+        recvRes == Herder::TX_STATUS_DUPLICATE)
+    {
+        // record that this peer sent us this transaction
+        mApp.getOverlayManager().recvFloodedMsg(msg, shared_from_this());
+
+        if (recvRes == Herder::TX_STATUS_PENDING)
+        {
+            // if it's a new transaction, broadcast it
+            mApp.getOverlayManager().broadcastMessage(msg);
         }
     }
+    else
+    {
+        // the herder has decided on it: stop demanding it from the other
+        // peers that advertised it
+        mApp.getOverlayManager().getTxFetcher().recv(msg->getHash());
+    }
 }
 
 void
@@ -769,17 +1012,17 @@ Peer::recvSCPQuorumSet(StellarMessage const& msg)
 }
 
 void
-Peer::recvSCPMessage(StellarMessage const& msg)
+Peer::recvSCPMessage(SerializedMessage::pointer const& msg)
 {
-    SCPEnvelope const& envelope = msg.envelope();
+    SCPEnvelope const& envelope = msg->mMessage.envelope();
     if (Logging::logTrace("Overlay"))
         CLOG(TRACE, "Overlay")
             << "recvSCPMessage node: "
-            << mApp.getConfig().toShortString(msg.envelope().statement.nodeID);
+            << mApp.getConfig().toShortString(envelope.statement.nodeID);
 
     mApp.getOverlayManager().recvFloodedMsg(msg, shared_from_this());
 
-    auto type = msg.envelope().statement.pledges.type();
+    auto type = envelope.statement.pledges.type();
     auto t = (type == SCP_ST_PREPARE
                   ? mRecvSCPPrepareTimer.TimeScope()
                   : (type == SCP_ST_CONFIRM
@@ -799,6 +1042,54 @@ Peer::recvGetSCPState(StellarMessage const& msg)
     mApp.getHerder().sendSCPStateToPeer(seq, shared_from_this());
 }
 
+void
+Peer::recvFloodAdvert(StellarMessage const& msg)
+{
+    // peers in pull mode advertise to us whatever our own FLOOD_TX_PULL_MODE,
+    // but only if the version we agreed on has adverts
+    if (!supportsFloodAdvert())
+    {
+        CLOG(DEBUG, "Overlay") << "Ignoring FLOOD_ADVERT from " << toString()
+                               << ": not supported by the overlay version";
+        return;
+    }
+
+    auto self = shared_from_this();
+    for (auto const& hash : msg.floodAdvert().txHashes)
+    {
+        mApp.getOverlayManager().recvTxAdvert(hash, self);
+    }
+}
+
+void
+Peer::recvFloodDemand(StellarMessage const& msg)
+{
+    // we only advertise, and so only expect demands, in pull mode
+    if (!isPullModeEnabled())
+    {
+        CLOG(DEBUG, "Overlay") << "Ignoring FLOOD_DEMAND from " << toString()
+                               << ": pull mode is not enabled";
+        return;
+    }
+
+    auto self = shared_from_this();
+    for (auto const& hash : msg.floodDemand().txHashes)
+    {
+        auto tx = mApp.getOverlayManager().getAdvertisedTx(hash, self);
+        if (tx)
+        {
+            // the advert was cheaper than pushing the transaction only if
+            // it is not demanded in the end
+            mPullBytesSaved.dec(tx->mBytes.size());
+            sendMessage(tx);
+        }
+        else
+        {
+            sendDontHave(TRANSACTION, hash);
+        }
+    }
+}
+
 void
 Peer::recvError(StellarMessage const& msg)
 {
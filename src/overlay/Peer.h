@@ -6,7 +6,9 @@
 
 #include "util/asio.h"
 #include "database/Database.h"
+#include "crypto/ByteSlice.h"
 #include "overlay/PeerBareAddress.h"
+#include "overlay/SerializedMessage.h"
 #include "overlay/StellarXDR.h"
 #include "util/NonCopyable.h"
 #include "util/Timer.h"
@@ -14,6 +16,7 @@
 
 namespace medida
 {
+class Counter;
 class Timer;
 class Meter;
 }
@@ -25,6 +28,7 @@ typedef std::shared_ptr<SCPQuorumSet> SCPQuorumSetPtr;
 
 class Application;
 class LoopbackPeer;
+class TransactionFrame;
 
 /*
  * Another peer out there that we are connected to
@@ -53,6 +57,14 @@ class Peer : public std::enable_shared_from_this<Peer>,
 
     static medida::Meter& getByteReadMeter(Application& app);
     static medida::Meter& getByteWriteMeter(Application& app);
+    static medida::Meter& getByteSerializeMeter(Application& app);
+    // Bytes not sent thanks to pull mode since the last ledger closed.
+    static medida::Counter& getPullBytesSavedCounter(Application& app);
+
+    // First overlay version understanding FLOOD_ADVERT and FLOOD_DEMAND.
+    static uint32_t const FIRST_OVERLAY_VERSION_WITH_FLOOD_ADVERT = 8;
+    // How long advertised hashes are held back to batch them.
+    static std::chrono::milliseconds const TX_ADVERT_PERIOD;
 
   protected:
     Application& mApp;
@@ -77,13 +89,20 @@ class Peer : public std::enable_shared_from_this<Peer>,
     VirtualClock::time_point mLastRead;
     VirtualClock::time_point mLastWrite;
 
+    // hashes waiting to go out in the next FLOOD_ADVERT / FLOOD_DEMAND
+    std::vector<Hash> mTxAdvertQueue;
+    VirtualTimer mTxAdvertTimer;
+    std::vector<Hash> mTxDemandQueue;
+
     medida::Meter& mMessageRead;
     medida::Meter& mMessageWrite;
     medida::Meter& mByteRead;
     medida::Meter& mByteWrite;
+    medida::Meter& mByteSerialize;
     medida::Meter& mErrorRead;
     medida::Meter& mErrorWrite;
     medida::Meter& mTimeoutIdle;
+    medida::Counter& mPullBytesSaved;
 
     medida::Timer& mRecvErrorTimer;
     medida::Timer& mRecvHelloTimer;
@@ -98,6 +117,8 @@ class Peer : public std::enable_shared_from_this<Peer>,
     medida::Timer& mRecvSCPQuorumSetTimer;
     medida::Timer& mRecvSCPMessageTimer;
     medida::Timer& mRecvGetSCPStateTimer;
+    medida::Timer& mRecvFloodAdvertTimer;
+    medida::Timer& mRecvFloodDemandTimer;
 
     medida::Timer& mRecvSCPPrepareTimer;
     medida::Timer& mRecvSCPConfirmTimer;
@@ -117,10 +138,14 @@ class Peer : public std::enable_shared_from_this<Peer>,
     medida::Meter& mSendSCPQuorumSetMeter;
     medida::Meter& mSendSCPMessageSetMeter;
     medida::Meter& mSendGetSCPStateMeter;
+    medida::Meter& mSendFloodAdvertMeter;
+    medida::Meter& mSendFloodDemandMeter;
 
     bool shouldAbort() const;
-    void recvMessage(StellarMessage const& msg);
-    void recvMessage(AuthenticatedMessage const& msg);
+    void recvMessage(SerializedMessage::pointer const& msg);
+    // `frame` holds the bytes `msg` was decoded from; the MAC is checked,
+    // and the message hashed and relayed, from those bytes.
+    void recvMessage(AuthenticatedMessage&& msg, ByteSlice const& frame);
     void recvMessage(xdr::msg_ptr const& xdrBytes);
 
     virtual void recvError(StellarMessage const& msg);
@@ -134,17 +159,32 @@ class Peer : public std::enable_shared_from_this<Peer>,
 
     void recvGetTxSet(StellarMessage const& msg);
     void recvTxSet(StellarMessage const& msg);
-    void recvTransaction(StellarMessage const& msg);
+    void recvTransaction(SerializedMessage::pointer const& msg);
+    void recvVerifiedTransaction(SerializedMessage::pointer const& msg,
+                                 std::shared_ptr<TransactionFrame> const& tx);
     void recvGetSCPQuorumSet(StellarMessage const& msg);
     void recvSCPQuorumSet(StellarMessage const& msg);
-    void recvSCPMessage(StellarMessage const& msg);
+    void recvSCPMessage(SerializedMessage::pointer const& msg);
     void recvGetSCPState(StellarMessage const& msg);
+    void recvFloodAdvert(StellarMessage const& msg);
+    void recvFloodDemand(StellarMessage const& msg);
 
     void sendHello();
     void sendAuth();
     void sendSCPQuorumSet(SCPQuorumSetPtr qSet);
     void sendDontHave(MessageType type, uint256 const& itemID);
     void sendPeers();
+    void flushTxAdverts();
+    void flushTxDemands();
+
+    // Frames `msg` as an AuthenticatedMessage for this peer, consuming the
+    // next MAC sequence number: frames must reach the wire in the order they
+    // were made.
+    xdr::msg_ptr frameMessage(SerializedMessage const& msg);
+
+    // Hands `msg` to the transport. The default frames and sends it at once;
+    // TCPPeer keeps it in an outbound queue and frames it on the way out.
+    virtual void queueMessage(SerializedMessage::pointer const& msg);
 
     // NB: This is a move-argument because the write-buffer has to travel
     // with the write-request through the async IO system, and we might have
@@ -153,7 +193,10 @@ class Peer : public std::enable_shared_from_this<Peer>,
     // put in a reused/non-owned buffer without having to buffer/queue
     // messages somewhere else. The async write request will point _into_
     // this owned buffer. This is really the best we can do.
-    virtual void sendMessage(xdr::msg_ptr&& xdrBytes) = 0;
+    //
+    // Only called by the default queueMessage, so transports that override
+    // that need not implement it; the default throws.
+    virtual void sendMessage(xdr::msg_ptr&& xdrBytes);
     virtual void
     connected()
     {
@@ -184,6 +227,19 @@ class Peer : public std::enable_shared_from_this<Peer>,
     void sendGetScpState(uint32 ledgerSeq);
 
     void sendMessage(StellarMessage const& msg);
+    // Sends an already marshalled message without serializing it again.
+    void sendMessage(SerializedMessage::pointer const& msg);
+
+    // Whether both ends speak FIRST_OVERLAY_VERSION_WITH_FLOOD_ADVERT, so that
+    // this peer may advertise transactions to us.
+    bool supportsFloodAdvert() const;
+    // Whether transactions are flooded to this peer by hash: FLOOD_TX_PULL_MODE
+    // is set, and supportsFloodAdvert().
+    bool isPullModeEnabled() const;
+    // Queue the flood hash of a transaction for the next FLOOD_ADVERT sent
+    // to this peer, respectively the next FLOOD_DEMAND.
+    void advertiseTx(Hash const& hash);
+    void demandTx(Hash const& hash);
 
     PeerRole
     getRole() const
@@ -242,12 +298,7 @@ class Peer : public std::enable_shared_from_this<Peer>,
     }
 
     virtual void
-    readHeaderHandler(asio::error_code const& error, size_t bytes_transferred)
-    {
-    }
-
-    virtual void
-    readBodyHandler(asio::error_code const& error, size_t bytes_transferred)
+    readHandler(asio::error_code const& error, size_t bytes_transferred)
     {
     }
 
@@ -0,0 +1,55 @@
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "overlay/SerializedMessage.h"
+#include "crypto/SHA.h"
+#include "xdrpp/marshal.h"
+
+namespace spn
+{
+
+SerializedMessage::pointer
+SerializedMessage::create(StellarMessage const& msg)
+{
+    return std::make_shared<SerializedMessage const>(
+        msg, xdr::xdr_to_opaque(msg));
+}
+
+SerializedMessage::pointer
+SerializedMessage::fromWire(StellarMessage&& msg, ByteSlice const& bytes)
+{
+    // xdrpp only decodes input it consumes entirely, with zeroed padding and
+    // in-range booleans, enums and discriminants; of such input, only the
+    // canonical encoding has the marshalled size of what it decoded to.
+    if (xdr::xdr_size(msg) != bytes.size())
+    {
+        return nullptr;
+    }
+    return std::make_shared<SerializedMessage const>(
+        std::move(msg), xdr::opaque_vec<>(bytes.begin(), bytes.end()));
+}
+
+SerializedMessage::SerializedMessage(StellarMessage const& msg,
+                                     xdr::opaque_vec<>&& bytes)
+    : mMessage(msg), mBytes(std::move(bytes))
+{
+}
+
+SerializedMessage::SerializedMessage(StellarMessage&& msg,
+                                     xdr::opaque_vec<>&& bytes)
+    : mMessage(std::move(msg)), mBytes(std::move(bytes))
+{
+}
+
+Hash const&
+SerializedMessage::getHash() const
+{
+    if (!mHashed)
+    {
+        mHash = sha256(mBytes);
+        mHashed = true;
+    }
+    return mHash;
+}
+}
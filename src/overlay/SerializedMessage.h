@@ -0,0 +1,48 @@
+#pragma once
+
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "crypto/ByteSlice.h"
+#include "overlay/StellarXDR.h"
+#include <memory>
+
+namespace spn
+{
+
+/**
+ * A StellarMessage marshalled exactly once, so that it can be flooded to any
+ * number of peers: each peer only frames these bytes with its own sequence
+ * number and MAC (see Peer::sendMessage), when the message leaves its
+ * outbound queue. Immutable once created, and shared between the Floodgate
+ * record and every pending send.
+ */
+class SerializedMessage
+{
+  public:
+    typedef std::shared_ptr<SerializedMessage const> pointer;
+
+    StellarMessage const mMessage;
+    xdr::opaque_vec<> const mBytes;
+
+    static pointer create(StellarMessage const& msg);
+
+    // Keeps `bytes`, the encoding `msg` was just decoded from, rather than
+    // marshalling `msg` again. Returns nullptr if `bytes` is not the
+    // canonical encoding of `msg`, in which case `msg` is left untouched and
+    // the caller should fall back to create().
+    static pointer fromWire(StellarMessage&& msg, ByteSlice const& bytes);
+
+    SerializedMessage(StellarMessage const& msg, xdr::opaque_vec<>&& bytes);
+    SerializedMessage(StellarMessage&& msg, xdr::opaque_vec<>&& bytes);
+
+    // sha256 of mBytes; the key the Floodgate knows this message by.
+    // Computed on first use (on the main thread).
+    Hash const& getHash() const;
+
+  private:
+    mutable Hash mHash;
+    mutable bool mHashed{false};
+};
+}
@@ -6,6 +6,8 @@
 #include "database/Database.h"
 #include "main/Application.h"
 #include "main/Config.h"
+#include "medida/counter.h"
+#include "medida/histogram.h"
 #include "medida/meter.h"
 #include "medida/metrics_registry.h"
 #include "overlay/LoadManager.h"
@@ -16,6 +18,8 @@
 #include "util/Logging.h"
 #include "xdrpp/marshal.h"
 
+#include <cstring>
+
 using namespace soci;
 
 namespace spn
@@ -29,10 +33,80 @@ using namespace std;
 
 TCPPeer::TCPPeer(Application& app, Peer::PeerRole role,
                  std::shared_ptr<TCPPeer::SocketType> socket)
-    : Peer(app, role), mSocket(socket)
+    : Peer(app, role)
+    , mSocket(socket)
+    , mSCPQueue(
+          MAX_SCP_QUEUE_BYTES, false,
+          app.getMetrics().NewCounter({"overlay", "outbound-queue", "scp"}),
+          app.getMetrics().NewMeter({"overlay", "outbound-drop", "scp"},
+                                    "message"))
+    , mFetchQueue(
+          MAX_FETCH_QUEUE_BYTES, false,
+          app.getMetrics().NewCounter({"overlay", "outbound-queue", "fetch"}),
+          app.getMetrics().NewMeter({"overlay", "outbound-drop", "fetch"},
+                                    "message"))
+    , mTxQueue(
+          MAX_TX_QUEUE_BYTES, true,
+          app.getMetrics().NewCounter({"overlay", "outbound-queue", "tx"}),
+          app.getMetrics().NewMeter({"overlay", "outbound-drop", "tx"},
+                                    "message"))
+    , mReadOps(app.getMetrics().NewMeter({"overlay", "async", "read"}, "call"))
+    , mWriteOps(
+          app.getMetrics().NewMeter({"overlay", "async", "write"}, "call"))
+    , mMessagesPerRead(
+          app.getMetrics().NewHistogram({"overlay", "read", "batch"}))
+    , mMessagesPerWrite(
+          app.getMetrics().NewHistogram({"overlay", "write", "batch"}))
+{
+}
+
+TCPPeer::OutboundQueue::OutboundQueue(size_t maxBytes, bool dropOldest,
+                                      medida::Counter& depth,
+                                      medida::Meter& drops)
+    : mMaxBytes(maxBytes), mDropOldest(dropOldest), mDepth(depth), mDrops(drops)
 {
 }
 
+void
+TCPPeer::OutboundQueue::push(SerializedMessage::pointer const& msg)
+{
+    auto size = msg->mBytes.size();
+    if (mDropOldest)
+    {
+        while (!mMessages.empty() && mBytes + size > mMaxBytes)
+        {
+            pop();
+            mDrops.Mark();
+        }
+    }
+    else if (!mMessages.empty() && mBytes + size > mMaxBytes)
+    {
+        mDrops.Mark();
+        return;
+    }
+    mMessages.emplace_back(msg);
+    mBytes += size;
+    mDepth.inc();
+}
+
+SerializedMessage::pointer
+TCPPeer::OutboundQueue::pop()
+{
+    auto msg = std::move(mMessages.front());
+    mMessages.pop_front();
+    mBytes -= msg->mBytes.size();
+    mDepth.dec();
+    return msg;
+}
+
+void
+TCPPeer::OutboundQueue::clear()
+{
+    mDepth.dec(mMessages.size());
+    mMessages.clear();
+    mBytes = 0;
+}
+
 TCPPeer::pointer
 TCPPeer::initiate(Application& app, PeerBareAddress const& address)
 {
@@ -97,6 +171,9 @@ TCPPeer::~TCPPeer()
 {
     assertThreadIsMain();
     mIdleTimer.cancel();
+    mSCPQueue.clear();
+    mFetchQueue.clear();
+    mTxQueue.clear();
     if (mSocket)
     {
         // Ignore: this indicates an attempt to cancel events
@@ -129,8 +206,25 @@ TCPPeer::makeAddress(int remoteListeningPort) const
     }
 }
 
+TCPPeer::OutboundQueue&
+TCPPeer::getOutboundQueue(MessageType type)
+{
+    switch (type)
+    {
+    case TX_SET:
+    case SCP_QUORUMSET:
+        return mFetchQueue;
+    case TRANSACTION:
+    case FLOOD_ADVERT:
+    case FLOOD_DEMAND:
+        return mTxQueue;
+    default:
+        return mSCPQueue;
+    }
+}
+
 void
-TCPPeer::sendMessage(xdr::msg_ptr&& xdrBytes)
+TCPPeer::queueMessage(SerializedMessage::pointer const& msg)
 {
     if (mState == CLOSING)
     {
@@ -140,24 +234,26 @@ TCPPeer::sendMessage(xdr::msg_ptr&& xdrBytes)
     }
 
     if (Logging::logTrace("Overlay"))
-        CLOG(TRACE, "Overlay") << "TCPPeer:sendMessage to " << toString();
+        CLOG(TRACE, "Overlay") << "TCPPeer:queueMessage to " << toString();
     assertThreadIsMain();
 
-    // places the buffer to write into the write queue
-    auto buf = std::make_shared<xdr::msg_ptr>(std::move(xdrBytes));
-
-    auto self = static_pointer_cast<TCPPeer>(shared_from_this());
+    getOutboundQueue(msg->mMessage.type()).push(msg);
 
-    self->mWriteQueue.emplace(buf);
-
-    if (!self->mWriting)
+    if (!mWriting)
     {
-        self->mWriting = true;
+        mWriting = true;
         // kick off the async write chain if we're the first one
-        self->messageSender();
+        messageSender();
     }
 }
 
+size_t
+TCPPeer::getOutboundQueueDepth() const
+{
+    return mSCPQueue.mMessages.size() + mFetchQueue.mMessages.size() +
+           mTxQueue.mMessages.size();
+}
+
 void
 TCPPeer::shutdown()
 {
@@ -223,49 +319,66 @@ TCPPeer::messageSender()
 
     auto self = static_pointer_cast<TCPPeer>(shared_from_this());
 
-    // if nothing to do, flush and return
-    if (mWriteQueue.empty())
+    // if nothing to do, return
+    if (getOutboundQueueDepth() == 0)
+    {
+        mWriting = false;
+        // there is nothing to send and delayed shutdown was requested - time
+        // to perform it
+        if (mDelayedShutdown)
+        {
+            shutdown();
+        }
+        return;
+    }
+
+    // gather as much as the budget allows into one write, highest priority
+    // class first; the framed buffers live in mWriteBatch for the duration
+    // of the write operation
+    assert(mWriteBatch.empty());
+    std::vector<asio::const_buffer> buffers;
+    size_t bytes = 0;
+    for (auto queue : {&mSCPQueue, &mFetchQueue, &mTxQueue})
     {
-        mSocket->async_flush([self](asio::error_code const& ec, std::size_t) {
-            self->writeHandler(ec, 0);
+        while (!queue->mMessages.empty() &&
+               buffers.size() < MAX_WRITE_BATCH_MESSAGES &&
+               (buffers.empty() ||
+                bytes + queue->mMessages.front()->mBytes.size() <=
+                    MAX_WRITE_BATCH_BYTES))
+        {
+            auto framed = frameMessage(*queue->pop());
+            buffers.emplace_back(framed->raw_data(), framed->raw_size());
+            bytes += framed->raw_size();
+            mWriteBatch.emplace_back(std::move(framed));
+        }
+        if (!queue->mMessages.empty())
+        {
+            // out of budget: lower classes must not overtake this one
+            break;
+        }
+    }
+
+    auto count = buffers.size();
+    mWriteOps.Mark();
+    mMessagesPerWrite.Update(count);
+    // writes go to the socket directly: the queues already do the buffering
+    asio::async_write(
+        mSocket->next_layer(), buffers,
+        [self, count](asio::error_code const& ec, std::size_t length) {
+            self->writeHandler(ec, length);
             if (!ec)
             {
-                if (!self->mWriteQueue.empty())
-                {
-                    self->messageSender();
-                }
-                else
-                {
-                    self->mWriting = false;
-                    // there is nothing to send and delayed shutdown was
-                    // requested - time to perform it
-                    if (self->mDelayedShutdown)
-                    {
-                        self->shutdown();
-                    }
-                }
+                self->mMessageWrite.Mark(count);
             }
-        });
-        return;
-    }
+            // done with the batch
+            self->mWriteBatch.clear();
 
-    // peek the buffer from the queue
-    // do not remove it yet as we need the buffer for the duration of the
-    // write operation
-    auto buf = mWriteQueue.front();
-
-    asio::async_write(*(mSocket.get()),
-                      asio::buffer((*buf)->raw_data(), (*buf)->raw_size()),
-                      [self](asio::error_code const& ec, std::size_t length) {
-                          self->writeHandler(ec, length);
-                          self->mWriteQueue.pop(); // done with front element
-
-                          // continue processing the queue/flush
-                          if (!ec)
-                          {
-                              self->messageSender();
-                          }
-                      });
+            // continue processing the queues
+            if (!ec)
+            {
+                self->messageSender();
+            }
+        });
 }
 
 void
@@ -299,7 +412,6 @@ TCPPeer::writeHandler(asio::error_code const& error,
     else if (bytes_transferred != 0)
     {
         LoadManager::PeerContext loadCtx(mApp, mPeerID);
-        mMessageWrite.Mark();
         mByteWrite.Mark(bytes_transferred);
     }
 }
@@ -315,35 +427,54 @@ TCPPeer::startRead()
 
     auto self = static_pointer_cast<TCPPeer>(shared_from_this());
 
-    assert(self->mIncomingHeader.size() == 0);
-
     if (Logging::logTrace("Overlay"))
         CLOG(TRACE, "Overlay") << "TCPPeer::startRead to " << self->toString();
 
-    self->mIncomingHeader.resize(4);
-    asio::async_read(*(self->mSocket.get()),
-                     asio::buffer(self->mIncomingHeader),
-                     [self](asio::error_code ec, std::size_t length) {
-                         if (Logging::logTrace("Overlay"))
-                             CLOG(TRACE, "Overlay")
-                                 << "TCPPeer::startRead calledback " << ec
-                                 << " length:" << length;
-                         self->readHeaderHandler(ec, length);
-                     });
+    if (mReadStart == mReadEnd)
+    {
+        mReadStart = mReadEnd = 0;
+        if (mReadBuffer.size() != READ_BUFFER_SIZE)
+        {
+            // first read, or the buffer last held an unusually large message
+            mReadBuffer.resize(READ_BUFFER_SIZE);
+            mReadBuffer.shrink_to_fit();
+        }
+    }
+    else if (mReadEnd == mReadBuffer.size())
+    {
+        // only the start of a header is left at the very end
+        std::memmove(mReadBuffer.data(), mReadBuffer.data() + mReadStart,
+                     mReadEnd - mReadStart);
+        mReadEnd -= mReadStart;
+        mReadStart = 0;
+    }
+    assert(mReadEnd < mReadBuffer.size());
+
+    mSocket->next_layer().async_read_some(
+        asio::buffer(mReadBuffer.data() + mReadEnd,
+                     mReadBuffer.size() - mReadEnd),
+        [self](asio::error_code ec, std::size_t length) {
+            if (Logging::logTrace("Overlay"))
+                CLOG(TRACE, "Overlay") << "TCPPeer::startRead calledback "
+                                       << ec << " length:" << length;
+            self->readHandler(ec, length);
+        });
 }
 
 int
-TCPPeer::getIncomingMsgLength()
+TCPPeer::getIncomingMsgLength(uint8_t const* header)
 {
-    int length = mIncomingHeader[0];
+    int length = header[0];
     length &= 0x7f; // clear the XDR 'continuation' bit
     length <<= 8;
-    length |= mIncomingHeader[1];
+    length |= header[1];
     length <<= 8;
-    length |= mIncomingHeader[2];
+    length |= header[2];
     length <<= 8;
-    length |= mIncomingHeader[3];
-    if (length <= 0 ||
+    length |= header[3];
+    // XDR messages are a multiple of 4 bytes long, which also keeps every
+    // message in the read buffer aligned for unmarshalling
+    if (length <= 0 || (length & 3) != 0 ||
         (!isAuthenticated() && (length > MAX_UNAUTH_MESSAGE_SIZE)) ||
         length > MAX_MESSAGE_SIZE)
     {
@@ -364,27 +495,19 @@ TCPPeer::connected()
 }
 
 void
-TCPPeer::readHeaderHandler(asio::error_code const& error,
-                           std::size_t bytes_transferred)
+TCPPeer::readHandler(asio::error_code const& error,
+                     std::size_t bytes_transferred)
 {
     assertThreadIsMain();
-    // LOG(DEBUG) << "TCPPeer::readHeaderHandler "
-    //     << "@" << mApp.getConfig().PEER_PORT
-    //     << " to " << mRemoteListeningPort
-    //     << (error ? "error " : "") << " bytes:" << bytes_transferred;
 
     if (!error)
     {
+        mReadOps.Mark();
         receivedBytes(bytes_transferred, false);
-        int length = getIncomingMsgLength();
-        if (length != 0)
+        mReadEnd += bytes_transferred;
+        if (processReadBuffer())
         {
-            mIncomingBody.resize(length);
-            auto self = static_pointer_cast<TCPPeer>(shared_from_this());
-            asio::async_read(*mSocket.get(), asio::buffer(mIncomingBody),
-                             [self](asio::error_code ec, std::size_t length) {
-                                 self->readBodyHandler(ec, length);
-                             });
+            startRead();
         }
     }
     else
@@ -395,56 +518,68 @@ TCPPeer::readHeaderHandler(asio::error_code const& error,
             // errors during shutdown or connection are common/expected.
             mErrorRead.Mark();
             CLOG(ERROR, "Overlay")
-                << "readHeaderHandler error: " << error.message() << " :"
+                << "readHandler error: " << error.message() << " :"
                 << toString();
         }
         drop();
     }
 }
 
-void
-TCPPeer::readBodyHandler(asio::error_code const& error,
-                         std::size_t bytes_transferred)
+bool
+TCPPeer::processReadBuffer()
 {
-    assertThreadIsMain();
-    // LOG(DEBUG) << "TCPPeer::readBodyHandler "
-    //     << "@" << mApp.getConfig().PEER_PORT
-    //     << " to " << mRemoteListeningPort
-    //     << (error ? "error " : "") << " bytes:" << bytes_transferred;
-
-    if (!error)
-    {
-        receivedBytes(bytes_transferred, true);
-        recvMessage();
-        mIncomingHeader.clear();
-        startRead();
-    }
-    else
+    size_t messages = 0;
+    while (mReadEnd - mReadStart >= 4)
     {
-        if (isConnected())
+        uint8_t const* header = mReadBuffer.data() + mReadStart;
+        int length = getIncomingMsgLength(header);
+        if (length == 0)
         {
-            // Only emit a warning if we have an error while connected;
-            // errors during shutdown or connection are common/expected.
-            mErrorRead.Mark();
-            CLOG(ERROR, "Overlay")
-                << "readBodyHandler error: " << error.message() << " :"
-                << toString();
+            return false;
+        }
+
+        size_t frameSize = 4 + static_cast<size_t>(length);
+        if (mReadEnd - mReadStart < frameSize)
+        {
+            // incomplete: make room for the rest of it
+            if (mReadStart + frameSize > mReadBuffer.size())
+            {
+                std::memmove(mReadBuffer.data(),
+                             mReadBuffer.data() + mReadStart,
+                             mReadEnd - mReadStart);
+                mReadEnd -= mReadStart;
+                mReadStart = 0;
+                if (frameSize > mReadBuffer.size())
+                {
+                    mReadBuffer.resize(frameSize);
+                }
+            }
+            break;
+        }
+
+        mReadStart += frameSize;
+        ++messages;
+        mMessageRead.Mark();
+        recvMessage(header + 4, length);
+        if (shouldAbort())
+        {
+            return false;
         }
-        drop();
     }
+    mMessagesPerRead.Update(messages);
+    return true;
 }
 
 void
-TCPPeer::recvMessage()
+TCPPeer::recvMessage(uint8_t const* body, size_t length)
 {
     assertThreadIsMain();
     try
     {
-        xdr::xdr_get g(mIncomingBody.data(),
-                       mIncomingBody.data() + mIncomingBody.size());
+        xdr::xdr_get g(body, body + length);
         AuthenticatedMessage am;
         xdr::xdr_argpack_archive(g, am);
-        Peer::recvMessage(am);
+        Peer::recvMessage(std::move(am), ByteSlice(body, length));
     }
     catch (xdr::xdr_runtime_error& e)
     {
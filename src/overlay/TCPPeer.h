@@ -6,11 +6,13 @@
 
 #include "overlay/Peer.h"
 #include "util/Timer.h"
-#include <queue>
+#include <deque>
 
 namespace medida
 {
+class Counter;
 class Meter;
+class Histogram;
 }
 
 namespace spn
@@ -19,6 +21,19 @@ namespace spn
 static auto const MAX_UNAUTH_MESSAGE_SIZE = 0x1000;
 static auto const MAX_MESSAGE_SIZE = 0x1000000;
 
+// Size the read buffer starts at (and returns to after holding a larger
+// message); several small messages are usually parsed out of one read.
+static auto const READ_BUFFER_SIZE = 0x10000;
+// Limits on how much of the write queue goes into one gathered write. 64
+// buffers is what a single sendmsg(2) takes on most platforms.
+static auto const MAX_WRITE_BATCH_MESSAGES = 64;
+static auto const MAX_WRITE_BATCH_BYTES = 0x100000;
+// Byte caps on the outbound queues of each message class. A message is always
+// accepted into an empty queue, however large.
+static auto const MAX_SCP_QUEUE_BYTES = 0x400000;
+static auto const MAX_FETCH_QUEUE_BYTES = 0x2000000;
+static auto const MAX_TX_QUEUE_BYTES = 0x400000;
+
 // Peer that communicates via a TCP socket.
 class TCPPeer : public Peer
 {
@@ -27,31 +42,70 @@ class TCPPeer : public Peer
 
   private:
     std::shared_ptr<SocketType> mSocket;
-    std::vector<uint8_t> mIncomingHeader;
-    std::vector<uint8_t> mIncomingBody;
 
-    std::queue<std::shared_ptr<xdr::msg_ptr>> mWriteQueue;
+    // Incoming bytes not yet parsed are mReadBuffer[mReadStart, mReadEnd);
+    // complete messages are unmarshalled in place.
+    std::vector<uint8_t> mReadBuffer;
+    size_t mReadStart{0};
+    size_t mReadEnd{0};
+
+    // Messages waiting to be written, split by class and drained in strict
+    // priority order: SCP and control messages, then responses to fetches,
+    // then flooded transactions (with their adverts and demands). They are
+    // framed (and so take their MAC sequence number) only when they leave
+    // the queue.
+    struct OutboundQueue
+    {
+        OutboundQueue(size_t maxBytes, bool dropOldest,
+                      medida::Counter& depth, medida::Meter& drops);
+
+        std::deque<SerializedMessage::pointer> mMessages;
+        size_t mBytes{0};
+        size_t const mMaxBytes;
+        // When full, make room by dropping the oldest messages instead of
+        // rejecting the new one.
+        bool const mDropOldest;
+        medida::Counter& mDepth;
+        medida::Meter& mDrops;
+
+        void push(SerializedMessage::pointer const& msg);
+        SerializedMessage::pointer pop();
+        void clear();
+    };
+    OutboundQueue mSCPQueue;
+    OutboundQueue mFetchQueue;
+    OutboundQueue mTxQueue;
+
+    // framed messages of the write in flight
+    std::vector<xdr::msg_ptr> mWriteBatch;
     bool mWriting{false};
     bool mDelayedShutdown{false};
     bool mShutdownScheduled{false};
 
+    medida::Meter& mReadOps;
+    medida::Meter& mWriteOps;
+    medida::Histogram& mMessagesPerRead;
+    medida::Histogram& mMessagesPerWrite;
+
     PeerBareAddress makeAddress(int remoteListeningPort) const override;
 
-    void recvMessage();
-    void sendMessage(xdr::msg_ptr&& xdrBytes) override;
+    void recvMessage(uint8_t const* body, size_t length);
+    void queueMessage(SerializedMessage::pointer const& msg) override;
+    OutboundQueue& getOutboundQueue(MessageType type);
 
     void messageSender();
 
-    int getIncomingMsgLength();
+    int getIncomingMsgLength(uint8_t const* header);
     virtual void connected() override;
     void startRead();
+    // Parses and dispatches every complete message in the read buffer;
+    // returns false if the peer was dropped meanwhile.
+    bool processReadBuffer();
 
     void writeHandler(asio::error_code const& error,
                       std::size_t bytes_transferred) override;
-    void readHeaderHandler(asio::error_code const& error,
-                           std::size_t bytes_transferred) override;
-    void readBodyHandler(asio::error_code const& error,
-                         std::size_t bytes_transferred) override;
+    void readHandler(asio::error_code const& error,
+                     std::size_t bytes_transferred) override;
     void shutdown();
 
   public:
@@ -69,5 +123,8 @@ class TCPPeer : public Peer
     virtual ~TCPPeer();
 
     virtual void drop(bool force = true) override;
+
+    // Number of messages waiting in the outbound queues.
+    size_t getOutboundQueueDepth() const;
 };
 }
@@ -14,10 +14,32 @@
 #include "util/Logging.h"
 #include "util/Timer.h"
 
+#include "medida/counter.h"
+#include "medida/histogram.h"
+#include "medida/meter.h"
+#include "medida/metrics_registry.h"
+#include "medida/timer.h"
+
 namespace spn
 {
 
-TEST_CASE("TCPPeer can communicate", "[overlay]")
+namespace
+{
+
+// Two nodes talking over TCP, each in a quorum of its own, connected to each
+// other.
+struct ConnectedNodes
+{
+    Simulation::pointer mSimulation;
+    Application::pointer mApp0;
+    Application::pointer mApp1;
+    // mApp0's peer for mApp1, and the other way around
+    Peer::pointer mPeer0;
+    Peer::pointer mPeer1;
+};
+
+ConnectedNodes
+connectTwoNodes()
 {
     Hash networkID = sha256(getTestConfig().NETWORK_PASSPHRASE);
     Simulation::pointer s =
@@ -47,10 +69,118 @@ TEST_CASE("TCPPeer can communicate", "[overlay]")
     auto p1 = n1->getOverlayManager().getConnectedPeer(
         PeerBareAddress{"127.0.0.1", n0->getConfig().PEER_PORT});
 
+    ConnectedNodes nodes;
+    nodes.mSimulation = s;
+    nodes.mApp0 = n0;
+    nodes.mApp1 = n1;
+    nodes.mPeer0 = p0;
+    nodes.mPeer1 = p1;
+    return nodes;
+}
+}
+
+TEST_CASE("TCPPeer can communicate", "[overlay]")
+{
+    auto nodes = connectTwoNodes();
+    REQUIRE(nodes.mPeer0);
+    REQUIRE(nodes.mPeer1);
+    REQUIRE(nodes.mPeer0->isAuthenticated());
+    REQUIRE(nodes.mPeer1->isAuthenticated());
+    nodes.mSimulation->stopAllNodes();
+}
+
+TEST_CASE("TCPPeer coalesces queued writes", "[overlay]")
+{
+    auto nodes = connectTwoNodes();
+    auto s = nodes.mSimulation;
+    auto n0 = nodes.mApp0;
+    auto n1 = nodes.mApp1;
+    auto p0 = nodes.mPeer0;
     REQUIRE(p0);
-    REQUIRE(p1);
     REQUIRE(p0->isAuthenticated());
-    REQUIRE(p1->isAuthenticated());
+
+    auto& writeBatch =
+        n0->getMetrics().NewHistogram({"overlay", "write", "batch"});
+    auto& messagesRead =
+        n1->getMetrics().NewMeter({"overlay", "message", "read"}, "message");
+    auto readBefore = messagesRead.count();
+
+    // queued back to back: all but the first go out in gathered writes
+    int const n = 200;
+    StellarMessage msg;
+    msg.type(DONT_HAVE);
+    msg.dontHave().type = TX_SET;
+    for (int i = 0; i < n; ++i)
+    {
+        p0->sendMessage(msg);
+    }
+    s->crankForAtLeast(std::chrono::seconds(1), false);
+
+    REQUIRE(writeBatch.max() == MAX_WRITE_BATCH_MESSAGES);
+    REQUIRE(messagesRead.count() - readBefore >= n);
+    REQUIRE(p0->isAuthenticated());
+    s->stopAllNodes();
+}
+
+TEST_CASE("TCPPeer bounds and prioritizes outbound queues", "[overlay]")
+{
+    auto nodes = connectTwoNodes();
+    auto s = nodes.mSimulation;
+    auto n0 = nodes.mApp0;
+    auto n1 = nodes.mApp1;
+    auto p0 = nodes.mPeer0;
+    REQUIRE(p0);
+    REQUIRE(p0->isAuthenticated());
+
+    auto& metrics = n0->getMetrics();
+    auto& scpDepth = metrics.NewCounter({"overlay", "outbound-queue", "scp"});
+    auto& txDepth = metrics.NewCounter({"overlay", "outbound-queue", "tx"});
+    auto& txDrops =
+        metrics.NewMeter({"overlay", "outbound-drop", "tx"}, "message");
+
+    StellarMessage txMsg;
+    txMsg.type(TRANSACTION);
+    auto tx = SerializedMessage::create(txMsg);
+    size_t const txFit = MAX_TX_QUEUE_BYTES / tx->mBytes.size();
+
+    // one goes straight into the write, the rest queue up to the cap and
+    // then push the oldest out
+    size_t const n = txFit + 100;
+    for (size_t i = 0; i < n; ++i)
+    {
+        p0->sendMessage(tx);
+    }
+    REQUIRE(txDepth.count() == static_cast<int64_t>(txFit));
+    REQUIRE(txDrops.count() >= n - 1 - txFit);
+
+    auto& txRecv =
+        n1->getMetrics().NewTimer({"overlay", "recv", "transaction"});
+    auto& scpRecv =
+        n1->getMetrics().NewTimer({"overlay", "recv", "get-scp-state"});
+    auto txRecvBefore = txRecv.count();
+    auto scpRecvBefore = scpRecv.count();
+
+    // SCP traffic is not held back by the transaction backlog
+    StellarMessage scpMsg;
+    scpMsg.type(GET_SCP_STATE);
+    scpMsg.getSCPLedgerSeq() = 0;
+    p0->sendMessage(scpMsg);
+    REQUIRE(scpDepth.count() == 1);
+    REQUIRE(txDepth.count() == static_cast<int64_t>(txFit));
+
+    // it goes out right after the write in flight, at the head of the next
+    // one, so the other side reads it before the backlog: at most the rest of
+    // its own write can have been read along with it
+    for (int i = 0; i < 10000 && scpRecv.count() == scpRecvBefore; ++i)
+    {
+        s->crankAllNodes(1);
+    }
+    REQUIRE(scpRecv.count() == scpRecvBefore + 1);
+    REQUIRE(txRecv.count() - txRecvBefore <= MAX_WRITE_BATCH_MESSAGES);
+    REQUIRE(scpDepth.count() == 0);
+
+    s->crankForAtLeast(std::chrono::seconds(1), false);
+    REQUIRE(txRecv.count() - txRecvBefore > MAX_WRITE_BATCH_MESSAGES);
     s->stopAllNodes();
 }
 }
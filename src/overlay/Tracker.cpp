@@ -61,7 +61,11 @@ Tracker::clearEnvelopesBelow(uint64 slotIndex)
             iter++;
         }
     }
-    if (!mWaitingEnvelopes.empty())
+    if (mLastSeenSlotIndex < slotIndex)
+    {
+        mPeersWithItem.clear();
+    }
+    if (!mWaitingEnvelopes.empty() || !mPeersWithItem.empty())
     {
         return true;
     }
@@ -98,25 +102,39 @@ Tracker::tryNextPeer()
     // currently asking peers, build a new list
     if (mPeersToAsk.empty() && !mLastAskedPeer)
     {
-        std::set<std::shared_ptr<Peer>> peersWithEnvelope;
-        for (auto const& e : mWaitingEnvelopes)
+        if (mWaitingEnvelopes.empty())
         {
-            auto const& s = mApp.getOverlayManager().getPeersKnows(e.first);
-            peersWithEnvelope.insert(s.begin(), s.end());
+            // only the peers that said they have it are asked, the first
+            // one first
+            for (auto const& p : mPeersWithItem)
+            {
+                mPeersToAsk.emplace_front(p);
+            }
         }
-
-        // move the peers that have the envelope to the back,
-        // to be processed first
-        for (auto const& p :
-             mApp.getOverlayManager().getRandomAuthenticatedPeers())
+        else
         {
-            if (peersWithEnvelope.find(p) != peersWithEnvelope.end())
+            std::set<std::shared_ptr<Peer>> peersWithEnvelope(
+                mPeersWithItem.begin(), mPeersWithItem.end());
+            for (auto const& e : mWaitingEnvelopes)
             {
-                mPeersToAsk.emplace_back(p);
+                auto const& s =
+                    mApp.getOverlayManager().getPeersKnows(e.first);
+                peersWithEnvelope.insert(s.begin(), s.end());
             }
-            else
+
+            // move the peers that have the envelope to the back,
+            // to be processed first
+            for (auto const& p :
+                 mApp.getOverlayManager().getRandomAuthenticatedPeers())
             {
-                mPeersToAsk.emplace_front(p);
+                if (peersWithEnvelope.find(p) != peersWithEnvelope.end())
+                {
+                    mPeersToAsk.emplace_back(p);
+                }
+                else
+                {
+                    mPeersToAsk.emplace_front(p);
+                }
             }
         }
 
@@ -181,6 +199,17 @@ Tracker::listen(const SCPEnvelope& env)
         std::make_pair(sha256(xdr::xdr_to_opaque(m)), env));
 }
 
+void
+Tracker::addPeerWithItem(Peer::pointer peer, uint64 slotIndex)
+{
+    mLastSeenSlotIndex = std::max(slotIndex, mLastSeenSlotIndex);
+    if (std::find(mPeersWithItem.begin(), mPeersWithItem.end(), peer) ==
+        mPeersWithItem.end())
+    {
+        mPeersWithItem.emplace_back(peer);
+    }
+}
+
 void
 Tracker::discard(const SCPEnvelope& env)
 {
@@ -198,5 +227,6 @@ Tracker::cancel()
 {
     mTimer.cancel();
     mLastSeenSlotIndex = 0;
+    mPeersWithItem.clear();
 }
 }
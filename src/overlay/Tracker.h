@@ -18,6 +18,9 @@
  * fully resolved. When data is received each envelope is resend to Herder
  * so it can check if it has all required data and then process envelope.
  * @see listen(Peer::pointer) is used to add envelopes to that list.
+ *
+ * A Tracker can also fetch an item that no envelope needs, but that peers
+ * said they have (@see addPeerWithItem); only those peers are asked then.
  */
 
 #include "overlay/Peer.h"
@@ -45,6 +48,7 @@ class Tracker
     std::deque<Peer::pointer> mPeersToAsk;
     VirtualTimer mTimer;
     std::vector<std::pair<Hash, SCPEnvelope>> mWaitingEnvelopes;
+    std::vector<Peer::pointer> mPeersWithItem;
     Hash mItemHash;
     medida::Meter& mTryNextPeer;
     uint64 mLastSeenSlotIndex{0};
@@ -91,9 +95,10 @@ class Tracker
 
     /**
      * Called periodically to remove old envelopes from list (with ledger id
-     * below some @p slotIndex).
+     * below some @p slotIndex), and to forget the peers with the data if it
+     * was last seen below @p slotIndex.
      *
-     * Returns true if at least one envelope remained in list.
+     * Returns true if at least one envelope or peer remained in list.
      */
     bool clearEnvelopesBelow(uint64 slotIndex);
 
@@ -103,6 +108,13 @@ class Tracker
      */
     void listen(const SCPEnvelope& env);
 
+    /**
+     * Add @p peer to the peers that said they have the data, for slot
+     * @p slotIndex. They are asked first, and if no envelope waits for the
+     * data, they are the only ones asked.
+     */
+    void addPeerWithItem(Peer::pointer peer, uint64 slotIndex);
+
     /**
      * Stops tracking envelope @p env.
      */
@@ -0,0 +1,154 @@
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "overlay/TransactionIngress.h"
+#include "crypto/SecretKey.h"
+#include "main/Application.h"
+#include "transactions/OperationFrame.h"
+#include "transactions/SignatureUtils.h"
+#include "util/Logging.h"
+
+#include "medida/counter.h"
+#include "medida/histogram.h"
+#include "medida/metrics_registry.h"
+#include "medida/timer.h"
+
+#include <algorithm>
+
+namespace spn
+{
+
+TransactionIngress::TransactionIngress(Application& app)
+    : mApp(app)
+    , mQueueSize(
+          app.getMetrics().NewCounter({"overlay", "tx-ingress", "queue"}))
+    , mBatchSize(
+          app.getMetrics().NewHistogram({"overlay", "tx-ingress", "batch"}))
+    , mLatency(
+          app.getMetrics().NewTimer({"overlay", "tx-ingress", "latency"}))
+{
+}
+
+void
+TransactionIngress::enqueue(TransactionFramePtr tx, Handler handler)
+{
+    if (mShuttingDown)
+    {
+        return;
+    }
+    mQueue.emplace_back(
+        Item{std::move(tx), std::move(handler), mApp.getClock().now()});
+    mQueueSize.set_count(mQueue.size());
+    if (!mBatchInFlight)
+    {
+        startBatch();
+    }
+}
+
+void
+TransactionIngress::shutdown()
+{
+    mShuttingDown = true;
+    mQueue.clear();
+    mQueueSize.set_count(0);
+}
+
+void
+TransactionIngress::startBatch()
+{
+    assert(!mBatchInFlight);
+    auto batch = std::make_shared<Batch>();
+    if (mQueue.size() <= MAX_BATCH_SIZE)
+    {
+        batch->swap(mQueue);
+    }
+    else
+    {
+        auto end = mQueue.begin() + MAX_BATCH_SIZE;
+        batch->assign(std::make_move_iterator(mQueue.begin()),
+                      std::make_move_iterator(end));
+        mQueue.erase(mQueue.begin(), end);
+    }
+    mQueueSize.set_count(mQueue.size());
+    mBatchSize.Update(batch->size());
+    mBatchInFlight = true;
+
+    // The batch is owned by the tasks, not by this object: the frames are
+    // only touched by the worker until the main-thread task picks them up.
+    std::weak_ptr<TransactionIngress> weak = shared_from_this();
+    Application& app = mApp;
+    app.postOnBackgroundThread([&app, weak, batch]() {
+        verifyBatch(*batch);
+        app.postOnMainThread([weak, batch]() {
+            if (auto self = weak.lock())
+            {
+                self->finishBatch(*batch);
+            }
+        });
+    });
+}
+
+void
+TransactionIngress::finishBatch(Batch& batch)
+{
+    mBatchInFlight = false;
+    if (mShuttingDown)
+    {
+        return;
+    }
+
+    auto now = mApp.getClock().now();
+    for (auto& item : batch)
+    {
+        mLatency.Update(now - item.mReceived);
+        item.mHandler(item.mTx);
+    }
+
+    if (!mQueue.empty() && !mBatchInFlight)
+    {
+        startBatch();
+    }
+}
+
+void
+TransactionIngress::verifyBatch(Batch& batch)
+{
+    std::vector<PubKeyUtils::VerifySigRequest> requests;
+    for (auto& item : batch)
+    {
+        auto const& tx = *item.mTx;
+        // Both are cached in the frame for the herder to use.
+        auto const& contentsHash = tx.getContentsHash();
+        tx.getFullHash();
+
+        // Only master keys can be checked without the ledger: they are the
+        // account IDs themselves. Other signers are left to checkValid.
+        // The operation frames are only built by checkValid, so the op
+        // sources are taken from the envelope.
+        std::vector<AccountID const*> sources{&tx.getSourceID()};
+        for (auto const& op : tx.getEnvelope().tx.operations)
+        {
+            if (op.sourceAccount)
+            {
+                sources.emplace_back(op.sourceAccount.get());
+            }
+        }
+        for (auto const& sig : tx.getEnvelope().signatures)
+        {
+            auto source = std::find_if(
+                sources.begin(), sources.end(), [&](AccountID const* id) {
+                    return SignatureUtils::doesHintMatch(id->ed25519(),
+                                                         sig.hint);
+                });
+            if (source != sources.end())
+            {
+                requests.emplace_back(PubKeyUtils::VerifySigRequest{
+                    **source, sig.signature, ByteSlice(contentsHash)});
+            }
+        }
+    }
+    // The results themselves are not needed, only the cache entries.
+    PubKeyUtils::verifySigBatch(requests);
+}
+}
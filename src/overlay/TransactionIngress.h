@@ -0,0 +1,86 @@
+#pragma once
+
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "transactions/TransactionFrame.h"
+#include "util/NonCopyable.h"
+#include "util/Timer.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace medida
+{
+class Counter;
+class Histogram;
+class Timer;
+}
+
+namespace spn
+{
+
+class Application;
+
+/**
+ * Staging area for transactions received from the network. Before a
+ * transaction reaches the herder (whose checks need the ledger, and so the
+ * main thread), its hashes are computed and the signatures made by the master
+ * keys of its source accounts are verified on a worker thread. Those results
+ * land in the signature verification cache, so the later checkValid on the
+ * main thread does not redo the ed25519 work for the common case.
+ *
+ * Transactions are verified in batches, one batch at a time: whatever arrives
+ * while a batch is in flight forms the next one. Handlers therefore run on
+ * the main thread in arrival order, which keeps sequence numbers from the
+ * same account in order.
+ */
+class TransactionIngress
+    : public std::enable_shared_from_this<TransactionIngress>,
+      NonMovableOrCopyable
+{
+  public:
+    typedef std::function<void(TransactionFramePtr const&)> Handler;
+
+    static size_t const MAX_BATCH_SIZE = 512;
+
+    explicit TransactionIngress(Application& app);
+
+    // Queues `tx` for verification; `handler` is called on the main thread
+    // once it is done.
+    void enqueue(TransactionFramePtr tx, Handler handler);
+
+    size_t
+    getQueueDepth() const
+    {
+        return mQueue.size();
+    }
+
+    void shutdown();
+
+  private:
+    struct Item
+    {
+        TransactionFramePtr mTx;
+        Handler mHandler;
+        VirtualClock::time_point mReceived;
+    };
+    typedef std::vector<Item> Batch;
+
+    Application& mApp;
+    Batch mQueue;
+    bool mBatchInFlight{false};
+    bool mShuttingDown{false};
+
+    medida::Counter& mQueueSize;
+    medida::Histogram& mBatchSize;
+    medida::Timer& mLatency;
+
+    void startBatch();
+    void finishBatch(Batch& batch);
+
+    static void verifyBatch(Batch& batch);
+};
+}
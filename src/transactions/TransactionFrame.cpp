@@ -8,6 +8,7 @@
 #include "crypto/Hex.h"
 #include "crypto/SHA.h"
 #include "crypto/SignerKey.h"
+#include "database/BinaryColumn.h"
 #include "database/Database.h"
 #include "database/DatabaseUtils.h"
 #include "herder/TxSetFrame.h"
@@ -21,7 +22,6 @@
 #include "transactions/SignatureUtils.h"
 #include "transactions/TransactionUtils.h"
 #include "util/Algoritm.h"
-#include "util/Decoder.h"
 #include "util/Logging.h"
 #include "util/XDROperators.h"
 #include "util/XDRStream.h"
@@ -682,6 +682,81 @@ TransactionFrame::toStellarMessage() const
     return msg;
 }
 
+static void
+insertAccountKey(std::set<LedgerKey>& keys, AccountID const& accountID)
+{
+    LedgerKey key(ACCOUNT);
+    key.account().accountID = accountID;
+    keys.emplace(key);
+}
+
+static void
+insertTrustLineKey(std::set<LedgerKey>& keys, AccountID const& accountID,
+                   Asset const& asset)
+{
+    if (asset.type() != ASSET_TYPE_NATIVE && !(getIssuer(asset) == accountID))
+    {
+        LedgerKey key(TRUSTLINE);
+        key.trustLine().accountID = accountID;
+        key.trustLine().asset = asset;
+        keys.emplace(key);
+    }
+}
+
+void
+TransactionFrame::insertLedgerKeysToPrefetch(std::set<LedgerKey>& keys) const
+{
+    insertAccountKey(keys, getSourceID());
+    for (auto const& op : mEnvelope.tx.operations)
+    {
+        auto const& source =
+            op.sourceAccount ? *op.sourceAccount : getSourceID();
+        insertAccountKey(keys, source);
+
+        auto const& body = op.body;
+        switch (body.type())
+        {
+        case CREATE_ACCOUNT:
+            insertAccountKey(keys, body.createAccountOp().destination);
+            break;
+        case PAYMENT:
+        {
+            auto const& payment = body.paymentOp();
+            insertAccountKey(keys, payment.destination);
+            insertTrustLineKey(keys, source, payment.asset);
+            insertTrustLineKey(keys, payment.destination, payment.asset);
+            break;
+        }
+        case PATH_PAYMENT:
+        {
+            auto const& payment = body.pathPaymentOp();
+            insertAccountKey(keys, payment.destination);
+            insertTrustLineKey(keys, source, payment.sendAsset);
+            insertTrustLineKey(keys, payment.destination, payment.destAsset);
+            break;
+        }
+        case MANAGE_OFFER:
+            insertTrustLineKey(keys, source, body.manageOfferOp().selling);
+            insertTrustLineKey(keys, source, body.manageOfferOp().buying);
+            break;
+        case CREATE_PASSIVE_OFFER:
+            insertTrustLineKey(keys, source,
+                               body.createPassiveOfferOp().selling);
+            insertTrustLineKey(keys, source,
+                               body.createPassiveOfferOp().buying);
+            break;
+        case CHANGE_TRUST:
+            insertTrustLineKey(keys, source, body.changeTrustOp().line);
+            break;
+        case ACCOUNT_MERGE:
+            insertAccountKey(keys, body.destination());
+            break;
+        default:
+            break;
+        }
+    }
+}
+
 void
 TransactionFrame::storeTransaction(Database& db, uint32_t ledgerSeq,
                                    TransactionMeta& tm, int txindex,
@@ -692,16 +767,13 @@ TransactionFrame::storeTransaction(Database& db, uint32_t ledgerSeq,
     resultSet.results.emplace_back(getResultPair());
     auto txResultBytes(xdr::xdr_to_opaque(resultSet.results.back()));
 
-    std::string txBody;
-    txBody = decoder::encode_b64(txBytes);
-
-    std::string txResult;
-    txResult = decoder::encode_b64(txResultBytes);
+    xdr::opaque_vec<> txMetaBytes(xdr::xdr_to_opaque(tm));
 
-    xdr::opaque_vec<> txMeta(xdr::xdr_to_opaque(tm));
-
-    std::string meta;
-    meta = decoder::encode_b64(txMeta);
+    auto& sess = db.getSession();
+    BinaryUse txBody(sess), txResult(sess), txMeta(sess);
+    txBody.set(txBytes);
+    txResult.set(txResultBytes);
+    txMeta.set(txMetaBytes);
 
     string txIDString(binToHex(getContentsHash()));
 
@@ -714,9 +786,9 @@ TransactionFrame::storeTransaction(Database& db, uint32_t ledgerSeq,
     st.exchange(soci::use(txIDString));
     st.exchange(soci::use(ledgerSeq));
     st.exchange(soci::use(txindex));
-    st.exchange(soci::use(txBody));
-    st.exchange(soci::use(txResult));
-    st.exchange(soci::use(meta));
+    st.exchange(txBody.use());
+    st.exchange(txResult.use());
+    st.exchange(txMeta.use());
     st.define_and_bind();
     {
         auto timer = db.getInsertTimer("txhistory");
@@ -734,10 +806,8 @@ TransactionFrame::storeTransactionFee(Database& db, uint32_t ledgerSeq,
                                       LedgerEntryChanges const& changes,
                                       int txindex) const
 {
-    xdr::opaque_vec<> txChanges(xdr::xdr_to_opaque(changes));
-
-    std::string txChanges64;
-    txChanges64 = decoder::encode_b64(txChanges);
+    BinaryUse txChanges(db.getSession());
+    txChanges.set(xdr::xdr_to_opaque(changes));
 
     string txIDString(binToHex(getContentsHash()));
 
@@ -750,7 +820,7 @@ TransactionFrame::storeTransactionFee(Database& db, uint32_t ledgerSeq,
     st.exchange(soci::use(txIDString));
     st.exchange(soci::use(ledgerSeq));
     st.exchange(soci::use(txindex));
-    st.exchange(soci::use(txChanges64));
+    st.exchange(txChanges.use());
     st.define_and_bind();
     {
         auto timer = db.getInsertTimer("txfeehistory");
@@ -789,26 +859,20 @@ TransactionResultSet
 TransactionFrame::getTransactionHistoryResults(Database& db, uint32 ledgerSeq)
 {
     TransactionResultSet res;
-    std::string txresult64;
+    BinaryInto txResult(db.getSession());
     auto prep =
         db.getPreparedStatement("SELECT txresult FROM txhistory "
                                 "WHERE ledgerseq = :lseq ORDER BY txindex ASC");
     auto& st = prep.statement();
 
     st.exchange(soci::use(ledgerSeq));
-    st.exchange(soci::into(txresult64));
+    st.exchange(txResult.into());
     st.define_and_bind();
     st.execute(true);
     while (st.got_data())
     {
-        std::vector<uint8_t> result;
-        decoder::decode_b64(txresult64, result);
-
         res.results.emplace_back();
-        TransactionResultPair& p = res.results.back();
-
-        xdr::xdr_get g(&result.front(), &result.back() + 1);
-        xdr_argpack_archive(g, p);
+        txResult.unpack(res.results.back());
 
         st.fetch();
     }
@@ -819,24 +883,20 @@ std::vector<LedgerEntryChanges>
 TransactionFrame::getTransactionFeeMeta(Database& db, uint32 ledgerSeq)
 {
     std::vector<LedgerEntryChanges> res;
-    std::string changes64;
+    BinaryInto changes(db.getSession());
     auto prep =
         db.getPreparedStatement("SELECT txchanges FROM txfeehistory "
                                 "WHERE ledgerseq = :lseq ORDER BY txindex ASC");
     auto& st = prep.statement();
 
-    st.exchange(soci::into(changes64));
+    st.exchange(changes.into());
     st.exchange(soci::use(ledgerSeq));
     st.define_and_bind();
     st.execute(true);
     while (st.got_data())
     {
-        std::vector<uint8_t> changesRaw;
-        decoder::decode_b64(changes64, changesRaw);
-
-        xdr::xdr_get g1(&changesRaw.front(), &changesRaw.back() + 1);
         res.emplace_back();
-        xdr_argpack_archive(g1, res.back());
+        changes.unpack(res.back());
 
         st.fetch();
     }
@@ -852,7 +912,7 @@ TransactionFrame::copyTransactionsToStream(Hash const& networkID, Database& db,
                                            XDROutputFileStream& txResultOut)
 {
     auto timer = db.getSelectTimer("txhistory");
-    std::string txBody, txResult, txMeta;
+    BinaryInto txBody(sess), txResult(sess);
     uint32_t begin = ledgerSeq, end = ledgerSeq + ledgerCount;
     size_t n = 0;
 
@@ -864,7 +924,7 @@ TransactionFrame::copyTransactionsToStream(Hash const& networkID, Database& db,
         (sess.prepare << "SELECT ledgerseq, txbody, txresult FROM txhistory "
                          "WHERE ledgerseq >= :begin AND ledgerseq < :end ORDER "
                          "BY ledgerseq ASC, txindex ASC",
-         soci::into(curLedgerSeq), soci::into(txBody), soci::into(txResult),
+         soci::into(curLedgerSeq), txBody.into(), txResult.into(),
          soci::use(begin), soci::use(end));
 
     Hash h;
@@ -889,24 +949,16 @@ TransactionFrame::copyTransactionsToStream(Hash const& networkID, Database& db,
             lastLedgerSeq = curLedgerSeq;
         }
 
-        std::vector<uint8_t> body;
-        decoder::decode_b64(txBody, body);
-
-        std::vector<uint8_t> result;
-        decoder::decode_b64(txResult, result);
-
-        xdr::xdr_get g1(&body.front(), &body.back() + 1);
-        xdr_argpack_archive(g1, tx);
+        txBody.unpack(tx);
 
         TransactionFramePtr txFrame =
             make_shared<TransactionFrame>(networkID, tx);
         txSet.add(txFrame);
 
-        xdr::xdr_get g2(&result.front(), &result.back() + 1);
         results.txResultSet.results.emplace_back();
 
         TransactionResultPair& p = results.txResultSet.results.back();
-        xdr_argpack_archive(g2, p);
+        txResult.unpack(p);
 
         if (p.transactionHash != txFrame->getContentsHash())
         {
@@ -177,6 +177,11 @@ class TransactionFrame
 
     StellarMessage toStellarMessage() const;
 
+    // insertLedgerKeysToPrefetch adds to keys the accounts and trust lines
+    // that applying this transaction is likely to load: the source accounts,
+    // the destinations and the trust lines of the assets involved.
+    void insertLedgerKeysToPrefetch(std::set<LedgerKey>& keys) const;
+
     LedgerStateEntry loadAccount(AbstractLedgerState& ls,
                                  LedgerStateHeader const& header,
                                  AccountID const& accountID);
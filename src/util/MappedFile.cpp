@@ -0,0 +1,146 @@
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/MappedFile.h"
+#include "util/Logging.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace spn
+{
+
+namespace
+{
+void
+throwMapError(std::string const& filename, std::string const& what, int err)
+{
+    std::string msg("failed to map file: ");
+    msg += filename;
+    msg += ", ";
+    msg += what;
+    msg += ", reason: ";
+    msg += std::to_string(err);
+    CLOG(ERROR, "Fs") << msg;
+    throw std::runtime_error(msg);
+}
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(std::string const& filename, Access access)
+{
+    DWORD flags = FILE_ATTRIBUTE_NORMAL;
+    flags |= (access == Access::SEQUENTIAL) ? FILE_FLAG_SEQUENTIAL_SCAN
+                                            : FILE_FLAG_RANDOM_ACCESS;
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, flags, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        throwMapError(filename, "open", GetLastError());
+    }
+
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(file, &sz))
+    {
+        auto err = GetLastError();
+        CloseHandle(file);
+        throwMapError(filename, "size", err);
+    }
+    mSize = static_cast<size_t>(sz.QuadPart);
+    if (mSize == 0)
+    {
+        CloseHandle(file);
+        return;
+    }
+
+    mMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    auto err = GetLastError();
+    // The mapping object holds its own reference to the file.
+    CloseHandle(file);
+    if (!mMapping)
+    {
+        throwMapError(filename, "mapping", err);
+    }
+
+    mData = static_cast<uint8_t const*>(
+        MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    if (!mData)
+    {
+        err = GetLastError();
+        CloseHandle(mMapping);
+        throwMapError(filename, "view", err);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (mData)
+    {
+        UnmapViewOfFile(mData);
+    }
+    if (mMapping)
+    {
+        CloseHandle(mMapping);
+    }
+}
+
+#else
+
+MappedFile::MappedFile(std::string const& filename, Access access)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        throwMapError(filename, "open", errno);
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        int err = errno;
+        ::close(fd);
+        throwMapError(filename, "stat", err);
+    }
+    mSize = static_cast<size_t>(st.st_size);
+    if (mSize == 0)
+    {
+        // mmap rejects zero-length mappings.
+        ::close(fd);
+        return;
+    }
+
+    void* p = ::mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    // The mapping holds its own reference to the file.
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        throwMapError(filename, "mmap", err);
+    }
+    mData = static_cast<uint8_t const*>(p);
+
+    // Purely advisory: a failure here only costs read-ahead.
+    ::madvise(p, mSize, access == Access::SEQUENTIAL ? MADV_SEQUENTIAL
+                                                      : MADV_RANDOM);
+}
+
+MappedFile::~MappedFile()
+{
+    if (mData)
+    {
+        ::munmap(const_cast<uint8_t*>(mData), mSize);
+    }
+}
+
+#endif
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+// Copyright 2018 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "crypto/ByteSlice.h"
+#include "util/NonCopyable.h"
+#include <cstdint>
+#include <string>
+
+namespace spn
+{
+
+/**
+ * Read-only memory mapping of a whole file. The mapping stays valid (and
+ * pointers into it stay dereferenceable) for the lifetime of the object.
+ *
+ * An empty file maps to a null data pointer with size 0.
+ */
+class MappedFile : NonCopyable
+{
+  public:
+    enum class Access
+    {
+        SEQUENTIAL,
+        RANDOM
+    };
+
+    explicit MappedFile(std::string const& filename,
+                        Access access = Access::SEQUENTIAL);
+    ~MappedFile();
+
+    uint8_t const*
+    data() const
+    {
+        return mData;
+    }
+
+    size_t
+    size() const
+    {
+        return mSize;
+    }
+
+    ByteSlice
+    bytes() const
+    {
+        return ByteSlice(mData, mSize);
+    }
+
+  private:
+    uint8_t const* mData{nullptr};
+    size_t mSize{0};
+#ifdef _WIN32
+    void* mMapping{nullptr};
+#endif
+};
+}
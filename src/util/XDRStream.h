@@ -7,8 +7,10 @@
 #include "crypto/ByteSlice.h"
 #include "crypto/SHA.h"
 #include "util/Logging.h"
+#include "util/MappedFile.h"
 #include "xdrpp/marshal.h"
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -67,7 +69,12 @@ class XDRInputFileStream
         }
 
         // Read 4 bytes of size, big-endian, with XDR 'continuation' bit cleared
-        // (high bit of high byte).
+        // (high bit of high byte). Records are always written as a single,
+        // last fragment, so that bit must be set.
+        if ((szBuf[0] & '\x80') == 0)
+        {
+            throw xdr::xdr_runtime_error("malformed XDR file");
+        }
         uint32_t sz = 0;
         sz |= static_cast<uint8_t>(szBuf[0] & '\x7f');
         sz <<= 8;
@@ -95,6 +102,114 @@ class XDRInputFileStream
     }
 };
 
+/**
+ * Same record format as XDRInputFileStream, but reads from a memory mapping
+ * of the file: objects are unmarshalled straight out of the mapped pages and
+ * the raw records (size header included) can be handed out without copying.
+ * Record slices stay valid until the stream is closed or reopened.
+ */
+class XDRInputMappedFileStream
+{
+    std::unique_ptr<MappedFile> mFile;
+    size_t mPos{0};
+    unsigned int mSizeLimit;
+
+  public:
+    XDRInputMappedFileStream(unsigned int sizeLimit = 0)
+        : mSizeLimit{sizeLimit}
+    {
+    }
+
+    void
+    close()
+    {
+        mFile.reset();
+        mPos = 0;
+    }
+
+    void
+    open(std::string const& filename)
+    {
+        mFile = std::make_unique<MappedFile>(filename);
+        mPos = 0;
+    }
+
+    operator bool() const
+    {
+        return mFile && mPos < mFile->size();
+    }
+
+    // Returns the record at offset `pos` of `data`, a run of records as this
+    // class reads them, including its 4-byte size header; or an empty slice
+    // if fewer than 4 bytes are left (or if the record exceeds `sizeLimit`,
+    // unless that is 0). For reading records at known offsets of a mapping.
+    static ByteSlice
+    recordAt(ByteSlice const& data, size_t pos, unsigned int sizeLimit = 0)
+    {
+        if (data.size() < pos || data.size() - pos < 4)
+        {
+            return ByteSlice(nullptr, 0);
+        }
+
+        uint8_t const* hdr = data.data() + pos;
+        // Every record is written as a single, last fragment; anything else
+        // is not a file we wrote.
+        if ((hdr[0] & 0x80) == 0)
+        {
+            throw xdr::xdr_runtime_error("malformed XDR file");
+        }
+        uint32_t sz = 0;
+        sz |= static_cast<uint8_t>(hdr[0] & 0x7f);
+        sz <<= 8;
+        sz |= hdr[1];
+        sz <<= 8;
+        sz |= hdr[2];
+        sz <<= 8;
+        sz |= hdr[3];
+
+        if (sizeLimit != 0 && sz > sizeLimit)
+        {
+            return ByteSlice(nullptr, 0);
+        }
+        // XDR records are padded to 4 bytes; this also keeps every record
+        // that follows aligned for xdr_get.
+        if ((sz & 3) != 0 || data.size() - pos - 4 < sz)
+        {
+            throw xdr::xdr_runtime_error("malformed XDR file");
+        }
+        return ByteSlice(hdr, sz + 4);
+    }
+
+    // Returns the next record, including its 4-byte size header, or an empty
+    // slice at end of file (or if the record exceeds the size limit).
+    ByteSlice
+    readRecord()
+    {
+        if (!mFile)
+        {
+            return ByteSlice(nullptr, 0);
+        }
+        auto record = recordAt(ByteSlice(mFile->data(), mFile->size()), mPos,
+                               mSizeLimit);
+        mPos += record.size();
+        return record;
+    }
+
+    template <typename T>
+    bool
+    readOne(T& out)
+    {
+        auto record = readRecord();
+        if (record.empty())
+        {
+            return false;
+        }
+        xdr::xdr_get g(record.data() + 4, record.end());
+        xdr::xdr_argpack_archive(g, out);
+        return true;
+    }
+};
+
 class XDROutputFileStream
 {
     std::ofstream mOut;
@@ -127,6 +242,28 @@ class XDROutputFileStream
         return mOut.good();
     }
 
+    // Writes a record already in file format (size header included), as
+    // handed out by XDRInputMappedFileStream::readRecord.
+    bool
+    writeRecord(ByteSlice const& record, SHA256* hasher = nullptr,
+                size_t* bytesPut = nullptr)
+    {
+        if (!mOut.write(reinterpret_cast<char const*>(record.data()),
+                        record.size()))
+        {
+            return false;
+        }
+        if (hasher)
+        {
+            hasher->add(record);
+        }
+        if (bytesPut)
+        {
+            *bytesPut += record.size();
+        }
+        return true;
+    }
+
     template <typename T>
     bool
     writeOne(T const& t, SHA256* hasher = nullptr, size_t* bytesPut = nullptr)
@@ -90,7 +90,11 @@ enum MessageType
     GET_SCP_STATE = 12,
 
     // new messages
-    HELLO = 13
+    HELLO = 13,
+
+    // transactions flooded by hash, see FloodAdvert
+    FLOOD_ADVERT = 14,
+    FLOOD_DEMAND = 15
 };
 
 struct DontHave
@@ -99,6 +103,25 @@ struct DontHave
     uint256 reqHash;
 };
 
+// Peers speaking overlay version 8 or later may advertise the transactions
+// they flood by hash (the hash of the TRANSACTION StellarMessage) instead of
+// sending them in full; the other side demands the ones it does not have.
+const TX_ADVERT_VECTOR_MAX_SIZE = 1000;
+typedef Hash TxAdvertVector<TX_ADVERT_VECTOR_MAX_SIZE>;
+
+struct FloodAdvert
+{
+    TxAdvertVector txHashes;
+};
+
+const TX_DEMAND_VECTOR_MAX_SIZE = 1000;
+typedef Hash TxDemandVector<TX_DEMAND_VECTOR_MAX_SIZE>;
+
+struct FloodDemand
+{
+    TxDemandVector txHashes;
+};
+
 union StellarMessage switch (MessageType type)
 {
 case ERROR_MSG:
@@ -131,6 +154,11 @@ case SCP_MESSAGE:
     SCPEnvelope envelope;
 case GET_SCP_STATE:
     uint32 getSCPLedgerSeq; // ledger seq requested ; if 0, requests the latest
+
+case FLOOD_ADVERT:
+    FloodAdvert floodAdvert;
+case FLOOD_DEMAND:
+    FloodDemand floodDemand;
 };
 
 union AuthenticatedMessage switch (uint32 v)